@@ -0,0 +1,123 @@
+#include "aho_corasick.h"
+#include "case_fold.h"
+
+#include <algorithm>
+
+// Marks a state without a pattern ending in it.
+static const std::uint32_t NO_PATTERN = 0xFFFFFFFFu;
+
+
+AhoCorasickSearcher::AhoCorasickSearcher(const std::vector<std::string>& patterns, bool ignore_case) : patterns_(patterns) {
+	// Ignoring case, the patterns are built in lower case, which keeps their lengths
+	if (ignore_case) {
+		for (auto& pattern : patterns_) {
+			pattern = foldAscii(pattern);
+		}
+	}
+
+	// Give every byte that occurs in a pattern its own class, class 0 stands for all other bytes.
+	for (const auto& pattern : patterns_) {
+		for (const unsigned char byte : pattern) {
+			if (byte != '\n' && byte_classes_[byte] == 0) {
+				byte_classes_[byte] = static_cast<std::uint8_t>(class_count_++);
+			}
+		}
+	}
+
+	// An upper case letter then takes the class of its lower case one.
+	if (ignore_case) {
+		for (unsigned char byte = 'A'; byte <= 'Z'; ++byte) {
+			byte_classes_[byte] = byte_classes_[byte + ('a' - 'A')];
+		}
+	}
+
+	// Build the trie, one row of transitions per node with 0 meaning no child yet.
+	// Node 0 is the root, so no transition can point back to it while the trie is built.
+	std::vector<std::uint32_t> trie(class_count_, 0);
+	state_patterns_.assign(1, NO_PATTERN);
+	for (std::size_t index = 0; index < patterns_.size(); ++index) {
+		const std::string& pattern = patterns_[index];
+		if (pattern.find('\n') != std::string::npos) {
+			continue;
+		}
+		if (pattern.empty()) {
+			empty_pattern_ = std::min(empty_pattern_, index);
+			continue;
+		}
+
+		std::uint32_t node = 0;
+		for (const unsigned char byte : pattern) {
+			std::uint32_t& child = trie[node * class_count_ + byte_classes_[byte]];
+			if (child == 0) {
+				child = static_cast<std::uint32_t>(state_patterns_.size());
+				state_patterns_.push_back(NO_PATTERN);
+				trie.resize(trie.size() + class_count_, 0);
+			}
+			// The resize above may have moved the table, so look the child up again
+			node = trie[node * class_count_ + byte_classes_[byte]];
+		}
+		state_patterns_[node] = std::min<std::uint32_t>(state_patterns_[node], static_cast<std::uint32_t>(index));
+	}
+
+	// Turn the trie into a complete automaton in breadth-first order, so the failure state of every
+	// node is finished before the node itself.
+	const std::size_t state_count = state_patterns_.size();
+	std::vector<std::uint32_t> failure(state_count, 0);
+	std::vector<std::uint32_t> queue;
+	queue.reserve(state_count);
+	for (std::size_t byte_class = 0; byte_class < class_count_; ++byte_class) {
+		if (trie[byte_class] != 0) {
+			queue.push_back(trie[byte_class]);
+		}
+	}
+	for (std::size_t head = 0; head < queue.size(); ++head) {
+		const std::uint32_t node = queue[head];
+		state_patterns_[node] = std::min(state_patterns_[node], state_patterns_[failure[node]]);
+
+		for (std::size_t byte_class = 0; byte_class < class_count_; ++byte_class) {
+			std::uint32_t& next = trie[node * class_count_ + byte_class];
+			const std::uint32_t fallback = trie[failure[node] * class_count_ + byte_class];
+			if (next != 0) {
+				failure[next] = fallback;
+				queue.push_back(next);
+			}
+			else {
+				next = fallback;
+			}
+		}
+	}
+
+	// Store row offsets instead of state numbers and flag the transitions into matching states.
+	transitions_.resize(trie.size());
+	for (std::size_t i = 0; i < trie.size(); ++i) {
+		const std::uint32_t next = trie[i];
+		transitions_[i] = static_cast<std::uint32_t>(next * class_count_) | (state_patterns_[next] != NO_PATTERN ? MATCH_FLAG : 0);
+	}
+}
+
+
+std::size_t AhoCorasickSearcher::find(std::string_view haystack, std::size_t position, std::size_t& pattern_index) const {
+	if (position > haystack.size()) {
+		return std::string_view::npos;
+	}
+	if (empty_pattern_ != std::string::npos) {
+		pattern_index = empty_pattern_;
+		return position;
+	}
+
+	const unsigned char* const begin = reinterpret_cast<const unsigned char*>(haystack.data());
+	const unsigned char* const end = begin + haystack.size();
+	const std::uint32_t* const transitions = transitions_.data();
+	const std::uint8_t* const byte_classes = byte_classes_;
+
+	std::uint32_t row = 0;
+	for (const unsigned char* byte = begin + position; byte < end; ++byte) {
+		row = transitions[(row & ~MATCH_FLAG) + byte_classes[*byte]];
+		if (row & MATCH_FLAG) {
+			pattern_index = state_patterns_[(row & ~MATCH_FLAG) / class_count_];
+			return (byte + 1 - begin) - patterns_[pattern_index].size();
+		}
+	}
+
+	return std::string_view::npos;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Finds occurrences of any of a set of literal strings in a buffer in a single pass (Aho-Corasick).
+ *
+ * The patterns are compiled into a deterministic automaton with one row of transitions per trie node,
+ * so scanning costs a single table lookup per byte regardless of the number of patterns. Bytes are
+ * mapped to equivalence classes first (all bytes that occur in no pattern share one class), which keeps
+ * the table small even for tens of thousands of patterns. Ignoring case, both cases of an ASCII letter
+ * share a class, so the automaton folds the input at no cost at all.
+ */
+class AhoCorasickSearcher {
+public:
+	/**
+	 * Builds the automaton for a set of patterns.
+	 *
+	 * @param patterns The literal strings to search for. Patterns containing a newline never match a line and are left out.
+	 * @param ignore_case Whether ASCII letters match in either case.
+	 */
+	explicit AhoCorasickSearcher(const std::vector<std::string>& patterns, bool ignore_case = false);
+
+	/**
+	 * Finds the occurrence that ends first at or after a position. When several patterns end at the
+	 * same byte, the one with the lowest index is reported.
+	 *
+	 * @param haystack The buffer to search in.
+	 * @param position The position to start searching at, occurrences must start at or after it.
+	 * @param pattern_index Receives the index of the pattern found.
+	 * @return The position of the occurrence, or std::string_view::npos if there is none.
+	 */
+	std::size_t find(std::string_view haystack, std::size_t position, std::size_t& pattern_index) const;
+
+private:
+	// Marks a transition into a state where some pattern ends.
+	static const std::uint32_t MATCH_FLAG = 0x80000000u;
+
+	std::vector<std::string> patterns_;
+	std::uint8_t byte_classes_[256] = {};
+	std::size_t class_count_ = 1;
+
+	// Transition table, indexed by row offset plus byte class. Each entry holds the row offset of the next
+	// state, with MATCH_FLAG set when a pattern ends there.
+	std::vector<std::uint32_t> transitions_;
+
+	// Lowest index of the patterns ending in each state, indexed by state number.
+	std::vector<std::uint32_t> state_patterns_;
+
+	// Index of an empty pattern, which matches at every position, or npos.
+	std::size_t empty_pattern_ = std::string::npos;
+};
@@ -0,0 +1,84 @@
+#include "aligned_buffer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+
+/**
+ * Allocates memory at an ALIGNMENT boundary.
+ *
+ * @param size The number of bytes, a multiple of ALIGNMENT.
+ * @return The memory, the program ends with std::bad_alloc if there is none left.
+ */
+static char* allocateAligned(std::size_t size) {
+#if defined(_WIN32)
+	void* memory = _aligned_malloc(size, AlignedBuffer::ALIGNMENT);
+#else
+	void* memory = std::aligned_alloc(AlignedBuffer::ALIGNMENT, size);
+#endif
+	if (memory == nullptr) {
+		throw std::bad_alloc();
+	}
+	return static_cast<char*>(memory);
+}
+
+
+static void freeAligned(char* memory) {
+#if defined(_WIN32)
+	_aligned_free(memory);
+#else
+	std::free(memory);
+#endif
+}
+
+
+AlignedBuffer::AlignedBuffer(std::size_t size) {
+	reserve(size);
+}
+
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer&& other) noexcept : data_(other.data_), size_(other.size_) {
+	other.data_ = nullptr;
+	other.size_ = 0;
+}
+
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& other) noexcept {
+	if (this != &other) {
+		freeAligned(data_);
+		data_ = other.data_;
+		size_ = other.size_;
+		other.data_ = nullptr;
+		other.size_ = 0;
+	}
+	return *this;
+}
+
+
+AlignedBuffer::~AlignedBuffer() {
+	freeAligned(data_);
+}
+
+
+void AlignedBuffer::reserve(std::size_t size, std::size_t keep) {
+	if (size <= size_) {
+		return;
+	}
+
+	// Grow to at least twice the old size, in whole pages
+	size = std::max(size, 2 * size_);
+	size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	char* const data = allocateAligned(size);
+	if (keep > 0) {
+		memcpy(data, data_, std::min(keep, size_));
+	}
+	freeAligned(data_);
+	data_ = data;
+	size_ = size;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * A block of memory that starts at a page boundary, owned by a single worker and reused for many files.
+ *
+ * Unlike a std::vector<char>, growing the buffer does not clear the new bytes, which the next read
+ * overwrites anyway, and the start is aligned for any vector load and for direct I/O.
+ */
+class AlignedBuffer {
+public:
+	// Alignment of the start of every buffer, and the granularity of its size.
+	static const std::size_t ALIGNMENT = 4096;
+
+	AlignedBuffer() = default;
+
+	/**
+	 * Allocates a buffer.
+	 *
+	 * @param size The size of the buffer in bytes, rounded up to a multiple of ALIGNMENT.
+	 */
+	explicit AlignedBuffer(std::size_t size);
+
+	AlignedBuffer(AlignedBuffer&& other) noexcept;
+	AlignedBuffer& operator=(AlignedBuffer&& other) noexcept;
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+	~AlignedBuffer();
+
+	/**
+	 * Makes the buffer at least a given size, moving it to a new allocation if it has to grow.
+	 * A buffer that grows takes at least twice its old size, so a thread reading ever larger files
+	 * only reallocates a few times.
+	 *
+	 * @param size The size the buffer needs.
+	 * @param keep The number of bytes at the start of the buffer that have to survive the move.
+	 */
+	void reserve(std::size_t size, std::size_t keep = 0);
+
+	char* data() { return data_; }
+	const char* data() const { return data_; }
+	std::size_t size() const { return size_; }
+
+private:
+	char* data_ = nullptr;
+	std::size_t size_ = 0;
+};
@@ -0,0 +1,491 @@
+#include "batch_reader.h"
+#include "aligned_buffer.h"
+
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define BATCH_READER_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+// Size of the buffer of every file in flight. Bigger files are opened once more by the FileReader,
+// which maps those of at least its mapping threshold.
+static const std::size_t SLOT_SIZE = 64 * 1024;
+
+#if defined(BATCH_READER_URING)
+// The operations of a chain, kept in the low bits of the user data of their completions, above them the slot.
+static const std::uint64_t OPERATION_OPEN = 0;
+static const std::uint64_t OPERATION_READ = 1;
+static const std::uint64_t OPERATION_CLOSE = 2;
+static const unsigned OPERATION_BITS = 2;
+
+// The number of submission queue entries of the chain of one file.
+static const unsigned ENTRIES_PER_FILE = 3;
+
+
+struct BatchReader::Ring {
+	// A file in flight: its index in the batch, the number of its operations not completed yet, and their results,
+	// and the device whose read it took, if it took one.
+	struct Slot {
+		std::size_t file = 0;
+		unsigned pending = 0;
+		int open_result = 0;
+		int read_result = 0;
+		bool limited = false;
+		std::uint64_t device = 0;
+	};
+
+	int fd = -1;
+
+	// The mapped rings, the submission queue entries, and the fields of both rings the kernel shares.
+	void* sq_ring = MAP_FAILED;
+	std::size_t sq_ring_size = 0;
+	void* cq_ring = MAP_FAILED;
+	std::size_t cq_ring_size = 0;
+	io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+	std::size_t sqes_size = 0;
+	unsigned* sq_tail = nullptr;
+	unsigned* sq_array = nullptr;
+	unsigned sq_mask = 0;
+	unsigned* cq_head = nullptr;
+	unsigned* cq_tail = nullptr;
+	unsigned cq_mask = 0;
+	io_uring_cqe* cqes = nullptr;
+
+	// Entries written to the submission queue that the kernel has not been told about yet.
+	unsigned unsubmitted = 0;
+
+	// Every slot has a buffer of SLOT_SIZE and an entry of the registered file table.
+	std::vector<Slot> slots;
+	AlignedBuffer buffers;
+	std::vector<std::uint32_t> free_slots;
+
+	// The slots in flight in the order of their files, and the slot whose contents were handed out last, or -1.
+	std::deque<std::uint32_t> in_flight;
+	std::int64_t held_slot = -1;
+
+	// The next file of the batch to submit, and the files that are not going to be opened.
+	std::size_t next_file = 0;
+	std::vector<bool> skipped;
+
+	// The limits of the devices, and the directory whose device was looked up last, if it has one.
+	DeviceReadLimits* device_limits = nullptr;
+	std::string device_directory;
+	bool device_known = false;
+	std::uint64_t device = 0;
+
+	// Whether the ring failed, and whether the kernel turned out not to support the chains. In both cases
+	// every file is opened by the FileReader from then on.
+	bool broken = false;
+	bool disabled = false;
+
+	bool setup(unsigned queue_depth);
+	~Ring();
+
+	io_uring_sqe* nextEntry();
+	bool deviceOf(const fs::path& file_path, std::uint64_t& file_device);
+	void submitFile(std::uint32_t slot, std::size_t file, const fs::path& file_path);
+	void fill(const std::vector<fs::path>& files);
+	bool enter(unsigned min_complete);
+	void reap();
+	bool wait(std::uint32_t slot);
+	void releaseHeld();
+	void drain();
+	void releaseLimits();
+};
+
+
+/**
+ * Sets up the ring and maps its queues, and registers a sparse file table with one entry per slot,
+ * into which the chains open their files directly, so no file descriptor passes through user space.
+ *
+ * @param queue_depth The number of files to keep in flight.
+ * @return True on success, false if io_uring is not available.
+ */
+bool BatchReader::Ring::setup(unsigned queue_depth) {
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	fd = static_cast<int>(syscall(__NR_io_uring_setup, queue_depth * ENTRIES_PER_FILE, &params));
+	if (fd < 0) {
+		return false;
+	}
+
+	// Map the submission and completion rings, which share one mapping on all but the oldest kernels
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	const bool single_mapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mapping) {
+		sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+	}
+	sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		return false;
+	}
+	if (!single_mapping) {
+		cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			return false;
+		}
+	}
+	sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+	if (sqes == MAP_FAILED) {
+		return false;
+	}
+
+	char* const sq = static_cast<char*>(sq_ring);
+	char* const cq = single_mapping ? sq : static_cast<char*>(cq_ring);
+	sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	// Register an empty file table for the files opened by the chains
+	std::vector<int> table(queue_depth, -1);
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, table.data(), queue_depth) < 0) {
+		return false;
+	}
+
+	slots.resize(queue_depth);
+	buffers.reserve(queue_depth * SLOT_SIZE);
+	for (std::uint32_t slot = queue_depth; slot > 0; --slot) {
+		free_slots.push_back(slot - 1);
+	}
+	return true;
+}
+
+
+BatchReader::Ring::~Ring() {
+	// The kernel may still be writing into the buffers of the files in flight
+	if (!broken) {
+		drain();
+	}
+	releaseLimits();
+	if (sqes != MAP_FAILED) {
+		munmap(sqes, sqes_size);
+	}
+	if (cq_ring != MAP_FAILED) {
+		munmap(cq_ring, cq_ring_size);
+	}
+	if (sq_ring != MAP_FAILED) {
+		munmap(sq_ring, sq_ring_size);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+
+/**
+ * @return The next free submission queue entry, cleared. The chains of the slots never fill the queue.
+ */
+io_uring_sqe* BatchReader::Ring::nextEntry() {
+	const unsigned tail = *sq_tail;
+	io_uring_sqe* entry = &sqes[tail & sq_mask];
+	sq_array[tail & sq_mask] = tail & sq_mask;
+	memset(entry, 0, sizeof(*entry));
+
+	// The kernel only reads the tail on the next submission, by then the entry is filled in
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++unsubmitted;
+	return entry;
+}
+
+
+/**
+ * Queues the chain that opens a file into the table entry of a slot, reads it into the slot's buffer, and closes it.
+ * The read is hard-linked to the close, so the entry is freed even if the read fails or comes up short.
+ *
+ * @param slot The slot to read the file into.
+ * @param file The index of the file in the batch.
+ * @param file_path The path of the file.
+ */
+void BatchReader::Ring::submitFile(std::uint32_t slot, std::size_t file, const fs::path& file_path) {
+	slots[slot] = { file, ENTRIES_PER_FILE, 0, 0, false, 0 };
+	in_flight.push_back(slot);
+
+	io_uring_sqe* entry = nextEntry();
+	entry->opcode = IORING_OP_OPENAT;
+	entry->fd = AT_FDCWD;
+	entry->addr = reinterpret_cast<std::uint64_t>(file_path.c_str());
+	entry->open_flags = O_RDONLY;
+	entry->file_index = slot + 1;
+	entry->flags = IOSQE_IO_LINK;
+	entry->user_data = (std::uint64_t{ slot } << OPERATION_BITS) | OPERATION_OPEN;
+
+	entry = nextEntry();
+	entry->opcode = IORING_OP_READ;
+	entry->fd = static_cast<int>(slot);
+	entry->addr = reinterpret_cast<std::uint64_t>(buffers.data() + slot * SLOT_SIZE);
+	entry->len = SLOT_SIZE;
+	entry->off = 0;
+	entry->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+	entry->user_data = (std::uint64_t{ slot } << OPERATION_BITS) | OPERATION_READ;
+
+	entry = nextEntry();
+	entry->opcode = IORING_OP_CLOSE;
+	entry->file_index = slot + 1;
+	entry->user_data = (std::uint64_t{ slot } << OPERATION_BITS) | OPERATION_CLOSE;
+}
+
+
+/**
+ * Finds the device of a file by its directory, looked up once for the files of a directory that follow each other.
+ *
+ * @param file_path The path of the file.
+ * @param file_device Receives the device.
+ * @return True on success, false if the directory could not be stat'ed.
+ */
+bool BatchReader::Ring::deviceOf(const fs::path& file_path, std::uint64_t& file_device) {
+	const std::string_view path = file_path.native();
+	const std::size_t slash = path.rfind('/');
+	const std::string_view directory = slash == std::string_view::npos ? "." : path.substr(0, std::max<std::size_t>(slash, 1));
+	if (directory != device_directory) {
+		device_directory.assign(directory);
+		struct stat status;
+		device_known = stat(device_directory.c_str(), &status) == 0;
+		device = device_known ? status.st_dev : 0;
+	}
+	file_device = device;
+	return device_known;
+}
+
+
+/**
+ * Queues the next files of the batch into the free slots. A file whose device has no read to spare stops the
+ * queueing until the next call, and is read when it is opened if it is still not queued by then.
+ *
+ * @param files The files of the batch.
+ */
+void BatchReader::Ring::fill(const std::vector<fs::path>& files) {
+	while (!free_slots.empty() && next_file < files.size()) {
+		if (skipped.empty() || !skipped[next_file]) {
+			std::uint64_t file_device = 0;
+			const bool limited = device_limits != nullptr && deviceOf(files[next_file], file_device);
+			if (limited && !device_limits->acquire(file_device)) {
+				return;
+			}
+			submitFile(free_slots.back(), next_file, files[next_file]);
+			slots[free_slots.back()].limited = limited;
+			slots[free_slots.back()].device = file_device;
+			free_slots.pop_back();
+		}
+		++next_file;
+	}
+}
+
+
+/**
+ * Submits the queued entries and waits for completions.
+ *
+ * @param min_complete The number of completions to wait for, 0 to only submit.
+ * @return True on success, false if the ring failed.
+ */
+bool BatchReader::Ring::enter(unsigned min_complete) {
+	while (true) {
+		const long submitted = syscall(__NR_io_uring_enter, fd, unsubmitted, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		if (submitted >= 0) {
+			unsubmitted -= static_cast<unsigned>(submitted);
+			return true;
+		}
+		if (errno != EINTR) {
+			return false;
+		}
+	}
+}
+
+
+/**
+ * Takes all completions off the completion ring and records them in their slots.
+ */
+void BatchReader::Ring::reap() {
+	unsigned head = *cq_head;
+	const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head) {
+		const io_uring_cqe& completion = cqes[head & cq_mask];
+		Slot& slot = slots[completion.user_data >> OPERATION_BITS];
+		const std::uint64_t operation = completion.user_data & ((1u << OPERATION_BITS) - 1);
+		if (operation == OPERATION_OPEN) {
+			slot.open_result = completion.res;
+		}
+		else if (operation == OPERATION_READ) {
+			slot.read_result = completion.res;
+		}
+
+		// The device has the read back once the whole chain is done
+		if (--slot.pending == 0 && slot.limited) {
+			device_limits->release(slot.device);
+			slot.limited = false;
+		}
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Waits until all operations of a slot are completed.
+ *
+ * @param slot The slot to wait for.
+ * @return True on success, false if the ring failed.
+ */
+bool BatchReader::Ring::wait(std::uint32_t slot) {
+	reap();
+	while (slots[slot].pending > 0) {
+		if (!enter(1)) {
+			broken = true;
+			releaseLimits();
+			return false;
+		}
+		reap();
+	}
+	return true;
+}
+
+
+/**
+ * Returns the slot whose contents were handed out last to the free slots.
+ */
+void BatchReader::Ring::releaseHeld() {
+	if (held_slot >= 0) {
+		free_slots.push_back(static_cast<std::uint32_t>(held_slot));
+		held_slot = -1;
+	}
+}
+
+
+/**
+ * Gives the devices back the reads of the slots still holding one. Once the ring failed or is disabled, their
+ * completions are never reaped, which would keep the reads from the other threads for the rest of the search.
+ */
+void BatchReader::Ring::releaseLimits() {
+	for (Slot& slot : slots) {
+		if (slot.limited) {
+			device_limits->release(slot.device);
+			slot.limited = false;
+		}
+	}
+}
+
+
+/**
+ * Waits for all files in flight and frees their slots.
+ */
+void BatchReader::Ring::drain() {
+	releaseHeld();
+	while (!in_flight.empty() && wait(in_flight.front())) {
+		free_slots.push_back(in_flight.front());
+		in_flight.pop_front();
+	}
+}
+
+
+BatchReader::BatchReader(unsigned queue_depth, DeviceReadLimits* device_limits) {
+	if (queue_depth == 0) {
+		return;
+	}
+	ring_ = std::make_unique<Ring>();
+	ring_->device_limits = device_limits;
+	if (!ring_->setup(queue_depth)) {
+		ring_.reset();
+	}
+}
+#else
+struct BatchReader::Ring {
+};
+
+
+BatchReader::BatchReader(unsigned, DeviceReadLimits*) {
+}
+#endif
+
+
+BatchReader::~BatchReader() = default;
+
+
+void BatchReader::start(const std::vector<fs::path>& files, const std::vector<bool>& skipped) {
+	files_ = &files;
+#if defined(BATCH_READER_URING)
+	if (ring_ == nullptr || ring_->broken || ring_->disabled) {
+		return;
+	}
+
+	// Whatever the previous batch left in flight is not needed anymore
+	ring_->drain();
+	ring_->next_file = 0;
+	ring_->skipped = skipped;
+	ring_->fill(files);
+	if (ring_->unsubmitted > 0 && !ring_->enter(0)) {
+		ring_->broken = true;
+		ring_->releaseLimits();
+	}
+#endif
+}
+
+
+bool BatchReader::open(std::size_t index, std::string_view& contents, bool& read_ahead) {
+	read_ahead = false;
+#if defined(BATCH_READER_URING)
+	if (ring_ != nullptr && !ring_->broken && !ring_->disabled) {
+		Ring& ring = *ring_;
+
+		// The contents handed out last are not used anymore, and files read ahead that were not asked for were skipped
+		ring.releaseHeld();
+		while (!ring.in_flight.empty() && ring.slots[ring.in_flight.front()].file < index && ring.wait(ring.in_flight.front())) {
+			ring.free_slots.push_back(ring.in_flight.front());
+			ring.in_flight.pop_front();
+		}
+
+		// The files before this one that a device held back were read when they were opened
+		ring.next_file = std::max(ring.next_file, index);
+		ring.fill(*files_);
+
+		// Take the file from its slot if it was read ahead in full
+		bool found = false;
+		if (!ring.in_flight.empty() && ring.slots[ring.in_flight.front()].file == index && ring.wait(ring.in_flight.front())) {
+			const std::uint32_t slot = ring.in_flight.front();
+			ring.in_flight.pop_front();
+			ring.held_slot = slot;
+			const Ring::Slot& state = ring.slots[slot];
+			found = state.open_result >= 0 && state.read_result >= 0 && static_cast<std::size_t>(state.read_result) < SLOT_SIZE;
+			if (found) {
+				contents = std::string_view(ring.buffers.data() + slot * SLOT_SIZE, state.read_result);
+			}
+
+			// Opening into the file table is not supported by kernels before 5.15
+			if (state.open_result == -EINVAL) {
+				ring.disabled = true;
+				ring.releaseLimits();
+			}
+		}
+
+		// Refill the free slots, so the next files are read while this one is searched, unless the ring was just disabled
+		if (!ring.disabled) {
+			ring.fill(*files_);
+		}
+		if (ring.unsubmitted > 0 && !ring.enter(0)) {
+			ring.broken = true;
+			ring.releaseLimits();
+		}
+		if (found) {
+			read_ahead = true;
+			return true;
+		}
+	}
+#endif
+
+	// Open the file directly if it was not read ahead, or did not fit into its buffer
+	return reader_.open((*files_)[index], contents);
+}
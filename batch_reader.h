@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <string_view>
+#include <memory>
+#include <cstddef>
+#include <filesystem>
+
+#include "file_reader.h"
+#include "device_limits.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * Gives a search thread the contents of the files of a batch, reading the small ones ahead with io_uring.
+ *
+ * On Linux, the files of a batch are submitted to an io_uring as chains of openat, read, and close, with
+ * up to a given number of files in flight. While the thread searches one file, the kernel already opens
+ * and reads the next ones, and a whole window of files costs a single system call instead of three per
+ * file. Every file in flight has a buffer of its own. A file that does not fit into it, or that could
+ * not be read ahead, is opened by a FileReader like before, which also does all the work on other
+ * systems, on kernels without io_uring, and with a queue depth of 0.
+ *
+ * The threads of a search can share the limits of the devices, which then caps the files all of them read ahead
+ * on one device. The device of a file is that of its directory, which is stat'ed once for its files of a batch.
+ */
+class BatchReader {
+public:
+	/**
+	 * Sets up the ring, falling back to plain reads if io_uring is not available.
+	 *
+	 * @param queue_depth The number of files to keep in flight, 0 to read every file when it is opened.
+	 * @param device_limits The reads the devices can take, shared with the other threads, or nullptr for no limits.
+	 */
+	explicit BatchReader(unsigned queue_depth, DeviceReadLimits* device_limits = nullptr);
+	BatchReader(const BatchReader&) = delete;
+	BatchReader& operator=(const BatchReader&) = delete;
+	~BatchReader();
+
+	/**
+	 * Starts reading the files of a new batch ahead.
+	 *
+	 * @param files The files of the batch, which have to stay unchanged until the next call.
+	 * @param skipped Flags of the files that are not going to be opened, or empty if all of them are.
+	 */
+	void start(const std::vector<fs::path>& files, const std::vector<bool>& skipped);
+
+	/**
+	 * Opens a file of the batch and makes its whole contents available. The files have to be opened in
+	 * the order of the batch, the contents stay valid until the next call.
+	 *
+	 * @param index The index of the file in the batch.
+	 * @param contents Receives a view of the file's bytes.
+	 * @param read_ahead Set to whether the contents were read ahead.
+	 * @return True on success, false if the file could not be opened or read.
+	 */
+	bool open(std::size_t index, std::string_view& contents, bool& read_ahead);
+
+	/**
+	 * @return Whether files are read ahead with io_uring.
+	 */
+	bool asynchronous() const { return ring_ != nullptr; }
+
+	// The io_uring and the state of the files in flight.
+	struct Ring;
+
+private:
+	std::unique_ptr<Ring> ring_;
+	FileReader reader_;
+	const std::vector<fs::path>* files_ = nullptr;
+};
@@ -0,0 +1,378 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <filesystem>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <iomanip>
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Bump whenever the generated content changes, so stale corpora are rebuilt instead of compared.
+static const std::string CORPUS_VERSION = "1";
+
+// Tokens that never show up in the generated filler text. The rare one lands on about one line in
+// a hundred thousand, the frequent one on every eighth line.
+static const std::string RARE_TOKEN = "needle_7f3a";
+static const std::string FREQUENT_TOKEN = "warn_timeout";
+static const std::uint64_t RARE_TOKEN_LINES = 100000;
+static const std::uint64_t FREQUENT_TOKEN_LINES = 8;
+
+static const char* const WORDS[] = {
+	"alpha", "bravo", "cache", "delta", "entry", "flush", "grant", "hash", "index", "jitter",
+	"kernel", "lease", "merge", "node", "offset", "page", "query", "read", "shard", "token",
+	"update", "value", "write", "yield", "zone", "batch", "commit", "digest", "event", "frame"
+};
+static const std::size_t WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+
+/**
+ * A small deterministic random generator (splitmix64), so every machine generates the very same corpus.
+ */
+class Random {
+public:
+	explicit Random(std::uint64_t seed) : state_(seed) {}
+
+	std::uint64_t next() {
+		std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	std::uint64_t range(std::uint64_t low, std::uint64_t high) {
+		return low + next() % (high - low + 1);
+	}
+
+private:
+	std::uint64_t state_;
+};
+
+
+/**
+ * Describes one synthetic corpus: a tree of directories with files of random size in each of them.
+ */
+struct CorpusSpec {
+	std::string name;
+	std::uint64_t seed;
+	int depth;
+	int fanout;
+	int files_per_directory;
+	std::uintmax_t min_file_bytes;
+	std::uintmax_t max_file_bytes;
+};
+
+static const std::vector<CorpusSpec> CORPORA = {
+	// Many small files in a flat tree, dominated by opening and listing.
+	{ "small_files", 1, 1, 200, 100, 512, 8 * 1024 },
+	// A few huge files, dominated by scanning.
+	{ "huge_files", 2, 0, 0, 4, 64 * 1024 * 1024, 64 * 1024 * 1024 },
+	// A deep binary tree of directories, dominated by the directory walk.
+	{ "deep_tree", 3, 10, 2, 8, 1024, 16 * 1024 },
+};
+
+
+/**
+ * One measured configuration, a row of the results file.
+ */
+struct BenchResult {
+	std::string corpus;
+	std::string hit_rate;
+	int threads = 0;
+	double wall_ms = 0;
+	long peak_rss_kb = 0;
+	std::uint64_t files = 0;
+	std::uintmax_t bytes = 0;
+	std::uint64_t matches = 0;
+};
+
+
+/**
+ * Appends a log-like line of filler words to the buffer, sometimes carrying one of the search tokens.
+ *
+ * @param buffer The buffer to append to.
+ * @param random The generator to draw the words from.
+ * @param line_number The running line number, which decides where the tokens land.
+ */
+static void appendLine(std::string& buffer, Random& random, std::uint64_t line_number) {
+	buffer += "2024-01-01 ";
+	buffer += std::to_string(random.range(0, 999999));
+	const std::uint64_t word_count = random.range(4, 14);
+	for (std::uint64_t i = 0; i < word_count; ++i) {
+		buffer += ' ';
+		buffer += WORDS[random.next() % WORD_COUNT];
+	}
+	if (line_number % RARE_TOKEN_LINES == RARE_TOKEN_LINES / 2) {
+		buffer += ' ';
+		buffer += RARE_TOKEN;
+	}
+	if (line_number % FREQUENT_TOKEN_LINES == 0) {
+		buffer += ' ';
+		buffer += FREQUENT_TOKEN;
+	}
+	buffer += '\n';
+}
+
+
+/**
+ * Writes the files of one directory of a corpus and recurses into its subdirectories.
+ *
+ * @param spec The corpus being generated.
+ * @param directory The directory to fill.
+ * @param depth The remaining depth of subdirectories below this one.
+ * @param random The generator of the whole corpus.
+ * @param line_number The running line number over the whole corpus.
+ * @return True on success, false if a file could not be written.
+ */
+static bool generateDirectory(const CorpusSpec& spec, const fs::path& directory, int depth, Random& random, std::uint64_t& line_number) {
+	fs::create_directories(directory);
+
+	// Only the leaves of trees hold files, a flat corpus has its files on the top level.
+	if (depth == 0) {
+		std::string contents;
+		for (int i = 0; i < spec.files_per_directory; ++i) {
+			const std::uintmax_t target_bytes = random.range(spec.min_file_bytes, spec.max_file_bytes);
+			contents.clear();
+			while (contents.size() < target_bytes) {
+				appendLine(contents, random, line_number++);
+			}
+
+			std::ofstream file(directory / ("file_" + std::to_string(i) + ".log"), std::ios::binary);
+			file.write(contents.data(), contents.size());
+			if (!file) {
+				std::cerr << "Error: could not write corpus file in " << directory.string() << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	for (int i = 0; i < spec.fanout; ++i) {
+		if (!generateDirectory(spec, directory / ("dir_" + std::to_string(i)), depth - 1, random, line_number)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+ * Generates a corpus unless a complete one of the current version already exists.
+ *
+ * @param spec The corpus to generate.
+ * @param directory The directory of the corpus.
+ * @return True if the corpus is ready, false otherwise.
+ */
+static bool ensureCorpus(const CorpusSpec& spec, const fs::path& directory) {
+	// The stamp is written last, so an interrupted generation is redone on the next run.
+	const fs::path stamp = directory.string() + ".version";
+	std::ifstream stamp_file(stamp);
+	std::string version;
+	if (stamp_file >> version && version == CORPUS_VERSION) {
+		return true;
+	}
+
+	std::cout << "Generating corpus " << spec.name << std::endl;
+	fs::remove_all(directory);
+	Random random(spec.seed);
+	std::uint64_t line_number = 1;
+	if (!generateDirectory(spec, directory, spec.depth, random, line_number)) {
+		return false;
+	}
+
+	std::ofstream(stamp) << CORPUS_VERSION << std::endl;
+	return true;
+}
+
+
+/**
+ * Runs specific_grep once and measures its wall time and peak memory.
+ *
+ * @param binary The specific_grep binary.
+ * @param run_directory The working directory of the run, which receives the result and log files.
+ * @param corpus The directory to search.
+ * @param pattern The pattern to search for.
+ * @param threads The number of search threads.
+ * @param result Receives the wall time, peak RSS and the counters printed by the run.
+ * @return True if the run exited successfully, false otherwise.
+ */
+static bool runOnce(const fs::path& binary, const fs::path& run_directory, const fs::path& corpus, const std::string& pattern, int threads, BenchResult& result) {
+	int output_pipe[2];
+	if (pipe(output_pipe) != 0) {
+		std::cerr << "Error: could not create pipe: " << std::strerror(errno) << std::endl;
+		return false;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const pid_t pid = fork();
+	if (pid < 0) {
+		std::cerr << "Error: could not fork: " << std::strerror(errno) << std::endl;
+		return false;
+	}
+	if (pid == 0) {
+		// Child: run in the scratch directory with stdout going into the pipe.
+		dup2(output_pipe[1], STDOUT_FILENO);
+		close(output_pipe[0]);
+		close(output_pipe[1]);
+		if (chdir(run_directory.c_str()) != 0) {
+			_exit(127);
+		}
+		const std::string thread_argument = std::to_string(threads);
+		execl(binary.c_str(), binary.c_str(), pattern.c_str(), "-d", corpus.c_str(), "-t", thread_argument.c_str(),
+			"-r", "bench_result", "-l", "bench_log", static_cast<char*>(nullptr));
+		_exit(127);
+	}
+
+	// Drain the summary before waiting, so a full pipe never blocks the child.
+	close(output_pipe[1]);
+	std::string output;
+	char buffer[4096];
+	ssize_t count;
+	while ((count = read(output_pipe[0], buffer, sizeof(buffer))) > 0 || (count < 0 && errno == EINTR)) {
+		if (count > 0) {
+			output.append(buffer, count);
+		}
+	}
+	close(output_pipe[0]);
+
+	int status = 0;
+	struct rusage usage;
+	while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {
+	}
+	const auto stop = std::chrono::steady_clock::now();
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		std::cerr << "Error: " << binary.string() << " failed on " << corpus.string() << std::endl;
+		return false;
+	}
+
+	result.wall_ms = std::chrono::duration<double, std::milli>(stop - start).count();
+	result.peak_rss_kb = usage.ru_maxrss;
+
+	// Pick the counters out of the summary, they catch a run that silently searched the wrong thing.
+	const std::string files_label = "Searched files: ";
+	const std::string matches_label = "Patterns number: ";
+	std::size_t position;
+	if ((position = output.find(files_label)) != std::string::npos) {
+		result.files = std::strtoull(output.c_str() + position + files_label.size(), nullptr, 10);
+	}
+	if ((position = output.find(matches_label)) != std::string::npos) {
+		result.matches = std::strtoull(output.c_str() + position + matches_label.size(), nullptr, 10);
+	}
+	return true;
+}
+
+
+/**
+ * Sums up the sizes of all regular files below a directory.
+ *
+ * @param directory The directory to measure.
+ * @return The total size in bytes.
+ */
+static std::uintmax_t corpusBytes(const fs::path& directory) {
+	std::uintmax_t bytes = 0;
+	for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+		if (entry.is_regular_file()) {
+			bytes += entry.file_size();
+		}
+	}
+	return bytes;
+}
+
+
+int main(int argc, char* argv[]) {
+	if (argc < 4) {
+		std::cerr << "Usage: " << argv[0] << " <specific_grep binary> <corpus directory> <results file> [<runs> [<threads>...]]" << std::endl;
+		return 1;
+	}
+
+	const fs::path binary = fs::absolute(argv[1]);
+	const fs::path corpus_root = fs::absolute(argv[2]);
+	const fs::path results_filename = argv[3];
+	const int runs = argc > 4 ? std::max(1, std::atoi(argv[4])) : 3;
+	std::vector<int> thread_counts;
+	for (int i = 5; i < argc; ++i) {
+		thread_counts.push_back(std::max(1, std::atoi(argv[i])));
+	}
+	if (thread_counts.empty()) {
+		thread_counts = { 1, 2, 4, 8 };
+	}
+
+	// The result and log files of the runs go next to the corpora, never into a searched directory.
+	const fs::path run_directory = corpus_root / "run";
+	fs::create_directories(run_directory);
+
+	std::vector<BenchResult> results;
+	for (const auto& spec : CORPORA) {
+		const fs::path corpus = corpus_root / spec.name;
+		if (!ensureCorpus(spec, corpus)) {
+			return 1;
+		}
+		const std::uintmax_t bytes = corpusBytes(corpus);
+
+		const std::pair<std::string, std::string> patterns[] = { { "low", RARE_TOKEN }, { "high", FREQUENT_TOKEN } };
+		for (const auto& [hit_rate, pattern] : patterns) {
+			// Warm the page cache once, so the first measured configuration is not penalized.
+			BenchResult warmup;
+			if (!runOnce(binary, run_directory, corpus, pattern, thread_counts.front(), warmup)) {
+				return 1;
+			}
+
+			for (int threads : thread_counts) {
+				// Report the median wall time of the runs and the highest peak RSS.
+				std::vector<BenchResult> samples(runs);
+				for (auto& sample : samples) {
+					if (!runOnce(binary, run_directory, corpus, pattern, threads, sample)) {
+						return 1;
+					}
+				}
+				std::sort(samples.begin(), samples.end(), [](const auto& lhs, const auto& rhs) {
+					return lhs.wall_ms < rhs.wall_ms;
+					});
+
+				BenchResult result = samples[samples.size() / 2];
+				for (const auto& sample : samples) {
+					result.peak_rss_kb = std::max(result.peak_rss_kb, sample.peak_rss_kb);
+				}
+				result.corpus = spec.name;
+				result.hit_rate = hit_rate;
+				result.threads = threads;
+				result.bytes = bytes;
+				results.push_back(result);
+
+				std::cout << spec.name << " " << hit_rate << " hits, " << threads << " threads: " << result.wall_ms << "[ms]" << std::endl;
+			}
+		}
+	}
+	fs::remove_all(run_directory);
+
+	// Write one CSV row per configuration, in a fixed order so two result files diff line by line.
+	std::ofstream results_file(results_filename);
+	results_file << "corpus,hit_rate,threads,runs,files,bytes,matches,wall_ms,mb_per_s,files_per_s,peak_rss_kb\n";
+	for (const auto& result : results) {
+		const double seconds = result.wall_ms / 1000;
+		const double mb_per_s = result.bytes / (1024.0 * 1024.0) / seconds;
+		const double files_per_s = result.files / seconds;
+		results_file << result.corpus << ',' << result.hit_rate << ',' << result.threads << ',' << runs << ','
+			<< result.files << ',' << result.bytes << ',' << result.matches << ','
+			<< std::fixed << std::setprecision(2) << result.wall_ms << ',' << mb_per_s << ',' << files_per_s << ','
+			<< std::defaultfloat << result.peak_rss_kb << '\n';
+	}
+	if (!results_file) {
+		std::cerr << "Error: could not write results file " << results_filename.string() << std::endl;
+		return 1;
+	}
+
+	std::cout << "Results written to " << results_filename.string() << std::endl;
+	return 0;
+}
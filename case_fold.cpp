@@ -0,0 +1,169 @@
+#include "case_fold.h"
+
+/**
+ * A range of upper case letters whose lower case letters follow at a fixed distance.
+ */
+struct CaseShift {
+	std::uint32_t first;
+	std::uint32_t last;
+	std::int32_t delta;
+};
+
+/**
+ * A range of letters that alternate between upper and lower case, starting with an upper case one.
+ */
+struct CasePairs {
+	std::uint32_t first;
+	std::uint32_t last;
+};
+
+static const CaseShift CASE_SHIFTS[] = {
+	{ 0x00C0, 0x00D6, 0x20 }, { 0x00D8, 0x00DE, 0x20 }, { 0x0178, 0x0178, -0x79 },
+	{ 0x0386, 0x0386, 0x26 }, { 0x0388, 0x038A, 0x25 }, { 0x038C, 0x038C, 0x40 }, { 0x038E, 0x038F, 0x3F },
+	{ 0x0391, 0x03A1, 0x20 }, { 0x03A3, 0x03AB, 0x20 },
+	{ 0x0400, 0x040F, 0x50 }, { 0x0410, 0x042F, 0x20 }, { 0x04C0, 0x04C0, 0x0F },
+	{ 0x0531, 0x0556, 0x30 },
+	{ 0xFF21, 0xFF3A, 0x20 },
+	{ 0x10400, 0x10427, 0x28 },
+};
+
+static const CasePairs CASE_PAIRS[] = {
+	{ 0x0100, 0x012F }, { 0x0132, 0x0137 }, { 0x0139, 0x0148 }, { 0x014A, 0x0177 }, { 0x0179, 0x017E },
+	{ 0x01CD, 0x01DC }, { 0x01DE, 0x01EF }, { 0x01F8, 0x021F }, { 0x0222, 0x0233 }, { 0x0246, 0x024F },
+	{ 0x03D8, 0x03EF },
+	{ 0x0460, 0x0481 }, { 0x048A, 0x04BF }, { 0x04C1, 0x04CE }, { 0x04D0, 0x052F },
+	{ 0x1E00, 0x1E95 }, { 0x1EA0, 0x1EFF },
+};
+
+// The Greek capital sigma has two small forms, the final one is only a lower case of the others.
+static const std::uint32_t CAPITAL_SIGMA = 0x03A3;
+static const std::uint32_t SMALL_SIGMA = 0x03C3;
+static const std::uint32_t FINAL_SIGMA = 0x03C2;
+
+
+std::string foldAscii(std::string_view text) {
+	std::string folded(text);
+	for (char& c : folded) {
+		c = foldAscii(c);
+	}
+	return folded;
+}
+
+
+std::size_t decodeUtf8(std::string_view text, std::uint32_t& code_point) {
+	if (text.empty()) {
+		return 0;
+	}
+
+	// The lead byte tells the length and the smallest code point that needs it, shorter encodings are invalid
+	const unsigned char lead = static_cast<unsigned char>(text[0]);
+	std::size_t length;
+	std::uint32_t minimum;
+	if (lead < 0x80) {
+		code_point = lead;
+		return 1;
+	}
+	else if ((lead & 0xE0) == 0xC0) {
+		length = 2;
+		minimum = 0x80;
+		code_point = lead & 0x1F;
+	}
+	else if ((lead & 0xF0) == 0xE0) {
+		length = 3;
+		minimum = 0x800;
+		code_point = lead & 0x0F;
+	}
+	else if ((lead & 0xF8) == 0xF0) {
+		length = 4;
+		minimum = 0x10000;
+		code_point = lead & 0x07;
+	}
+	else {
+		return 0;
+	}
+	if (text.size() < length) {
+		return 0;
+	}
+	for (std::size_t i = 1; i < length; ++i) {
+		const unsigned char continuation = static_cast<unsigned char>(text[i]);
+		if ((continuation & 0xC0) != 0x80) {
+			return 0;
+		}
+		code_point = (code_point << 6) | (continuation & 0x3F);
+	}
+	if (code_point < minimum || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)) {
+		return 0;
+	}
+	return length;
+}
+
+
+void appendUtf8(std::string& text, std::uint32_t code_point) {
+	if (code_point < 0x80) {
+		text += static_cast<char>(code_point);
+	}
+	else if (code_point < 0x800) {
+		text += static_cast<char>(0xC0 | (code_point >> 6));
+		text += static_cast<char>(0x80 | (code_point & 0x3F));
+	}
+	else if (code_point < 0x10000) {
+		text += static_cast<char>(0xE0 | (code_point >> 12));
+		text += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+		text += static_cast<char>(0x80 | (code_point & 0x3F));
+	}
+	else {
+		text += static_cast<char>(0xF0 | (code_point >> 18));
+		text += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+		text += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+		text += static_cast<char>(0x80 | (code_point & 0x3F));
+	}
+}
+
+
+std::size_t otherCases(std::uint32_t code_point, std::uint32_t others[2]) {
+	if (code_point < 0x80) {
+		return 0;
+	}
+	if (code_point == CAPITAL_SIGMA || code_point == SMALL_SIGMA || code_point == FINAL_SIGMA) {
+		std::size_t count = 0;
+		for (const std::uint32_t sigma : { CAPITAL_SIGMA, SMALL_SIGMA, FINAL_SIGMA }) {
+			if (sigma != code_point) {
+				others[count++] = sigma;
+			}
+		}
+		return count;
+	}
+
+	// Look the code point up as an upper case letter, and as the lower case one of a shifted range
+	for (const CaseShift& shift : CASE_SHIFTS) {
+		if (code_point >= shift.first && code_point <= shift.last) {
+			others[0] = code_point + shift.delta;
+			return 1;
+		}
+		if (code_point >= shift.first + shift.delta && code_point <= shift.last + shift.delta) {
+			others[0] = code_point - shift.delta;
+			return 1;
+		}
+	}
+	for (const CasePairs& pairs : CASE_PAIRS) {
+		if (code_point >= pairs.first && code_point <= pairs.last) {
+			others[0] = (code_point - pairs.first) % 2 == 0 ? code_point + 1 : code_point - 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+bool hasUnicodeCases(std::string_view text) {
+	std::uint32_t others[2];
+	for (std::size_t position = 0; position < text.size();) {
+		std::uint32_t code_point;
+		const std::size_t length = decodeUtf8(text.substr(position), code_point);
+		if (length > 1 && otherCases(code_point, others) > 0) {
+			return true;
+		}
+		position += length > 0 ? length : 1;
+	}
+	return false;
+}
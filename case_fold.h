@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Lowers an ASCII letter and leaves every other byte as it is, which is all the case folding the
+ * byte-level searchers do.
+ *
+ * @param c The byte.
+ * @return The lower case letter, or the byte itself.
+ */
+inline char foldAscii(char c) {
+	return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+/**
+ * @param text The text.
+ * @return The text with its ASCII letters lowered.
+ */
+std::string foldAscii(std::string_view text);
+
+/**
+ * Decodes the UTF-8 sequence at the start of some text.
+ *
+ * @param text The text.
+ * @param code_point Receives the decoded code point.
+ * @return The length of the sequence, or 0 if the text does not start with a valid one.
+ */
+std::size_t decodeUtf8(std::string_view text, std::uint32_t& code_point);
+
+/**
+ * Appends a code point to a string in UTF-8.
+ *
+ * @param text The string to append to.
+ * @param code_point The code point, which has to be valid.
+ */
+void appendUtf8(std::string& text, std::uint32_t code_point);
+
+/**
+ * Finds the other cases of a code point outside of ASCII, from the one-to-one mappings of the Latin, Greek,
+ * Cyrillic, Armenian, fullwidth and Deseret letters. Only the cases that take as many bytes in UTF-8 are
+ * given, so a string and its variants are always equally long.
+ *
+ * @param code_point The code point.
+ * @param others Receives the other cases, at most two, like σ and ς for Σ.
+ * @return The number of other cases, 0 if the code point has none.
+ */
+std::size_t otherCases(std::uint32_t code_point, std::uint32_t others[2]);
+
+/**
+ * @param text The text, in UTF-8.
+ * @return Whether the text holds a character outside of ASCII that has another case.
+ */
+bool hasUnicodeCases(std::string_view text);
@@ -0,0 +1,480 @@
+#include "decompressor.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+// Every library is optional, the Makefile links the ones whose headers it finds.
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define HAVE_ZLIB 1
+#else
+#define HAVE_ZLIB 0
+#endif
+
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define HAVE_ZSTD 1
+#else
+#define HAVE_ZSTD 0
+#endif
+
+#if __has_include(<lz4frame.h>)
+#include <lz4frame.h>
+#define HAVE_LZ4 1
+#else
+#define HAVE_LZ4 0
+#endif
+
+// Size of the decompressed part every thread produces at a time.
+static const std::size_t PART_SIZE = 4 * 1024 * 1024;
+
+// Compressed size from which a file of independent pieces is decompressed in runs shared with the other threads.
+static const std::size_t PARALLEL_MIN_SIZE = 1024 * 1024;
+
+// Largest decompressed piece of a file decompressed in parallel, a file with larger ones is decompressed as a stream.
+static const std::size_t MAX_PIECE_SIZE = 64 * 1024 * 1024;
+
+// Largest number of runs a part of a single file is decompressed in.
+static const unsigned MAX_THREADS = 16;
+
+
+struct Decompressor::Streams {
+#if HAVE_ZLIB
+	z_stream gzip = {};
+	bool gzip_ready = false;
+#endif
+#if HAVE_ZSTD
+	ZSTD_DCtx* zstd = nullptr;
+#endif
+#if HAVE_LZ4
+	LZ4F_dctx* lz4 = nullptr;
+#endif
+};
+
+
+Decompressor::Decompressor(FileScheduler* scheduler) : streams_(std::make_unique<Streams>()), scheduler_(scheduler) {
+}
+
+
+Decompressor::~Decompressor() {
+#if HAVE_ZLIB
+	if (streams_->gzip_ready) {
+		inflateEnd(&streams_->gzip);
+	}
+#endif
+#if HAVE_ZSTD
+	ZSTD_freeDCtx(streams_->zstd);
+#endif
+#if HAVE_LZ4
+	if (streams_->lz4 != nullptr) {
+		LZ4F_freeDecompressionContext(streams_->lz4);
+	}
+#endif
+}
+
+
+/**
+ * Recognizes the format of a file by its magic number.
+ *
+ * @param contents The first bytes of the file, or all of them.
+ * @return The format, none for an uncompressed file or a format this build can not decompress.
+ */
+Decompressor::Format Decompressor::detect(std::string_view contents) {
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(contents.data());
+	if (HAVE_ZLIB && contents.size() >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b) {
+		return Format::gzip;
+	}
+	if (HAVE_ZSTD && contents.size() >= 4 && bytes[0] == 0x28 && bytes[1] == 0xb5 && bytes[2] == 0x2f && bytes[3] == 0xfd) {
+		return Format::zstd;
+	}
+	if (HAVE_LZ4 && contents.size() >= 4 && bytes[0] == 0x04 && bytes[1] == 0x22 && bytes[2] == 0x4d && bytes[3] == 0x18) {
+		return Format::lz4;
+	}
+	return Format::none;
+}
+
+
+bool Decompressor::isCompressed(std::string_view contents) {
+	return detect(contents) != Format::none;
+}
+
+
+void Decompressor::start(std::string_view compressed) {
+	format_ = detect(compressed);
+	compressed_ = compressed;
+	consumed_ = 0;
+	pieces_.clear();
+	next_piece_ = 0;
+	filled_ = 0;
+	part_end_ = 0;
+	finished_ = false;
+	failed_ = false;
+	buffer_.reserve(PART_SIZE);
+
+	// Set up the stream of the format, reusing the one of the previous file
+	bool ready = false;
+	switch (format_) {
+	case Format::gzip:
+#if HAVE_ZLIB
+		if (!streams_->gzip_ready) {
+			streams_->gzip_ready = inflateInit2(&streams_->gzip, 15 + 16) == Z_OK;
+			ready = streams_->gzip_ready;
+		}
+		else {
+			ready = inflateReset(&streams_->gzip) == Z_OK;
+		}
+#endif
+		break;
+	case Format::zstd:
+#if HAVE_ZSTD
+		if (streams_->zstd == nullptr) {
+			streams_->zstd = ZSTD_createDCtx();
+		}
+		ready = streams_->zstd != nullptr && !ZSTD_isError(ZSTD_DCtx_reset(streams_->zstd, ZSTD_reset_session_only));
+#endif
+		break;
+	case Format::lz4:
+#if HAVE_LZ4
+		if (streams_->lz4 == nullptr && LZ4F_isError(LZ4F_createDecompressionContext(&streams_->lz4, LZ4F_VERSION))) {
+			streams_->lz4 = nullptr;
+		}
+		if (streams_->lz4 != nullptr) {
+			LZ4F_resetDecompressionContext(streams_->lz4);
+			ready = true;
+		}
+#endif
+		break;
+	case Format::none:
+		break;
+	}
+	if (!ready) {
+		finished_ = true;
+		failed_ = true;
+		return;
+	}
+
+	findPieces();
+	if (!pieces_.empty()) {
+		buffer_.reserve(thread_count_ * PART_SIZE);
+	}
+}
+
+
+/**
+ * Splits the file into pieces that decompress independently to a known size, if it is worth decompressing
+ * them in parallel. The pieces are found from their headers without decompressing anything: the frame
+ * headers of zstd, which hold the size a frame decompresses to in files written by pzstd or in seekable
+ * form, and the BGZF extra field of gzip members written by bgzip, which holds the size of the member
+ * whose trailer then gives the size it decompresses to. The pieces stay empty for any other file.
+ */
+void Decompressor::findPieces() {
+	// There is a run for every thread let into the search, which -t bounds
+	thread_count_ = scheduler_ != nullptr ? std::min(static_cast<unsigned>(scheduler_->activeThreads()), MAX_THREADS) : 1;
+	if (thread_count_ < 2 || compressed_.size() < PARALLEL_MIN_SIZE) {
+		return;
+	}
+
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(compressed_.data());
+	std::size_t offset = 0;
+	bool intact = true;
+	while (intact && offset < compressed_.size()) {
+		const unsigned char* header = bytes + offset;
+		const std::size_t remaining = compressed_.size() - offset;
+		std::size_t size = 0;
+		std::size_t decompressed_size = 0;
+		if (format_ == Format::gzip) {
+			// A BGZF member is a gzip member with an extra subfield 'BC' holding its size minus 1
+			intact = remaining >= 18 && header[0] == 0x1f && header[1] == 0x8b && header[2] == 8 && (header[3] & 4) != 0;
+			const std::size_t extra_end = intact ? 12 + (header[10] | (std::size_t{ header[11] } << 8)) : 0;
+			intact = intact && extra_end <= remaining;
+			for (std::size_t field = 12; intact && field + 4 <= extra_end;) {
+				const std::size_t field_size = header[field + 2] | (std::size_t{ header[field + 3] } << 8);
+				if (header[field] == 'B' && header[field + 1] == 'C' && field_size == 2 && field + 6 <= extra_end) {
+					size = (header[field + 4] | (std::size_t{ header[field + 5] } << 8)) + 1;
+				}
+				field += 4 + field_size;
+			}
+			intact = intact && size >= extra_end + 8 && size <= remaining;
+			if (intact) {
+				const unsigned char* trailer = header + size - 4;
+				decompressed_size = trailer[0] | (std::size_t{ trailer[1] } << 8) | (std::size_t{ trailer[2] } << 16) | (std::size_t{ trailer[3] } << 24);
+			}
+		}
+		else if (format_ == Format::zstd) {
+#if HAVE_ZSTD
+			// Skippable frames hold no data, every other frame has to tell its size
+			size = ZSTD_findFrameCompressedSize(header, remaining);
+			intact = !ZSTD_isError(size);
+			if (intact && (header[0] & 0xf0) == 0x50 && header[1] == 0x2a && header[2] == 0x4d && header[3] == 0x18) {
+				decompressed_size = 0;
+			}
+			else if (intact) {
+				const unsigned long long content_size = ZSTD_getFrameContentSize(header, size);
+				intact = content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != ZSTD_CONTENTSIZE_ERROR;
+				decompressed_size = static_cast<std::size_t>(content_size);
+			}
+#endif
+		}
+		else {
+			intact = false;
+		}
+
+		intact = intact && decompressed_size <= MAX_PIECE_SIZE;
+		pieces_.push_back({ offset, size, decompressed_size });
+		offset += size;
+	}
+	if (!intact || pieces_.size() < 2) {
+		pieces_.clear();
+	}
+}
+
+
+/**
+ * Decompresses a run of pieces, each one to its place in the output.
+ *
+ * @param format The format of the file.
+ * @param compressed The contents of the file.
+ * @param first The first piece.
+ * @param last The end of the pieces.
+ * @param output The place of the first piece, the others follow it.
+ * @return The number of pieces at the start of the run that decompressed to their size.
+ */
+std::size_t Decompressor::decodePieces(Format format, const char* compressed, const Piece* first, const Piece* last, char* output) {
+	std::size_t intact = 0;
+#if HAVE_ZLIB
+	if (format == Format::gzip) {
+		z_stream stream = {};
+		if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+			return 0;
+		}
+		for (const Piece* piece = first; piece != last; ++piece, ++intact) {
+			stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed + piece->offset));
+			stream.avail_in = static_cast<uInt>(piece->size);
+			stream.next_out = reinterpret_cast<Bytef*>(output);
+			stream.avail_out = static_cast<uInt>(piece->decompressed_size);
+			if (inflate(&stream, Z_FINISH) != Z_STREAM_END || stream.avail_out != 0 || inflateReset(&stream) != Z_OK) {
+				break;
+			}
+			output += piece->decompressed_size;
+		}
+		inflateEnd(&stream);
+	}
+#endif
+#if HAVE_ZSTD
+	if (format == Format::zstd) {
+		ZSTD_DCtx* context = ZSTD_createDCtx();
+		if (context == nullptr) {
+			return 0;
+		}
+		for (const Piece* piece = first; piece != last; ++piece, ++intact) {
+			if (ZSTD_decompressDCtx(context, output, piece->decompressed_size, compressed + piece->offset, piece->size) != piece->decompressed_size) {
+				break;
+			}
+			output += piece->decompressed_size;
+		}
+		ZSTD_freeDCtx(context);
+	}
+#endif
+	return intact;
+}
+
+
+/**
+ * Decompresses the next pieces that fit into the buffer, at least one, in runs of about the same
+ * decompressed size. The runs are shared with the search threads out of work, the calling thread
+ * decompresses those they do not take.
+ *
+ * @return True if pieces are left, false after the last one or at a piece that is corrupt.
+ */
+bool Decompressor::decodeGroup() {
+	if (next_piece_ == pieces_.size()) {
+		return false;
+	}
+
+	std::size_t last = next_piece_;
+	std::size_t group_size = 0;
+	while (last < pieces_.size() && filled_ + group_size + pieces_[last].decompressed_size <= buffer_.size()) {
+		group_size += pieces_[last++].decompressed_size;
+	}
+	if (last == next_piece_) {
+		group_size = pieces_[last++].decompressed_size;
+		buffer_.reserve(filled_ + group_size, filled_);
+	}
+
+	// Split the pieces into runs of about the same size, each one with its place in the buffer
+	struct Run {
+		std::size_t first;
+		std::size_t last;
+		std::size_t output_offset;
+		std::size_t intact;
+	};
+	const std::size_t run_size = group_size / thread_count_ + 1;
+	std::vector<Run> runs;
+	std::size_t output_offset = filled_;
+	std::size_t run_output_size = 0;
+	for (std::size_t piece = next_piece_; piece < last; ++piece) {
+		if (runs.empty() || run_output_size >= run_size) {
+			runs.push_back({ piece, piece, output_offset, 0 });
+			run_output_size = 0;
+		}
+		runs.back().last = piece + 1;
+		run_output_size += pieces_[piece].decompressed_size;
+		output_offset += pieces_[piece].decompressed_size;
+	}
+
+	// Share the runs with the threads out of work, decompress the ones they do not take, and wait for theirs.
+	// The runs do not search, so they leave the searcher of the threads alone.
+	auto decode_run = [this, &runs](std::size_t run, const void*) {
+		runs[run].intact = decodePieces(format_, compressed_.data(), pieces_.data() + runs[run].first, pieces_.data() + runs[run].last,
+			buffer_.data() + runs[run].output_offset);
+	};
+	if (runs.size() > 1) {
+		auto split = std::make_shared<SplitFile>(runs.size(), decode_run);
+		scheduler_->share(split);
+		split->searchChunks(nullptr);
+		split->wait();
+	}
+	else {
+		decode_run(0, nullptr);
+	}
+	std::size_t intact_end = runs[0].first;
+	for (const Run& run : runs) {
+		if (intact_end == run.first) {
+			intact_end += run.intact;
+		}
+	}
+
+	// Only the pieces before the first corrupt one are searched
+	for (std::size_t piece = next_piece_; piece < intact_end; ++piece) {
+		filled_ += pieces_[piece].decompressed_size;
+	}
+	next_piece_ = last;
+	if (intact_end != last) {
+		failed_ = true;
+		return false;
+	}
+	return next_piece_ < pieces_.size();
+}
+
+
+/**
+ * Decompresses the stream of the file into the free space of the buffer.
+ *
+ * @return True if more data may follow, false at the end of the file or at corrupt or truncated data.
+ */
+bool Decompressor::decodeStream() {
+	switch (format_) {
+	case Format::gzip:
+#if HAVE_ZLIB
+		while (filled_ < buffer_.size()) {
+			z_stream& stream = streams_->gzip;
+			const std::size_t input_size = std::min<std::size_t>(compressed_.size() - consumed_, std::numeric_limits<uInt>::max());
+			stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed_.data() + consumed_));
+			stream.avail_in = static_cast<uInt>(input_size);
+			stream.next_out = reinterpret_cast<Bytef*>(buffer_.data() + filled_);
+			stream.avail_out = static_cast<uInt>(std::min<std::size_t>(buffer_.size() - filled_, std::numeric_limits<uInt>::max()));
+			const int result = inflate(&stream, Z_NO_FLUSH);
+			consumed_ += input_size - stream.avail_in;
+			filled_ = reinterpret_cast<char*>(stream.next_out) - buffer_.data();
+			if (result == Z_STREAM_END) {
+				// Another member may follow, anything else after the end is ignored, like gzip does
+				const std::string_view rest = compressed_.substr(consumed_);
+				if (rest.size() >= 2 && static_cast<unsigned char>(rest[0]) == 0x1f && static_cast<unsigned char>(rest[1]) == 0x8b
+					&& inflateReset(&stream) == Z_OK) {
+					continue;
+				}
+				return false;
+			}
+			// With room for output, an error or a lack of progress means the data is corrupt or cut off
+			if (result != Z_OK) {
+				failed_ = true;
+				return false;
+			}
+		}
+#endif
+		return true;
+	case Format::zstd:
+#if HAVE_ZSTD
+		while (filled_ < buffer_.size()) {
+			ZSTD_inBuffer input = { compressed_.data() + consumed_, compressed_.size() - consumed_, 0 };
+			ZSTD_outBuffer output = { buffer_.data(), buffer_.size(), filled_ };
+			const std::size_t result = ZSTD_decompressStream(streams_->zstd, &output, &input);
+			const bool progress = input.pos > 0 || output.pos > filled_;
+			consumed_ += input.pos;
+			filled_ = output.pos;
+			if (ZSTD_isError(result)) {
+				failed_ = true;
+				return false;
+			}
+			// All input taken and the last frame complete is the end, a frame that can not go on is cut off
+			if (consumed_ == compressed_.size() && result == 0) {
+				return false;
+			}
+			if (!progress) {
+				failed_ = true;
+				return false;
+			}
+		}
+#endif
+		return true;
+	case Format::lz4:
+#if HAVE_LZ4
+		while (filled_ < buffer_.size()) {
+			std::size_t output_size = buffer_.size() - filled_;
+			std::size_t input_size = compressed_.size() - consumed_;
+			const std::size_t result = LZ4F_decompress(streams_->lz4, buffer_.data() + filled_, &output_size, compressed_.data() + consumed_, &input_size, nullptr);
+			consumed_ += input_size;
+			filled_ += output_size;
+			if (LZ4F_isError(result)) {
+				failed_ = true;
+				return false;
+			}
+			if (consumed_ == compressed_.size() && result == 0) {
+				return false;
+			}
+			if (input_size == 0 && output_size == 0) {
+				failed_ = true;
+				return false;
+			}
+		}
+#endif
+		return true;
+	case Format::none:
+		break;
+	}
+	return false;
+}
+
+
+bool Decompressor::next(std::string_view& part) {
+	// Move the start of the line after the previous part to the front, it holds no newline
+	std::memmove(buffer_.data(), buffer_.data() + part_end_, filled_ - part_end_);
+	filled_ -= part_end_;
+	part_end_ = 0;
+	std::size_t scanned = filled_;
+
+	while (true) {
+		// A line longer than the buffer makes it grow
+		if (filled_ == buffer_.size()) {
+			buffer_.reserve(buffer_.size() * 2, filled_);
+		}
+		if (!finished_ && !(pieces_.empty() ? decodeStream() : decodeGroup())) {
+			finished_ = true;
+		}
+
+		// The part ends after the last newline of the new bytes, the rest of the file after the last one
+		const std::size_t newline = std::string_view(buffer_.data() + scanned, filled_ - scanned).rfind('\n');
+		if (newline != std::string_view::npos) {
+			part_end_ = scanned + newline + 1;
+			part = std::string_view(buffer_.data(), part_end_);
+			return true;
+		}
+		scanned = filled_;
+		if (finished_) {
+			part_end_ = filled_;
+			part = std::string_view(buffer_.data(), filled_);
+			return filled_ > 0;
+		}
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "aligned_buffer.h"
+#include "file_scheduler.h"
+
+/**
+ * Turns the contents of a compressed file back into lines, a bounded part at a time, so that a compressed
+ * log is searched like the file it was made from without ever being decompressed as a whole.
+ *
+ * The format is recognized by the first bytes of the file: gzip, zstd, and lz4 frames, as far as the
+ * program was built with zlib, libzstd, and liblz4. Every part ends at the end of a line, so a line is
+ * never split between two parts. A file made of independent pieces whose decompressed sizes are known up
+ * front, the frames of a zstd file written by pzstd or in seekable form, or the blocks of a gzip file
+ * written by bgzip, is decompressed in runs of pieces, each one written straight to its place in the part.
+ * The runs of a part are shared through the scheduler like the chunks of a huge file, so the search threads
+ * out of work help with them and no threads are started for it. Any other file is decompressed as a stream
+ * by the calling thread.
+ */
+class Decompressor {
+public:
+	/**
+	 * @param scheduler The scheduler of the search, whose idle threads help decompress the runs of a part,
+	 * or nullptr to decompress every file on the calling thread.
+	 */
+	explicit Decompressor(FileScheduler* scheduler = nullptr);
+	Decompressor(const Decompressor&) = delete;
+	Decompressor& operator=(const Decompressor&) = delete;
+	~Decompressor();
+
+	/**
+	 * Tells whether some bytes start like a file this build can decompress.
+	 *
+	 * @param contents The first bytes of a file, or all of them.
+	 * @return True for a supported compressed format.
+	 */
+	static bool isCompressed(std::string_view contents);
+
+	/**
+	 * Starts decompressing a file.
+	 *
+	 * @param compressed The contents of the file, which have to stay valid until the last part was taken.
+	 */
+	void start(std::string_view compressed);
+
+	/**
+	 * Decompresses the next part of the file.
+	 *
+	 * @param part Receives the decompressed bytes, valid until the next call.
+	 * @return True if there was another part, false at the end of the file or of its intact data.
+	 */
+	bool next(std::string_view& part);
+
+	/**
+	 * @return Whether decompressing stopped at corrupt or truncated data.
+	 */
+	bool failed() const { return failed_; }
+
+	// The state of the decompression libraries.
+	struct Streams;
+
+private:
+	enum class Format { none, gzip, zstd, lz4 };
+
+	// A piece of the file that decompresses on its own, to a known number of bytes.
+	struct Piece {
+		std::size_t offset;
+		std::size_t size;
+		std::size_t decompressed_size;
+	};
+
+	static Format detect(std::string_view contents);
+	static std::size_t decodePieces(Format format, const char* compressed, const Piece* first, const Piece* last, char* output);
+	void findPieces();
+	bool decodeStream();
+	bool decodeGroup();
+
+	std::unique_ptr<Streams> streams_;
+	Format format_ = Format::none;
+	std::string_view compressed_;
+	std::size_t consumed_ = 0;
+
+	// The scheduler to share the runs with, the independent pieces of the file if it is decompressed in
+	// parallel, the next one to decompress, and the number of runs of a part, one per search thread.
+	FileScheduler* scheduler_;
+	std::vector<Piece> pieces_;
+	std::size_t next_piece_ = 0;
+	unsigned thread_count_ = 1;
+
+	// The decompressed bytes: the part handed out last, followed by the start of the line after it.
+	AlignedBuffer buffer_;
+	std::size_t filled_ = 0;
+	std::size_t part_end_ = 0;
+
+	bool finished_ = false;
+	bool failed_ = false;
+};
@@ -0,0 +1,61 @@
+#include "device_limits.h"
+
+#include <fstream>
+#include <string>
+#include <limits>
+
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#endif
+
+// The files a rotational disk reads ahead at once, enough for it to order the reads by their position.
+static const unsigned ROTATIONAL_READ_AHEAD = 8;
+
+static const unsigned UNLIMITED = std::numeric_limits<unsigned>::max();
+
+
+/**
+ * @param device The device, by st_dev.
+ * @return The most files to read ahead on the device at once, ROTATIONAL_READ_AHEAD for a rotational disk, UNLIMITED otherwise.
+ */
+static unsigned detectLimit(std::uint64_t device) {
+#if defined(__linux__)
+	// A partition has no queue of its own, it shares the one of its disk
+	const std::string block = "/sys/dev/block/" + std::to_string(major(device)) + ":" + std::to_string(minor(device));
+	for (const char* queue : { "/queue/rotational", "/../queue/rotational" }) {
+		std::ifstream rotational_file(block + queue);
+		int rotational = 0;
+		if (rotational_file >> rotational) {
+			return rotational != 0 ? ROTATIONAL_READ_AHEAD : UNLIMITED;
+		}
+	}
+#endif
+	(void)device;
+	return UNLIMITED;
+}
+
+
+DeviceReadLimits::DeviceReadLimits(unsigned depth) : depth_(depth) {
+}
+
+
+bool DeviceReadLimits::acquire(std::uint64_t device) {
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// The limit of a device is looked up on its first file
+	auto [it, inserted] = devices_.try_emplace(device);
+	if (inserted) {
+		it->second.limit = depth_ > 0 ? depth_ : detectLimit(device);
+	}
+	if (it->second.in_flight >= it->second.limit) {
+		return false;
+	}
+	++it->second.in_flight;
+	return true;
+}
+
+
+void DeviceReadLimits::release(std::uint64_t device) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	--devices_[device].in_flight;
+}
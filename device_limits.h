@@ -0,0 +1,48 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+/**
+ * The files read ahead on every device, shared by the search threads, so that together they keep no more
+ * reads in flight on a device than it handles well.
+ *
+ * Every thread reads a window of files ahead of its own, which suits an SSD or a network filesystem, but a
+ * rotational disk, or an array of them, spends its time seeking between the files of all the windows. The limit
+ * of a device is given by the options, or found in /sys/dev/block: a rotational disk gets ROTATIONAL_READ_AHEAD
+ * reads, other devices are not limited, and neither are the filesystems without a block device, like NFS.
+ * A read that is refused is not waited for, the file is read by its thread when it is searched.
+ */
+class DeviceReadLimits {
+public:
+	/**
+	 * @param depth The most files read ahead at once on one device, 0 to only limit rotational disks.
+	 */
+	explicit DeviceReadLimits(unsigned depth);
+
+	/**
+	 * Takes one of the reads of a device, if it has one to spare.
+	 *
+	 * @param device The device of the file, by st_dev.
+	 * @return True if the file may be read ahead, false if the device has as many reads in flight as it may.
+	 */
+	bool acquire(std::uint64_t device);
+
+	/**
+	 * Gives back a read taken with acquire() once it completed.
+	 *
+	 * @param device The device of the file, by st_dev.
+	 */
+	void release(std::uint64_t device);
+
+private:
+	struct Device {
+		unsigned limit = 0;
+		unsigned in_flight = 0;
+	};
+
+	unsigned depth_;
+	std::mutex mutex_;
+	std::map<std::uint64_t, Device> devices_;
+};
@@ -0,0 +1,444 @@
+#include "directory_walker.h"
+
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// A walker pushes its batch once it holds this many files or bytes, so the search threads get
+// work early without paying the scheduler locking for every single file.
+static const std::size_t PIPELINE_BATCH_FILES = 64;
+static const std::uintmax_t PIPELINE_BATCH_BYTES = 8 * 1024 * 1024;
+
+// Size of the buffer the entries of a directory are read into, enough for thousands of entries per call.
+static const std::size_t DIRECTORY_BUFFER_SIZE = 256 * 1024;
+
+
+bool VisitedDirectories::insert(std::uint64_t device, std::uint64_t inode) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return directories_.emplace(device, inode).second;
+}
+
+
+DirectoryReader::DirectoryReader(const WalkOptions& options, VisitedDirectories* visited) : options_(options), visited_(visited) {
+#if defined(__linux__)
+	buffer_.resize(DIRECTORY_BUFFER_SIZE);
+#endif
+}
+
+
+/**
+ * Tells whether a directory is left out of the walk.
+ *
+ * @param name The name of the directory, without its parent.
+ * @return True if it is one of the excluded names.
+ */
+bool DirectoryReader::isExcluded(std::string_view name) const {
+	return std::find(options_.excluded_directories.begin(), options_.excluded_directories.end(), name) != options_.excluded_directories.end();
+}
+
+
+/**
+ * Tells whether a file is left out of the walk by its name.
+ *
+ * @param name The name of the file, without its directory.
+ * @return True if it matches none of the included patterns, when there are any, or one of the excluded ones.
+ */
+bool DirectoryReader::isFileExcluded(std::string_view name) const {
+	auto matches = [name](const std::string& pattern) { return matchesGlob(pattern, name); };
+	if (!options_.included_files.empty() && std::none_of(options_.included_files.begin(), options_.included_files.end(), matches)) {
+		return true;
+	}
+	return std::any_of(options_.excluded_files.begin(), options_.excluded_files.end(), matches);
+}
+
+
+/**
+ * Matches a character against a bracket expression of a glob pattern.
+ *
+ * @param pattern The pattern, starting right after the opening bracket.
+ * @param c The character.
+ * @param matched Set to whether the character is one of the set.
+ * @return The length of the expression including its closing bracket, 0 if it is not closed.
+ */
+static std::size_t matchBracket(std::string_view pattern, char c, bool& matched) {
+	std::size_t i = 0;
+	const bool negated = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+	if (negated) {
+		++i;
+	}
+
+	// A closing bracket right at the start is a member of the set
+	bool found = false;
+	const std::size_t members_start = i;
+	while (i < pattern.size() && (pattern[i] != ']' || i == members_start)) {
+		char low = pattern[i];
+		if (low == '\\' && i + 1 < pattern.size()) {
+			low = pattern[++i];
+		}
+		++i;
+		char high = low;
+		if (i + 1 < pattern.size() && pattern[i] == '-' && pattern[i + 1] != ']') {
+			high = pattern[++i];
+			if (high == '\\' && i + 1 < pattern.size()) {
+				high = pattern[++i];
+			}
+			++i;
+		}
+		const unsigned char value = static_cast<unsigned char>(c);
+		found = found || (value >= static_cast<unsigned char>(low) && value <= static_cast<unsigned char>(high));
+	}
+	if (i >= pattern.size()) {
+		return 0;
+	}
+	matched = found != negated;
+	return i + 1;
+}
+
+
+bool matchesGlob(std::string_view pattern, std::string_view name) {
+	std::size_t p = 0;
+	std::size_t n = 0;
+
+	// Where to go on after the last star, which takes one more character of the name on every mismatch
+	std::size_t star_p = std::string_view::npos;
+	std::size_t star_n = 0;
+	while (n < name.size()) {
+		if (p < pattern.size()) {
+			const char c = pattern[p];
+			if (c == '*') {
+				star_p = ++p;
+				star_n = n;
+				continue;
+			}
+			if (c == '?') {
+				++p;
+				++n;
+				continue;
+			}
+			if (c == '[') {
+				// A bracket that is never closed stands for itself
+				bool matched = false;
+				const std::size_t length = matchBracket(pattern.substr(p + 1), name[n], matched);
+				if (length > 0 ? matched : name[n] == '[') {
+					p += length > 0 ? length + 1 : 1;
+					++n;
+					continue;
+				}
+			}
+			else {
+				const std::size_t literal = c == '\\' && p + 1 < pattern.size() ? p + 1 : p;
+				if (pattern[literal] == name[n]) {
+					p = literal + 1;
+					++n;
+					continue;
+				}
+			}
+		}
+
+		// On a mismatch, let the last star take one more character, without one the name does not match
+		if (star_p == std::string_view::npos) {
+			return false;
+		}
+		p = star_p;
+		n = ++star_n;
+	}
+
+	// What is left of the pattern has to match the empty rest of the name
+	while (p < pattern.size() && pattern[p] == '*') {
+		++p;
+	}
+	return p == pattern.size();
+}
+
+
+#if defined(__linux__)
+/**
+ * An entry as getdents64 returns it, the name runs up to its terminating zero.
+ */
+struct LinuxDirectoryEntry {
+	std::uint64_t d_ino;
+	std::int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+
+bool DirectoryReader::list(const fs::path& directory, std::vector<fs::path>& files, std::vector<std::uintmax_t>& file_sizes, std::vector<fs::path>& subdirectories) {
+	const int directory_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (directory_fd < 0) {
+		return false;
+	}
+
+	// When links are followed, a directory reached once more is not listed again
+	if (visited_ != nullptr) {
+		struct stat directory_stat;
+		if (fstat(directory_fd, &directory_stat) != 0 || !visited_->insert(directory_stat.st_dev, directory_stat.st_ino)) {
+			close(directory_fd);
+			return true;
+		}
+	}
+
+	while (true) {
+		const long length = syscall(SYS_getdents64, directory_fd, buffer_.data(), buffer_.size());
+		if (length < 0 && errno == EINTR) {
+			continue;
+		}
+		if (length <= 0) {
+			break;
+		}
+		for (long position = 0; position < length;) {
+			const LinuxDirectoryEntry* entry = reinterpret_cast<const LinuxDirectoryEntry*>(buffer_.data() + position);
+			position += entry->d_reclen;
+			const char* name = entry->d_name;
+			if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+				continue;
+			}
+
+			// Only an entry of unknown type and a link need a stat to tell what they are
+			unsigned char type = entry->d_type;
+			struct stat entry_stat;
+			bool stat_done = false;
+			if (type == DT_UNKNOWN) {
+				if (fstatat(directory_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW) != 0) {
+					continue;
+				}
+				type = IFTODT(entry_stat.st_mode);
+				stat_done = true;
+			}
+			const bool is_link = type == DT_LNK;
+			if (is_link) {
+				// A dangling link is skipped
+				if (fstatat(directory_fd, name, &entry_stat, 0) != 0) {
+					continue;
+				}
+				type = IFTODT(entry_stat.st_mode);
+				stat_done = true;
+			}
+
+			if (type == DT_DIR) {
+				if ((!is_link || options_.follow_symlinks) && !isExcluded(name)) {
+					subdirectories.push_back(directory / name);
+				}
+			}
+			else if (type == DT_REG) {
+				// A file is left out by its name before it costs a stat, and by its size after
+				if (isFileExcluded(name)) {
+					continue;
+				}
+				if (!stat_done) {
+					stat_done = fstatat(directory_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0;
+				}
+				if (stat_done && options_.max_file_size > 0 && static_cast<std::uintmax_t>(entry_stat.st_size) > options_.max_file_size) {
+					continue;
+				}
+				files.push_back(directory / name);
+				file_sizes.push_back(stat_done ? entry_stat.st_size : 0);
+			}
+		}
+	}
+
+	close(directory_fd);
+	return true;
+}
+#else
+bool DirectoryReader::list(const fs::path& directory, std::vector<fs::path>& files, std::vector<std::uintmax_t>& file_sizes, std::vector<fs::path>& subdirectories) {
+	std::error_code error;
+	fs::directory_iterator it(directory, error);
+	if (error) {
+		errno = error.value();
+		return false;
+	}
+
+	// Without inodes, the canonical path tells a directory reached once more
+	if (visited_ != nullptr) {
+		const fs::path canonical = fs::canonical(directory, error);
+		if (error || !visited_->insert(0, std::hash<std::string>()(canonical.string()))) {
+			return true;
+		}
+	}
+
+	for (; !error && it != fs::directory_iterator(); it.increment(error)) {
+		const fs::directory_entry& entry = *it;
+		std::error_code type_error;
+		if (entry.is_directory(type_error)) {
+			if ((!entry.is_symlink(type_error) || options_.follow_symlinks) && !isExcluded(entry.path().filename().string())) {
+				subdirectories.push_back(entry.path());
+			}
+		}
+		else if (entry.is_regular_file(type_error)) {
+			if (isFileExcluded(entry.path().filename().string())) {
+				continue;
+			}
+			std::error_code size_error;
+			const std::uintmax_t file_size = entry.file_size(size_error);
+			if (!size_error && options_.max_file_size > 0 && file_size > options_.max_file_size) {
+				continue;
+			}
+			files.push_back(entry.path());
+			file_sizes.push_back(size_error ? 0 : file_size);
+		}
+	}
+	return true;
+}
+#endif
+
+
+/**
+ * The directories that still have to be listed, shared by all walker threads.
+ */
+struct PendingDirectories {
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::vector<fs::path> directories;
+	int active_walkers = 0;
+};
+
+
+/**
+ * Walks a tree with several threads, each taking pending directories until the whole tree has been listed.
+ *
+ * @param directory_path The directory to walk.
+ * @param walker_count The number of walker threads.
+ * @param options The directories and files to leave out and whether to follow symbolic links.
+ * @param take_files Takes over the files and sizes of a listed directory, called by the walker with the given index.
+ * @param finish Called by every walker once the tree is walked, or empty.
+ * @param stopped Tells whether the files are not needed anymore, after which no more directories are listed, or empty.
+ */
+static void walkTree(const std::string& directory_path, int walker_count, const WalkOptions& options,
+	const std::function<void(int, std::vector<fs::path>&, std::vector<std::uintmax_t>&)>& take_files, const std::function<void(int)>& finish,
+	const std::function<bool()>& stopped = nullptr) {
+	PendingDirectories pending;
+	pending.directories.push_back(directory_path);
+	VisitedDirectories visited;
+
+	auto walk = [&](int walker) {
+		DirectoryReader reader(options, options.follow_symlinks ? &visited : nullptr);
+		std::vector<fs::path> files;
+		std::vector<std::uintmax_t> file_sizes;
+		std::vector<fs::path> subdirectories;
+
+		while (true) {
+			// Take a pending directory, or stop once no directory is left and no other walker can add one.
+			fs::path directory;
+			{
+				std::unique_lock<std::mutex> lock(pending.mutex);
+				pending.changed.wait(lock, [&pending] { return !pending.directories.empty() || pending.active_walkers == 0; });
+				if (stopped && stopped()) {
+					pending.directories.clear();
+				}
+				if (pending.directories.empty()) {
+					break;
+				}
+				directory = std::move(pending.directories.back());
+				pending.directories.pop_back();
+				++pending.active_walkers;
+			}
+
+			// List the directory and hand over its regular files.
+			files.clear();
+			file_sizes.clear();
+			subdirectories.clear();
+			if (!reader.list(directory, files, file_sizes, subdirectories)) {
+				std::cerr << "Error: could not open directory " << directory.string() << ": " << std::strerror(errno) << std::endl;
+			}
+			if (!files.empty()) {
+				take_files(walker, files, file_sizes);
+			}
+
+			// Queue the subdirectories so that the first one is taken next, which walks the tree depth first.
+			std::lock_guard<std::mutex> lock(pending.mutex);
+			std::move(subdirectories.rbegin(), subdirectories.rend(), std::back_inserter(pending.directories));
+			--pending.active_walkers;
+			if (pending.active_walkers == 0 && pending.directories.empty()) {
+				pending.changed.notify_all();
+			}
+			else if (!subdirectories.empty()) {
+				pending.changed.notify_all();
+			}
+		}
+
+		if (finish) {
+			finish(walker);
+		}
+	};
+
+	// Start the walker threads and wait for all of them to finish the tree.
+	std::vector<std::thread> walkers;
+	for (int i = 1; i < walker_count; ++i) {
+		walkers.emplace_back(walk, i);
+	}
+	walk(0);
+	for (auto& walker : walkers) {
+		walker.join();
+	}
+}
+
+
+void listDirectoryTree(const std::string& directory_path, int walker_count, const WalkOptions& options,
+	std::vector<fs::path>& files, std::vector<std::uintmax_t>& file_sizes) {
+	// Every walker collects its own files, which are put together once the tree is walked.
+	walker_count = std::max(walker_count, 1);
+	std::vector<std::vector<fs::path>> walker_files(walker_count);
+	std::vector<std::vector<std::uintmax_t>> walker_sizes(walker_count);
+	walkTree(directory_path, walker_count, options, [&](int walker, std::vector<fs::path>& listed_files, std::vector<std::uintmax_t>& listed_sizes) {
+		std::move(listed_files.begin(), listed_files.end(), std::back_inserter(walker_files[walker]));
+		walker_sizes[walker].insert(walker_sizes[walker].end(), listed_sizes.begin(), listed_sizes.end());
+		}, nullptr);
+
+	for (int walker = 0; walker < walker_count; ++walker) {
+		std::move(walker_files[walker].begin(), walker_files[walker].end(), std::back_inserter(files));
+		file_sizes.insert(file_sizes.end(), walker_sizes[walker].begin(), walker_sizes[walker].end());
+	}
+}
+
+
+std::size_t walkDirectoryIntoScheduler(const std::string& directory_path, int walker_count, const WalkOptions& options, FileScheduler& scheduler,
+	const std::function<bool(const fs::path&)>& filter) {
+	// Every walker fills a batch of its own and pushes it once it is big enough.
+	walker_count = std::max(walker_count, 1);
+	std::vector<FileBatch> batches(walker_count);
+	std::atomic<std::size_t> files_count = 0;
+	walkTree(directory_path, walker_count, options, [&](int walker, std::vector<fs::path>& listed_files, std::vector<std::uintmax_t>& listed_sizes) {
+		FileBatch& batch = batches[walker];
+		for (std::size_t i = 0; i < listed_files.size(); ++i) {
+			if (filter && !filter(listed_files[i])) {
+				continue;
+			}
+			batch.files.push_back(std::move(listed_files[i]));
+			batch.bytes += listed_sizes[i];
+			++files_count;
+
+			if (batch.files.size() >= PIPELINE_BATCH_FILES || batch.bytes >= PIPELINE_BATCH_BYTES) {
+				scheduler.push(std::move(batch));
+				batch = FileBatch();
+			}
+		}
+		}, [&](int walker) {
+			// Hand over the files left over in the last batch.
+			if (!batches[walker].files.empty()) {
+				scheduler.push(std::move(batches[walker]));
+			}
+		}, [&scheduler] {
+			// A cancelled search needs no more files, so the rest of the tree is not listed.
+			return scheduler.cancelled();
+		});
+
+	// Let the search threads finish once the queues are drained.
+	scheduler.close();
+
+	return files_count;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "file_scheduler.h"
+#include "search_options.h"
+
+/**
+ * The directories a walk that follows symbolic links has listed, by device and inode, shared by its
+ * walker threads so that a link back up the tree is not followed round in circles.
+ */
+class VisitedDirectories {
+public:
+	/**
+	 * Records a directory.
+	 *
+	 * @return True if it was not listed before.
+	 */
+	bool insert(std::uint64_t device, std::uint64_t inode);
+
+private:
+	std::mutex mutex_;
+	std::set<std::pair<std::uint64_t, std::uint64_t>> directories_;
+};
+
+
+/**
+ * Lists directories, one at a time, keeping its buffer across them.
+ *
+ * On Linux the entries are read with getdents64 into a large buffer, and their type is taken from
+ * d_type, so a subdirectory costs no stat at all. Only a regular file is stat'ed, relative to its open
+ * directory, for its size, and an entry whose type the filesystem does not report, or a symbolic link,
+ * for what it is or points to. Other systems list through std::filesystem.
+ *
+ * Symbolic links to files are listed like files. Symbolic links to directories are only descended into
+ * when the options say so. Files are left out by their name before they are stat'ed, and by their size after.
+ */
+class DirectoryReader {
+public:
+	/**
+	 * @param options The directories and files to leave out and whether to follow symbolic links.
+	 * @param visited The directories listed so far, needed when symbolic links are followed, nullptr otherwise.
+	 */
+	DirectoryReader(const WalkOptions& options, VisitedDirectories* visited);
+
+	/**
+	 * Lists a directory.
+	 *
+	 * @param directory The directory.
+	 * @param files Receives the regular files that are not left out, appended to the given ones.
+	 * @param file_sizes Receives the size of each file, appended in the same order.
+	 * @param subdirectories Receives the subdirectories to walk, appended to the given ones.
+	 * @return True on success, false if the directory could not be opened.
+	 */
+	bool list(const fs::path& directory, std::vector<fs::path>& files, std::vector<std::uintmax_t>& file_sizes, std::vector<fs::path>& subdirectories);
+
+private:
+	bool isExcluded(std::string_view name) const;
+	bool isFileExcluded(std::string_view name) const;
+
+	const WalkOptions& options_;
+	VisitedDirectories* visited_;
+	std::vector<char> buffer_;
+};
+
+
+/**
+ * Matches a file name against a glob pattern: '*' stands for any run of characters, '?' for any single
+ * one, and brackets for one of a set, like [a-z] or [!0-9]. A backslash takes the next character literally.
+ *
+ * @param pattern The glob pattern.
+ * @param name The file name, without its directory.
+ * @return True if the whole name matches.
+ */
+bool matchesGlob(std::string_view pattern, std::string_view name);
+
+/**
+ * Lists the regular files of a directory and all of its subdirectories with several threads, along
+ * with their sizes. Each walker thread takes a pending directory, lists it, and queues its
+ * subdirectories for the other walkers, so independent subtrees are listed in parallel. A single
+ * walker lists the tree in the same order on every run.
+ *
+ * @param directory_path The path to the directory to walk.
+ * @param walker_count The number of walker threads to use.
+ * @param options The directories and files to leave out and whether to follow symbolic links.
+ * @param files Receives the paths of the files.
+ * @param file_sizes Receives the size of each file in bytes, in the same order as files.
+ */
+void listDirectoryTree(const std::string& directory_path, int walker_count, const WalkOptions& options,
+	std::vector<fs::path>& files, std::vector<std::uintmax_t>& file_sizes);
+
+/**
+ * Walks a directory and its subdirectories like listDirectoryTree and feeds the regular files found
+ * into the scheduler in batches, while the search threads already take work from it.
+ * The scheduler is closed once the whole tree has been walked, or once the walk stopped because the search was cancelled.
+ *
+ * @param directory_path The path to the directory to walk.
+ * @param walker_count The number of walker threads to use.
+ * @param options The directories and files to leave out and whether to follow symbolic links.
+ * @param scheduler The scheduler to push the batches of files into.
+ * @param filter Decides for every file found whether it is pushed, empty to push all of them.
+ *               It is called from all walker threads at once.
+ * @return The number of files pushed into the scheduler.
+ */
+std::size_t walkDirectoryIntoScheduler(const std::string& directory_path, int walker_count, const WalkOptions& options, FileScheduler& scheduler,
+	const std::function<bool(const fs::path&)>& filter = nullptr);
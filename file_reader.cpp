@@ -0,0 +1,101 @@
+#include "file_reader.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <fstream>
+#endif
+
+// Files of at least this size are memory-mapped, smaller ones are read into the reusable buffer.
+static const std::size_t MMAP_THRESHOLD = 256 * 1024;
+
+// The amount the buffer grows by when a file turns out bigger than its reported size.
+static const std::size_t READ_CHUNK_SIZE = 128 * 1024;
+
+
+FileReader::~FileReader() {
+	release();
+}
+
+
+void FileReader::release() {
+#if defined(__unix__) || defined(__APPLE__)
+	if (mapping_ != nullptr) {
+		munmap(mapping_, mapping_size_);
+		mapping_ = nullptr;
+		mapping_size_ = 0;
+	}
+#endif
+}
+
+
+#if defined(__unix__) || defined(__APPLE__)
+bool FileReader::open(const fs::path& file_path, std::string_view& contents) {
+	release();
+
+	const int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		close(fd);
+		return false;
+	}
+
+	// Map big files, the kernel pages them in with read-ahead while they are scanned.
+	const std::size_t file_size = file_stat.st_size;
+	if (file_size >= MMAP_THRESHOLD) {
+		void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			close(fd);
+			madvise(mapping, file_size, MADV_SEQUENTIAL);
+			mapping_ = mapping;
+			mapping_size_ = file_size;
+			contents = std::string_view(static_cast<const char*>(mapping), file_size);
+			return true;
+		}
+	}
+
+	// Read everything else until the end of file, the reported size is only a hint for special files.
+	std::size_t length = 0;
+	buffer_.reserve(file_size + 1);
+	while (true) {
+		if (length == buffer_.size()) {
+			buffer_.reserve(buffer_.size() + READ_CHUNK_SIZE, length);
+		}
+		const ssize_t read_size = read(fd, buffer_.data() + length, buffer_.size() - length);
+		if (read_size < 0) {
+			close(fd);
+			return false;
+		}
+		if (read_size == 0) {
+			break;
+		}
+		length += read_size;
+	}
+	close(fd);
+
+	contents = std::string_view(buffer_.data(), length);
+	return true;
+}
+#else
+bool FileReader::open(const fs::path& file_path, std::string_view& contents) {
+	std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+	if (!file.good()) {
+		return false;
+	}
+
+	// Read the whole file into the reusable buffer in one go.
+	const std::size_t file_size = static_cast<std::size_t>(file.tellg());
+	file.seekg(0);
+	buffer_.reserve(file_size);
+	file.read(buffer_.data(), file_size);
+	contents = std::string_view(buffer_.data(), static_cast<std::size_t>(file.gcount()));
+	return true;
+}
+#endif
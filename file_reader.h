@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+#include <filesystem>
+
+#include "aligned_buffer.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * Gives a search thread access to the raw bytes of one file at a time.
+ *
+ * Large files are memory-mapped, so searching them copies nothing. Smaller files, for which setting up
+ * a mapping costs more than it saves, are read with a few big read() calls into a buffer that the reader
+ * keeps and reuses for every file. The contents stay valid until the next open() or until the reader is destroyed.
+ */
+class FileReader {
+public:
+	FileReader() = default;
+	FileReader(const FileReader&) = delete;
+	FileReader& operator=(const FileReader&) = delete;
+	~FileReader();
+
+	/**
+	 * Opens a file and makes its whole contents available.
+	 *
+	 * @param file_path The path of the file to open.
+	 * @param contents Receives a view of the file's bytes.
+	 * @return True on success, false if the file could not be opened or read.
+	 */
+	bool open(const fs::path& file_path, std::string_view& contents);
+
+private:
+	void release();
+
+	AlignedBuffer buffer_;
+	void* mapping_ = nullptr;
+	std::size_t mapping_size_ = 0;
+};
@@ -0,0 +1,303 @@
+#include "file_scheduler.h"
+
+#include <algorithm>
+#include <numeric>
+
+// Batches are cut so that every thread gets about this many of them, which leaves enough
+// granularity for stealing without paying the queue locking on every single file.
+static const std::uintmax_t BATCHES_PER_THREAD = 8;
+
+// Upper limit of files per batch, so trees of tiny files still spread well across the threads.
+static const std::size_t MAX_FILES_PER_BATCH = 256;
+
+// The sequence of a thread that searches no batch of its own.
+static const std::size_t NO_SEQUENCE = SIZE_MAX;
+
+
+SplitFile::SplitFile(std::size_t chunk_count, std::function<void(std::size_t, const void*)> search_chunk)
+	: chunk_count_(chunk_count), search_chunk_(std::move(search_chunk)) {
+}
+
+
+std::size_t SplitFile::searchChunks(const void* searcher) {
+	std::size_t searched = 0;
+	std::size_t chunk;
+	while ((chunk = next_chunk_++) < chunk_count_) {
+		search_chunk_(chunk, searcher);
+		++searched;
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (++searched_ == chunk_count_) {
+			all_searched_.notify_all();
+		}
+	}
+	return searched;
+}
+
+
+void SplitFile::wait() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	all_searched_.wait(lock, [this] { return searched_ == chunk_count_; });
+}
+
+
+FileScheduler::FileScheduler(std::vector<fs::path> files, const std::vector<std::uintmax_t>& file_sizes, int thread_count, std::size_t ordered_window)
+	: busy_threads_(thread_count), ordered_window_(ordered_window), running_sequences_(thread_count, NO_SEQUENCE), active_threads_(thread_count) {
+	for (int i = 0; i < thread_count; ++i) {
+		queues_.push_back(std::make_unique<WorkerQueue>());
+	}
+
+	// Calculate the byte size a batch should reach before a new one is started.
+	const std::uintmax_t total_bytes = std::accumulate(file_sizes.begin(), file_sizes.end(), std::uintmax_t{ 0 });
+	const std::uintmax_t batch_bytes = std::max<std::uintmax_t>(total_bytes / (thread_count * BATCHES_PER_THREAD), 1);
+
+	// Group neighbouring files into batches. A file bigger than the batch size gets a batch of its own.
+	// The batches are numbered in the order of their files, so results written in sequence order follow
+	// the order of the files, whatever the batch size.
+	std::vector<FileBatch> batches;
+	FileBatch current;
+	for (std::size_t i = 0; i < files.size(); ++i) {
+		if (!current.files.empty() && (current.bytes + file_sizes[i] > batch_bytes || current.files.size() == MAX_FILES_PER_BATCH)) {
+			current.sequence = next_sequence_++;
+			batches.push_back(std::move(current));
+			current = FileBatch();
+		}
+		current.files.push_back(std::move(files[i]));
+		current.bytes += file_sizes[i];
+	}
+	if (!current.files.empty()) {
+		current.sequence = next_sequence_++;
+		batches.push_back(std::move(current));
+	}
+
+	// In ordered mode, deal the batches out round-robin, which keeps every queue in sequence order.
+	if (ordered_window_ > 0) {
+		for (auto& batch : batches) {
+			queues_[next_queue_]->batches.push_back(std::move(batch));
+			next_queue_ = (next_queue_ + 1) % queues_.size();
+		}
+		return;
+	}
+
+	// Otherwise deal the batches out largest first, each one to the queue with the least bytes so far.
+	std::sort(batches.begin(), batches.end(), [](const auto& lhs, const auto& rhs) {
+		return lhs.bytes > rhs.bytes;
+		});
+	std::vector<std::uintmax_t> queue_bytes(thread_count, 0);
+	for (auto& batch : batches) {
+		const auto least_loaded = std::min_element(queue_bytes.begin(), queue_bytes.end()) - queue_bytes.begin();
+		queue_bytes[least_loaded] += batch.bytes;
+		queues_[least_loaded]->batches.push_back(std::move(batch));
+	}
+}
+
+
+FileScheduler::FileScheduler(int thread_count, std::size_t capacity, std::size_t ordered_window)
+	: capacity_(capacity), closed_(false), busy_threads_(thread_count), ordered_window_(ordered_window), running_sequences_(thread_count, NO_SEQUENCE),
+	active_threads_(thread_count) {
+	for (int i = 0; i < thread_count; ++i) {
+		queues_.push_back(std::make_unique<WorkerQueue>());
+	}
+}
+
+
+bool FileScheduler::push(FileBatch batch) {
+	std::unique_lock<std::mutex> state_lock(state_mutex_);
+	space_available_.wait(state_lock, [this] { return queued_ < capacity_ || cancelled(); });
+	if (cancelled()) {
+		return false;
+	}
+
+	// Hand the batches out round-robin, stealing evens out whatever imbalance is left.
+	batch.sequence = next_sequence_++;
+	WorkerQueue& target = *queues_[next_queue_];
+	next_queue_ = (next_queue_ + 1) % queues_.size();
+	{
+		std::lock_guard<std::mutex> lock(target.mutex);
+		target.batches.push_back(std::move(batch));
+	}
+	++queued_;
+
+	// A thread that is not let in would take the wakeup without taking the batch
+	if (activeThreads() < static_cast<int>(queues_.size())) {
+		work_available_.notify_all();
+	}
+	else {
+		work_available_.notify_one();
+	}
+	return true;
+}
+
+
+void FileScheduler::close() {
+	std::lock_guard<std::mutex> state_lock(state_mutex_);
+	closed_ = true;
+	work_available_.notify_all();
+}
+
+
+void FileScheduler::cancel() {
+	std::lock_guard<std::mutex> state_lock(state_mutex_);
+	cancelled_ = true;
+	for (auto& queue : queues_) {
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (capacity_ > 0) {
+			queued_ -= queue->batches.size();
+		}
+		queue->batches.clear();
+	}
+	work_available_.notify_all();
+	space_available_.notify_all();
+}
+
+
+void FileScheduler::share(std::shared_ptr<SplitFile> file) {
+	std::lock_guard<std::mutex> state_lock(state_mutex_);
+	split_files_.push_back(std::move(file));
+	work_available_.notify_all();
+}
+
+
+bool FileScheduler::nextBatch(int worker_index, FileBatch& batch) {
+	// The batch the thread took last is searched by now
+	bytes_searched_.fetch_add(batch.bytes, std::memory_order_relaxed);
+
+	// A thread with work left takes its next batch right away, if it is let in. In ordered mode, the batches
+	// are only handed out under the state mutex, which knows the batches still searched.
+	batch.split.reset();
+	if (ordered_window_ == 0 && !cancelled() && worker_index < activeThreads() && tryTakeBatch(worker_index, batch)) {
+		if (capacity_ > 0) {
+			std::lock_guard<std::mutex> state_lock(state_mutex_);
+			--queued_;
+			space_available_.notify_one();
+		}
+		return true;
+	}
+
+	// Otherwise help with a split file, or wait until there is work again or no thread has any left.
+	std::unique_lock<std::mutex> state_lock(state_mutex_);
+	--busy_threads_;
+
+	// The batch the thread is done with may let the others take batches past the window
+	if (ordered_window_ > 0 && running_sequences_[worker_index] != NO_SEQUENCE) {
+		running_sequences_[worker_index] = NO_SEQUENCE;
+		work_available_.notify_all();
+	}
+	while (true) {
+		// A cancelled search leaves the split files to the threads that split them
+		if (cancelled()) {
+			return false;
+		}
+
+		// A thread that is not let in only waits, the others take over its queue
+		if (worker_index < activeThreads()) {
+			if (tryTakeChunks(batch)) {
+				++busy_threads_;
+				return true;
+			}
+			if (ordered_window_ > 0 ? tryTakeInOrder(worker_index, batch) : tryTakeBatch(worker_index, batch)) {
+				++busy_threads_;
+				if (capacity_ > 0) {
+					--queued_;
+					space_available_.notify_one();
+				}
+				return true;
+			}
+		}
+		if (busy_threads_ == 0 && closed_) {
+			work_available_.notify_all();
+			return false;
+		}
+		work_available_.wait(state_lock);
+	}
+}
+
+
+void FileScheduler::setActiveThreads(int count) {
+	std::lock_guard<std::mutex> state_lock(state_mutex_);
+	active_threads_ = std::clamp(count, 1, static_cast<int>(queues_.size()));
+	work_available_.notify_all();
+}
+
+
+/**
+ * Hands out the chunks of the oldest split file that still has some, dropping the files without any.
+ * The caller holds the state mutex.
+ *
+ * @param batch Receives the split file.
+ * @return True if a split file with chunks left was found.
+ */
+bool FileScheduler::tryTakeChunks(FileBatch& batch) {
+	split_files_.erase(std::remove_if(split_files_.begin(), split_files_.end(), [](const auto& file) {
+		return !file->hasChunks();
+		}), split_files_.end());
+	if (split_files_.empty()) {
+		return false;
+	}
+	batch.files.clear();
+	batch.bytes = 0;
+	batch.split = split_files_.front();
+	return true;
+}
+
+
+/**
+ * Hands out the oldest batch of all queues, unless it lies a window or more past the oldest batch still searched.
+ * The caller holds the state mutex, under which alone the queues change in ordered mode.
+ *
+ * @param worker_index The index of the calling thread.
+ * @param batch Receives the batch.
+ * @return True if a batch was taken.
+ */
+bool FileScheduler::tryTakeInOrder(int worker_index, FileBatch& batch) {
+	// Every queue holds its batches in sequence order, so the oldest one is at the front of one of them
+	WorkerQueue* oldest = nullptr;
+	std::size_t sequence = NO_SEQUENCE;
+	for (auto& queue : queues_) {
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (!queue->batches.empty() && queue->batches.front().sequence < sequence) {
+			oldest = queue.get();
+			sequence = queue->batches.front().sequence;
+		}
+	}
+	if (oldest == nullptr) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(oldest->mutex);
+	const std::size_t oldest_running = *std::min_element(running_sequences_.begin(), running_sequences_.end());
+	if (oldest_running != NO_SEQUENCE && sequence >= oldest_running + ordered_window_) {
+		return false;
+	}
+	batch = std::move(oldest->batches.front());
+	oldest->batches.pop_front();
+	running_sequences_[worker_index] = sequence;
+	return true;
+}
+
+
+bool FileScheduler::tryTakeBatch(int worker_index, FileBatch& batch) {
+	// Take the biggest remaining batch from the own queue first.
+	{
+		WorkerQueue& own = *queues_[worker_index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.batches.empty()) {
+			batch = std::move(own.batches.front());
+			own.batches.pop_front();
+			return true;
+		}
+	}
+
+	// Otherwise steal the smallest batch of another thread, so the victim keeps its big ones.
+	const int queue_count = static_cast<int>(queues_.size());
+	for (int offset = 1; offset < queue_count; ++offset) {
+		WorkerQueue& victim = *queues_[(worker_index + offset) % queue_count];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.batches.empty()) {
+			batch = std::move(victim.batches.back());
+			victim.batches.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
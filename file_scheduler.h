@@ -0,0 +1,213 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+/**
+ * A huge file that several search threads search at once, split into chunks of whole lines, or the runs
+ * of pieces of a compressed file that they decompress at once.
+ *
+ * The thread that opened the file shares it through the scheduler, searches chunks itself, and waits for
+ * the chunks other threads took before it puts their results together. The chunks are handed out in
+ * order, one at a time, so the threads that help finish at about the same time.
+ */
+class SplitFile {
+public:
+	/**
+	 * @param chunk_count The number of chunks.
+	 * @param search_chunk Searches the chunk with the given index, called from every thread that helps
+	 * with the searcher that thread passes to searchChunks().
+	 */
+	SplitFile(std::size_t chunk_count, std::function<void(std::size_t, const void*)> search_chunk);
+
+	/**
+	 * @return Whether some chunks were not taken yet.
+	 */
+	bool hasChunks() const { return next_chunk_.load(std::memory_order_relaxed) < chunk_count_; }
+
+	/**
+	 * Takes and searches chunks until none is left.
+	 *
+	 * @param searcher The searcher of the calling thread, of the type the thread that split the file searches with.
+	 * A thread searches with a searcher of its own, since a regex searcher builds its DFA while it searches.
+	 * @return The number of chunks searched by the calling thread.
+	 */
+	std::size_t searchChunks(const void* searcher);
+
+	/**
+	 * Waits until the chunks taken by other threads are searched as well.
+	 */
+	void wait();
+
+private:
+	const std::size_t chunk_count_;
+	const std::function<void(std::size_t, const void*)> search_chunk_;
+	std::atomic<std::size_t> next_chunk_ = 0;
+
+	std::mutex mutex_;
+	std::condition_variable all_searched_;
+	std::size_t searched_ = 0;
+};
+
+
+/**
+ * A group of files that is handed to a search thread as a single unit of work.
+ */
+struct FileBatch {
+	std::vector<fs::path> files;
+	std::uintmax_t bytes = 0;
+
+	// Position of the batch in the order of its files, used to write results in a fixed order. The batches
+	// are numbered in the order the files were listed, before they are dealt out, so the order of the
+	// results does not depend on the number of threads or the size of the batches.
+	std::size_t sequence = 0;
+
+	// Instead of files, the batch may hand out the chunks of a file another thread split.
+	std::shared_ptr<SplitFile> split;
+};
+
+
+/**
+ * Distributes files between the search threads.
+ *
+ * Files are grouped into batches of roughly equal byte size. Every thread owns a queue of batches,
+ * filled largest first, and takes work from its front. A thread whose queue runs dry steals from the
+ * back of another thread's queue, so a few huge files can not keep one thread busy while the rest idle.
+ *
+ * In pipelined mode the batches are pushed by the directory walkers while the search threads already
+ * run. The number of queued batches is bounded, so a fast walker blocks instead of buffering the whole tree.
+ *
+ * A thread without work waits until every other thread is out of work too, since a thread searching a huge
+ * file may still share its chunks. That way the last file of a search is searched by all threads.
+ *
+ * For results written in sequence order, the batches are handed out in that order instead, and none more than
+ * a window past the oldest batch still searched, so a slow batch holds back the results of a bounded number of
+ * batches after it rather than those of the whole search.
+ *
+ * Only the first threads may be let in to take work, so the number of threads that search can be adapted while
+ * the search runs. The others wait until they are let in again or the search is over, and their queues are stolen from.
+ */
+class FileScheduler {
+public:
+	/**
+	 * Builds the batches and deals them out to the per-thread queues.
+	 *
+	 * @param files The files to search.
+	 * @param file_sizes The size of each file in bytes, in the same order as files.
+	 * @param thread_count The number of threads that will take work from the scheduler.
+	 * @param ordered_window The most batches handed out past the oldest one still searched, with the batches
+	 *                       handed out in sequence order, or 0 to hand them out largest first.
+	 */
+	FileScheduler(std::vector<fs::path> files, const std::vector<std::uintmax_t>& file_sizes, int thread_count, std::size_t ordered_window = 0);
+
+	/**
+	 * Creates an empty scheduler in pipelined mode, which is fed by push() until close() is called.
+	 *
+	 * @param thread_count The number of threads that will take work from the scheduler.
+	 * @param capacity The maximum number of queued batches before push() blocks.
+	 * @param ordered_window The most batches handed out past the oldest one still searched, with the batches
+	 *                       handed out in sequence order, or 0 for no limit.
+	 */
+	FileScheduler(int thread_count, std::size_t capacity, std::size_t ordered_window = 0);
+
+	/**
+	 * Queues a batch for the search threads, waiting while the scheduler is full.
+	 *
+	 * @param batch The batch to queue.
+	 * @return True if it was queued, false if the search was cancelled, in which case it is dropped.
+	 */
+	bool push(FileBatch batch);
+
+	/**
+	 * Marks the end of the input, after which nextBatch() returns false once the queues are drained.
+	 */
+	void close();
+
+	/**
+	 * Stops the search early. The queued batches are dropped, so every thread stops once it is done with
+	 * the work it took, and the batches pushed afterwards are dropped as well, which tells the walkers to stop.
+	 */
+	void cancel();
+
+	/**
+	 * @return Whether the search was cancelled.
+	 */
+	bool cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+	/**
+	 * Hands the chunks of a file to the threads without work, and to those that run out of it later.
+	 *
+	 * @param file The split file.
+	 */
+	void share(std::shared_ptr<SplitFile> file);
+
+	/**
+	 * Takes the next batch for the given thread, stealing from other threads when its own queue is empty.
+	 * Without a batch left, the call waits for the chunks of a split file or for new batches in pipelined
+	 * mode, until the last thread runs out of work.
+	 *
+	 * @param worker_index The index of the calling thread, in the range [0, thread_count).
+	 * @param batch Receives the batch.
+	 * @return True if a batch was taken, false if there is no work left.
+	 */
+	bool nextBatch(int worker_index, FileBatch& batch);
+
+	/**
+	 * Lets only the threads with the first indices take work. The others finish what they took and then wait.
+	 *
+	 * @param count The number of threads to let in, at least 1.
+	 */
+	void setActiveThreads(int count);
+
+	/**
+	 * @return The number of threads let in to take work.
+	 */
+	int activeThreads() const { return active_threads_.load(std::memory_order_relaxed); }
+
+	/**
+	 * @return The bytes of the batches the threads are done with, which tells how fast the search goes.
+	 */
+	std::uint64_t bytesSearched() const { return bytes_searched_.load(std::memory_order_relaxed); }
+
+private:
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<FileBatch> batches;
+	};
+
+	bool tryTakeBatch(int worker_index, FileBatch& batch);
+	bool tryTakeInOrder(int worker_index, FileBatch& batch);
+	bool tryTakeChunks(FileBatch& batch);
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues_;
+
+	// Bookkeeping of the pipelined mode, the split files, and the threads with work, guarded by state_mutex_.
+	std::mutex state_mutex_;
+	std::condition_variable work_available_;
+	std::condition_variable space_available_;
+	std::size_t capacity_ = 0;
+	std::size_t queued_ = 0;
+	std::size_t next_queue_ = 0;
+	std::size_t next_sequence_ = 0;
+	bool closed_ = true;
+	std::vector<std::shared_ptr<SplitFile>> split_files_;
+	std::size_t busy_threads_ = 0;
+	std::atomic<bool> cancelled_ = false;
+
+	// In ordered mode, the window and the sequence of the batch every thread searches, guarded by state_mutex_.
+	std::size_t ordered_window_ = 0;
+	std::vector<std::size_t> running_sequences_;
+
+	// The threads let in, changed under state_mutex_, and the bytes of the batches they are done with.
+	std::atomic<int> active_threads_ = 0;
+	std::atomic<std::uint64_t> bytes_searched_ = 0;
+};
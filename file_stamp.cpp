@@ -0,0 +1,34 @@
+#include "file_stamp.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#endif
+
+
+#if defined(__unix__) || defined(__APPLE__)
+bool readFileStamp(const fs::path& file_path, FileStamp& stamp) {
+	struct stat file_stat;
+	if (stat(file_path.c_str(), &file_stat) != 0) {
+		return false;
+	}
+	stamp.size = file_stat.st_size;
+	stamp.inode = file_stat.st_ino;
+#if defined(__APPLE__)
+	stamp.mtime_ns = std::int64_t{ file_stat.st_mtimespec.tv_sec } * 1000000000 + file_stat.st_mtimespec.tv_nsec;
+#else
+	stamp.mtime_ns = std::int64_t{ file_stat.st_mtim.tv_sec } * 1000000000 + file_stat.st_mtim.tv_nsec;
+#endif
+	return true;
+}
+#else
+bool readFileStamp(const fs::path& file_path, FileStamp& stamp) {
+	std::error_code error;
+	stamp.size = fs::file_size(file_path, error);
+	if (error) {
+		return false;
+	}
+	stamp.mtime_ns = fs::last_write_time(file_path, error).time_since_epoch().count();
+	stamp.inode = 0;
+	return !error;
+}
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+/**
+ * The size, modification time and inode of a file, which tell whether what was indexed or cached of it
+ * is still current.
+ */
+struct FileStamp {
+	std::uint64_t size = 0;
+	std::int64_t mtime_ns = 0;
+	std::uint64_t inode = 0;
+
+	bool operator==(const FileStamp&) const = default;
+};
+
+
+/**
+ * Reads the stamp of a file.
+ *
+ * @param file_path The path of the file.
+ * @param stamp Receives the stamp.
+ * @return True on success, false if the file could not be examined.
+ */
+bool readFileStamp(const fs::path& file_path, FileStamp& stamp);
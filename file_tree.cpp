@@ -0,0 +1,240 @@
+#include "file_tree.h"
+
+#include <iostream>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#if defined(__linux__)
+// The changes that make a directory list differently: files and subdirectories appearing, disappearing, or being written.
+static const std::uint32_t WATCHED_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR | IN_EXCL_UNLINK;
+#endif
+
+
+/**
+ * Tells whether a path is a directory or lies below it.
+ *
+ * @param path The path to check.
+ * @param directory The directory.
+ * @return True if every element of the directory starts the path.
+ */
+static bool isInside(const fs::path& path, const fs::path& directory) {
+	return std::mismatch(directory.begin(), directory.end(), path.begin(), path.end()).first == directory.end();
+}
+
+
+FileTree::FileTree(const WalkOptions& options) : reader_(options, nullptr) {
+}
+
+
+FileTree::~FileTree() {
+	stopWatching();
+}
+
+
+void FileTree::watch(const fs::path& root) {
+	root_ = root;
+	stopWatching();
+#if defined(__linux__)
+	notify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	walk();
+}
+
+
+/**
+ * Lists the whole tree from scratch.
+ */
+void FileTree::walk() {
+	directories_.clear();
+	watched_.clear();
+	addDirectory(root_);
+}
+
+
+/**
+ * Watches and lists a directory that is new to the tree, and all of its subdirectories.
+ * The watch is added before the listing, so nothing created in between is missed.
+ *
+ * @param path The directory.
+ */
+void FileTree::addDirectory(const fs::path& path) {
+	std::vector<fs::path> pending = { path };
+	while (!pending.empty()) {
+		const fs::path next = std::move(pending.back());
+		pending.pop_back();
+		Directory& directory = directories_[next];
+#if defined(__linux__)
+		if (notify_fd_ >= 0) {
+			const int watch = inotify_add_watch(notify_fd_, next.c_str(), WATCHED_EVENTS);
+			if (watch >= 0) {
+				directory.watch = watch;
+				watched_[watch] = next;
+			}
+			else if (errno == ENOSPC) {
+				std::cerr << "Warning: could not watch all directories of " << root_.string() << ", walking it before every search" << std::endl;
+				stopWatching();
+			}
+		}
+#endif
+		listDirectory(next, directory, pending);
+	}
+}
+
+
+/**
+ * Lists the files directly in a directory, replacing the previous listing.
+ *
+ * @param path The directory.
+ * @param directory Receives the files and their sizes.
+ * @param subdirectories Receives the subdirectories, appended to the given ones.
+ */
+void FileTree::listDirectory(const fs::path& path, Directory& directory, std::vector<fs::path>& subdirectories) {
+	directory.files.clear();
+	directory.file_sizes.clear();
+
+	// A directory that can not be read, or is gone already, lists as empty
+	reader_.list(path, directory.files, directory.file_sizes, subdirectories);
+}
+
+
+/**
+ * Lists a changed directory again, walking its new subdirectories and dropping those that are gone.
+ *
+ * @param path The directory.
+ */
+void FileTree::updateDirectory(const fs::path& path) {
+	const auto found = directories_.find(path);
+	if (found == directories_.end()) {
+		return;
+	}
+	std::vector<fs::path> subdirectories;
+	listDirectory(path, found->second, subdirectories);
+	std::sort(subdirectories.begin(), subdirectories.end());
+
+	// The subdirectories of a directory follow it in the map, together with everything below them
+	std::vector<fs::path> removed;
+	for (auto known = std::next(found); known != directories_.end() && isInside(known->first, path); ++known) {
+		if (known->first.parent_path() == path && !std::binary_search(subdirectories.begin(), subdirectories.end(), known->first)) {
+			removed.push_back(known->first);
+		}
+	}
+	for (const auto& subdirectory : removed) {
+		removeDirectory(subdirectory);
+	}
+	for (const auto& subdirectory : subdirectories) {
+		if (directories_.find(subdirectory) == directories_.end()) {
+			addDirectory(subdirectory);
+		}
+	}
+}
+
+
+/**
+ * Drops a directory and everything below it from the tree.
+ *
+ * @param path The directory.
+ */
+void FileTree::removeDirectory(const fs::path& path) {
+	auto first = directories_.lower_bound(path);
+	auto last = first;
+	for (; last != directories_.end() && isInside(last->first, path); ++last) {
+#if defined(__linux__)
+		// The watch of a deleted directory is gone already, one that was moved away still has to be removed
+		if (last->second.watch >= 0 && watched_.erase(last->second.watch) > 0) {
+			inotify_rm_watch(notify_fd_, last->second.watch);
+		}
+#endif
+	}
+	directories_.erase(first, last);
+}
+
+
+/**
+ * Removes all watches, after which every refresh walks the whole tree.
+ */
+void FileTree::stopWatching() {
+#if defined(__linux__)
+	if (notify_fd_ >= 0) {
+		close(notify_fd_);
+	}
+#endif
+	notify_fd_ = -1;
+	watched_.clear();
+	for (auto& [path, directory] : directories_) {
+		directory.watch = -1;
+	}
+}
+
+
+void FileTree::refresh() {
+	if (notify_fd_ < 0) {
+		walk();
+		return;
+	}
+
+#if defined(__linux__)
+	// Collect the directories with changes until no event is left
+	std::vector<fs::path> changed;
+	bool overflowed = false;
+	alignas(inotify_event) char buffer[64 * 1024];
+	while (true) {
+		const ssize_t length = read(notify_fd_, buffer, sizeof(buffer));
+		if (length < 0 && errno == EINTR) {
+			continue;
+		}
+		if (length <= 0) {
+			break;
+		}
+		for (ssize_t position = 0; position < length;) {
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + position);
+			position += sizeof(inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW) {
+				overflowed = true;
+				continue;
+			}
+			const auto watched = watched_.find(event->wd);
+			if (watched == watched_.end()) {
+				continue;
+			}
+			if (event->mask & IN_IGNORED) {
+				// The directory was deleted, its parent lists it as gone
+				const auto directory = directories_.find(watched->second);
+				if (directory != directories_.end()) {
+					directory->second.watch = -1;
+				}
+				watched_.erase(watched);
+				continue;
+			}
+			changed.push_back(watched->second);
+		}
+	}
+
+	// Some changes were lost, so only a new walk is sure to see all of them
+	if (overflowed) {
+		stopWatching();
+		notify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		walk();
+		return;
+	}
+
+	// A parent comes before its subdirectories, which it may have dropped already
+	std::sort(changed.begin(), changed.end());
+	changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+	for (const auto& path : changed) {
+		updateDirectory(path);
+	}
+#endif
+}
+
+
+void FileTree::list(const fs::path& directory, std::vector<fs::path>& files, std::vector<std::uintmax_t>& file_sizes) const {
+	for (auto listed = directories_.lower_bound(directory); listed != directories_.end() && isInside(listed->first, directory); ++listed) {
+		files.insert(files.end(), listed->second.files.begin(), listed->second.files.end());
+		file_sizes.insert(file_sizes.end(), listed->second.file_sizes.begin(), listed->second.file_sizes.end());
+	}
+}
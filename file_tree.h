@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+#include <filesystem>
+
+#include "directory_walker.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * The regular files of a directory tree, kept in memory between searches.
+ *
+ * The tree is walked once. On Linux every directory is then watched with inotify, and before each search
+ * only the directories in which files or subdirectories were created, deleted, moved or written since
+ * the previous search are listed again. New subdirectories are walked and watched, removed ones are
+ * dropped with everything below them. If the events overflowed, the whole tree is walked again. On
+ * other systems, or when the watches run out, the tree is walked again before every search.
+ *
+ * Like a walk of the tree, symbolic links to files are listed, symbolic links to directories are not followed,
+ * and excluded directories are left out.
+ */
+class FileTree {
+public:
+	/**
+	 * @param options The directories to leave out of the tree, kept by reference, so they have to outlive it.
+	 *                Symbolic links to directories are never followed.
+	 */
+	explicit FileTree(const WalkOptions& options);
+	FileTree(const FileTree&) = delete;
+	FileTree& operator=(const FileTree&) = delete;
+	~FileTree();
+
+	/**
+	 * Walks the tree and starts watching it.
+	 *
+	 * @param root The directory at the top of the tree.
+	 */
+	void watch(const fs::path& root);
+
+	/**
+	 * Applies the changes of the tree since the previous call.
+	 */
+	void refresh();
+
+	/**
+	 * Lists the files below a directory of the tree, along with their sizes.
+	 *
+	 * @param directory The directory, the root or one below it.
+	 * @param files Receives the paths of the files.
+	 * @param file_sizes Receives the size of each file in bytes, in the same order as files.
+	 */
+	void list(const fs::path& directory, std::vector<fs::path>& files, std::vector<std::uintmax_t>& file_sizes) const;
+
+	/**
+	 * @return The directory at the top of the tree.
+	 */
+	const fs::path& root() const { return root_; }
+
+private:
+	// The files directly in a directory and the inotify watch of the directory.
+	struct Directory {
+		int watch = -1;
+		std::vector<fs::path> files;
+		std::vector<std::uintmax_t> file_sizes;
+	};
+
+	void walk();
+	void addDirectory(const fs::path& path);
+	void listDirectory(const fs::path& path, Directory& directory, std::vector<fs::path>& subdirectories);
+	void updateDirectory(const fs::path& path);
+	void removeDirectory(const fs::path& path);
+	void stopWatching();
+
+	DirectoryReader reader_;
+	fs::path root_;
+	std::map<fs::path, Directory> directories_;
+	std::unordered_map<int, fs::path> watched_;
+	int notify_fd_ = -1;
+};
@@ -0,0 +1,343 @@
+#include "literal_search.h"
+#include "case_fold.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#define LITERAL_SEARCH_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define LITERAL_SEARCH_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+/**
+ * Scalar kernel: memchr for the first byte, then the last byte, then the rest.
+ * Used for patterns of a single byte, for the tails of the vector kernels, and on CPUs without vector support.
+ */
+static const char* findScalar(const char* begin, const char* end, const char* needle, std::size_t needle_size) {
+	const char first = needle[0];
+	const char last = needle[needle_size - 1];
+	const char* const last_start = end - needle_size;
+
+	const char* candidate = begin;
+	while (candidate <= last_start) {
+		candidate = static_cast<const char*>(memchr(candidate, first, last_start - candidate + 1));
+		if (candidate == nullptr) {
+			return nullptr;
+		}
+		if (candidate[needle_size - 1] == last && memcmp(candidate + 1, needle + 1, needle_size - 1) == 0) {
+			return candidate;
+		}
+		++candidate;
+	}
+	return nullptr;
+}
+
+
+/**
+ * Compares bytes of the input with bytes of a lower case pattern, folding the input's ASCII letters.
+ */
+static bool equalFolded(const char* text, const char* folded, std::size_t size) {
+	for (std::size_t i = 0; i < size; ++i) {
+		if (foldAscii(text[i]) != folded[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+ * @return The bits to OR into an input byte before it is compared with a byte of a lower case pattern, 0x20 for a letter.
+ */
+static char foldBits(char folded) {
+	return folded >= 'a' && folded <= 'z' ? 0x20 : 0;
+}
+
+
+/**
+ * Scalar kernel ignoring case: the first and the last byte of every position, then the rest.
+ * Used for the tails of the vector kernels, and on CPUs without vector support.
+ */
+static const char* findScalarFolded(const char* begin, const char* end, const char* needle, std::size_t needle_size) {
+	const char first = needle[0];
+	const char first_bits = foldBits(first);
+	const char last = needle[needle_size - 1];
+	const char last_bits = foldBits(last);
+
+	for (const char* candidate = begin; candidate + needle_size <= end; ++candidate) {
+		if ((*candidate | first_bits) == first && (candidate[needle_size - 1] | last_bits) == last
+			&& (needle_size < 3 || equalFolded(candidate + 1, needle + 1, needle_size - 2))) {
+			return candidate;
+		}
+	}
+	return nullptr;
+}
+
+
+#if defined(LITERAL_SEARCH_X86)
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE2
+#endif
+
+/**
+ * AVX2 kernel: checks 32 candidate positions per iteration.
+ */
+TARGET_AVX2 static const char* findAvx2(const char* begin, const char* end, const char* needle, std::size_t needle_size) {
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[needle_size - 1]);
+
+	const char* block = begin;
+	for (; block + needle_size - 1 + 32 <= end; block += 32) {
+		const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+		const __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + needle_size - 1));
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+
+		// Verify the candidates in order, so the first match found is the first one in the buffer
+		while (mask != 0) {
+			const char* candidate = block + __builtin_ctz(mask);
+			if (memcmp(candidate + 1, needle + 1, needle_size - 2) == 0) {
+				return candidate;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	return findScalar(block, end, needle, needle_size);
+}
+
+
+/**
+ * AVX2 kernel ignoring case: folds the candidate bytes before comparing them, which also takes patterns of a single byte.
+ */
+TARGET_AVX2 static const char* findAvx2Folded(const char* begin, const char* end, const char* needle, std::size_t needle_size) {
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i first_bits = _mm256_set1_epi8(foldBits(needle[0]));
+	const __m256i last = _mm256_set1_epi8(needle[needle_size - 1]);
+	const __m256i last_bits = _mm256_set1_epi8(foldBits(needle[needle_size - 1]));
+
+	const char* block = begin;
+	for (; block + needle_size - 1 + 32 <= end; block += 32) {
+		const __m256i block_first = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block)), first_bits);
+		const __m256i block_last = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + needle_size - 1)), last_bits);
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+
+		// Verify the candidates in order, so the first match found is the first one in the buffer
+		while (mask != 0) {
+			const char* candidate = block + __builtin_ctz(mask);
+			if (needle_size < 3 || equalFolded(candidate + 1, needle + 1, needle_size - 2)) {
+				return candidate;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	return findScalarFolded(block, end, needle, needle_size);
+}
+
+
+/**
+ * SSE2 kernel: checks 16 candidate positions per iteration.
+ */
+TARGET_SSE2 static const char* findSse2(const char* begin, const char* end, const char* needle, std::size_t needle_size) {
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[needle_size - 1]);
+
+	const char* block = begin;
+	for (; block + needle_size - 1 + 16 <= end; block += 16) {
+		const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+		const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + needle_size - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+
+		// Verify the candidates in order, so the first match found is the first one in the buffer
+		while (mask != 0) {
+			const char* candidate = block + __builtin_ctz(mask);
+			if (memcmp(candidate + 1, needle + 1, needle_size - 2) == 0) {
+				return candidate;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	return findScalar(block, end, needle, needle_size);
+}
+
+
+/**
+ * SSE2 kernel ignoring case.
+ */
+TARGET_SSE2 static const char* findSse2Folded(const char* begin, const char* end, const char* needle, std::size_t needle_size) {
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i first_bits = _mm_set1_epi8(foldBits(needle[0]));
+	const __m128i last = _mm_set1_epi8(needle[needle_size - 1]);
+	const __m128i last_bits = _mm_set1_epi8(foldBits(needle[needle_size - 1]));
+
+	const char* block = begin;
+	for (; block + needle_size - 1 + 16 <= end; block += 16) {
+		const __m128i block_first = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)), first_bits);
+		const __m128i block_last = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + needle_size - 1)), last_bits);
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+
+		// Verify the candidates in order, so the first match found is the first one in the buffer
+		while (mask != 0) {
+			const char* candidate = block + __builtin_ctz(mask);
+			if (needle_size < 3 || equalFolded(candidate + 1, needle + 1, needle_size - 2)) {
+				return candidate;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	return findScalarFolded(block, end, needle, needle_size);
+}
+#endif
+
+
+#if defined(LITERAL_SEARCH_NEON)
+/**
+ * NEON kernel: checks 16 candidate positions per iteration.
+ */
+static const char* findNeon(const char* begin, const char* end, const char* needle, std::size_t needle_size) {
+	const uint8x16_t first = vdupq_n_u8(needle[0]);
+	const uint8x16_t last = vdupq_n_u8(needle[needle_size - 1]);
+
+	const char* block = begin;
+	for (; block + needle_size - 1 + 16 <= end; block += 16) {
+		const uint8x16_t block_first = vld1q_u8(reinterpret_cast<const uint8_t*>(block));
+		const uint8x16_t block_last = vld1q_u8(reinterpret_cast<const uint8_t*>(block + needle_size - 1));
+		const uint8x16_t equal = vandq_u8(vceqq_u8(first, block_first), vceqq_u8(last, block_last));
+
+		// Narrow the byte mask to 4 bits per position, NEON has no movemask
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+
+		// Verify the candidates in order, so the first match found is the first one in the buffer
+		while (mask != 0) {
+			const int bit = __builtin_ctzll(mask);
+			const char* candidate = block + bit / 4;
+			if (memcmp(candidate + 1, needle + 1, needle_size - 2) == 0) {
+				return candidate;
+			}
+			mask &= ~(uint64_t{ 0xF } << (bit & ~3));
+		}
+	}
+
+	return findScalar(block, end, needle, needle_size);
+}
+
+
+/**
+ * NEON kernel ignoring case.
+ */
+static const char* findNeonFolded(const char* begin, const char* end, const char* needle, std::size_t needle_size) {
+	const uint8x16_t first = vdupq_n_u8(needle[0]);
+	const uint8x16_t first_bits = vdupq_n_u8(foldBits(needle[0]));
+	const uint8x16_t last = vdupq_n_u8(needle[needle_size - 1]);
+	const uint8x16_t last_bits = vdupq_n_u8(foldBits(needle[needle_size - 1]));
+
+	const char* block = begin;
+	for (; block + needle_size - 1 + 16 <= end; block += 16) {
+		const uint8x16_t block_first = vorrq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(block)), first_bits);
+		const uint8x16_t block_last = vorrq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(block + needle_size - 1)), last_bits);
+		const uint8x16_t equal = vandq_u8(vceqq_u8(first, block_first), vceqq_u8(last, block_last));
+
+		// Narrow the byte mask to 4 bits per position, NEON has no movemask
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+
+		// Verify the candidates in order, so the first match found is the first one in the buffer
+		while (mask != 0) {
+			const int bit = __builtin_ctzll(mask);
+			const char* candidate = block + bit / 4;
+			if (needle_size < 3 || equalFolded(candidate + 1, needle + 1, needle_size - 2)) {
+				return candidate;
+			}
+			mask &= ~(uint64_t{ 0xF } << (bit & ~3));
+		}
+	}
+
+	return findScalarFolded(block, end, needle, needle_size);
+}
+#endif
+
+
+/**
+ * Picks the best kernel the CPU supports, and the same one ignoring case.
+ */
+static LiteralSearcher::Kernel selectKernel(const char** name, LiteralSearcher::Kernel* folded) {
+#if defined(LITERAL_SEARCH_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		*name = "avx2";
+		*folded = findAvx2Folded;
+		return findAvx2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		*name = "sse2";
+		*folded = findSse2Folded;
+		return findSse2;
+	}
+#elif defined(LITERAL_SEARCH_X86)
+	*name = "sse2";
+	*folded = findSse2Folded;
+	return findSse2;
+#elif defined(LITERAL_SEARCH_NEON)
+	*name = "neon";
+	*folded = findNeonFolded;
+	return findNeon;
+#endif
+	*name = "scalar";
+	*folded = findScalarFolded;
+	return findScalar;
+}
+
+
+// The kernels picked for this CPU and their name, selected on first use.
+static const char* selected_kernel_name = "scalar";
+static LiteralSearcher::Kernel selected_folded_kernel = findScalarFolded;
+
+static LiteralSearcher::Kernel selectedKernel(bool ignore_case) {
+	static const LiteralSearcher::Kernel kernel = selectKernel(&selected_kernel_name, &selected_folded_kernel);
+	return ignore_case ? selected_folded_kernel : kernel;
+}
+
+
+LiteralSearcher::LiteralSearcher(std::string pattern, bool ignore_case) : pattern_(std::move(pattern)) {
+	// A pattern without letters is the same in every case, and is searched for as it is
+	if (ignore_case) {
+		pattern_ = foldAscii(pattern_);
+		ignore_case = pattern_.find_first_of("abcdefghijklmnopqrstuvwxyz") != std::string::npos;
+	}
+
+	// The vector kernels compare the first and the last byte separately, a single byte is best left to memchr
+	// unless its case is ignored, which the folding kernels take care of
+	if (ignore_case) {
+		kernel_ = selectedKernel(true);
+	}
+	else {
+		kernel_ = pattern_.size() >= 2 ? selectedKernel(false) : findScalar;
+	}
+}
+
+
+std::size_t LiteralSearcher::find(std::string_view haystack, std::size_t position) const {
+	if (position > haystack.size() || pattern_.size() > haystack.size() - position) {
+		return std::string_view::npos;
+	}
+	if (pattern_.empty()) {
+		return position;
+	}
+
+	const char* match = kernel_(haystack.data() + position, haystack.data() + haystack.size(), pattern_.data(), pattern_.size());
+	return match == nullptr ? std::string_view::npos : match - haystack.data();
+}
+
+
+const char* LiteralSearcher::kernelName() {
+	selectedKernel(false);
+	return selected_kernel_name;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstddef>
+
+/**
+ * Finds occurrences of a literal string in a buffer with a vectorized kernel.
+ *
+ * The kernel compares the first and the last byte of the pattern against a whole vector of candidate
+ * positions at once and only verifies the few positions where both bytes agree with memcmp. The best
+ * kernel for the CPU (AVX2, SSE2, NEON, or a scalar fallback) is picked at runtime. The results are
+ * the same as those of std::string_view::find.
+ *
+ * Ignoring case, the pattern is kept in lower case and the kernels fold ASCII letters while they compare:
+ * a byte ORed with 0x20 equals a lower case letter exactly when it is that letter in either case, so the
+ * candidates cost one more vector instruction per end byte and the input is never transformed.
+ */
+class LiteralSearcher {
+public:
+	/**
+	 * Prepares the search for a pattern.
+	 *
+	 * @param pattern The literal string to search for.
+	 * @param ignore_case Whether ASCII letters match in either case.
+	 */
+	explicit LiteralSearcher(std::string pattern, bool ignore_case = false);
+
+	/**
+	 * Finds the first occurrence of the pattern at or after a position.
+	 *
+	 * @param haystack The buffer to search in.
+	 * @param position The position to start searching at.
+	 * @return The position of the first occurrence, or std::string_view::npos if there is none.
+	 */
+	std::size_t find(std::string_view haystack, std::size_t position = 0) const;
+
+	/**
+	 * Same as find(), for use interchangeably with the multi-pattern searcher.
+	 *
+	 * @param haystack The buffer to search in.
+	 * @param position The position to start searching at.
+	 * @param pattern_index Receives the index of the pattern found, always 0.
+	 * @return The position of the first occurrence, or std::string_view::npos if there is none.
+	 */
+	std::size_t find(std::string_view haystack, std::size_t position, std::size_t& pattern_index) const {
+		pattern_index = 0;
+		return find(haystack, position);
+	}
+
+	/**
+	 * @return The pattern that is searched for, in lower case when case is ignored.
+	 */
+	const std::string& pattern() const { return pattern_; }
+
+	/**
+	 * @return The name of the kernel picked for this CPU, for diagnostics. The same vectors are used when case is ignored.
+	 */
+	static const char* kernelName();
+
+	// Signature shared by all kernels, returns the address of the first match or nullptr.
+	using Kernel = const char* (*)(const char* begin, const char* end, const char* needle, std::size_t needle_size);
+
+private:
+	std::string pattern_;
+	Kernel kernel_;
+};
+
+
+/**
+ * Finds occurrences of a single byte with memchr, which the C library implements with the widest vectors
+ * the CPU has. Used for patterns of one byte, where the literal kernel has no second byte to filter on.
+ */
+class ByteSearcher {
+public:
+	/**
+	 * Prepares the search for a byte.
+	 *
+	 * @param byte The byte to search for.
+	 */
+	explicit ByteSearcher(char byte) : byte_(byte) {}
+
+	/**
+	 * Finds the first occurrence of the byte at or after a position.
+	 *
+	 * @param haystack The buffer to search in.
+	 * @param position The position to start searching at.
+	 * @param pattern_index Receives the index of the pattern found, always 0.
+	 * @return The position of the first occurrence, or std::string_view::npos if there is none.
+	 */
+	std::size_t find(std::string_view haystack, std::size_t position, std::size_t& pattern_index) const {
+		pattern_index = 0;
+		if (position >= haystack.size()) {
+			return std::string_view::npos;
+		}
+		const void* match = memchr(haystack.data() + position, byte_, haystack.size() - position);
+		return match == nullptr ? std::string_view::npos : static_cast<const char*>(match) - haystack.data();
+	}
+
+private:
+	char byte_;
+};
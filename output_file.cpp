@@ -0,0 +1,119 @@
+#include "output_file.h"
+#include "query_socket.h"
+
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+OutputFile::~OutputFile() {
+	close();
+}
+
+
+#if defined(__unix__) || defined(__APPLE__)
+bool OutputFile::open(const std::string& path) {
+	close();
+
+	// Anything buffered in std::cout has to go out before the results are written past it.
+	if (path == "-") {
+		std::cout.flush();
+		fd_ = STDOUT_FILENO;
+		is_stdout_ = true;
+		is_socket_ = false;
+		return true;
+	}
+
+	fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	is_stdout_ = false;
+	is_socket_ = false;
+	return fd_ >= 0;
+}
+
+
+bool OutputFile::openMessages(int socket) {
+	close();
+	fd_ = socket;
+	is_stdout_ = false;
+	is_socket_ = true;
+	return true;
+}
+
+
+bool OutputFile::write(std::string_view data) {
+	if (is_socket_) {
+		return sendMessage(fd_, RESULT_MESSAGE, data);
+	}
+	while (!data.empty()) {
+		const ssize_t written = ::write(fd_, data.data(), data.size());
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data.remove_prefix(written);
+	}
+	return true;
+}
+
+
+bool OutputFile::sync() {
+	// A terminal, pipe or socket has nothing to flush to disk
+	return is_stdout_ || is_socket_ || fsync(fd_) == 0;
+}
+
+
+bool OutputFile::close() {
+	if (fd_ < 0) {
+		return true;
+	}
+	const bool closed = is_stdout_ || is_socket_ || ::close(fd_) == 0;
+	fd_ = -1;
+	return closed;
+}
+#else
+bool OutputFile::open(const std::string& path) {
+	close();
+
+	if (path == "-") {
+		std::cout.flush();
+		file_ = stdout;
+		is_stdout_ = true;
+		return true;
+	}
+
+	file_ = std::fopen(path.c_str(), "wb");
+	is_stdout_ = false;
+	return file_ != nullptr;
+}
+
+
+bool OutputFile::openMessages(int socket) {
+	return false;
+}
+
+
+bool OutputFile::write(std::string_view data) {
+	return std::fwrite(data.data(), 1, data.size(), file_) == data.size();
+}
+
+
+bool OutputFile::sync() {
+	return std::fflush(file_) == 0;
+}
+
+
+bool OutputFile::close() {
+	if (file_ == nullptr) {
+		return true;
+	}
+	const bool closed = is_stdout_ ? std::fflush(file_) == 0 : std::fclose(file_) == 0;
+	file_ = nullptr;
+	return closed;
+}
+#endif
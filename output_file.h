@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdio>
+
+/**
+ * An output file written with a few large unbuffered writes.
+ *
+ * The callers format whole chunks of output in memory and hand them over in one piece, so every
+ * chunk costs a single write() call instead of a flush per line.
+ */
+class OutputFile {
+public:
+	OutputFile() = default;
+	OutputFile(const OutputFile&) = delete;
+	OutputFile& operator=(const OutputFile&) = delete;
+	~OutputFile();
+
+	/**
+	 * Creates or truncates a file for writing.
+	 *
+	 * @param path The path of the file, or "-" for stdout.
+	 * @return True on success, false if the file could not be opened.
+	 */
+	bool open(const std::string& path);
+
+	/**
+	 * Writes to a connection of the search server instead, every chunk as a result message.
+	 *
+	 * @param socket The connection to the client, which stays owned by the caller.
+	 * @return True on success, false if sockets are not supported.
+	 */
+	bool openMessages(int socket);
+
+	/**
+	 * Writes a chunk completely, retrying short writes.
+	 *
+	 * @param data The bytes to write.
+	 * @return True on success, false on a write error.
+	 */
+	bool write(std::string_view data);
+
+	/**
+	 * Flushes the written data to the storage device (fsync).
+	 *
+	 * @return True on success, false on error.
+	 */
+	bool sync();
+
+	/**
+	 * Closes the file. Stdout stays open.
+	 *
+	 * @return True on success, false on error.
+	 */
+	bool close();
+
+private:
+#if defined(__unix__) || defined(__APPLE__)
+	int fd_ = -1;
+#else
+	std::FILE* file_ = nullptr;
+#endif
+	bool is_stdout_ = false;
+	bool is_socket_ = false;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <vector>
+#include <iterator>
+#include <cstddef>
+
+#include "thread_pool.h"
+
+/**
+ * Sorts a range with several threads: the range is cut into one slice per thread, the slices are
+ * sorted in parallel, and neighbouring slices are then merged pairwise, also in parallel.
+ * Small ranges are sorted on the calling thread, which must not be a worker of the pool.
+ *
+ * @param first The beginning of the range.
+ * @param last The end of the range.
+ * @param comp The comparison function, as for std::sort.
+ * @param pool The threads to sort with, one slice each.
+ */
+template <typename RandomIt, typename Compare>
+void parallelSort(RandomIt first, RandomIt last, Compare comp, ThreadPool& pool) {
+	// Below this size the threads cost more than they save.
+	const std::ptrdiff_t min_slice_size = 4096;
+
+	const std::ptrdiff_t size = std::distance(first, last);
+	const std::ptrdiff_t slice_count = std::min<std::ptrdiff_t>(pool.size(), size / min_slice_size);
+	if (slice_count < 2) {
+		std::sort(first, last, comp);
+		return;
+	}
+
+	// Sort the slices in parallel.
+	std::vector<RandomIt> bounds;
+	for (std::ptrdiff_t i = 0; i <= slice_count; ++i) {
+		bounds.push_back(first + size * i / slice_count);
+	}
+	std::vector<std::future<void>> tasks;
+	for (std::ptrdiff_t i = 0; i < slice_count; ++i) {
+		tasks.push_back(pool.submit([&bounds, &comp, i] { std::sort(bounds[i], bounds[i + 1], comp); }));
+	}
+	for (auto& task : tasks) {
+		task.get();
+	}
+
+	// Merge neighbouring sorted runs until a single run is left.
+	while (bounds.size() > 2) {
+		std::vector<RandomIt> merged_bounds;
+		tasks.clear();
+		for (std::size_t i = 0; i + 2 < bounds.size(); i += 2) {
+			tasks.push_back(pool.submit([&bounds, &comp, i] { std::inplace_merge(bounds[i], bounds[i + 1], bounds[i + 2], comp); }));
+			merged_bounds.push_back(bounds[i]);
+		}
+		if (bounds.size() % 2 == 0) {
+			merged_bounds.push_back(bounds[bounds.size() - 2]);
+		}
+		merged_bounds.push_back(bounds.back());
+		for (auto& task : tasks) {
+			task.get();
+		}
+		bounds = std::move(merged_bounds);
+	}
+}
@@ -0,0 +1,427 @@
+#include "query_socket.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <charconv>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// The time a client may leave the server waiting for its query or for taking the results, in seconds.
+static const int CLIENT_TIMEOUT_SECONDS = 60;
+
+
+bool isTcpAddress(const std::string& socket_path) {
+	return socket_path.find(':') != std::string::npos && socket_path.find('/') == std::string::npos;
+}
+
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * Looks up the addresses of a TCP socket of the form <host>:<port>, where the host may be a name, an address,
+ * an IPv6 address in brackets, or left out to listen on all addresses.
+ *
+ * @param socket_path The address of the socket.
+ * @param passive Whether the addresses are to listen on rather than to connect to.
+ * @return The addresses, to be freed with freeaddrinfo(), or nullptr on error, which is reported on stderr.
+ */
+static addrinfo* tcpAddresses(const std::string& socket_path, bool passive) {
+	const std::size_t colon = socket_path.find_last_of(':');
+	std::string host = socket_path.substr(0, colon);
+	const std::string port = socket_path.substr(colon + 1);
+	if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+		host = host.substr(1, host.size() - 2);
+	}
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	addrinfo* addresses = nullptr;
+	const int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses);
+	if (error != 0) {
+		std::cerr << "Error: could not resolve " << socket_path << ": " << gai_strerror(error) << std::endl;
+		return nullptr;
+	}
+	return addresses;
+}
+
+
+/**
+ * Makes the small messages of a query and its summary go out at once instead of waiting for more data to
+ * fill a segment. A socket file has no such delay, the call fails on it and changes nothing.
+ *
+ * @param connection The connection.
+ */
+static void disableSendDelay(int connection) {
+	const int enabled = 1;
+	setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+}
+
+
+/**
+ * Fills in the address of a socket file.
+ *
+ * @param socket_path The path of the socket file.
+ * @param address Receives the address.
+ * @return True on success, false if the path is too long for a socket address.
+ */
+static bool socketAddress(const std::string& socket_path, sockaddr_un& address) {
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Error: the socket path " << socket_path << " is too long" << std::endl;
+		return false;
+	}
+	std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+	return true;
+}
+
+
+/**
+ * Reads exactly the given number of bytes, retrying short reads.
+ *
+ * @param socket The connection to read from.
+ * @param data The buffer to fill.
+ * @param size The number of bytes to read.
+ * @return True on success, false on error, timeout, or if the connection was closed first.
+ */
+static bool readFully(int socket, char* data, std::size_t size) {
+	while (size > 0) {
+		const ssize_t received = ::read(socket, data, size);
+		if (received < 0 && errno == EINTR) {
+			continue;
+		}
+		if (received <= 0) {
+			return false;
+		}
+		data += received;
+		size -= received;
+	}
+	return true;
+}
+
+
+/**
+ * Writes all bytes, retrying short writes.
+ *
+ * @param socket The connection to write to.
+ * @param data The bytes to write.
+ * @return True on success, false on error or timeout.
+ */
+static bool writeFully(int socket, std::string_view data) {
+	while (!data.empty()) {
+		const ssize_t written = ::write(socket, data.data(), data.size());
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data.remove_prefix(written);
+	}
+	return true;
+}
+
+
+int listenOnSocket(const std::string& socket_path) {
+	// A TCP socket takes the first address it can listen on, and may be taken over from a server that just stopped
+	if (isTcpAddress(socket_path)) {
+		addrinfo* const addresses = tcpAddresses(socket_path, true);
+		if (addresses == nullptr) {
+			return -1;
+		}
+		int listener = -1;
+		for (const addrinfo* address = addresses; address != nullptr && listener < 0; address = address->ai_next) {
+			listener = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (listener < 0) {
+				continue;
+			}
+			const int reuse = 1;
+			setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+			if (bind(listener, address->ai_addr, address->ai_addrlen) != 0 || listen(listener, SOMAXCONN) != 0) {
+				::close(listener);
+				listener = -1;
+			}
+		}
+		freeaddrinfo(addresses);
+		if (listener < 0) {
+			std::cerr << "Error: could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+		}
+		return listener;
+	}
+
+	sockaddr_un address;
+	if (!socketAddress(socket_path, address)) {
+		return -1;
+	}
+
+	// A socket file nobody accepts on is left over from a server that stopped, a live one is kept
+	const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe >= 0) {
+		const bool in_use = connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+		::close(probe);
+		if (in_use) {
+			std::cerr << "Error: a server is already listening on " << socket_path << std::endl;
+			return -1;
+		}
+		if (errno == ECONNREFUSED) {
+			::unlink(socket_path.c_str());
+		}
+	}
+
+	const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		std::cerr << "Error: could not create a socket: " << std::strerror(errno) << std::endl;
+		return -1;
+	}
+	if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+		std::cerr << "Error: could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+		::close(listener);
+		return -1;
+	}
+	return listener;
+}
+
+
+int acceptClient(int listener) {
+	const int connection = accept(listener, nullptr, nullptr);
+	if (connection < 0) {
+		return -1;
+	}
+	timeval timeout = {};
+	timeout.tv_sec = CLIENT_TIMEOUT_SECONDS;
+	setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	disableSendDelay(connection);
+	return connection;
+}
+
+
+int connectToSocket(const std::string& socket_path) {
+	if (isTcpAddress(socket_path)) {
+		addrinfo* const addresses = tcpAddresses(socket_path, false);
+		if (addresses == nullptr) {
+			return -1;
+		}
+		int connection = -1;
+		for (const addrinfo* address = addresses; address != nullptr && connection < 0; address = address->ai_next) {
+			connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (connection >= 0 && connect(connection, address->ai_addr, address->ai_addrlen) != 0) {
+				::close(connection);
+				connection = -1;
+			}
+		}
+		freeaddrinfo(addresses);
+		if (connection < 0) {
+			std::cerr << "Error: no server is listening on " << socket_path << ": " << std::strerror(errno) << std::endl;
+			return -1;
+		}
+		disableSendDelay(connection);
+		return connection;
+	}
+
+	sockaddr_un address;
+	if (!socketAddress(socket_path, address)) {
+		return -1;
+	}
+	const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connection < 0 || connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+		std::cerr << "Error: no server is listening on " << socket_path << ": " << std::strerror(errno) << std::endl;
+		if (connection >= 0) {
+			::close(connection);
+		}
+		return -1;
+	}
+	return connection;
+}
+
+
+void closeSocket(int socket) {
+	::close(socket);
+}
+
+
+bool sendMessage(int socket, char type, std::string_view payload) {
+	// An empty payload still makes a message, a long one is split up
+	do {
+		const std::string_view part = payload.substr(0, MAX_MESSAGE_SIZE);
+		payload.remove_prefix(part.size());
+
+		char header[5];
+		const std::uint32_t length = static_cast<std::uint32_t>(part.size());
+		header[0] = type;
+		std::memcpy(header + 1, &length, sizeof(length));
+		if (!writeFully(socket, std::string_view(header, sizeof(header))) || !writeFully(socket, part)) {
+			return false;
+		}
+	} while (!payload.empty());
+	return true;
+}
+
+
+bool receiveMessage(int socket, char& type, std::string& payload) {
+	char header[5];
+	if (!readFully(socket, header, sizeof(header))) {
+		return false;
+	}
+	std::uint32_t length;
+	std::memcpy(&length, header + 1, sizeof(length));
+	if (length > MAX_MESSAGE_SIZE) {
+		return false;
+	}
+	type = header[0];
+	payload.resize(length);
+	return readFully(socket, payload.data(), length);
+}
+#else
+int listenOnSocket(const std::string& socket_path) {
+	std::cerr << "Error: the search server is only supported on Unix" << std::endl;
+	return -1;
+}
+
+
+int acceptClient(int listener) {
+	return -1;
+}
+
+
+int connectToSocket(const std::string& socket_path) {
+	std::cerr << "Error: the search server is only supported on Unix" << std::endl;
+	return -1;
+}
+
+
+void closeSocket(int socket) {
+}
+
+
+bool sendMessage(int socket, char type, std::string_view payload) {
+	return false;
+}
+
+
+bool receiveMessage(int socket, char& type, std::string& payload) {
+	return false;
+}
+#endif
+
+
+bool sendQuery(int socket, const SearchOptions& options) {
+	std::string flags;
+	if (options.regex) {
+		flags += 'e';
+	}
+	if (options.ignore_case) {
+		flags += 'i';
+	}
+	if (options.count) {
+		flags += 'c';
+	}
+	if (options.list_files) {
+		flags += 'L';
+	}
+	if (options.stream) {
+		flags += options.ordered ? 'o' : 's';
+	}
+	if (options.binary_files != BinaryFiles::Match) {
+		flags += options.binary_files == BinaryFiles::Skip ? 'I' : 'a';
+	}
+	if (options.format != ResultFormat::Text) {
+		flags += options.format == ResultFormat::Json ? 'j' : 'b';
+	}
+
+	if (!sendMessage(socket, DIRECTORY_MESSAGE, options.directory_path) || !sendMessage(socket, FLAGS_MESSAGE, flags)) {
+		return false;
+	}
+	if ((options.max_count != 0 || options.max_results != 0)
+		&& !sendMessage(socket, LIMITS_MESSAGE, std::to_string(options.max_count) + ' ' + std::to_string(options.max_results))) {
+		return false;
+	}
+	if (options.context.any()
+		&& !sendMessage(socket, CONTEXT_MESSAGE, std::to_string(options.context.before) + ' ' + std::to_string(options.context.after))) {
+		return false;
+	}
+	for (const auto& search_string : options.search_strings) {
+		if (!sendMessage(socket, PATTERN_MESSAGE, search_string)) {
+			return false;
+		}
+	}
+	return sendMessage(socket, QUERY_END_MESSAGE, {});
+}
+
+
+/**
+ * Parses the payload of a message that holds two decimal numbers separated by a space.
+ *
+ * @param payload The payload.
+ * @param first Receives the first number.
+ * @param second Receives the second number.
+ * @return True if the payload holds exactly two numbers.
+ */
+static bool parseNumberPair(const std::string& payload, std::uint64_t& first, std::uint64_t& second) {
+	const char* const end = payload.data() + payload.size();
+	const auto [first_end, first_error] = std::from_chars(payload.data(), end, first);
+	if (first_error != std::errc() || first_end == end || *first_end != ' ') {
+		return false;
+	}
+	const auto [second_end, second_error] = std::from_chars(first_end + 1, end, second);
+	return second_error == std::errc() && second_end == end;
+}
+
+
+bool receiveQuery(int socket, SearchOptions& options) {
+	options.search_strings.clear();
+	options.max_count = 0;
+	options.max_results = 0;
+	options.context = LineContext();
+	char type;
+	std::string payload;
+	while (receiveMessage(socket, type, payload)) {
+		switch (type) {
+		case DIRECTORY_MESSAGE:
+			options.directory_path = payload;
+			break;
+		case FLAGS_MESSAGE:
+			options.regex = payload.find('e') != std::string::npos;
+			options.ignore_case = payload.find('i') != std::string::npos;
+			options.count = payload.find('c') != std::string::npos;
+			options.list_files = payload.find('L') != std::string::npos;
+			options.ordered = payload.find('o') != std::string::npos;
+			options.stream = options.ordered || payload.find('s') != std::string::npos;
+			options.binary_files = payload.find('I') != std::string::npos ? BinaryFiles::Skip
+				: payload.find('a') != std::string::npos ? BinaryFiles::Text : BinaryFiles::Match;
+			options.format = payload.find('j') != std::string::npos ? ResultFormat::Json
+				: payload.find('b') != std::string::npos ? ResultFormat::Binary : ResultFormat::Text;
+			break;
+		case LIMITS_MESSAGE:
+			if (!parseNumberPair(payload, options.max_count, options.max_results)) {
+				return false;
+			}
+			break;
+		case CONTEXT_MESSAGE:
+			if (!parseNumberPair(payload, options.context.before, options.context.after)) {
+				return false;
+			}
+			break;
+		case PATTERN_MESSAGE:
+			options.search_strings.push_back(payload);
+			break;
+		case QUERY_END_MESSAGE:
+			return !options.search_strings.empty();
+		default:
+			return false;
+		}
+	}
+	return false;
+}
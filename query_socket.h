@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+#include "search_options.h"
+
+/**
+ * The protocol between a search server and its clients, over a Unix domain socket, or over TCP for a
+ * server on another host.
+ *
+ * Both sides exchange messages of a type byte, a 4-byte payload length in the byte order of the host,
+ * and the payload. A client sends the directory to search, the flags of the search, every pattern in a
+ * message of its own, and an end marker. The server answers with the results in as many result messages
+ * as it writes chunks, followed by a summary, or with an error message if it can not run the search.
+ * Every connection carries a single query.
+ */
+
+// The directory to search, an absolute path below the directory of the server.
+static const char DIRECTORY_MESSAGE = 'D';
+// The flags of the search: 'e' for regular expressions, 'i' to ignore case, 'c' to count, 'L' to list files, 's' and 'o' to stream,
+// 'I' to leave out binary files and 'a' to search them as text, 'j' for NDJSON results and 'b' for binary ones.
+static const char FLAGS_MESSAGE = 'F';
+// The limits on the matches, the lines of every file and the results of the search, as two decimal numbers. Only sent with a limit.
+static const char LIMITS_MESSAGE = 'M';
+// The lines shown before and after every matching line, as two decimal numbers. Only sent with context lines.
+static const char CONTEXT_MESSAGE = 'C';
+// A pattern to search for.
+static const char PATTERN_MESSAGE = 'P';
+// The end of a query.
+static const char QUERY_END_MESSAGE = 'Q';
+// A chunk of the results, written out as it is.
+static const char RESULT_MESSAGE = 'R';
+// The summary that ends a successful search: the searched files, the files and lines with a match, and the thread count.
+static const char SUMMARY_MESSAGE = 'S';
+// The reason the search could not run, which ends the answer.
+static const char ERROR_MESSAGE = 'E';
+
+// The largest payload of a message, longer results are split over several messages.
+static const std::size_t MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+
+/**
+ * @param socket_path The socket of a server.
+ * @return Whether the socket is a TCP address of the form <host>:<port>, rather than the path of a socket file.
+ */
+bool isTcpAddress(const std::string& socket_path);
+
+/**
+ * Creates a socket and listens on it for clients. A socket file left behind by a server that is no
+ * longer running is replaced.
+ *
+ * @param socket_path The path of the socket file, or a TCP address of the form <host>:<port>, with an empty host for all addresses.
+ * @return The listening socket, or -1 on error, which is reported on stderr.
+ */
+int listenOnSocket(const std::string& socket_path);
+
+/**
+ * Waits for the next client. The connection gives up on a client that sends nothing or takes no data
+ * for a while, so a stuck client can not block the server.
+ *
+ * @param listener The listening socket.
+ * @return The connection to the client, or -1 if a signal or an error came first.
+ */
+int acceptClient(int listener);
+
+/**
+ * Connects to a server.
+ *
+ * @param socket_path The path of the socket file of the server, or its TCP address of the form <host>:<port>.
+ * @return The connection, or -1 on error, which is reported on stderr.
+ */
+int connectToSocket(const std::string& socket_path);
+
+/**
+ * Closes a socket.
+ *
+ * @param socket The socket to close.
+ */
+void closeSocket(int socket);
+
+/**
+ * Sends a message, split into several of the same type if the payload is longer than MAX_MESSAGE_SIZE.
+ *
+ * @param socket The connection to send on.
+ * @param type The type of the message.
+ * @param payload The payload.
+ * @return True on success, false if the connection failed.
+ */
+bool sendMessage(int socket, char type, std::string_view payload);
+
+/**
+ * Receives the next message.
+ *
+ * @param socket The connection to receive from.
+ * @param type Receives the type of the message.
+ * @param payload Receives the payload.
+ * @return True on success, false if the connection failed or was closed, or the message is malformed.
+ */
+bool receiveMessage(int socket, char& type, std::string& payload);
+
+/**
+ * Sends the search of a client to the server.
+ *
+ * @param socket The connection to the server.
+ * @param options The search settings: the directory, the patterns, and the flags of the output.
+ * @return True on success, false if the connection failed.
+ */
+bool sendQuery(int socket, const SearchOptions& options);
+
+/**
+ * Receives the search of a client, filling in what the client decides and keeping the settings of the server.
+ *
+ * @param socket The connection to the client.
+ * @param options Receives the directory, the patterns, and the flags of the output.
+ * @return True on success, false if the connection failed or the query is malformed.
+ */
+bool receiveQuery(int socket, SearchOptions& options);
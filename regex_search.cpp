@@ -0,0 +1,1228 @@
+#include "regex_search.h"
+
+#include "literal_search.h"
+#include "aho_corasick.h"
+#include "case_fold.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <cctype>
+
+// The most strings a set of required strings may hold, larger sets tell too little to be worth searching for.
+static const std::size_t MAX_LITERALS = 64;
+
+// Classes of up to this many bytes still count as a set of literals, like [Ee] or [0-3].
+static const std::size_t MAX_CLASS_LITERALS = 8;
+
+// The largest count of a bounded repetition, and of groups nested in each other.
+static const int MAX_REPEAT = 1000;
+static const int MAX_NESTING = 1000;
+
+// The most instructions the expressions may compile to.
+static const std::size_t MAX_INSTRUCTIONS = 1 << 20;
+
+// Memory a searcher may use for its DFA states before it drops all of them and starts over.
+static const std::size_t DFA_CACHE_SIZE = 8 * 1024 * 1024;
+
+// Memory a DFA state takes apart from its transitions and instructions, in its containers and the lookup.
+static const std::size_t DFA_STATE_OVERHEAD = 128;
+
+
+/**
+ * A node of the parsed expression.
+ */
+struct RegexNode {
+	enum class Type { Empty, Bytes, Concat, Alternate, Repeat, LineStart, LineEnd };
+
+	Type type = Type::Empty;
+
+	// The bytes a Bytes node matches.
+	std::bitset<256> bytes;
+
+	// The parts of a Concat or an Alternate node, or the single repeated node.
+	std::vector<RegexNode> children;
+
+	// The bounds of a Repeat node, a maximum of -1 is unbounded.
+	int min = 0;
+	int max = 0;
+};
+
+
+/**
+ * An instruction of the NFA. Bytes consumes a byte of its set, all others are taken without consuming one.
+ */
+struct RegexInstruction {
+	enum class Op : std::uint8_t { Bytes, Split, Jump, LineStart, LineEnd, Match };
+
+	Op op;
+
+	// The byte set of Bytes, or the expression index of Match.
+	std::uint32_t arg;
+
+	// The instruction taken next, and the second one of a Split.
+	std::uint32_t next;
+	std::uint32_t alt;
+};
+
+
+struct RegexSearcher::Program {
+	std::vector<RegexInstruction> instructions;
+	std::vector<std::bitset<256>> byte_sets;
+	std::vector<std::uint32_t> starts;
+
+	// Bytes that no instruction tells apart share a class, which keeps the transition rows short.
+	std::uint8_t byte_classes[256] = {};
+	std::vector<std::uint8_t> class_bytes;
+
+	// The strings every match contains, and the kernel that searches for them.
+	std::vector<std::string> required_strings;
+	std::unique_ptr<LiteralSearcher> literal_searcher;
+	std::unique_ptr<AhoCorasickSearcher> multi_searcher;
+};
+
+
+/**
+ * Parses an expression into a tree of nodes by recursive descent.
+ */
+class RegexParser {
+public:
+	/**
+	 * @param pattern The expression.
+	 * @param ignore_case Whether letters match in either case: ASCII letters everywhere, other letters outside of classes.
+	 */
+	RegexParser(std::string_view pattern, bool ignore_case) : pattern_(pattern), ignore_case_(ignore_case) {}
+
+	/**
+	 * @param root Receives the parsed expression.
+	 * @param error Receives the reason if the expression is invalid.
+	 * @return True on success, false if the expression is invalid.
+	 */
+	bool parse(RegexNode& root, std::string& error) {
+		if (!parseAlternation(root)) {
+			error = error_;
+			return false;
+		}
+		if (position_ < pattern_.size()) {
+			error = "unmatched ) at position " + std::to_string(position_);
+			return false;
+		}
+		return true;
+	}
+
+private:
+	bool fail(const std::string& message) {
+		error_ = message + " at position " + std::to_string(position_);
+		return false;
+	}
+
+	bool atEnd() const {
+		return position_ >= pattern_.size();
+	}
+
+	char peek() const {
+		return pattern_[position_];
+	}
+
+	/**
+	 * Adds the other case of every ASCII letter of a set when case is ignored.
+	 */
+	void foldBytes(std::bitset<256>& bytes) const {
+		if (!ignore_case_) {
+			return;
+		}
+		for (unsigned int lower = 'a'; lower <= 'z'; ++lower) {
+			const unsigned int upper = lower - ('a' - 'A');
+			if (bytes.test(lower) || bytes.test(upper)) {
+				bytes.set(lower);
+				bytes.set(upper);
+			}
+		}
+	}
+
+	/**
+	 * Parses a character outside of ASCII that has other cases into the alternation of its cases, when case is
+	 * ignored. The scan never transforms the input, every case is a sequence of bytes of its own in the DFA.
+	 *
+	 * @param node Receives the alternation.
+	 * @return True if the pattern continues with such a character, false to parse it byte by byte.
+	 */
+	bool parseUnicodeCases(RegexNode& node) {
+		std::uint32_t code_point;
+		std::uint32_t others[2];
+		const std::size_t length = decodeUtf8(pattern_.substr(position_), code_point);
+		const std::size_t other_count = length > 1 ? otherCases(code_point, others) : 0;
+		if (!ignore_case_ || other_count == 0) {
+			return false;
+		}
+		position_ += length;
+
+		node.type = RegexNode::Type::Alternate;
+		for (std::size_t i = 0; i <= other_count; ++i) {
+			std::string sequence;
+			appendUtf8(sequence, i == 0 ? code_point : others[i - 1]);
+			RegexNode& variant = node.children.emplace_back();
+			variant.type = RegexNode::Type::Concat;
+			for (const unsigned char byte : sequence) {
+				RegexNode& byte_node = variant.children.emplace_back();
+				byte_node.type = RegexNode::Type::Bytes;
+				byte_node.bytes.set(byte);
+			}
+		}
+		return true;
+	}
+
+	bool parseAlternation(RegexNode& node) {
+		RegexNode branch;
+		if (!parseConcatenation(branch)) {
+			return false;
+		}
+		if (atEnd() || peek() != '|') {
+			node = std::move(branch);
+			return true;
+		}
+
+		node.type = RegexNode::Type::Alternate;
+		node.children.push_back(std::move(branch));
+		while (!atEnd() && peek() == '|') {
+			++position_;
+			RegexNode next_branch;
+			if (!parseConcatenation(next_branch)) {
+				return false;
+			}
+			node.children.push_back(std::move(next_branch));
+		}
+		return true;
+	}
+
+	bool parseConcatenation(RegexNode& node) {
+		node.type = RegexNode::Type::Concat;
+		while (!atEnd() && peek() != '|' && peek() != ')') {
+			RegexNode atom;
+			if (!parseAtom(atom)) {
+				return false;
+			}
+
+			// Any number of repetitions may follow, each one optionally lazy, which makes no difference for whole lines
+			while (!atEnd()) {
+				int min, max;
+				const char quantifier = peek();
+				if (quantifier == '*' || quantifier == '+' || quantifier == '?') {
+					++position_;
+					min = quantifier == '+' ? 1 : 0;
+					max = quantifier == '?' ? 1 : -1;
+				}
+				else if (quantifier == '{') {
+					// A brace that does not start valid bounds is a literal brace
+					bool is_bounds;
+					if (!parseBounds(min, max, is_bounds)) {
+						return false;
+					}
+					if (!is_bounds) {
+						break;
+					}
+				}
+				else {
+					break;
+				}
+				if (!atEnd() && peek() == '?') {
+					++position_;
+				}
+
+				RegexNode repeat;
+				repeat.type = RegexNode::Type::Repeat;
+				repeat.min = min;
+				repeat.max = max;
+				repeat.children.push_back(std::move(atom));
+				atom = std::move(repeat);
+			}
+			node.children.push_back(std::move(atom));
+		}
+		return true;
+	}
+
+	bool parseBounds(int& min, int& max, bool& is_bounds) {
+		const std::size_t start = position_;
+		is_bounds = false;
+
+		// Reads a decimal number, capped so it can not overflow.
+		auto parseNumber = [this](int& value) {
+			if (atEnd() || peek() < '0' || peek() > '9') {
+				return false;
+			}
+			value = 0;
+			while (!atEnd() && peek() >= '0' && peek() <= '9') {
+				value = std::min(value * 10 + (peek() - '0'), MAX_REPEAT + 1);
+				++position_;
+			}
+			return true;
+		};
+
+		++position_;
+		if (!parseNumber(min)) {
+			position_ = start;
+			return true;
+		}
+		max = min;
+		if (!atEnd() && peek() == ',') {
+			++position_;
+			if (!parseNumber(max)) {
+				max = -1;
+			}
+		}
+		if (atEnd() || peek() != '}') {
+			position_ = start;
+			return true;
+		}
+		++position_;
+
+		is_bounds = true;
+		if (min > MAX_REPEAT || max > MAX_REPEAT) {
+			return fail("repetition count too large");
+		}
+		if (max != -1 && max < min) {
+			return fail("repetition bounds out of order");
+		}
+		return true;
+	}
+
+	bool parseAtom(RegexNode& node) {
+		if (parseUnicodeCases(node)) {
+			return true;
+		}
+		const char c = pattern_[position_++];
+		switch (c) {
+		case '(':
+			if (!atEnd() && peek() == '?') {
+				if (position_ + 1 >= pattern_.size() || pattern_[position_ + 1] != ':') {
+					return fail("lookarounds and named groups are not supported");
+				}
+				position_ += 2;
+			}
+			if (++depth_ > MAX_NESTING) {
+				return fail("groups nested too deeply");
+			}
+			if (!parseAlternation(node)) {
+				return false;
+			}
+			--depth_;
+			if (atEnd() || peek() != ')') {
+				return fail("missing )");
+			}
+			++position_;
+			return true;
+		case '[':
+			return parseClass(node);
+		case '.':
+			node.type = RegexNode::Type::Bytes;
+			node.bytes.set();
+			node.bytes.reset('\n');
+			return true;
+		case '^':
+			node.type = RegexNode::Type::LineStart;
+			return true;
+		case '$':
+			node.type = RegexNode::Type::LineEnd;
+			return true;
+		case '\\':
+			node.type = RegexNode::Type::Bytes;
+			if (!parseEscape(node.bytes, false)) {
+				return false;
+			}
+			foldBytes(node.bytes);
+			return true;
+		case '*':
+		case '+':
+		case '?':
+			--position_;
+			return fail("nothing to repeat");
+		default:
+			node.type = RegexNode::Type::Bytes;
+			node.bytes.set(static_cast<unsigned char>(c));
+			foldBytes(node.bytes);
+			return true;
+		}
+	}
+
+	bool parseEscape(std::bitset<256>& bytes, bool in_class) {
+		if (atEnd()) {
+			return fail("trailing backslash");
+		}
+
+		// Adds a range of bytes to the set.
+		auto addRange = [&bytes](unsigned char first, unsigned char last) {
+			for (unsigned int byte = first; byte <= last; ++byte) {
+				bytes.set(byte);
+			}
+		};
+
+		const char c = pattern_[position_++];
+		switch (c) {
+		case 'd':
+		case 'D':
+			addRange('0', '9');
+			break;
+		case 'w':
+		case 'W':
+			addRange('a', 'z');
+			addRange('A', 'Z');
+			addRange('0', '9');
+			bytes.set('_');
+			break;
+		case 's':
+		case 'S':
+			for (const char space : { ' ', '\t', '\n', '\r', '\f', '\v' }) {
+				bytes.set(static_cast<unsigned char>(space));
+			}
+			break;
+		case 'n':
+			bytes.set('\n');
+			return true;
+		case 't':
+			bytes.set('\t');
+			return true;
+		case 'r':
+			bytes.set('\r');
+			return true;
+		case 'f':
+			bytes.set('\f');
+			return true;
+		case 'v':
+			bytes.set('\v');
+			return true;
+		case '0':
+			bytes.set(0);
+			return true;
+		case 'x': {
+			// Exactly two hex digits follow
+			unsigned int value = 0;
+			for (int i = 0; i < 2; ++i) {
+				const char digit = atEnd() ? '\0' : pattern_[position_++];
+				if (digit >= '0' && digit <= '9') value = value * 16 + (digit - '0');
+				else if (digit >= 'a' && digit <= 'f') value = value * 16 + (digit - 'a' + 10);
+				else if (digit >= 'A' && digit <= 'F') value = value * 16 + (digit - 'A' + 10);
+				else return fail("invalid hex escape");
+			}
+			bytes.set(value);
+			return true;
+		}
+		case 'b':
+			// Inside a class, \b is the backspace
+			if (in_class) {
+				bytes.set('\b');
+				return true;
+			}
+			return fail("word boundaries are not supported");
+		case 'B':
+			return fail("word boundaries are not supported");
+		default:
+			if (c >= '1' && c <= '9') {
+				return fail("backreferences are not supported");
+			}
+			bytes.set(static_cast<unsigned char>(c));
+			return true;
+		}
+
+		// The upper case class escapes match everything else, except the newline that ends every line
+		if (c == 'D' || c == 'W' || c == 'S') {
+			bytes.flip();
+			bytes.reset('\n');
+		}
+		return true;
+	}
+
+	bool parseNamedClass(std::string_view name, std::bitset<256>& member) {
+		// The classes of the C locale, like [[:digit:]]
+		static const struct {
+			const char* name;
+			int (*test)(int);
+		} named_classes[] = {
+			{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+			{ "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+			{ "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+		};
+		for (const auto& named_class : named_classes) {
+			if (name == named_class.name) {
+				for (int byte = 0; byte < 128; ++byte) {
+					if (named_class.test(byte)) {
+						member.set(byte);
+					}
+				}
+				return true;
+			}
+		}
+		if (name == "word") {
+			for (int byte = 0; byte < 128; ++byte) {
+				if (isalnum(byte) || byte == '_') {
+					member.set(byte);
+				}
+			}
+			return true;
+		}
+		return fail("unknown class name");
+	}
+
+	bool parseClass(RegexNode& node) {
+		node.type = RegexNode::Type::Bytes;
+		const bool negated = !atEnd() && peek() == '^';
+		if (negated) {
+			++position_;
+		}
+
+		// Reads a single member, which is a set of bytes for the class escapes and the named classes
+		auto parseMember = [this](std::bitset<256>& member) {
+			member.reset();
+			const char c = pattern_[position_++];
+			if (c == '\\') {
+				return parseEscape(member, true);
+			}
+			if (c == '[' && !atEnd() && peek() == ':') {
+				const std::size_t name_end = pattern_.find(":]", position_ + 1);
+				if (name_end == std::string_view::npos) {
+					return fail("missing :]");
+				}
+				const std::string_view name = pattern_.substr(position_ + 1, name_end - position_ - 1);
+				position_ = name_end + 2;
+				return parseNamedClass(name, member);
+			}
+			member.set(static_cast<unsigned char>(c));
+			return true;
+		};
+		auto singleByte = [](const std::bitset<256>& member) {
+			for (unsigned int byte = 0; byte < 256; ++byte) {
+				if (member.test(byte)) {
+					return byte;
+				}
+			}
+			return 0u;
+		};
+
+		// A closing bracket right at the start is a member
+		bool first = true;
+		while (true) {
+			if (atEnd()) {
+				return fail("missing ]");
+			}
+			if (peek() == ']' && !first) {
+				++position_;
+				break;
+			}
+			first = false;
+
+			std::bitset<256> member;
+			if (!parseMember(member)) {
+				return false;
+			}
+
+			// A dash between two single bytes makes a range, elsewhere it is a member itself
+			if (member.count() == 1 && position_ + 1 < pattern_.size() && peek() == '-' && pattern_[position_ + 1] != ']') {
+				++position_;
+				std::bitset<256> last_member;
+				if (!parseMember(last_member)) {
+					return false;
+				}
+				const unsigned int first_byte = singleByte(member);
+				const unsigned int last_byte = singleByte(last_member);
+				if (last_member.count() != 1 || last_byte < first_byte) {
+					return fail("invalid range in class");
+				}
+				for (unsigned int byte = first_byte; byte <= last_byte; ++byte) {
+					node.bytes.set(byte);
+				}
+				continue;
+			}
+			node.bytes |= member;
+		}
+
+		// The cases are added before the negation, so a negated letter leaves out both of them
+		foldBytes(node.bytes);
+		if (negated) {
+			node.bytes.flip();
+			node.bytes.reset('\n');
+		}
+		return true;
+	}
+
+	std::string_view pattern_;
+	bool ignore_case_;
+	std::size_t position_ = 0;
+	int depth_ = 0;
+	std::string error_;
+};
+
+
+/**
+ * What is known about the strings a node matches: either all of them, when they are few, or a set of
+ * strings of which every match contains one. The set holds the empty string if nothing is known.
+ */
+struct LiteralInfo {
+	bool exact = false;
+	std::vector<std::string> strings = { "" };
+};
+
+
+/**
+ * @return True if the first set of required strings is the better one to search for: its shortest
+ *         string is longer, or the strings are as long and there are fewer of them.
+ */
+static bool betterLiterals(const std::vector<std::string>& lhs, const std::vector<std::string>& rhs) {
+	auto shortest = [](const std::vector<std::string>& strings) {
+		std::size_t length = std::string::npos;
+		for (const auto& string : strings) {
+			length = std::min(length, string.size());
+		}
+		return length;
+	};
+	const std::size_t lhs_length = lhs.empty() ? 0 : shortest(lhs);
+	const std::size_t rhs_length = rhs.empty() ? 0 : shortest(rhs);
+	if (lhs_length != rhs_length) {
+		return lhs_length > rhs_length;
+	}
+	return lhs.size() < rhs.size();
+}
+
+
+static void keepBetterLiterals(std::vector<std::string>& best, const std::vector<std::string>& candidate) {
+	if (betterLiterals(candidate, best)) {
+		best = candidate;
+	}
+}
+
+
+/**
+ * Works out the strings a node matches, or the ones every match of the node contains. Ignoring case, the
+ * strings are given with their ASCII letters in lower case, to be searched for ignoring case as well.
+ */
+static LiteralInfo extractLiterals(const RegexNode& node, bool ignore_case) {
+	LiteralInfo info;
+	switch (node.type) {
+	case RegexNode::Type::Empty:
+	case RegexNode::Type::LineStart:
+	case RegexNode::Type::LineEnd:
+		info.exact = true;
+		break;
+
+	case RegexNode::Type::Bytes: {
+		// Ignoring case, both cases of a letter are found by its lower case one
+		std::bitset<256> bytes = node.bytes;
+		if (ignore_case) {
+			for (unsigned int upper = 'A'; upper <= 'Z'; ++upper) {
+				if (bytes.test(upper + ('a' - 'A'))) {
+					bytes.reset(upper);
+				}
+			}
+		}
+		if (bytes.count() <= MAX_CLASS_LITERALS && bytes.any()) {
+			info.exact = true;
+			info.strings.clear();
+			for (unsigned int byte = 0; byte < 256; ++byte) {
+				if (bytes.test(byte)) {
+					info.strings.push_back(std::string(1, static_cast<char>(byte)));
+				}
+			}
+		}
+		break;
+	}
+
+	case RegexNode::Type::Concat: {
+		// Extend a run of exact parts by each exact child, every other child ends the run. The best of the runs
+		// and of the required strings of the other children is required.
+		bool exact = true;
+		std::vector<std::string> run = { "" };
+		std::vector<std::string> best = { "" };
+		for (const auto& child : node.children) {
+			// A repetition of at least once starts with one exact copy, which still extends the run before ending it
+			LiteralInfo child_info = extractLiterals(child, ignore_case);
+			bool ends_run = false;
+			if (child.type == RegexNode::Type::Repeat && child.min >= 1 && !child_info.exact) {
+				const LiteralInfo repeated_info = extractLiterals(child.children.front(), ignore_case);
+				if (repeated_info.exact) {
+					child_info = repeated_info;
+					ends_run = true;
+				}
+			}
+			if (child_info.exact && run.size() * child_info.strings.size() <= MAX_LITERALS) {
+				std::vector<std::string> product;
+				for (const auto& prefix : run) {
+					for (const auto& suffix : child_info.strings) {
+						product.push_back(prefix + suffix);
+					}
+				}
+				run = std::move(product);
+				if (ends_run) {
+					exact = false;
+					keepBetterLiterals(best, run);
+					run = { "" };
+				}
+				continue;
+			}
+
+			exact = false;
+			keepBetterLiterals(best, run);
+			if (child_info.exact) {
+				run = child_info.strings;
+			}
+			else {
+				keepBetterLiterals(best, child_info.strings);
+				run = { "" };
+			}
+		}
+		if (exact) {
+			info.exact = true;
+			info.strings = std::move(run);
+		}
+		else {
+			keepBetterLiterals(best, run);
+			info.strings = std::move(best);
+		}
+		break;
+	}
+
+	case RegexNode::Type::Alternate: {
+		// Every match matches one of the branches, so the strings of all branches together are required
+		bool exact = true;
+		std::vector<std::string> strings;
+		for (const auto& child : node.children) {
+			const LiteralInfo child_info = extractLiterals(child, ignore_case);
+			exact = exact && child_info.exact;
+			strings.insert(strings.end(), child_info.strings.begin(), child_info.strings.end());
+		}
+		std::sort(strings.begin(), strings.end());
+		strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+		if (strings.size() > MAX_LITERALS || (!exact && strings.front().empty())) {
+			break;
+		}
+		info.exact = exact;
+		info.strings = std::move(strings);
+		break;
+	}
+
+	case RegexNode::Type::Repeat:
+		// A node repeated at least once is contained in every match, and a fixed number of repetitions of
+		// a few exact strings stays exact
+		if (node.min >= 1) {
+			info = extractLiterals(node.children.front(), ignore_case);
+			if (!info.exact || node.min != node.max) {
+				info.exact = false;
+				break;
+			}
+			std::vector<std::string> product = info.strings;
+			for (int i = 1; i < node.min && info.exact; ++i) {
+				if (product.size() * info.strings.size() > MAX_LITERALS) {
+					info.exact = false;
+					break;
+				}
+				std::vector<std::string> longer;
+				for (const auto& prefix : product) {
+					for (const auto& suffix : info.strings) {
+						longer.push_back(prefix + suffix);
+					}
+				}
+				product = std::move(longer);
+			}
+			if (info.exact) {
+				info.strings = std::move(product);
+			}
+		}
+		break;
+	}
+	return info;
+}
+
+
+/**
+ * Compiles the nodes of an expression into NFA instructions.
+ */
+class RegexCompiler {
+public:
+	explicit RegexCompiler(RegexSearcher::Program& program) : program_(program) {}
+
+	/**
+	 * @return True on success, false if the expressions compile to too many instructions.
+	 */
+	bool compile(const RegexNode& node) {
+		switch (node.type) {
+		case RegexNode::Type::Empty:
+			return true;
+
+		case RegexNode::Type::Bytes: {
+			// Instructions with the same bytes share their set
+			const auto found = set_numbers_.find(node.bytes);
+			std::uint32_t set_number;
+			if (found != set_numbers_.end()) {
+				set_number = found->second;
+			}
+			else {
+				set_number = static_cast<std::uint32_t>(program_.byte_sets.size());
+				program_.byte_sets.push_back(node.bytes);
+				set_numbers_.emplace(node.bytes, set_number);
+			}
+			return add(RegexInstruction::Op::Bytes, set_number) != INVALID;
+		}
+
+		case RegexNode::Type::LineStart:
+			return add(RegexInstruction::Op::LineStart, 0) != INVALID;
+
+		case RegexNode::Type::LineEnd:
+			return add(RegexInstruction::Op::LineEnd, 0) != INVALID;
+
+		case RegexNode::Type::Concat:
+			for (const auto& child : node.children) {
+				if (!compile(child)) {
+					return false;
+				}
+			}
+			return true;
+
+		case RegexNode::Type::Alternate: {
+			// Split to every branch but the last, each branch jumps to the end
+			std::vector<std::uint32_t> jumps;
+			for (std::size_t i = 0; i < node.children.size(); ++i) {
+				std::uint32_t split = INVALID;
+				if (i + 1 < node.children.size() && (split = add(RegexInstruction::Op::Split, 0)) == INVALID) {
+					return false;
+				}
+				if (!compile(node.children[i])) {
+					return false;
+				}
+				if (i + 1 < node.children.size()) {
+					const std::uint32_t jump = add(RegexInstruction::Op::Jump, 0);
+					if (jump == INVALID) {
+						return false;
+					}
+					jumps.push_back(jump);
+					program_.instructions[split].alt = position();
+				}
+			}
+			for (const std::uint32_t jump : jumps) {
+				program_.instructions[jump].next = position();
+			}
+			return true;
+		}
+
+		case RegexNode::Type::Repeat: {
+			// The required repetitions one after another, then either a loop or the optional ones, which all skip to the end
+			const RegexNode& child = node.children.front();
+			for (int i = 0; i < node.min; ++i) {
+				if (!compile(child)) {
+					return false;
+				}
+			}
+			if (node.max == -1) {
+				const std::uint32_t split = add(RegexInstruction::Op::Split, 0);
+				if (split == INVALID || !compile(child)) {
+					return false;
+				}
+				const std::uint32_t jump = add(RegexInstruction::Op::Jump, 0);
+				if (jump == INVALID) {
+					return false;
+				}
+				program_.instructions[jump].next = split;
+				program_.instructions[split].alt = position();
+				return true;
+			}
+
+			std::vector<std::uint32_t> splits;
+			for (int i = node.min; i < node.max; ++i) {
+				const std::uint32_t split = add(RegexInstruction::Op::Split, 0);
+				if (split == INVALID || !compile(child)) {
+					return false;
+				}
+				splits.push_back(split);
+			}
+			for (const std::uint32_t split : splits) {
+				program_.instructions[split].alt = position();
+			}
+			return true;
+		}
+		}
+		return false;
+	}
+
+	/**
+	 * Adds an instruction that continues with the one after it.
+	 *
+	 * @return The number of the instruction, or INVALID if there are too many.
+	 */
+	std::uint32_t add(RegexInstruction::Op op, std::uint32_t arg) {
+		if (program_.instructions.size() >= MAX_INSTRUCTIONS) {
+			return INVALID;
+		}
+		const std::uint32_t number = position();
+		program_.instructions.push_back({ op, arg, number + 1, number + 1 });
+		return number;
+	}
+
+	std::uint32_t position() const {
+		return static_cast<std::uint32_t>(program_.instructions.size());
+	}
+
+	static const std::uint32_t INVALID = 0xFFFFFFFFu;
+
+private:
+	RegexSearcher::Program& program_;
+	std::unordered_map<std::bitset<256>, std::uint32_t> set_numbers_;
+};
+
+
+std::string escapeRegex(std::string_view literal) {
+	std::string escaped;
+	for (const char c : literal) {
+		if (std::strchr("\\^$.|?*+()[]{}", c) != nullptr && c != '\0') {
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+
+bool RegexSearcher::compile(const std::vector<std::string>& patterns, std::string& error, bool ignore_case) {
+	auto program = std::make_shared<Program>();
+	RegexCompiler compiler(*program);
+
+	// Parse every expression, collect the strings it requires, and append its instructions
+	bool any_string = false;
+	std::vector<std::string> required_strings;
+	for (std::size_t i = 0; i < patterns.size(); ++i) {
+		RegexNode root;
+		RegexParser parser(patterns[i], ignore_case);
+		if (!parser.parse(root, error)) {
+			error = "\"" + patterns[i] + "\": " + error;
+			return false;
+		}
+
+		const LiteralInfo info = extractLiterals(root, ignore_case);
+		required_strings.insert(required_strings.end(), info.strings.begin(), info.strings.end());
+		any_string = any_string || std::find(info.strings.begin(), info.strings.end(), "") != info.strings.end();
+
+		program->starts.push_back(compiler.position());
+		if (!compiler.compile(root) || compiler.add(RegexInstruction::Op::Match, static_cast<std::uint32_t>(i)) == RegexCompiler::INVALID) {
+			error = "\"" + patterns[i] + "\": expression too large";
+			return false;
+		}
+	}
+
+	// A single expression without required strings can match any line, so there is nothing to search for first
+	if (any_string) {
+		required_strings = { "" };
+	}
+	std::sort(required_strings.begin(), required_strings.end());
+	required_strings.erase(std::unique(required_strings.begin(), required_strings.end()), required_strings.end());
+	if (!any_string) {
+		if (required_strings.size() == 1) {
+			program->literal_searcher = std::make_unique<LiteralSearcher>(required_strings.front(), ignore_case);
+		}
+		else {
+			program->multi_searcher = std::make_unique<AhoCorasickSearcher>(required_strings, ignore_case);
+		}
+	}
+	program->required_strings = std::move(required_strings);
+
+	// Split the bytes into classes by refining them with every byte set, the newline always gets its own class
+	std::bitset<256> newline;
+	newline.set('\n');
+	std::vector<std::bitset<256>> partition = program->byte_sets;
+	partition.push_back(newline);
+	std::size_t class_count = 1;
+	for (const auto& bytes : partition) {
+		std::vector<int> inside(class_count, -1), outside(class_count, -1);
+		std::size_t refined_count = 0;
+		for (unsigned int byte = 0; byte < 256; ++byte) {
+			int& refined = bytes.test(byte) ? inside[program->byte_classes[byte]] : outside[program->byte_classes[byte]];
+			if (refined < 0) {
+				refined = static_cast<int>(refined_count++);
+			}
+			program->byte_classes[byte] = static_cast<std::uint8_t>(refined);
+		}
+		class_count = refined_count;
+	}
+	program->class_bytes.assign(class_count, 0);
+	for (int byte = 255; byte >= 0; --byte) {
+		program->class_bytes[program->byte_classes[byte]] = static_cast<std::uint8_t>(byte);
+	}
+
+	program_ = std::move(program);
+	flushStates();
+	visited_.assign(program_->instructions.size(), 0);
+	visit_generation_ = 0;
+	return true;
+}
+
+
+const std::vector<std::string>& RegexSearcher::requiredStrings() const {
+	return program_->required_strings;
+}
+
+
+void RegexSearcher::startClosure() const {
+	// Every closure marks its instructions with a new generation, so the marks never have to be cleared
+	if (++visit_generation_ == 0) {
+		std::fill(visited_.begin(), visited_.end(), 0);
+		visit_generation_ = 1;
+	}
+}
+
+
+void RegexSearcher::addClosure(std::uint32_t instruction, bool at_line_start, std::vector<std::uint32_t>& instructions) const {
+	// Follow all instructions that consume nothing and keep the ones that wait for a byte, a line end, or match
+	stack_.push_back(instruction);
+	while (!stack_.empty()) {
+		const std::uint32_t number = stack_.back();
+		stack_.pop_back();
+		if (visited_[number] == visit_generation_) {
+			continue;
+		}
+		visited_[number] = visit_generation_;
+
+		const RegexInstruction& current = program_->instructions[number];
+		switch (current.op) {
+		case RegexInstruction::Op::Split:
+			stack_.push_back(current.alt);
+			stack_.push_back(current.next);
+			break;
+		case RegexInstruction::Op::Jump:
+			stack_.push_back(current.next);
+			break;
+		case RegexInstruction::Op::LineStart:
+			if (at_line_start) {
+				stack_.push_back(current.next);
+			}
+			break;
+		default:
+			instructions.push_back(number);
+			break;
+		}
+	}
+}
+
+
+std::int32_t RegexSearcher::addState(std::vector<std::uint32_t>& instructions, bool& flushed) const {
+	std::sort(instructions.begin(), instructions.end());
+	std::string key(reinterpret_cast<const char*>(instructions.data()), instructions.size() * sizeof(std::uint32_t));
+	flushed = false;
+	const auto found = state_numbers_.find(key);
+	if (found != state_numbers_.end()) {
+		return found->second;
+	}
+
+	// Once the states take up their share of memory, drop them all, the scan rebuilds the ones it still needs.
+	// The instructions are held twice, by the state and by its key.
+	const std::size_t state_size = program_->class_bytes.size() * sizeof(std::int32_t) + 2 * key.size() + DFA_STATE_OVERHEAD;
+	if (state_memory_ + state_size > DFA_CACHE_SIZE && !states_.empty()) {
+		flushStates();
+		flushed = true;
+	}
+	state_memory_ += state_size;
+
+	const std::int32_t number = static_cast<std::int32_t>(states_.size());
+	std::int32_t match = -1;
+	for (const std::uint32_t instruction : instructions) {
+		const RegexInstruction& current = program_->instructions[instruction];
+		if (current.op == RegexInstruction::Op::Match && (match < 0 || current.arg < static_cast<std::uint32_t>(match))) {
+			match = static_cast<std::int32_t>(current.arg);
+		}
+	}
+	states_.push_back(instructions);
+	state_numbers_.emplace(std::move(key), number);
+	transitions_.resize(transitions_.size() + program_->class_bytes.size(), -1);
+	matches_.push_back(match);
+	line_end_matches_.push_back(-2);
+	return number;
+}
+
+
+void RegexSearcher::flushStates() const {
+	states_.clear();
+	state_numbers_.clear();
+	transitions_.clear();
+	matches_.clear();
+	line_end_matches_.clear();
+	line_start_state_ = -1;
+	state_memory_ = 0;
+}
+
+
+std::int32_t RegexSearcher::lineStartState() const {
+	if (line_start_state_ < 0) {
+		startClosure();
+		next_instructions_.clear();
+		for (const std::uint32_t start : program_->starts) {
+			addClosure(start, true, next_instructions_);
+		}
+		bool flushed;
+		line_start_state_ = addState(next_instructions_, flushed);
+	}
+	return line_start_state_;
+}
+
+
+std::int32_t RegexSearcher::computeTransition(std::int32_t state, std::size_t byte_class) const {
+	// Advance every instruction that takes the byte, and start every expression anew at the next byte,
+	// since a match may start anywhere in the line
+	const unsigned int byte = program_->class_bytes[byte_class];
+	startClosure();
+	next_instructions_.clear();
+	for (const std::uint32_t instruction : states_[state]) {
+		const RegexInstruction& current = program_->instructions[instruction];
+		if (current.op == RegexInstruction::Op::Bytes && program_->byte_sets[current.arg].test(byte)) {
+			addClosure(current.next, false, next_instructions_);
+		}
+	}
+	for (const std::uint32_t start : program_->starts) {
+		addClosure(start, false, next_instructions_);
+	}
+
+	// The transition is only kept if the state it leaves survived
+	bool flushed;
+	const std::int32_t next = addState(next_instructions_, flushed);
+	if (!flushed) {
+		transitions_[state * program_->class_bytes.size() + byte_class] = next;
+	}
+	return next;
+}
+
+
+std::int32_t RegexSearcher::lineEndMatch(std::int32_t state) const {
+	if (line_end_matches_[state] != -2) {
+		return line_end_matches_[state];
+	}
+
+	// Follow the instructions waiting for the line end as far as they get without another byte
+	std::int32_t match = -1;
+	startClosure();
+	for (const std::uint32_t instruction : states_[state]) {
+		if (program_->instructions[instruction].op == RegexInstruction::Op::LineEnd) {
+			stack_.push_back(program_->instructions[instruction].next);
+		}
+	}
+	while (!stack_.empty()) {
+		const std::uint32_t number = stack_.back();
+		stack_.pop_back();
+		if (visited_[number] == visit_generation_) {
+			continue;
+		}
+		visited_[number] = visit_generation_;
+
+		const RegexInstruction& current = program_->instructions[number];
+		switch (current.op) {
+		case RegexInstruction::Op::Split:
+			stack_.push_back(current.alt);
+			stack_.push_back(current.next);
+			break;
+		case RegexInstruction::Op::Jump:
+		case RegexInstruction::Op::LineEnd:
+			stack_.push_back(current.next);
+			break;
+		case RegexInstruction::Op::Match:
+			if (match < 0 || current.arg < static_cast<std::uint32_t>(match)) {
+				match = static_cast<std::int32_t>(current.arg);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	line_end_matches_[state] = match;
+	return match;
+}
+
+
+bool RegexSearcher::matchLine(const char* begin, const char* end, std::size_t& pattern_index) const {
+	const std::size_t class_count = program_->class_bytes.size();
+	std::int32_t state = lineStartState();
+	for (const char* position = begin; position < end; ++position) {
+		if (matches_[state] >= 0) {
+			pattern_index = matches_[state];
+			return true;
+		}
+		const std::size_t byte_class = program_->byte_classes[static_cast<unsigned char>(*position)];
+		std::int32_t next = transitions_[state * class_count + byte_class];
+		if (next < 0) {
+			next = computeTransition(state, byte_class);
+		}
+		state = next;
+	}
+
+	if (matches_[state] >= 0) {
+		pattern_index = matches_[state];
+		return true;
+	}
+	const std::int32_t match = lineEndMatch(state);
+	if (match >= 0) {
+		pattern_index = match;
+		return true;
+	}
+	return false;
+}
+
+
+std::size_t RegexSearcher::find(std::string_view haystack, std::size_t position, std::size_t& pattern_index) const {
+	const char* const begin = haystack.data();
+	const char* const end = begin + haystack.size();
+
+	// With required strings, only the lines holding one of them can match, so only those run through the DFA
+	if (program_->literal_searcher || program_->multi_searcher) {
+		while (position < haystack.size()) {
+			std::size_t literal_index;
+			const std::size_t hit = program_->literal_searcher
+				? program_->literal_searcher->find(haystack, position)
+				: program_->multi_searcher->find(haystack, position, literal_index);
+			if (hit == std::string_view::npos) {
+				return std::string_view::npos;
+			}
+
+			const char* line_begin = begin + hit;
+			while (line_begin > begin + position && line_begin[-1] != '\n') {
+				--line_begin;
+			}
+			const char* line_end = static_cast<const char*>(memchr(begin + hit, '\n', end - (begin + hit)));
+			if (line_end == nullptr) {
+				line_end = end;
+			}
+			if (matchLine(line_begin, line_end, pattern_index)) {
+				return line_begin - begin;
+			}
+			position = line_end - begin + 1;
+		}
+		return std::string_view::npos;
+	}
+
+	// Otherwise the DFA runs over all lines in one go, each newline ends a line and starts the next one
+	const std::size_t class_count = program_->class_bytes.size();
+	std::int32_t state = lineStartState();
+	for (const char* current = begin + position; current < end; ++current) {
+		if (matches_[state] >= 0) {
+			pattern_index = matches_[state];
+			return current - begin;
+		}
+		if (*current == '\n') {
+			const std::int32_t match = lineEndMatch(state);
+			if (match >= 0) {
+				pattern_index = match;
+				return current - begin;
+			}
+			state = lineStartState();
+			continue;
+		}
+		const std::size_t byte_class = program_->byte_classes[static_cast<unsigned char>(*current)];
+		std::int32_t next = transitions_[state * class_count + byte_class];
+		if (next < 0) {
+			next = computeTransition(state, byte_class);
+		}
+		state = next;
+	}
+
+	// The last line has no newline at its end
+	if (position < haystack.size() && end[-1] != '\n') {
+		std::int32_t match = matches_[state];
+		if (match < 0) {
+			match = lineEndMatch(state);
+		}
+		if (match >= 0) {
+			pattern_index = match;
+			return haystack.size() - 1;
+		}
+	}
+	return std::string_view::npos;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Finds lines matching any of a set of regular expressions with a lazily built DFA.
+ *
+ * The expressions are compiled into a single Thompson NFA. Its sets of states are turned into DFA states
+ * the first time the scan reaches them, so scanning costs one table lookup per byte, and the automaton
+ * only ever holds the states the input actually visits. Every expression is matched against single lines:
+ * '.' and negated classes never match a newline, and ^ and $ match at the start and the end of a line.
+ *
+ * The strings that every match has to contain are extracted from the expressions. When there are any,
+ * the literal kernels find the candidate lines first and only those lines run through the DFA.
+ *
+ * The syntax is the usual subset of ECMAScript: literals, '.', classes with ranges, negation, and names like [:digit:], the
+ * escapes \d \w \s and their negations, ^ and $, alternation, groups, and the repetitions * + ? {n} {n,}
+ * and {n,m}, which may be lazy. Bytes are matched as they are. Backreferences, lookarounds, and word
+ * boundaries are not supported. Ignoring case, the byte sets of ASCII letters take in both cases, and a
+ * character outside of ASCII with other cases becomes the alternation of their UTF-8 sequences.
+ *
+ * A searcher must not be shared between threads. Each search thread uses its own copy, which shares the
+ * compiled expressions but builds its own DFA states.
+ */
+class RegexSearcher {
+public:
+	/**
+	 * Compiles the expressions.
+	 *
+	 * @param patterns The regular expressions to search for, a line matches if it matches any of them.
+	 * @param error Receives the reason if an expression is invalid.
+	 * @param ignore_case Whether letters match in either case.
+	 * @return True on success, false if an expression is invalid or too large.
+	 */
+	bool compile(const std::vector<std::string>& patterns, std::string& error, bool ignore_case = false);
+
+	/**
+	 * Finds the first line at or after a position that matches one of the expressions. The expression
+	 * whose match ends first in the line is reported, the one with the lowest index on a tie.
+	 *
+	 * @param haystack The buffer to search in.
+	 * @param position The position to start searching at, which has to be the start of a line.
+	 * @param pattern_index Receives the index of the expression found.
+	 * @return A position within the matching line, or std::string_view::npos if there is none.
+	 */
+	std::size_t find(std::string_view haystack, std::size_t position, std::size_t& pattern_index) const;
+
+	/**
+	 * @return Strings of which every match contains at least one. The set holds the empty string when
+	 *         nothing is known about the matches. Ignoring case, their ASCII letters are in lower case.
+	 */
+	const std::vector<std::string>& requiredStrings() const;
+
+	// The compiled expressions, shared by all copies.
+	struct Program;
+
+private:
+	std::int32_t lineStartState() const;
+	std::int32_t computeTransition(std::int32_t state, std::size_t byte_class) const;
+	std::int32_t lineEndMatch(std::int32_t state) const;
+	std::int32_t addState(std::vector<std::uint32_t>& instructions, bool& flushed) const;
+	void startClosure() const;
+	void addClosure(std::uint32_t instruction, bool at_line_start, std::vector<std::uint32_t>& instructions) const;
+	void flushStates() const;
+	bool matchLine(const char* begin, const char* end, std::size_t& pattern_index) const;
+
+	std::shared_ptr<const Program> program_;
+
+	// The DFA states built so far. Each one is a sorted set of NFA instructions. Its row of transitions is
+	// indexed by byte class and holds -1 for a transition not taken yet.
+	mutable std::vector<std::vector<std::uint32_t>> states_;
+	mutable std::unordered_map<std::string, std::int32_t> state_numbers_;
+	mutable std::vector<std::int32_t> transitions_;
+
+	// The lowest index of the expressions matching on entering each state, and at the end of the line
+	// after it, or -1. The latter is worked out on first use and -2 until then.
+	mutable std::vector<std::int32_t> matches_;
+	mutable std::vector<std::int32_t> line_end_matches_;
+	mutable std::int32_t line_start_state_ = -1;
+	mutable std::size_t state_memory_ = 0;
+
+	// Working space of the closure.
+	mutable std::vector<std::uint32_t> visited_;
+	mutable std::uint32_t visit_generation_ = 0;
+	mutable std::vector<std::uint32_t> stack_;
+	mutable std::vector<std::uint32_t> next_instructions_;
+};
+
+
+/**
+ * Escapes a literal string, so that as a regular expression it matches the string itself.
+ *
+ * @param literal The string.
+ * @return The expression.
+ */
+std::string escapeRegex(std::string_view literal);
@@ -0,0 +1,263 @@
+#include "result_cache.h"
+
+#include "file_reader.h"
+#include "output_file.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <charconv>
+
+static const char CACHE_MAGIC[8] = { 'S', 'G', 'R', 'E', 'S', 'U', 'L', 'T' };
+static const std::uint32_t CACHE_VERSION = 3;
+
+// The number of bytes at the start and before the end of the scanned part that have to be unchanged for a tail scan.
+static const std::size_t END_HASH_BYTES = 4096;
+
+// The number of searches whose results are kept, the caches of the least recent ones are removed.
+static const std::size_t MAX_CACHED_SEARCHES = 64;
+
+// Size of the chunks the cache is written in.
+static const std::size_t CACHE_CHUNK_SIZE = 1024 * 1024;
+
+
+/**
+ * Hashes bytes with 64-bit FNV-1a.
+ */
+static std::uint64_t hashBytes(std::string_view bytes, std::uint64_t hash = 0xCBF29CE484222325ull) {
+	for (const char byte : bytes) {
+		hash = (hash ^ static_cast<unsigned char>(byte)) * 0x100000001B3ull;
+	}
+	return hash;
+}
+
+
+/**
+ * @return The path of the cache file of a set of search strings, named by a hash of the matcher and the strings.
+ */
+static fs::path cachePath(const std::string& index_directory, const std::string& matcher, const std::vector<std::string>& search_strings) {
+	std::uint64_t hash = hashBytes(matcher);
+	for (const auto& search_string : search_strings) {
+		const std::uint64_t length = search_string.size();
+		hash = hashBytes(std::string_view(reinterpret_cast<const char*>(&length), sizeof(length)), hash);
+		hash = hashBytes(search_string, hash);
+	}
+
+	char name[17];
+	const char* const name_end = std::to_chars(name, name + sizeof(name), hash, 16).ptr;
+	return fs::path(index_directory) / ("results_" + std::string(name, name_end - name) + ".cache");
+}
+
+
+template <typename T>
+static void appendValue(std::string& buffer, T value) {
+	buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+
+static void appendBytes(std::string& buffer, std::string_view bytes) {
+	appendValue<std::uint64_t>(buffer, bytes.size());
+	buffer += bytes;
+}
+
+
+/**
+ * Reads the cache file front to back, failing on the first value that runs past its end.
+ */
+class CacheReader {
+public:
+	explicit CacheReader(std::string_view contents) : position_(contents.data()), end_(contents.data() + contents.size()) {}
+
+	template <typename T>
+	bool value(T& value) {
+		if (static_cast<std::size_t>(end_ - position_) < sizeof(value)) {
+			return false;
+		}
+		std::memcpy(&value, position_, sizeof(value));
+		position_ += sizeof(value);
+		return true;
+	}
+
+	bool bytes(std::string_view& bytes) {
+		std::uint64_t length;
+		if (!value(length) || static_cast<std::uint64_t>(end_ - position_) < length) {
+			return false;
+		}
+		bytes = std::string_view(position_, length);
+		position_ += length;
+		return true;
+	}
+
+private:
+	const char* position_;
+	const char* end_;
+};
+
+
+std::uint64_t ResultCache::hashEnds(std::string_view contents) {
+	// A file of up to twice the hashed size is hashed in full
+	if (contents.size() <= 2 * END_HASH_BYTES) {
+		return hashBytes(contents);
+	}
+	return hashBytes(contents.substr(contents.size() - END_HASH_BYTES), hashBytes(contents.substr(0, END_HASH_BYTES)));
+}
+
+
+bool ResultCache::load(const std::string& index_directory, const std::string& matcher, const std::vector<std::string>& search_strings) {
+	files_.clear();
+
+	FileReader reader;
+	std::string_view contents;
+	if (!reader.open(cachePath(index_directory, matcher, search_strings), contents)) {
+		return false;
+	}
+
+	// Check the version, and that the cache is for exactly this matcher and these strings and not for a colliding hash.
+	CacheReader cache(contents);
+	char magic[sizeof(CACHE_MAGIC)];
+	std::uint32_t version, pattern_count;
+	std::string_view cached_matcher;
+	if (!cache.value(magic) || std::memcmp(magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || !cache.value(version) || version != CACHE_VERSION
+		|| !cache.bytes(cached_matcher) || cached_matcher != matcher || !cache.value(pattern_count) || pattern_count != search_strings.size()) {
+		return false;
+	}
+	for (const auto& search_string : search_strings) {
+		std::string_view pattern;
+		if (!cache.bytes(pattern) || pattern != search_string) {
+			return false;
+		}
+	}
+
+	// Read the files with their matches.
+	std::uint64_t file_count;
+	if (!cache.value(file_count)) {
+		return false;
+	}
+	for (std::uint64_t i = 0; i < file_count; ++i) {
+		std::string_view path;
+		CachedFile file;
+		std::uint64_t match_count;
+		if (!cache.bytes(path) || !cache.value(file.stamp.size) || !cache.value(file.stamp.mtime_ns) || !cache.value(file.stamp.inode)
+			|| !cache.value(file.resume_offset) || !cache.value(file.resume_line) || !cache.value(file.tail_hash) || !cache.value(match_count)) {
+			files_.clear();
+			return false;
+		}
+
+		file.matches.resize(match_count);
+		for (auto& match : file.matches) {
+			std::string_view line;
+			match.file_index = 0;
+			if (!cache.value(match.pattern_index) || !cache.value(match.line_number) || !cache.value(match.byte_offset) || !cache.bytes(line)) {
+				files_.clear();
+				return false;
+			}
+			match.line_length = line.size();
+			match.text_offset = file.text.size();
+			file.text += line;
+		}
+		files_.emplace(std::string(path), std::move(file));
+	}
+
+	return true;
+}
+
+
+std::size_t ResultCache::fileCount() const {
+	return files_.size();
+}
+
+
+const CachedFile* ResultCache::find(const fs::path& file_path) const {
+	const auto found = files_.find(file_path.generic_string());
+	return found != files_.end() ? &found->second : nullptr;
+}
+
+
+bool ResultCache::save(const std::string& index_directory, const std::string& matcher, const std::vector<std::string>& search_strings, const SearchResults& results) {
+	// Write a temporary file and move it into place, so a concurrent search never sees half a cache.
+	const fs::path path = cachePath(index_directory, matcher, search_strings);
+	const fs::path temporary_path = path.string() + ".tmp";
+	OutputFile output;
+	if (!output.open(temporary_path.string())) {
+		std::cerr << "Error: could not create result cache " << temporary_path.string() << std::endl;
+		return false;
+	}
+
+	std::string buffer;
+	buffer.append(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	appendValue<std::uint32_t>(buffer, CACHE_VERSION);
+	appendBytes(buffer, matcher);
+	appendValue<std::uint32_t>(buffer, static_cast<std::uint32_t>(search_strings.size()));
+	for (const auto& search_string : search_strings) {
+		appendBytes(buffer, search_string);
+	}
+
+	std::uint64_t file_count = 0;
+	for (const auto& thread : results.threads) {
+		file_count += thread.scanned.size();
+	}
+	appendValue<std::uint64_t>(buffer, file_count);
+
+	// Every scanned file with its resume point, followed by its matches.
+	bool written = true;
+	for (const auto& thread : results.threads) {
+		for (const auto& scanned : thread.scanned) {
+			appendBytes(buffer, scanned.path.generic_string());
+			appendValue(buffer, scanned.stamp.size);
+			appendValue(buffer, scanned.stamp.mtime_ns);
+			appendValue(buffer, scanned.stamp.inode);
+			appendValue(buffer, scanned.resume_offset);
+			appendValue(buffer, scanned.resume_line);
+			appendValue(buffer, scanned.tail_hash);
+			if (scanned.file_index < 0) {
+				appendValue<std::uint64_t>(buffer, 0);
+				continue;
+			}
+
+			const FileMatches& file = thread.files[scanned.file_index];
+			appendValue<std::uint64_t>(buffer, file.match_count);
+			for (std::size_t i = file.first_match; i < file.first_match + file.match_count; ++i) {
+				const MatchRecord& match = thread.matches[i];
+				appendValue(buffer, match.pattern_index);
+				appendValue(buffer, match.line_number);
+				appendValue(buffer, match.byte_offset);
+				appendBytes(buffer, thread.line(match));
+			}
+
+			if (buffer.size() >= CACHE_CHUNK_SIZE) {
+				written = output.write(buffer) && written;
+				buffer.clear();
+			}
+		}
+	}
+	written = output.write(buffer) && written;
+
+	std::error_code error;
+	if (!written || !output.close()) {
+		std::cerr << "Error: could not write result cache " << temporary_path.string() << std::endl;
+		fs::remove(temporary_path, error);
+		return false;
+	}
+	fs::rename(temporary_path, path, error);
+	if (error) {
+		std::cerr << "Error: could not replace result cache " << path.string() << ": " << error.message() << std::endl;
+		return false;
+	}
+
+	// Remove the caches of the least recent searches, so searching for ever new strings does not fill the disk.
+	std::vector<std::pair<fs::file_time_type, fs::path>> caches;
+	for (fs::directory_iterator it(index_directory, error); !error && it != fs::directory_iterator(); it.increment(error)) {
+		const std::string name = it->path().filename().string();
+		if (name.rfind("results_", 0) == 0 && it->path().extension() == ".cache") {
+			std::error_code time_error;
+			caches.push_back({ it->last_write_time(time_error), it->path() });
+		}
+	}
+	if (caches.size() > MAX_CACHED_SEARCHES) {
+		std::sort(caches.begin(), caches.end());
+		for (std::size_t i = 0; i < caches.size() - MAX_CACHED_SEARCHES; ++i) {
+			fs::remove(caches[i].second, error);
+		}
+	}
+	return true;
+}
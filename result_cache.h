@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <filesystem>
+
+#include "file_stamp.h"
+#include "search_results.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * What the result cache holds of a file: how far it was scanned, and its matching lines.
+ */
+struct CachedFile {
+	// The stamp of the file when it was scanned, its size is the number of bytes scanned.
+	FileStamp stamp;
+
+	// The start of the last line, which may still grow, its number, and the hash of the ends of the scanned part.
+	std::uint64_t resume_offset = 0;
+	std::uint64_t resume_line = 1;
+	std::uint64_t tail_hash = 0;
+
+	// The matching lines in line order, their text_offset points into text.
+	std::vector<MatchRecord> matches;
+	std::string text;
+};
+
+
+/**
+ * The results of the previous search for the same strings, kept next to the trigram index of the tree.
+ *
+ * A file whose stamp is unchanged takes its matches from the cache without being read. A file that
+ * only grew, with the same inode and the same bytes at its start and before the old end, keeps the matches
+ * before its last line and is scanned from there. Every other file is scanned as usual. Only the ends are
+ * compared, so a file that grew and was also changed in place in between keeps matches that are stale.
+ */
+class ResultCache {
+public:
+	/**
+	 * Loads the cache of a set of search strings.
+	 *
+	 * @param index_directory The directory holding the trigram index.
+	 * @param matcher The name of the way the strings are matched, each one has its own caches.
+	 * @param search_strings The strings to search for.
+	 * @return True on success, false if there is no valid cache for the strings.
+	 */
+	bool load(const std::string& index_directory, const std::string& matcher, const std::vector<std::string>& search_strings);
+
+	/**
+	 * @param file_path The path of a file.
+	 * @return The cached results of the file, or nullptr if it is not in the cache.
+	 */
+	const CachedFile* find(const fs::path& file_path) const;
+
+	/**
+	 * @return The number of files in the cache.
+	 */
+	std::size_t fileCount() const;
+
+	/**
+	 * Writes the cache of a set of search strings from the files the search threads scanned, replacing the previous one.
+	 * Only the caches of the most recent searches are kept.
+	 *
+	 * @param index_directory The directory holding the trigram index.
+	 * @param matcher The name of the way the strings were matched.
+	 * @param search_strings The strings searched for.
+	 * @param results The results of all search threads, including what they scanned.
+	 * @return True on success, false if the cache could not be written.
+	 */
+	static bool save(const std::string& index_directory, const std::string& matcher, const std::vector<std::string>& search_strings, const SearchResults& results);
+
+	/**
+	 * Hashes the first and the last bytes of some contents, which tells whether a file that grew was only appended to.
+	 *
+	 * @param contents The contents up to the end to hash.
+	 * @return The hash.
+	 */
+	static std::uint64_t hashEnds(std::string_view contents);
+
+private:
+	std::unordered_map<std::string, CachedFile> files_;
+};
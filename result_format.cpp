@@ -0,0 +1,252 @@
+#include "result_format.h"
+
+#include <charconv>
+#include <cstring>
+
+#include "case_fold.h"
+
+static const char BASE64_DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+
+/**
+ * @param text Some bytes.
+ * @return Whether the bytes are valid UTF-8, which a JSON string has to be.
+ */
+static bool isUtf8(std::string_view text) {
+	for (std::size_t position = 0; position < text.size();) {
+		// Runs of ASCII need no decoding
+		if (static_cast<unsigned char>(text[position]) < 0x80) {
+			++position;
+			continue;
+		}
+		std::uint32_t code_point;
+		const std::size_t length = decodeUtf8(text.substr(position), code_point);
+		if (length == 0) {
+			return false;
+		}
+		position += length;
+	}
+	return true;
+}
+
+
+/**
+ * Appends bytes to a buffer in base64, with padding.
+ *
+ * @param buffer The buffer to append to.
+ * @param bytes The bytes.
+ */
+static void appendBase64(std::string& buffer, std::string_view bytes) {
+	std::size_t i = 0;
+	for (; i + 3 <= bytes.size(); i += 3) {
+		const std::uint32_t group = static_cast<unsigned char>(bytes[i]) << 16 | static_cast<unsigned char>(bytes[i + 1]) << 8
+			| static_cast<unsigned char>(bytes[i + 2]);
+		buffer += BASE64_DIGITS[group >> 18];
+		buffer += BASE64_DIGITS[(group >> 12) & 0x3F];
+		buffer += BASE64_DIGITS[(group >> 6) & 0x3F];
+		buffer += BASE64_DIGITS[group & 0x3F];
+	}
+	if (i < bytes.size()) {
+		const bool two = i + 1 < bytes.size();
+		const std::uint32_t group = static_cast<unsigned char>(bytes[i]) << 16 | (two ? static_cast<unsigned char>(bytes[i + 1]) << 8 : 0);
+		buffer += BASE64_DIGITS[group >> 18];
+		buffer += BASE64_DIGITS[(group >> 12) & 0x3F];
+		buffer += two ? BASE64_DIGITS[(group >> 6) & 0x3F] : '=';
+		buffer += '=';
+	}
+}
+
+
+/**
+ * Appends a member holding text to a JSON object, as an escaped string if the text is valid UTF-8,
+ * and in base64 under the key with a "_base64" suffix otherwise.
+ *
+ * @param buffer The buffer to append to.
+ * @param key The key of the member.
+ * @param text The text.
+ */
+static void appendJsonText(std::string& buffer, std::string_view key, std::string_view text) {
+	buffer += ",\"";
+	buffer += key;
+	if (!isUtf8(text)) {
+		buffer += "_base64\":\"";
+		appendBase64(buffer, text);
+		buffer += '"';
+		return;
+	}
+
+	// Only quotes, backslashes and control characters need escaping, the rest is copied in runs
+	buffer += "\":\"";
+	std::size_t run_start = 0;
+	for (std::size_t i = 0; i < text.size(); ++i) {
+		const unsigned char c = static_cast<unsigned char>(text[i]);
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+		buffer.append(text.data() + run_start, i - run_start);
+		run_start = i + 1;
+		buffer += '\\';
+		if (c == '"' || c == '\\') {
+			buffer += static_cast<char>(c);
+		}
+		else if (c == '\t') {
+			buffer += 't';
+		}
+		else if (c == '\r') {
+			buffer += 'r';
+		}
+		else if (c == '\n') {
+			buffer += 'n';
+		}
+		else {
+			buffer += "u00";
+			buffer += HEX_DIGITS[c >> 4];
+			buffer += HEX_DIGITS[c & 0xF];
+		}
+	}
+	buffer.append(text.data() + run_start, text.size() - run_start);
+	buffer += '"';
+}
+
+
+/**
+ * Appends a member holding a number to a JSON object.
+ *
+ * @param buffer The buffer to append to.
+ * @param key The key of the member.
+ * @param number The number.
+ */
+static void appendJsonNumber(std::string& buffer, std::string_view key, std::uint64_t number) {
+	char digits[24];
+	const char* const digits_end = std::to_chars(digits, digits + sizeof(digits), number).ptr;
+	buffer += ",\"";
+	buffer += key;
+	buffer += "\":";
+	buffer.append(digits, digits_end - digits);
+}
+
+
+const char* resultExtension(ResultFormat format) {
+	switch (format) {
+	case ResultFormat::Json:
+		return ".ndjson";
+	case ResultFormat::Binary:
+		return ".bin";
+	default:
+		return ".txt";
+	}
+}
+
+
+std::string formatResultHeader(ResultFormat format, const std::vector<std::string>& search_strings) {
+	std::string buffer;
+	if (format != ResultFormat::Binary) {
+		return buffer;
+	}
+
+	BinaryResultHeader header;
+	std::memcpy(header.magic, BINARY_RESULT_MAGIC, sizeof(header.magic));
+	header.version = BINARY_RESULT_VERSION;
+	header.pattern_count = static_cast<std::uint32_t>(search_strings.size());
+	buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (std::size_t i = 0; i < search_strings.size(); ++i) {
+		ResultEntry entry{ ResultType::Pattern };
+		entry.pattern_index = static_cast<std::uint32_t>(i);
+		entry.text = search_strings[i];
+		formatBinaryEntry(buffer, entry);
+	}
+	return buffer;
+}
+
+
+void formatJsonEntry(std::string& buffer, const ResultEntry& entry) {
+	switch (entry.type) {
+	case ResultType::Match:
+		buffer += "{\"type\":\"match\"";
+		break;
+	case ResultType::Context:
+		buffer += "{\"type\":\"context\"";
+		break;
+	case ResultType::BinaryFile:
+		buffer += "{\"type\":\"binary\"";
+		break;
+	case ResultType::Count:
+		buffer += "{\"type\":\"count\"";
+		break;
+	default:
+		buffer += "{\"type\":\"file\"";
+		break;
+	}
+	appendJsonText(buffer, "path", entry.path);
+
+	// A line has its number, its position and its text, the line of a binary file only its position
+	if (entry.type == ResultType::Match || entry.type == ResultType::Context) {
+		appendJsonNumber(buffer, "line", entry.line_number);
+	}
+	if (entry.type == ResultType::Match || entry.type == ResultType::Context || entry.type == ResultType::BinaryFile) {
+		appendJsonNumber(buffer, "offset", entry.byte_offset);
+	}
+	if (entry.pattern != nullptr) {
+		appendJsonText(buffer, "pattern", *entry.pattern);
+	}
+	if (entry.type == ResultType::Match || entry.type == ResultType::Context) {
+		appendJsonText(buffer, "text", entry.text);
+	}
+	if (entry.type == ResultType::Count) {
+		appendJsonNumber(buffer, "count", entry.line_number);
+	}
+	buffer += "}\n";
+}
+
+
+void formatBinaryEntry(std::string& buffer, const ResultEntry& entry) {
+	const std::size_t unpadded = sizeof(BinaryResultRecord) + entry.path.size() + entry.text.size();
+	BinaryResultRecord record;
+	record.size = (unpadded + 7) & ~static_cast<std::uint64_t>(7);
+	record.type = static_cast<std::uint32_t>(entry.type);
+	record.pattern_index = entry.pattern_index;
+	record.line_number = entry.line_number;
+	record.byte_offset = entry.byte_offset;
+	record.path_length = static_cast<std::uint32_t>(entry.path.size());
+	record.reserved = 0;
+	record.text_length = entry.text.size();
+
+	buffer.append(reinterpret_cast<const char*>(&record), sizeof(record));
+	buffer += entry.path;
+	buffer += entry.text;
+	buffer.append(record.size - unpadded, '\0');
+}
+
+
+bool isBinaryResultHeader(std::string_view data) {
+	BinaryResultHeader header;
+	if (data.size() < sizeof(header)) {
+		return false;
+	}
+	std::memcpy(&header, data.data(), sizeof(header));
+	return std::memcmp(header.magic, BINARY_RESULT_MAGIC, sizeof(header.magic)) == 0 && header.version == BINARY_RESULT_VERSION;
+}
+
+
+std::size_t readBinaryEntry(std::string_view data, ResultEntry& entry) {
+	BinaryResultRecord record;
+	if (data.size() < sizeof(record)) {
+		return 0;
+	}
+	std::memcpy(&record, data.data(), sizeof(record));
+
+	// The path and the text have to fit within the record, and the record within the data
+	if (record.size < sizeof(record) || record.size % 8 != 0 || record.size > data.size() || record.path_length > record.size - sizeof(record)
+		|| record.text_length > record.size - sizeof(record) - record.path_length) {
+		return 0;
+	}
+	entry.type = static_cast<ResultType>(record.type);
+	entry.path = data.substr(sizeof(record), record.path_length);
+	entry.pattern = nullptr;
+	entry.pattern_index = record.pattern_index;
+	entry.line_number = record.line_number;
+	entry.byte_offset = record.byte_offset;
+	entry.text = data.substr(sizeof(record) + record.path_length, record.text_length);
+	return record.size;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "search_options.h"
+
+/**
+ * The machine-readable formats of the results, for tools that take them in instead of a reader.
+ *
+ * NDJSON writes one JSON object per line and per result, with the full path of the file and the byte offset of
+ * the line in the searched contents. Text that is not valid UTF-8, a path or a line, is written in base64 under
+ * the key with a "_base64" suffix instead.
+ *
+ * The binary format starts with a BinaryResultHeader, followed by a record of every search string and then
+ * a record of every result. Every record is a BinaryResultRecord followed by the path and the text, and padded
+ * to a multiple of 8 bytes, so a reader that maps the file can step from record to record by their sizes and read
+ * every header in place. All numbers are in the byte order of the host that wrote them.
+ *
+ * Both formats consist of records that do not depend on each other, so they are written in streaming mode as well.
+ */
+
+// The kinds of records.
+enum class ResultType : std::uint32_t {
+	// A matching line.
+	Match = 1,
+	// A line shown around a matching line.
+	Context = 2,
+	// A binary file with a match, whose line is not shown.
+	BinaryFile = 3,
+	// A file with its number of matching lines, in the count mode.
+	Count = 4,
+	// A file with a match, in the list-files mode.
+	File = 5,
+	// A search string, only in the binary format, where the matches refer to it by its index.
+	Pattern = 6
+};
+
+
+/**
+ * The start of a binary result file.
+ */
+struct BinaryResultHeader {
+	// BINARY_RESULT_MAGIC, without a terminating zero.
+	char magic[8];
+
+	// BINARY_RESULT_VERSION, which also tells the byte order of the file.
+	std::uint32_t version;
+
+	// The number of pattern records after the header.
+	std::uint32_t pattern_count;
+};
+
+static const char BINARY_RESULT_MAGIC[] = "SGRESULT";
+static const std::uint32_t BINARY_RESULT_VERSION = 1;
+
+
+/**
+ * The fixed part of a record of the binary format, which the path and the text follow.
+ */
+struct BinaryResultRecord {
+	// The size of the whole record with its padding, a multiple of 8.
+	std::uint64_t size;
+
+	// The kind of record, a ResultType.
+	std::uint32_t type;
+
+	// The index of the search string found in the line, or UINT32_MAX for a context line.
+	std::uint32_t pattern_index;
+
+	// The number of the line, starting at 1, or the number of matching lines of a Count record.
+	std::uint64_t line_number;
+
+	// The position of the first byte of the line within the searched contents of the file.
+	std::uint64_t byte_offset;
+
+	// The length of the path that follows the record, and of the text after it.
+	std::uint32_t path_length;
+	std::uint32_t reserved;
+	std::uint64_t text_length;
+};
+
+static_assert(sizeof(BinaryResultRecord) == 48, "the binary records are read in place");
+
+
+/**
+ * One result, as it is written in the machine-readable formats. Each kind of record only uses some of the fields.
+ */
+struct ResultEntry {
+	ResultType type;
+	std::string_view path;
+
+	// The search string found in the line, and its index.
+	const std::string* pattern = nullptr;
+	std::uint32_t pattern_index = 0;
+
+	// The line, or the number of matching lines of a Count record.
+	std::uint64_t line_number = 0;
+	std::uint64_t byte_offset = 0;
+	std::string_view text;
+};
+
+
+/**
+ * @param format The format of the results.
+ * @return The extension of the result file, with its dot.
+ */
+const char* resultExtension(ResultFormat format);
+
+/**
+ * Formats what a result file starts with, before all results.
+ *
+ * @param format The format of the results.
+ * @param search_strings The strings searched for.
+ * @return The header and the pattern records of the binary format, nothing in the other formats.
+ */
+std::string formatResultHeader(ResultFormat format, const std::vector<std::string>& search_strings);
+
+/**
+ * Appends a result to a buffer as a line of NDJSON.
+ *
+ * @param buffer The buffer to append to.
+ * @param entry The result.
+ */
+void formatJsonEntry(std::string& buffer, const ResultEntry& entry);
+
+/**
+ * Appends a result to a buffer as a record of the binary format.
+ *
+ * @param buffer The buffer to append to.
+ * @param entry The result.
+ */
+void formatBinaryEntry(std::string& buffer, const ResultEntry& entry);
+
+/**
+ * @param data The start of a binary result file, at least sizeof(BinaryResultHeader) bytes of it.
+ * @return Whether the data starts with the header of a binary result file of this version and byte order.
+ */
+bool isBinaryResultHeader(std::string_view data);
+
+/**
+ * Reads a record of the binary format in place.
+ *
+ * @param data The data that starts with the record.
+ * @param entry Receives the result, whose path and text point into the data. The pattern is left out, the records refer
+ *              to it by its index.
+ * @return The size of the record, or 0 if the data does not hold a whole record or starts with a malformed one.
+ */
+std::size_t readBinaryEntry(std::string_view data, ResultEntry& entry);
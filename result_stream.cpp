@@ -0,0 +1,94 @@
+#include "result_stream.h"
+
+// The search threads wait once this many bytes are queued and not yet written.
+static const std::size_t MAX_READY_BYTES = 64 * 1024 * 1024;
+
+
+ResultStream::ResultStream(OutputFile& output, bool ordered) : output_(output), ordered_(ordered) {
+	writer_ = std::thread(&ResultStream::run, this);
+}
+
+
+ResultStream::~ResultStream() {
+	finish();
+}
+
+
+void ResultStream::write(std::string chunk) {
+	if (chunk.empty()) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	space_available_.wait(lock, [this] { return ready_bytes_ < MAX_READY_BYTES || failed_; });
+	ready_bytes_ += chunk.size();
+	ready_.push_back(std::move(chunk));
+	chunk_available_.notify_one();
+}
+
+
+void ResultStream::writeBatch(std::size_t sequence, std::string chunk) {
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	// Held back chunks do not count against the limit, the writer can not drain them before their turn
+	// and waiting on them could block the very thread that owns the next batch.
+	if (sequence != next_sequence_) {
+		held_back_.emplace(sequence, std::move(chunk));
+		return;
+	}
+
+	space_available_.wait(lock, [this] { return ready_bytes_ < MAX_READY_BYTES || failed_; });
+
+	// Release this batch and every batch after it that is already complete.
+	ready_bytes_ += chunk.size();
+	ready_.push_back(std::move(chunk));
+	++next_sequence_;
+	for (auto it = held_back_.begin(); it != held_back_.end() && it->first == next_sequence_; it = held_back_.erase(it)) {
+		ready_bytes_ += it->second.size();
+		ready_.push_back(std::move(it->second));
+		++next_sequence_;
+	}
+	chunk_available_.notify_one();
+}
+
+
+bool ResultStream::finish() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto& [sequence, chunk] : held_back_) {
+			ready_bytes_ += chunk.size();
+			ready_.push_back(std::move(chunk));
+		}
+		held_back_.clear();
+		finishing_ = true;
+		chunk_available_.notify_one();
+	}
+	if (writer_.joinable()) {
+		writer_.join();
+	}
+	return !failed_;
+}
+
+
+void ResultStream::run() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		chunk_available_.wait(lock, [this] { return !ready_.empty() || finishing_; });
+		if (ready_.empty()) {
+			break;
+		}
+
+		// Write the chunk without holding the lock, so the search threads can keep queueing.
+		std::string chunk = std::move(ready_.front());
+		ready_.pop_front();
+		lock.unlock();
+		const bool written = failed_ || output_.write(chunk);
+		lock.lock();
+
+		if (!written) {
+			failed_ = true;
+		}
+		ready_bytes_ -= chunk.size();
+		space_available_.notify_all();
+	}
+}
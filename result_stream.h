@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstddef>
+
+#include "output_file.h"
+
+/**
+ * Writes the results while the search is still running.
+ *
+ * The search threads format their matches into their own buffers and hand them over in large chunks.
+ * A single writer thread writes the chunks to the output, so the search threads never wait on I/O
+ * unless the writer falls behind by more than a bounded number of bytes.
+ *
+ * In ordered mode every chunk carries the sequence number of the batch it was produced from, and the
+ * writer puts the chunks out in sequence order. Only chunks that arrive ahead of their turn are held back,
+ * and the scheduler of an ordered search hands out no batch more than a window past the oldest one still
+ * searched, so the output is deterministic while only the results of that window are held in memory.
+ */
+class ResultStream {
+public:
+	/**
+	 * Starts the writer thread.
+	 *
+	 * @param output The file to write to, which stays owned by the caller.
+	 * @param ordered Whether chunks are written in batch sequence order.
+	 */
+	ResultStream(OutputFile& output, bool ordered);
+	ResultStream(const ResultStream&) = delete;
+	ResultStream& operator=(const ResultStream&) = delete;
+	~ResultStream();
+
+	/**
+	 * Queues a chunk for writing in unordered mode, waiting while the writer is too far behind.
+	 *
+	 * @param chunk The formatted results.
+	 */
+	void write(std::string chunk);
+
+	/**
+	 * Queues the complete output of a batch in ordered mode. Every batch has to be handed over exactly once,
+	 * even without any results, so the batches after it can be written.
+	 *
+	 * @param sequence The sequence number of the batch.
+	 * @param chunk The formatted results of the batch.
+	 */
+	void writeBatch(std::size_t sequence, std::string chunk);
+
+	/**
+	 * Writes everything still queued and stops the writer thread. In ordered mode the chunks still held back,
+	 * behind batches that were dropped when the search was cancelled, are written last, in sequence order.
+	 *
+	 * @return True if all writes succeeded.
+	 */
+	bool finish();
+
+	/**
+	 * @return Whether chunks are written in batch sequence order.
+	 */
+	bool ordered() const { return ordered_; }
+
+private:
+	void run();
+
+	OutputFile& output_;
+	bool ordered_;
+
+	std::mutex mutex_;
+	std::condition_variable chunk_available_;
+	std::condition_variable space_available_;
+
+	// Chunks ready to be written and their total size.
+	std::deque<std::string> ready_;
+	std::size_t ready_bytes_ = 0;
+
+	// Ordered mode: chunks waiting for the batches before them, and the next sequence number to write.
+	std::map<std::size_t, std::string> held_back_;
+	std::size_t next_sequence_ = 0;
+
+	bool finishing_ = false;
+	bool failed_ = false;
+	std::thread writer_;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * How the directory tree is walked.
+ */
+struct WalkOptions {
+	// The names of the directories that are not descended into, like .git or node_modules.
+	std::vector<std::string> excluded_directories;
+
+	// Whether to descend into symbolic links to directories. Every directory is still listed only once.
+	bool follow_symlinks = false;
+
+	// Glob patterns of the names of the files to search, every file if there are none, and of the names of files to leave out.
+	std::vector<std::string> included_files;
+	std::vector<std::string> excluded_files;
+
+	// The size in bytes above which files are left out, 0 for no limit.
+	std::uintmax_t max_file_size = 0;
+};
+
+
+/**
+ * The lines shown around every matching line.
+ */
+struct LineContext {
+	// The number of lines shown before and after a matching line.
+	std::uint64_t before = 0;
+	std::uint64_t after = 0;
+
+	/**
+	 * @return Whether any lines are shown.
+	 */
+	bool any() const { return before != 0 || after != 0; }
+};
+
+
+/**
+ * What is done with a binary file, one with a zero byte near its start.
+ */
+enum class BinaryFiles {
+	// Search it up to its first match, which is reported without the line.
+	Match,
+	// Leave it out.
+	Skip,
+	// Search it like a text file.
+	Text
+};
+
+
+/**
+ * The format of the result file.
+ */
+enum class ResultFormat {
+	// One line per result, for reading, with the name of the file without its directory and extension.
+	Text,
+	// One JSON object per line and result, with the full path of the file and the byte offset of the line.
+	Json,
+	// Records of a fixed layout with length-prefixed paths and lines, to map and read in place.
+	Binary
+};
+
+
+/**
+ * The settings of a search, as given on the command line.
+ */
+struct SearchOptions {
+	// The strings to search for, a line matches if it contains any of them.
+	std::vector<std::string> search_strings;
+
+	// Whether the search strings are regular expressions, a line then matches if it matches any of them.
+	bool regex = false;
+
+	// Whether letters match in either case.
+	bool ignore_case = false;
+
+	// The directory to search in, including its subdirectories.
+	std::string directory_path;
+
+	// The names of the log and result files, without extension. A result filename of "-" stands for stdout.
+	std::string log_filename;
+	std::string result_filename;
+
+	// The number of search threads. With auto_threads, the number to start with, one per CPU, which the search adapts.
+	int thread_count = 4;
+	bool auto_threads = false;
+
+	// Whether to pin every thread to a CPU of its own, spread over the NUMA nodes.
+	bool pin = false;
+
+	// The number of files every search thread reads ahead, 0 to read each file only when it is searched.
+	unsigned io_depth = 32;
+
+	// The most files all search threads together read ahead on one device, 0 to only limit rotational disks.
+	unsigned device_depth = 0;
+
+	// The size of the chunks a file of at least twice the size is split into, which several threads search at once, 0 to never split files.
+	std::uint64_t chunk_size = 16 * 1024 * 1024;
+
+	// Whether to search while the directory is still being walked.
+	bool pipelined = false;
+
+	// The directories left out of the walk, and whether symbolic links to directories are followed.
+	WalkOptions walk;
+
+	// What is done with binary files.
+	BinaryFiles binary_files = BinaryFiles::Match;
+
+	// Whether to write the results while searching, and whether to keep a fixed order while doing so.
+	bool stream = false;
+	bool ordered = false;
+
+	// Whether to only write the number of matching lines of every file, or only the files with a match.
+	bool count = false;
+	bool list_files = false;
+
+	// The format of the results, which also sets the extension of the result file.
+	ResultFormat format = ResultFormat::Text;
+
+	// The lines shown around every matching line, which the count and list-files modes do not show.
+	LineContext context;
+
+	// The most matching lines kept of every file, and the most results of the whole search, 0 for no limit.
+	// The results are the matching lines, or the files with -c and -L.
+	std::uint64_t max_count = 0;
+	std::uint64_t max_results = 0;
+
+	// Whether to flush the result and log files to disk before exiting.
+	bool sync = false;
+
+	// The directory of the trigram index used to skip files that can not match, empty to search every file.
+	std::string index_directory;
+
+	// The name of the statistics report without extension, empty for no report. A name of "-" stands for stderr.
+	std::string stats_filename;
+
+	// The socket to answer searches of the directory on, empty to search once and exit.
+	std::string serve_socket;
+
+	// The socket of a server to run the search, empty to run it in this process.
+	std::string connect_socket;
+
+	// The servers a distributed search runs on, empty to run it in this process, and the directories it is split into.
+	// Without shards, every server searches the directory of the search in its own tree.
+	std::vector<std::string> worker_sockets;
+	std::vector<std::string> shard_directories;
+};
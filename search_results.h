@@ -0,0 +1,176 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+
+#include "file_stamp.h"
+#include "text_arena.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * A single matching line, or a line shown around one. The line's text lives in the text arena of the thread that found it.
+ */
+struct MatchRecord {
+	// Index into the files of the thread that found the match.
+	std::uint32_t file_index;
+
+	// Index of the search string found in the line, or CONTEXT_LINE for a line shown around a match.
+	std::uint32_t pattern_index;
+
+	// Number of the line within the file, starting at 1.
+	std::uint64_t line_number;
+
+	// Position of the first byte of the line within the file.
+	std::uint64_t byte_offset;
+
+	// Length of the line without its newline.
+	std::uint64_t line_length;
+
+	// Position of the line's text within the thread's text arena.
+	std::uint64_t text_offset;
+};
+
+
+// The pattern index of a record of a context line, which contains none of the search strings.
+static const std::uint32_t CONTEXT_LINE = UINT32_MAX;
+
+
+/**
+ * A file with at least one match, and how many lines of it matched.
+ */
+struct FileMatches {
+	fs::path path;
+	std::uint64_t match_count = 0;
+
+	// Index of the file's first record in ThreadResults::matches. Its matches follow in line order, with the
+	// context lines shown around them in between, up to the first record of the next file.
+	std::size_t first_match = 0;
+
+	// Whether the file is binary and was only searched up to its first match, which has no line to show.
+	bool binary = false;
+};
+
+
+/**
+ * How far a file was scanned, recorded for the result cache so a file that only grows can later be
+ * scanned from where this search stopped.
+ */
+struct ScannedFile {
+	fs::path path;
+
+	// The stamp of the file, with the number of bytes scanned as its size.
+	FileStamp stamp;
+
+	// The start of the last line, which may still grow, its number, and the hash of the scanned tail.
+	std::uint64_t resume_offset = 0;
+	std::uint64_t resume_line = 1;
+	std::uint64_t tail_hash = 0;
+
+	// Index of the file in ThreadResults::files, or -1 if it has no matches.
+	std::int64_t file_index = -1;
+};
+
+
+/**
+ * What one search thread spent its time on, and how much it read.
+ */
+struct WorkerStats {
+	std::uint64_t batches = 0;
+	std::uint64_t files_opened = 0;
+	std::uint64_t files_skipped = 0;
+	std::uint64_t bytes_read = 0;
+
+	// Files whose matches came from the result cache unread, and files of which only the appended tail was scanned.
+	std::uint64_t files_cached = 0;
+	std::uint64_t files_tail_scanned = 0;
+
+	// Files whose contents were read ahead while the thread searched the files before them.
+	std::uint64_t files_read_ahead = 0;
+
+	// Compressed files, searched as the files they decompress to, which bytes_read counts.
+	std::uint64_t files_decompressed = 0;
+
+	// Binary files, which were left out or only searched up to their first match, unless they are searched as text.
+	std::uint64_t files_binary = 0;
+
+	// Huge files this thread split to search them together with the others, and the chunks of split files it searched.
+	std::uint64_t files_split = 0;
+	std::uint64_t chunks_searched = 0;
+
+	// Time spent on the work, and waiting in the scheduler for a batch.
+	std::chrono::nanoseconds busy_time{ 0 };
+	std::chrono::nanoseconds queue_wait_time{ 0 };
+
+	// Breakdown of the busy time: opening and reading, matching, and formatting streamed output.
+	std::chrono::nanoseconds read_time{ 0 };
+	std::chrono::nanoseconds match_time{ 0 };
+	std::chrono::nanoseconds output_time{ 0 };
+};
+
+
+/**
+ * Everything one search thread found. Only files with at least one match are recorded.
+ */
+struct ThreadResults {
+	std::thread::id thread_id;
+
+	// The files with matches, referenced by MatchRecord::file_index.
+	std::vector<FileMatches> files;
+
+	// The matches in the order they were found, which is by file and then by line.
+	// Empty when the results were streamed out during the search.
+	std::vector<MatchRecord> matches;
+
+	// The texts of all matching lines, back to back.
+	TextArena text;
+
+	// Every file scanned or taken from the result cache, only kept while a result cache is used.
+	std::vector<ScannedFile> scanned;
+
+	WorkerStats stats;
+
+	/**
+	 * @param match A match found by this thread.
+	 * @return The text of the matching line.
+	 */
+	std::string_view line(const MatchRecord& match) const {
+		return text.view(match.text_offset, match.line_length);
+	}
+};
+
+
+/**
+ * The results of a whole search, one entry per search thread.
+ */
+struct SearchResults {
+	std::vector<ThreadResults> threads;
+
+	// The number of files searched.
+	std::size_t searched_files = 0;
+
+	// The number of threads that searched at the end, which -t auto adapts while searching.
+	int active_threads = 0;
+
+	// Wall time of the directory walk, which overlaps the search in pipelined mode, and of the search itself.
+	std::chrono::nanoseconds walk_time{ 0 };
+	std::chrono::nanoseconds search_time{ 0 };
+
+	// Wall time of bringing the trigram index and the result cache up to date after the search.
+	std::chrono::nanoseconds index_time{ 0 };
+};
+
+
+/**
+ * The counts that the summary of a search reports.
+ */
+struct SearchSummary {
+	std::size_t searched_files = 0;
+	std::uint64_t files_with_pattern = 0;
+	std::uint64_t pattern_occurrences = 0;
+};
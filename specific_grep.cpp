@@ -1,548 +1,3633 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <algorithm>
 #include <fstream>
 #include <filesystem>
 #include <thread>
 #include <future>
 #include <regex>
-#include <set>
 #include <map>
+#include <list>
+#include <cstring>
+#include <cctype>
+#include <charconv>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iomanip>
+#include <functional>
+#include <variant>
+#include <type_traits>
+#include <csignal>
 #include <math.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <signal.h>
+#include <poll.h>
+#endif
+
+#include "file_scheduler.h"
+#include "directory_walker.h"
+#include "file_reader.h"
+#include "batch_reader.h"
+#include "device_limits.h"
+#include "literal_search.h"
+#include "aho_corasick.h"
+#include "regex_search.h"
+#include "case_fold.h"
+#include "search_options.h"
+#include "search_results.h"
+#include "result_stream.h"
+#include "output_file.h"
+#include "result_format.h"
+#include "thread_pool.h"
+#include "thread_tuner.h"
+#include "parallel_sort.h"
+#include "trigram_index.h"
+#include "result_cache.h"
+#include "file_stamp.h"
+#include "file_tree.h"
+#include "query_socket.h"
+#include "decompressor.h"
+
 namespace fs = std::filesystem;
 
-/**
- * Searches for a given string in a vector of files and returns a vector of tuples that contain
- * the thread ID, file path, line number, and line that matches the search string.
- *
- * @param search_string The string to search for.
- * @param files_to_search A vector of file paths to search in.
- * @return A vector of tuples containing thread ID, file path, line number, and line that match the search string.
- */
-std::vector<std::tuple<std::thread::id, std::string, int, std::string>> searchFilesForString(const std::string& search_string, const std::vector<fs::path>& files_to_search) {
-	// Initialize the vector that will contain the search results
-	std::vector<std::tuple<std::thread::id, std::string, int, std::string>> results;
+// Number of batches per search thread the walkers may queue ahead in pipelined mode.
+static const std::size_t PIPELINE_BATCHES_PER_THREAD = 16;
 
-	// Get the ID of the current thread
-	std::thread::id thread_id = std::this_thread::get_id();
+// Number of batches per search thread handed out past the oldest one still searched in ordered streaming mode,
+// whose results the stream holds back until that one is written.
+static const std::size_t ORDERED_BATCHES_PER_THREAD = 4;
 
-	// Loop through each file path in the vector and search for the string
-	for (const auto& file_path : files_to_search) {
-		// Open the file for reading
-		std::ifstream file(file_path);
+// Size from which a search thread hands its formatted results to the writer in streaming mode.
+static const std::size_t STREAM_CHUNK_SIZE = 1024 * 1024;
 
-		// If the file could not be opened, output an error message
-		if (!file.good()) {
-			std::cerr << "Error: could not open file " << file_path.string() << " due to permission issues." << std::endl;
-			continue;
-		}
+// Size of the chunks the result and log files are formatted in before they are written.
+static const std::size_t OUTPUT_CHUNK_SIZE = 1024 * 1024;
 
-		// If the file was successfully opened, read each line and search for the string
-		std::string line;
-		int line_number = 0;
-		while (std::getline(file, line)) {
-			++line_number;
-			if (line.find(search_string) != std::string::npos) {
-				// If the string was found, add the search results to the vector
-				results.emplace_back(thread_id, file_path.filename().stem().string(), line_number, line);
-			}
-		}
-		file.close();
-	}
+// Largest number of files a search thread may read ahead, and all threads together on one device.
+static const unsigned MAX_IO_DEPTH = 1024;
 
-	// Add entry for thread id storage if there was no file with the string in files subset
-	if (results.empty()) {
-		results.emplace_back(thread_id, "", NULL, "");
-	}
+// With -t auto, the threads started for every CPU, among which the tuner picks how many search, and at most.
+static const int AUTO_THREADS_PER_CPU = 4;
+static const int MAX_AUTO_THREADS = 256;
 
-	// Return the vector of search results
-	return results;
-}
+// Largest size of the chunks huge files are split into, and of the size limit of the searched files, in MiB.
+static const std::uint64_t MAX_MEBIBYTES = 1024 * 1024;
 
+// Number of bytes at the start of a file that are checked for a zero byte, which marks the file as binary.
+static const std::size_t BINARY_CHECK_SIZE = 32 * 1024;
+
+// How long a shard of a distributed search may take, as a multiple of the median shard and at least, before it
+// is handed to an idle worker as well, and how often the coordinator looks for such stragglers, in milliseconds.
+static const int STRAGGLER_FACTOR = 3;
+static const std::chrono::milliseconds STRAGGLER_MIN_TIME{ 1000 };
+static const int STRAGGLER_CHECK_MS = 100;
+
+// Set by SIGINT and SIGTERM to stop a server once the current query is answered.
+static volatile std::sig_atomic_t stop_serving = 0;
 
 /**
- * Search a directory and its subdirectories for files containing a given string.
+ * Finds the name of a file without its directory and its last extension, like path.filename().stem(),
+ * without building the two paths and the string those take.
  *
- * @param search_string The string to search for.
- * @param directory_path The path to the directory to search.
- * @param thread_count The number of threads to use for the search.
- * @return A pair containing a vector of tuples representing the search results and an integer representing the total number of files searched.
+ * @param file_path The path of the file.
+ * @param storage Holds the name where the path can not be viewed as narrow characters.
+ * @return The name of the file without extension, valid as long as the path and the storage.
  */
-std::pair<std::vector<std::tuple<std::thread::id, std::string, int, std::string>>, int> searchDirectoryForString(const std::string& search_string, const std::string& directory_path, const int thread_count) {
-	// Create a vector of paths to all regular files in the directory and its subdirectories.
-	std::vector<fs::path> files_to_search;
-	for (const auto& file : fs::recursive_directory_iterator(directory_path)) {
-		if (fs::is_regular_file(file)) {
-			files_to_search.push_back(file.path());
-		}
+std::string_view fileStem(const fs::path& file_path, std::string& storage) {
+#if defined(__unix__) || defined(__APPLE__)
+	std::string_view name = file_path.native();
+	const std::size_t separator = name.find_last_of('/');
+	if (separator != std::string_view::npos) {
+		name.remove_prefix(separator + 1);
 	}
 
-	// Calculate the number of files to search per thread.
-	const int files_per_thread = files_to_search.size() / thread_count;
+	// A name that starts with its only dot, and the names . and .., have no extension
+	const std::size_t dot = name.find_last_of('.');
+	if (dot == std::string_view::npos || dot == 0 || name == "..") {
+		return name;
+	}
+	return name.substr(0, dot);
+#else
+	storage = file_path.filename().stem().string();
+	return storage;
+#endif
+}
 
-	// Create a vector of futures representing the search results for each thread.
-	std::vector<std::future<std::vector<std::tuple<std::thread::id, std::string, int, std::string>>>> futures;
-	for (int i = 0; i < thread_count; ++i) {
-		const int start_index = i * files_per_thread;
-		const int end_index = (i + 1) == thread_count ? files_to_search.size() : (i + 1) * files_per_thread;
-		const std::vector<fs::path> files_subset(files_to_search.begin() + start_index, files_to_search.begin() + end_index);
 
-		// Launch a new thread to search the subset of files.
-		std::future<std::vector<std::tuple<std::thread::id, std::string, int, std::string>>> result = std::async(std::launch::async, searchFilesForString, std::cref(search_string), files_subset);
-		futures.emplace_back(std::move(result));
+/**
+ * Finds how a file is named in the results: by its name without extension in the text format, which is
+ * for reading, and by its full path in the formats for tools.
+ *
+ * @param file_path The path of the file.
+ * @param format The format of the results.
+ * @param storage Holds the name where the path can not be viewed as narrow characters.
+ * @return The name of the file, valid as long as the path and the storage.
+ */
+std::string_view resultName(const fs::path& file_path, ResultFormat format, std::string& storage) {
+	if (format == ResultFormat::Text) {
+		return fileStem(file_path, storage);
 	}
+#if defined(__unix__) || defined(__APPLE__)
+	return file_path.native();
+#else
+	storage = file_path.string();
+	return storage;
+#endif
+}
 
-	// Collect the results from each thread and combine them into a single vector.
-	std::vector<std::tuple<std::thread::id, std::string, int, std::string>> results;
-	for (auto& future : futures) {
-		std::vector<std::tuple<std::thread::id, std::string, int, std::string>> result = future.get();
-		results.insert(results.end(), result.begin(), result.end());
-	}
 
-	// Return a pair containing the search results and the total number of files searched.
-	return std::make_pair(results, files_to_search.size());
+/**
+ * Tells whether a file is binary, like grep does: by a zero byte near its start, which no text file holds.
+ *
+ * @param contents The contents of the file, or their start.
+ * @return True if the start of the contents holds a zero byte.
+ */
+bool isBinary(std::string_view contents) {
+	return memchr(contents.data(), '\0', std::min(contents.size(), BINARY_CHECK_SIZE)) != nullptr;
 }
 
 
 /**
- * Writes the results to a file in the specified format.
- * The results are a vector of tuples, each containing a thread ID, a file path, a line number,
- * and the content of the line.
+ * Appends a binary file with a match to a buffer in the format of the result file, which has no line to show for it.
  *
- * @param output_filename The name of the output file to write to.
- * @param results A vector of tuples containing the results to write to the file.
+ * @param buffer The buffer to append to.
+ * @param file_name The name of the file, without extension.
  */
-void writeResultsToFile(const std::string& output_filename, const std::vector<std::tuple<std::thread::id, std::string, int, std::string>>& results) {
-	// Map to store the file patterns (line numbers and content) for each file.
-	std::map<std::string, std::vector<std::tuple<int, std::string>>> file_patterns_map;
-
-	// Populate the map with file patterns.
-	for (const auto& result : results) {
-		// Extract the relevant values from the tuple.
-		const auto& [thread_id, file_path, line_number, line_content] = result;
+void formatBinaryFile(std::string& buffer, std::string_view file_name) {
+	buffer += "Binary file ";
+	buffer += file_name;
+	buffer += " matches\n";
+}
 
-		// Check that the values are not empty or zero.
-		if (!file_path.empty() && line_number && !line_content.empty()) {
-			// Add the line number and content to the vector for this file path.
-			file_patterns_map[file_path].push_back({ line_number, line_content });
-		}
-	}
 
-	// Sort the patterns for each file by line number.
-	for (auto& [file_path, patterns] : file_patterns_map) {
-		std::sort(patterns.begin(), patterns.end(), [](const auto& lhs, const auto& rhs) {
-			return std::get<0>(lhs) < std::get<0>(rhs);
-			});
+/**
+ * Appends a match to a buffer in the format of the result file.
+ *
+ * @param buffer The buffer to append to.
+ * @param file_name The name of the file, without extension.
+ * @param line_number The number of the matching line.
+ * @param search_string The string found in the line, or nullptr if only one string is searched for.
+ * @param line_content The content of the line.
+ */
+void formatResultLine(std::string& buffer, std::string_view file_name, std::uint64_t line_number, const std::string* search_string, std::string_view line_content) {
+	char number[24];
+	const char* const number_end = std::to_chars(number, number + sizeof(number), line_number).ptr;
+
+	buffer += file_name;
+	buffer += ':';
+	buffer.append(number, number_end - number);
+	buffer += ':';
+	if (search_string != nullptr) {
+		buffer += *search_string;
+		buffer += ':';
 	}
+	buffer += ' ';
+	buffer += line_content;
+	buffer += '\n';
+}
 
-	// Sort the files by number of patterns.
-	std::vector<std::pair<std::string, std::vector<std::tuple<int, std::string>>>> sorted_files(file_patterns_map.begin(), file_patterns_map.end());
-	std::sort(sorted_files.begin(), sorted_files.end(), [](const auto& lhs, const auto& rhs) {
-		return lhs.second.size() > rhs.second.size();
-		});
 
-	// Write the sorted patterns to the output file.
-	std::ofstream output_file(output_filename + ".txt");
-	if (!output_file.is_open()) {
-		std::cerr << "Could not open output file" << std::endl;
-		return;
-	}
+/**
+ * Appends a line shown around a match to a buffer, set apart from the matching lines by dashes instead of colons.
+ *
+ * @param buffer The buffer to append to.
+ * @param file_name The name of the file, without extension.
+ * @param line_number The number of the line.
+ * @param line_content The content of the line.
+ */
+void formatContextLine(std::string& buffer, std::string_view file_name, std::uint64_t line_number, std::string_view line_content) {
+	char number[24];
+	const char* const number_end = std::to_chars(number, number + sizeof(number), line_number).ptr;
+
+	buffer += file_name;
+	buffer += '-';
+	buffer.append(number, number_end - number);
+	buffer += "- ";
+	buffer += line_content;
+	buffer += '\n';
+}
 
-	// Iterate over each file's patterns and write them to the output file.
-	for (const auto& [file_path, patterns] : sorted_files) {
-		for (const auto& [line_number, line_content] : patterns) {
-			// Write the file path, line number, and content in the specified format.
-			output_file << file_path << ":" << line_number << ": " << line_content << std::endl;
-		}
-	}
 
-	output_file.close();
+/**
+ * Tells whether a record of a file starts a new group of lines, which a separator line sets apart from the
+ * group before it. Groups only exist with context lines: without them no two records follow each other
+ * without a gap that involves one.
+ *
+ * @param previous The record before it in the same file.
+ * @param record The record.
+ * @return True if a separator goes between them.
+ */
+bool startsContextGroup(const MatchRecord& previous, const MatchRecord& record) {
+	return record.line_number != previous.line_number + 1 && (record.pattern_index == CONTEXT_LINE || previous.pattern_index == CONTEXT_LINE);
 }
 
 
 /**
- * Writes log information to a file.
+ * Appends a file with matches to a buffer in the format of the result file of the count and list-files modes.
  *
- * @param filename The name of the file to write to.
- * @param results A vector of tuples containing log information for each thread.
+ * @param buffer The buffer to append to.
+ * @param file The file with its number of matching lines.
+ * @param count Whether to write the number of matching lines after the path.
+ * @param format The format of the results.
  */
-void writeLogToFile(const std::string& filename, const std::vector<std::tuple<std::thread::id, std::string, int, std::string>>& results) {
-	// Open the output file for writing.
-	std::ofstream output_file(filename + ".log");
-	if (!output_file.is_open()) {
-		std::cerr << "Unable to open file for writing: " << filename << std::endl;
+void formatResultFile(std::string& buffer, const FileMatches& file, bool count, ResultFormat format) {
+	if (format != ResultFormat::Text) {
+		std::string path_storage;
+		ResultEntry entry{ count ? ResultType::Count : ResultType::File, resultName(file.path, format, path_storage) };
+		entry.line_number = file.match_count;
+		format == ResultFormat::Json ? formatJsonEntry(buffer, entry) : formatBinaryEntry(buffer, entry);
 		return;
 	}
-
-	// Create a map to store the files associated with each thread.
-	std::map<std::thread::id, std::vector<std::string>> threads_to_files;
-
-	// Populate the map with file names for each thread.
-	for (const auto& result : results) {
-		std::thread::id thread_id = std::get<0>(result);
-		std::string file_name = std::get<1>(result);
-		threads_to_files[thread_id].push_back(file_name);
+#if defined(__unix__) || defined(__APPLE__)
+	buffer += file.path.native();
+#else
+	buffer += file.path.string();
+#endif
+	if (count) {
+		char number[24];
+		const char* const number_end = std::to_chars(number, number + sizeof(number), file.match_count).ptr;
+		buffer += ':';
+		buffer.append(number, number_end - number);
 	}
+	buffer += '\n';
+}
 
-	// Convert the map to a vector of pairs.
-	std::vector<std::pair<std::thread::id, std::vector<std::string>>> thread_file_pairs;
-	std::copy(threads_to_files.begin(), threads_to_files.end(), std::back_inserter(thread_file_pairs));
 
-	// Sort the vector of thread-file pairs by the number of files associated with each thread.
-	std::sort(thread_file_pairs.begin(), thread_file_pairs.end(), [](const auto& lhs, const auto& rhs) {
-		if (lhs.second[0] == "" && rhs.second[0] != "") {
-			return false;
-		}
-		else if (lhs.second[0] != "" && rhs.second[0] == "") {
-			return true;
-		}
-		else {
-			return lhs.second.size() > rhs.second.size();
+/**
+ * Appends a record of a file to a buffer in the format of the results. In the text format of a binary file only
+ * the fact that it matches is shown, a separator sets the groups of context lines apart, and empty matching lines
+ * are left out, which have no content to show. The formats for tools write every record as it is.
+ *
+ * @param buffer The buffer to append to.
+ * @param format The format of the results.
+ * @param thread The results of the thread that found the record, which hold its text.
+ * @param file The file of the record.
+ * @param file_name The name of the file in the results, from resultName().
+ * @param previous The record before it in the same file, nullptr for the first one.
+ * @param record The record, a matching line or a line around one.
+ * @param search_strings The strings searched for.
+ */
+void formatRecord(std::string& buffer, ResultFormat format, const ThreadResults& thread, const FileMatches& file, std::string_view file_name,
+	const MatchRecord* previous, const MatchRecord& record, const std::vector<std::string>& search_strings) {
+	if (format != ResultFormat::Text) {
+		ResultEntry entry{ file.binary ? ResultType::BinaryFile : record.pattern_index == CONTEXT_LINE ? ResultType::Context : ResultType::Match, file_name };
+		if (record.pattern_index != CONTEXT_LINE) {
+			entry.pattern = &search_strings[record.pattern_index];
 		}
-		});
-
-	// Write the sorted thread-file pairs to the output file.
-	for (const auto& [thread_id, file_names] : thread_file_pairs) {
-		output_file << thread_id << ":";
-		for (const auto& file_name : file_names) {
-			output_file << " " << file_name << ",";
+		entry.pattern_index = record.pattern_index;
+		entry.line_number = record.line_number;
+		entry.byte_offset = record.byte_offset;
+		if (!file.binary) {
+			entry.text = thread.line(record);
 		}
-		// Remove the trailing comma and add a newline character.
-		output_file.seekp(-1, std::ios_base::end);
-		output_file << std::endl;
+		format == ResultFormat::Json ? formatJsonEntry(buffer, entry) : formatBinaryEntry(buffer, entry);
+		return;
 	}
 
-	// Close the output file.
-	output_file.close();
+	if (file.binary) {
+		formatBinaryFile(buffer, file_name);
+		return;
+	}
+	if (previous != nullptr && startsContextGroup(*previous, record)) {
+		buffer += "--\n";
+	}
+	if (record.pattern_index == CONTEXT_LINE) {
+		formatContextLine(buffer, file_name, record.line_number, thread.line(record));
+	}
+	else if (record.line_length != 0) {
+		formatResultLine(buffer, file_name, record.line_number, search_strings.size() > 1 ? &search_strings[record.pattern_index] : nullptr, thread.line(record));
+	}
 }
 
 
 /**
-* Print the search results to the console, including the number of searched files,
-* the number of files containing the search pattern, the number of unique pattern occurrences,
-* the name of the result file, the name of the log file, the number of threads used in the search,
-* and the elapsed time.
-*
-* @param results A pair consisting of the search results and the number of searched files.
-* @param thread_count The number of threads used in the search.
-* @param log_filename The name of the log file to be generated.
-* @param result_filename The name of the result file to be generated.
-* @param timer_start The time at which the search began.
-*/
-void printSearchResults(const std::pair<std::vector<std::tuple<std::thread::id, std::string, int, std::string>>, int>& results, int thread_count, std::string log_filename, std::string result_filename, int& timer_start) {
-	// Extract search results.
-	std::vector<std::tuple<std::thread::id, std::string, int, std::string>> results_vector = results.first;
-
-	// Print number of searched files.
-	std::cout << "Searched files: " << results.second << std::endl;
-
-	// Count files with pattern and pattern occurrences.
-	std::set<std::string> files_with_pattern;
-	std::set<std::tuple<std::string, int>> pattern_occurrences;
-	for (const auto& result : results_vector) {
-		if (std::get<2>(result) != 0) {
-			files_with_pattern.insert(std::get<1>(result));
-			pattern_occurrences.insert(std::make_tuple(std::get<1>(result), std::get<2>(result)));
-		}
+ * Formats the matches a thread holds into a buffer and drops them, so they do not pile up in streaming mode.
+ *
+ * @param results The results of the searching thread.
+ * @param search_strings The strings searched for.
+ * @param format The format of the results.
+ * @param buffer The buffer to append the formatted matches to.
+ */
+void moveMatchesToStreamBuffer(ThreadResults& results, const std::vector<std::string>& search_strings, ResultFormat format, std::string& buffer) {
+	if (results.matches.empty()) {
+		return;
 	}
 
-	// Print number of files with pattern and number of unique pattern occurrences.
-	std::cout << "Files with pattern: " << files_with_pattern.size() << std::endl;
-	std::cout << "Patterns number: " << pattern_occurrences.size() << std::endl;
-
-	// Get current directory.
-	std::string cur_directory = fs::current_path().string();
-
-	// Print name of result file and log file, number of threads used, and elapsed time.
-	std::cout << "Result file: " << cur_directory << "\\" << result_filename << ".txt" << std::endl;
-	std::cout << "Log file: " << cur_directory << "\\" << log_filename << ".log" << std::endl;
-	std::cout << "Used threads: " << thread_count << std::endl;
+	// All held matches belong to the file searched last
+	std::string name_storage;
+	const FileMatches& file = results.files.back();
+	const std::string_view file_name = resultName(file.path, format, name_storage);
+	for (std::size_t i = 0; i < results.matches.size(); ++i) {
+		formatRecord(buffer, format, results, file, file_name, i > 0 ? &results.matches[i - 1] : nullptr, results.matches[i], search_strings);
+	}
 
-	// Stop the timer and calculate the elapsed time of the program
-	int timer_stop = clock();
-	double elapsed_time_ms = (timer_stop - timer_start) / (double)CLOCKS_PER_SEC * 1000;
-	std::cout << "Elapsed time: " << elapsed_time_ms << "[ms]" << std::endl;
+	results.matches.clear();
+	results.text.clear();
 }
 
-
 /**
- * Determines if a given filename is valid, meaning it contains only alphanumeric
- * characters, hyphens, dots, and spaces.
+ * Adds the first matches of a cached file to the results of the thread, as if they were just found.
  *
- * @param filename the filename to validate
- * @return true if the filename is valid, false otherwise
+ * @param results The results of the searching thread.
+ * @param cached The cached results of the file.
+ * @param count The number of cached matches to add.
+ * @return The index of the file in the results, or -1 if no match was added.
  */
-bool isValidFilename(const std::string& filename) {
-	// Define a regular expression pattern to match characters that are not alphanumeric,
-	// hyphens, dots, or spaces.
-	static const std::regex pattern("[^\\w\\-. ]");
+std::int64_t addCachedMatches(ThreadResults& results, const CachedFile& cached, std::size_t count) {
+	if (count == 0) {
+		return -1;
+	}
 
-	// Use regex_search to check if the filename contains any invalid characters.
-	// If the search returns true, it means the filename is invalid, so return false.
-	// If the search returns false, it means the filename is valid, so return true.
-	return !std::regex_search(filename, pattern);
+	results.files.push_back({ fs::path(), count, results.matches.size() });
+	for (std::size_t i = 0; i < count; ++i) {
+		MatchRecord record = cached.matches[i];
+		record.file_index = static_cast<std::uint32_t>(results.files.size() - 1);
+		record.text_offset = results.text.append(std::string_view(cached.text).substr(cached.matches[i].text_offset, record.line_length));
+		results.matches.push_back(record);
+	}
+	return results.files.size() - 1;
 }
 
 
 /**
- * Sets the starting directory for the program.
- *
- * @param dir_opt A reference to a boolean that tracks whether the directory option has already been set.
- * @param directory_path A reference to a string that stores the path of the starting directory.
- * @param argv The command line arguments.
- * @param i The index of the current option.
- *
- * @return True on success, false on error.
+ * Output policy of a binary file in the mode that keeps the matching lines. A binary file has no lines
+ * worth showing, and they may be huge, so only its first match is recorded, without any text, and the
+ * rest of the file is not searched.
  */
-bool setStartingDirectory(bool& dir_opt, std::string& directory_path, char* argv[], int i)
-{
-	// Check if the directory option has already been set
-	if (dir_opt == true) {
-		std::cerr << "Error: multiple usage of the starting directory option" << std::endl;
+struct MatchingBinary {
+	static const bool LINE_NUMBERS = false;
+	static const bool RESULT_PER_LINE = false;
+
+	static bool addMatch(ThreadResults& results, bool& file_recorded, std::size_t pattern_index, std::uint64_t,
+		std::string_view contents, const char* line_begin, const char*) {
+		results.files.push_back({ fs::path(), 1, results.matches.size(), true });
+		file_recorded = true;
+		MatchRecord record{};
+		record.file_index = static_cast<std::uint32_t>(results.files.size() - 1);
+		record.pattern_index = static_cast<std::uint32_t>(pattern_index);
+		record.byte_offset = line_begin - contents.data();
+		results.matches.push_back(record);
 		return false;
 	}
+};
 
-	// Append the directory to the current directory path
-	directory_path = directory_path + "\\" + argv[i * 2 + 1];
 
-	// Check if the directory exists
-	if (!fs::exists(directory_path)) {
-		if (!fs::exists(argv[i * 2 + 1])) {
-			std::cerr << "Error: directory does not exist" << std::endl;
-			return false;
+/**
+ * Output policy that keeps every matching line: its number, its position, and its text, for the result file
+ * and the stream. The file loop is instantiated for each policy, so what it records costs no branch per line.
+ * The policies record a file without its path, which the file loop moves over from the batch afterwards.
+ */
+struct MatchingLines {
+	// Whether the numbers of the matching lines are needed.
+	static const bool LINE_NUMBERS = true;
+
+	// Whether every matching line is a result of its own, which a limit on the results counts, rather than its file.
+	static const bool RESULT_PER_LINE = true;
+
+	// The policy a binary file is searched with, which only has to find its first match.
+	using Binary = MatchingBinary;
+
+	/**
+	 * Records a matching line.
+	 *
+	 * @param results The results of the searching thread to add the match to.
+	 * @param file_recorded Whether the file is already the last one in the results, set once it is.
+	 * @param pattern_index The index of the string found in the line.
+	 * @param line_number The number of the line.
+	 * @param contents The contents of the file.
+	 * @param line_begin The first byte of the line.
+	 * @param line_end The end of the line, without its newline.
+	 * @return Whether the rest of the file still has to be searched.
+	 */
+	static bool addMatch(ThreadResults& results, bool& file_recorded, std::size_t pattern_index, std::uint64_t line_number,
+		std::string_view contents, const char* line_begin, const char* line_end) {
+		// Record the file on its first match, and the line with its text appended to the thread's arena
+		if (!file_recorded) {
+			results.files.push_back({ fs::path(), 0, results.matches.size() });
+			file_recorded = true;
 		}
-		directory_path = argv[i * 2 + 1];
+		++results.files.back().match_count;
+		MatchRecord record;
+		record.file_index = static_cast<std::uint32_t>(results.files.size() - 1);
+		record.pattern_index = static_cast<std::uint32_t>(pattern_index);
+		record.line_number = line_number;
+		record.byte_offset = line_begin - contents.data();
+		record.line_length = line_end - line_begin;
+		record.text_offset = results.text.append(std::string_view(line_begin, line_end - line_begin));
+		results.matches.push_back(record);
+		return true;
 	}
 
-	// Set the directory option to true indicating that this option has been set
-	dir_opt = true;
+	/**
+	 * Records the first matches of a cached file, as if they were just found.
+	 *
+	 * @param results The results of the searching thread.
+	 * @param cached The cached results of the file.
+	 * @param count The number of cached matches to add.
+	 * @return The index of the file in the results, or -1 if no match was added.
+	 */
+	static std::int64_t addCached(ThreadResults& results, const CachedFile& cached, std::size_t count) {
+		return addCachedMatches(results, cached, count);
+	}
 
-	return true;
-}
+	/**
+	 * Records the matches another thread found in a chunk of a split file, as if they were just found.
+	 *
+	 * @param results The results of the searching thread.
+	 * @param file_recorded Whether the file is already the last one in the results, set once it is.
+	 * @param chunk The results of the chunk, with line numbers counted from the start of the chunk.
+	 * @param first_line The number of the first line of the chunk.
+	 * @return Whether the chunks after this one still have to be added.
+	 */
+	static bool addChunk(ThreadResults& results, bool& file_recorded, const ThreadResults& chunk, std::uint64_t first_line) {
+		if (chunk.files.empty()) {
+			return true;
+		}
+		if (!file_recorded) {
+			results.files.push_back({ fs::path(), 0, results.matches.size() });
+			file_recorded = true;
+		}
+		results.files.back().match_count += chunk.files.front().match_count;
+		for (const auto& match : chunk.matches) {
+			MatchRecord record = match;
+			record.file_index = static_cast<std::uint32_t>(results.files.size() - 1);
+			record.line_number += first_line - 1;
+			record.text_offset = results.text.append(chunk.line(match));
+			results.matches.push_back(record);
+		}
+		return true;
+	}
+
+	/**
+	 * Formats what a thread found since the last call into a buffer for the stream.
+	 *
+	 * @param results The results of the searching thread.
+	 * @param search_strings The strings searched for.
+	 * @param format The format of the results.
+	 * @param streamed_files The number of files of the thread formatted already.
+	 * @param buffer The buffer to append to.
+	 */
+	static void moveToStreamBuffer(ThreadResults& results, const std::vector<std::string>& search_strings, ResultFormat format, std::size_t& streamed_files, std::string& buffer) {
+		moveMatchesToStreamBuffer(results, search_strings, format, buffer);
+		streamed_files = results.files.size();
+	}
+};
 
 
 /**
- * Sets the log filename and checks if it is a valid filename.
- *
- * @param log_filename_opt A boolean reference indicating if the log filename option has already been set.
- * @param log_filename A string reference to store the log filename.
- * @param argv A character array containing the command line arguments.
- * @param i The index of the current argument being processed.
- *
- * @return True on success, false on error.
+ * Output policy of the count mode, which keeps the number of matching lines of every file and nothing of the lines themselves.
  */
-bool setLogFilename(bool& log_filename_opt, std::string& log_filename, char* argv[], int i)
-{
-	// Check if option already used
-	if (log_filename_opt == true) {
-		std::cerr << "Error: multiple usage of the log filename option" << std::endl;
-		return false;
+struct MatchCounts {
+	static const bool LINE_NUMBERS = false;
+	static const bool RESULT_PER_LINE = false;
+
+	// Counting builds no lines, so a binary file is counted like any other.
+	using Binary = MatchCounts;
+
+	static bool addMatch(ThreadResults& results, bool& file_recorded, std::size_t, std::uint64_t,
+		std::string_view, const char*, const char*) {
+		if (!file_recorded) {
+			results.files.push_back({ fs::path(), 0, 0 });
+			file_recorded = true;
+		}
+		++results.files.back().match_count;
+		return true;
 	}
 
-	// Set log filename and check if valid
-	log_filename = argv[i * 2 + 1];
-	if (!isValidFilename(log_filename)) {
-		std::cerr << "Error: invalid log filename" << std::endl;
-		return false;
+	static std::int64_t addCached(ThreadResults& results, const CachedFile&, std::size_t count) {
+		if (count == 0) {
+			return -1;
+		}
+		results.files.push_back({ fs::path(), count, 0 });
+		return results.files.size() - 1;
 	}
 
-	// Set log filename option to true indicating that this option has been set
-	log_filename_opt = true;
+	static bool addChunk(ThreadResults& results, bool& file_recorded, const ThreadResults& chunk, std::uint64_t) {
+		if (chunk.files.empty()) {
+			return true;
+		}
+		if (!file_recorded) {
+			results.files.push_back({ fs::path(), 0, 0 });
+			file_recorded = true;
+		}
+		results.files.back().match_count += chunk.files.front().match_count;
+		return true;
+	}
 
-	return true;
-}
+	static void moveToStreamBuffer(ThreadResults& results, const std::vector<std::string>&, ResultFormat format, std::size_t& streamed_files, std::string& buffer) {
+		for (; streamed_files < results.files.size(); ++streamed_files) {
+			formatResultFile(buffer, results.files[streamed_files], true, format);
+		}
+	}
+};
 
 
 /**
- * Sets the result filename option and checks if the option has already been set
- * and if the filename is valid.
- *
- * @param result_filename_opt A boolean flag to indicate if the result filename option has been set.
- * @param result_filename A reference to the string that will hold the result filename.
- * @param argv The command line arguments.
- * @param i The index of the current argument being processed.
- *
- * @return True on success, false on error.
+ * Output policy of the list-files mode, which only keeps the files with a match and stops reading a file at its first one.
  */
-bool setResultFilename(bool& result_filename_opt, std::string& result_filename, char* argv[], int i)
-{
-	// Check if option already used
-	if (result_filename_opt == true) {
-		std::cerr << "Error: multiple usage of the result filename option" << std::endl;
+struct MatchingFiles {
+	static const bool LINE_NUMBERS = false;
+	static const bool RESULT_PER_LINE = false;
+
+	using Binary = MatchingFiles;
+
+	static bool addMatch(ThreadResults& results, bool& file_recorded, std::size_t, std::uint64_t,
+		std::string_view, const char*, const char*) {
+		if (!file_recorded) {
+			results.files.push_back({ fs::path(), 1, 0 });
+			file_recorded = true;
+		}
 		return false;
 	}
 
-	// Set result filename and check if valid
-	result_filename = argv[i * 2 + 1];
-	if (!isValidFilename(result_filename)) {
-		std::cerr << "Error: invalid result filename" << std::endl;
-		return false;
+	static std::int64_t addCached(ThreadResults& results, const CachedFile&, std::size_t count) {
+		if (count == 0) {
+			return -1;
+		}
+		results.files.push_back({ fs::path(), 1, 0 });
+		return results.files.size() - 1;
 	}
 
-	// Set result filename option to true indicating that this option has been set
-	result_filename_opt = true;
+	static bool addChunk(ThreadResults& results, bool& file_recorded, const ThreadResults& chunk, std::uint64_t) {
+		if (chunk.files.empty()) {
+			return true;
+		}
+		if (!file_recorded) {
+			results.files.push_back({ fs::path(), 1, 0 });
+			file_recorded = true;
+		}
+		return false;
+	}
 
-	return true;
-}
+	static void moveToStreamBuffer(ThreadResults& results, const std::vector<std::string>&, ResultFormat format, std::size_t& streamed_files, std::string& buffer) {
+		for (; streamed_files < results.files.size(); ++streamed_files) {
+			formatResultFile(buffer, results.files[streamed_files], false, format);
+		}
+	}
+};
 
 
 /**
- * Sets the number of threads to be used in the program.
- *
- * @param thread_cnt_opt A boolean flag indicating whether the thread count option has already been set.
- * @param thread_cnt An integer indicating the number of threads to be used in the program.
- * @param argv The command-line arguments.
- * @param i The index of the current argument being processed.
- *
- * @return True on success, false on error.
+ * The limits on the matches of a search: the matching lines kept of every file, and the results kept of the
+ * whole search. The threads take the results one at a time as they find them, so the search keeps exactly
+ * as many as allowed however the files are spread, and stops once none are left.
  */
-bool setThreadCount(bool& thread_cnt_opt, int& thread_cnt, char* argv[], int i)
-{
-	// Check if option already used
-	if (thread_cnt_opt == true) {
-		std::cerr << "Error: multiple usage of the thread count option" << std::endl;
-		return false;
+class MatchLimits {
+public:
+	/**
+	 * @param per_file The most matching lines of a file, 0 for no limit.
+	 * @param results The most results of the search, 0 for no limit.
+	 */
+	MatchLimits(std::uint64_t per_file, std::uint64_t results) : per_file_(per_file), results_(results) {
 	}
 
-	// Set thread count and catch invalid argument
-	try {
-		thread_cnt = std::stoi(argv[i * 2 + 1]);
-	}
-	catch (const std::invalid_argument& e) {
-		std::cerr << "Error: invalid thread count" << std::endl;
-		return false;
+	/**
+	 * @return The most matching lines of a file, 0 for no limit.
+	 */
+	std::uint64_t perFile() const { return per_file_; }
+
+	/**
+	 * @return The number of results still to take, or 0 if their number is not limited.
+	 */
+	std::uint64_t remaining() const {
+		const std::uint64_t taken = taken_.load(std::memory_order_relaxed);
+		return results_ == 0 ? 0 : taken < results_ ? results_ - taken : 0;
 	}
 
-	// Check if thread count is valid
-	if (thread_cnt < 1) {
-		std::cerr << "Error: invalid thread count" << std::endl;
-		return 1;
+	/**
+	 * @return Whether all results have been taken, after which the search stops.
+	 */
+	bool exhausted() const { return results_ != 0 && taken_.load(std::memory_order_relaxed) >= results_; }
+
+	/**
+	 * Takes results for matches to keep.
+	 *
+	 * @param count The number of results wanted.
+	 * @return The number of results taken, fewer than wanted once they run out.
+	 */
+	std::uint64_t take(std::uint64_t count) {
+		if (results_ == 0) {
+			return count;
+		}
+		const std::uint64_t taken = taken_.fetch_add(count, std::memory_order_relaxed);
+		return taken >= results_ ? 0 : std::min(count, results_ - taken);
 	}
 
-	thread_cnt_opt = true;
+private:
+	const std::uint64_t per_file_;
+	const std::uint64_t results_;
+	std::atomic<std::uint64_t> taken_ = 0;
+};
 
-	return true;
+
+/**
+ * Cuts matches that a file gets all at once, from the result cache or a chunk of a split file, down to the limits,
+ * and takes the results they are.
+ *
+ * @param limits The limits of the search, or nullptr for none.
+ * @param count The number of matches.
+ * @param recorded The number of matches the file has so far.
+ * @return The number of matches to keep.
+ */
+template <typename Output>
+std::uint64_t limitMatches(MatchLimits* limits, std::uint64_t count, std::uint64_t recorded) {
+	if (limits == nullptr || count == 0) {
+		return count;
+	}
+	if (limits->perFile() != 0) {
+		count = std::min(count, limits->perFile() > recorded ? limits->perFile() - recorded : 0);
+	}
+	if (count == 0) {
+		return 0;
+	}
+	if constexpr (Output::RESULT_PER_LINE) {
+		return limits->take(count);
+	}
+	else {
+		return recorded > 0 || limits->take(1) == 1 ? count : 0;
+	}
 }
 
 
 /**
- * Sets additional options for the program based on the provided command line arguments.
- *
- * @param argc The number of command line arguments.
- * @param filename The name of the program.
- * @param argv An array of the command line arguments.
- * @param directory_path The directory to search in.
- * @param log_filename The name of the log file.
- * @param result_filename The name of the result file.
- * @param thread_cnt The number of threads to use.
+ * Searches the raw contents of a file for the search strings and hands every line containing one of them to the output policy.
+ * The bytes are scanned for the strings directly, the surrounding line is only looked up on a hit, and the
+ * line numbers are found by counting the newlines between hits in bulk. Lines are split at '\n' exactly like
+ * std::getline does.
  *
- * @return True on success, false on error.
+ * @param searcher The searcher for the strings to search for: a ByteSearcher, a LiteralSearcher, an AhoCorasickSearcher, or a RegexSearcher.
+ * @param contents The contents of the file.
+ * @param results The results of the searching thread to add the matches to.
+ * @param start_offset The position to start at, which has to be the start of a line.
+ * @param start_line The number of the line starting at start_offset.
+ * @param file_recorded Whether the file is already the last one in the results, with matches before start_offset.
+ * @param limits The limits on the matches, or nullptr for none.
+ * @return Whether the output needs the contents after these, false once it stopped at a match or a limit.
  */
-bool setAdditionalOptions(int argc, std::string& filename, char* argv[], std::string& directory_path, std::string& log_filename, std::string& result_filename, int& thread_cnt)
-{
-	// If no arguments are given or the number of arguments is invalid, print an error message and exit
-	if (argc == 1) {
-		std::cerr << "Error: wrong usage of the program\n"
-			<< "Usage: " << filename << " <search string> [options]\n"
-			<< "Options:\n"
-			<< "  -d <directory> - directory to search in (default: current directory)\n"
-			<< "  -l <log filename> - log filename (default: <program name>.log)\n"
-			<< "  -r <result filename> - result filename (default: <program name>.txt)\n"
-			<< "  -t <thread count> - number of threads to use (default: 4)\n";
+template <typename Output, typename Searcher>
+bool searchContentsForString(const Searcher& searcher, std::string_view contents, ThreadResults& results,
+	std::size_t start_offset = 0, std::uint64_t start_line = 1, bool file_recorded = false, MatchLimits* limits = nullptr) {
+	// A file that has all the matches it may keep already is not searched any further
+	const std::uint64_t per_file = limits != nullptr ? limits->perFile() : 0;
+	if (per_file != 0 && file_recorded && results.files.back().match_count >= per_file) {
 		return false;
 	}
 
-	if (!(argc % 2 == 0) || argc > 10) {
-		std::cerr << "Error: wrong number of arguments" << std::endl;
-		return false;
-	}
+	const char* const contents_end = contents.data() + contents.size();
+	const char* counted_up_to = contents.data() + start_offset;
+	std::uint64_t line_number = start_line;
+
+	std::size_t position = start_offset;
+	while (position < contents.size()) {
+		// Find the next occurrence, which is only possible while the rest of the file still holds a line
+		std::size_t pattern_index = 0;
+		const std::size_t match = searcher.find(contents, position, pattern_index);
+		if (match == std::string_view::npos) {
+			break;
+		}
 
-	// Calculate the number of additional options passed
-	int additional_options_cnt = (argc - 2) / 2;
-	bool dir_opt = false, log_filename_opt = false, result_filename_opt = false, thread_cnt_opt = false;
+		// Find the boundaries of the line containing the match
+		const char* const match_ptr = contents.data() + match;
+		const char* line_begin = match_ptr;
+		while (line_begin > counted_up_to && line_begin[-1] != '\n') {
+			--line_begin;
+		}
+		const char* line_end = static_cast<const char*>(memchr(match_ptr, '\n', contents_end - match_ptr));
+		if (line_end == nullptr) {
+			line_end = contents_end;
+		}
+
+		// Count the lines skipped since the previous match in one go, unless the output has no use for them
+		if constexpr (Output::LINE_NUMBERS) {
+			line_number += std::count(counted_up_to, line_begin, '\n');
+		}
+
+		// Take the result the line is, or the file with its first line, and stop once the search has none left
+		if (limits != nullptr && (Output::RESULT_PER_LINE || !file_recorded) && limits->take(1) == 0) {
+			return false;
+		}
+
+		// Hand the line to the output, which may not need the rest of the file, nor does a file at its limit
+		if (!Output::addMatch(results, file_recorded, pattern_index, line_number, contents, line_begin, line_end)) {
+			return false;
+		}
+		if (per_file != 0 && results.files.back().match_count >= per_file) {
+			return false;
+		}
+
+		// Continue after the end of the matching line
+		if (line_end == contents_end) {
+			break;
+		}
+		counted_up_to = line_end + 1;
+		++line_number;
+		position = counted_up_to - contents.data();
+	}
+	return true;
+}
+
+
+/**
+ * Returns where a chunk of a split file starts: at the first line that starts at or after its nominal start.
+ * Every thread finds the same boundaries, so each line belongs to exactly one chunk.
+ *
+ * @param contents The contents of the file.
+ * @param start_offset The start of the first chunk, which is the start of a line.
+ * @param chunk_size The nominal size of a chunk.
+ * @param chunk The index of the chunk, the chunk count for the end of the last one.
+ * @param chunk_count The number of chunks.
+ * @return The position of the first byte of the chunk.
+ */
+std::size_t chunkStart(std::string_view contents, std::size_t start_offset, std::uint64_t chunk_size, std::size_t chunk, std::size_t chunk_count) {
+	if (chunk == 0) {
+		return start_offset;
+	}
+	if (chunk == chunk_count) {
+		return contents.size();
+	}
+	const std::size_t nominal = start_offset + chunk * chunk_size;
+	if (contents[nominal - 1] == '\n') {
+		return nominal;
+	}
+	const char* newline = static_cast<const char*>(memchr(contents.data() + nominal, '\n', contents.size() - nominal));
+	return newline != nullptr ? newline + 1 - contents.data() : contents.size();
+}
+
+
+/**
+ * Searches a huge file together with the threads that run out of work, in chunks of whole lines, with the
+ * same results as searchContentsForString. Every chunk is searched with its lines numbered from 1 and its
+ * newlines counted, then the chunks are added in order, numbered on from the newlines of those before them.
+ *
+ * @param searcher The searcher of the calling thread.
+ * @param scheduler The scheduler to share the chunks through.
+ * @param contents The contents of the file.
+ * @param results The results of the searching thread to add the matches to.
+ * @param start_offset The position to start at, which has to be the start of a line.
+ * @param start_line The number of the line starting at start_offset.
+ * @param file_recorded Whether the file is already the last one in the results, with matches before start_offset.
+ * @param chunk_size The nominal size of a chunk.
+ * @param count_lines Whether to count the lines even where the output needs no line numbers.
+ * @param line_count Receives the number of newlines after start_offset if they were counted.
+ * @param limits The limits on the matches, or nullptr for none.
+ * @return The number of chunks the calling thread searched.
+ */
+template <typename Output, typename Searcher>
+std::size_t searchSplitContents(const Searcher& searcher, FileScheduler& scheduler, std::string_view contents, ThreadResults& results,
+	std::size_t start_offset, std::uint64_t start_line, bool file_recorded, std::uint64_t chunk_size, bool count_lines, std::uint64_t& line_count,
+	MatchLimits* limits) {
+	const std::size_t chunk_count = (contents.size() - start_offset) / chunk_size;
+	const bool lines_needed = Output::LINE_NUMBERS || count_lines;
+	std::vector<ThreadResults> chunk_results(chunk_count);
+	std::vector<std::uint64_t> chunk_lines(chunk_count, 0);
+
+	// The chunks take no results, they are taken as the chunks are added in order, but no chunk needs more
+	// matches than the file may keep or the search has left
+	std::uint64_t chunk_cap = limits != nullptr ? limits->perFile() : 0;
+	if (limits != nullptr && Output::RESULT_PER_LINE && limits->remaining() > 0) {
+		chunk_cap = chunk_cap == 0 ? limits->remaining() : std::min(chunk_cap, limits->remaining());
+	}
+	MatchLimits chunk_limits(chunk_cap, 0);
+
+	// The first chunk at which the output stops, the chunks after it are not searched anymore
+	std::atomic<std::size_t> stop_chunk = chunk_count;
+
+	// Every thread searches with its own searcher, the chunks only share the contents
+	auto search_chunk = [&](std::size_t chunk, const void* chunk_searcher) {
+		const std::size_t begin = chunkStart(contents, start_offset, chunk_size, chunk, chunk_count);
+		const std::size_t end = chunkStart(contents, start_offset, chunk_size, chunk + 1, chunk_count);
+		if (lines_needed) {
+			chunk_lines[chunk] = std::count(contents.data() + begin, contents.data() + end, '\n');
+		}
+		if (begin == end || chunk > stop_chunk.load(std::memory_order_relaxed) || (limits != nullptr && limits->exhausted())) {
+			return;
+		}
+		if (!searchContentsForString<Output>(*static_cast<const Searcher*>(chunk_searcher), contents.substr(0, end), chunk_results[chunk], begin, 1, false,
+			chunk_cap != 0 ? &chunk_limits : nullptr)) {
+			std::size_t stop = stop_chunk.load(std::memory_order_relaxed);
+			while (chunk < stop && !stop_chunk.compare_exchange_weak(stop, chunk, std::memory_order_relaxed)) {
+			}
+		}
+	};
+	auto split = std::make_shared<SplitFile>(chunk_count, search_chunk);
+	scheduler.share(split);
+	const std::size_t searched = split->searchChunks(&searcher);
+	split->wait();
+
+	// Add the chunks in order, each one numbered on from the lines before it, up to the one the output or a limit stops at
+	std::uint64_t first_line = start_line;
+	for (std::size_t chunk = 0; chunk < chunk_count; ++chunk) {
+		ThreadResults& found = chunk_results[chunk];
+		bool last = false;
+		if (limits != nullptr && !found.files.empty()) {
+			const std::uint64_t count = found.files.front().match_count;
+			const std::uint64_t kept = limitMatches<Output>(limits, count, file_recorded ? results.files.back().match_count : 0);
+			if (kept == 0) {
+				break;
+			}
+			last = kept < count;
+			found.files.front().match_count = kept;
+			if (found.matches.size() > kept) {
+				found.matches.resize(kept);
+			}
+		}
+		if (!Output::addChunk(results, file_recorded, found, first_line) || last) {
+			break;
+		}
+		first_line += chunk_lines[chunk];
+	}
+	line_count = 0;
+	for (const std::uint64_t lines : chunk_lines) {
+		line_count += lines;
+	}
+	return searched;
+}
+
+
+/**
+ * What the context lines of a file searched in parts carry from one part to the next.
+ */
+struct ContextCarry {
+	// The lines after the last match that still have to be shown at the start of the next part.
+	std::uint64_t after_left = 0;
+
+	// The last lines of the part that were not shown, for the lines before the first match of the next part.
+	std::string tail;
+};
+
+
+/**
+ * Finds where the last lines of some text start.
+ *
+ * @param text_begin The start of the text, or of the lines that may be taken.
+ * @param text_end The end of the text, at the end of a line.
+ * @param count The number of lines wanted.
+ * @param found Receives the number of lines found, fewer than wanted if the text holds fewer.
+ * @return The start of the first of the lines.
+ */
+const char* lastLines(const char* text_begin, const char* text_end, std::uint64_t count, std::uint64_t& found) {
+	const char* lines_begin = text_end;
+	for (found = 0; found < count && lines_begin > text_begin; ++found) {
+		--lines_begin;
+		while (lines_begin > text_begin && lines_begin[-1] != '\n') {
+			--lines_begin;
+		}
+	}
+	return lines_begin;
+}
+
+
+/**
+ * Adds the lines around the matches found in some contents to the records, where they are shown, with every
+ * line once: the lines before a match go back no further than the last line shown of the match before it, and
+ * the lines after a match stop at the next one, so overlapping windows merge. Every context line becomes a
+ * record of its own, with CONTEXT_LINE as its pattern, and only its text is copied to the thread's arena.
+ * The lines come from the contents the matches were found in, read once for both.
+ *
+ * @param results The results of the searching thread, which end with the matches found in the contents.
+ * @param first_record The index of the first of those matches.
+ * @param contents The contents, starting at the start of a line.
+ * @param base_offset The offset of the contents in the file, which the byte offsets of the records count from.
+ * @param first_line The number of the first line of the contents.
+ * @param context The number of lines to show before and after every match.
+ * @param carry What the previous part of the file left to show, which receives what these contents leave,
+ * or nullptr for a file searched as a whole.
+ */
+void addContextLines(ThreadResults& results, std::size_t first_record, std::string_view contents, std::uint64_t base_offset, std::uint64_t first_line,
+	const LineContext& context, ContextCarry* carry) {
+	const char* const contents_end = contents.data() + contents.size();
+	const std::uint32_t file_index = static_cast<std::uint32_t>(results.files.size() - 1);
+
+	// Records a line of the contents, or of the tail carried over, and returns the start of the line after it
+	auto add_line = [&](const char* line_begin, const char* text_end, std::uint64_t offset, std::uint64_t line_number) {
+		const char* line_end = static_cast<const char*>(memchr(line_begin, '\n', text_end - line_begin));
+		if (line_end == nullptr) {
+			line_end = text_end;
+		}
+		MatchRecord record;
+		record.file_index = file_index;
+		record.pattern_index = CONTEXT_LINE;
+		record.line_number = line_number;
+		record.byte_offset = offset;
+		record.line_length = line_end - line_begin;
+		record.text_offset = results.text.append(std::string_view(line_begin, line_end - line_begin));
+		results.matches.push_back(record);
+		return line_end == text_end ? text_end : line_end + 1;
+	};
+	auto add_contents_line = [&](const char* line_begin, std::uint64_t line_number) {
+		return add_line(line_begin, contents_end, base_offset + (line_begin - contents.data()), line_number);
+	};
+
+	// Take the matches out, they are put back between their context lines
+	std::vector<MatchRecord> found(results.matches.begin() + first_record, results.matches.end());
+	results.matches.resize(first_record);
+
+	// The lines the previous part still owes its last match come first
+	const char* shown = contents.data();
+	std::uint64_t shown_line = first_line;
+	std::uint64_t after_left = carry != nullptr ? carry->after_left : 0;
+	const char* const first_match = found.empty() ? contents_end : contents.data() + (found.front().byte_offset - base_offset);
+	for (; after_left > 0 && shown < first_match; --after_left) {
+		shown = add_contents_line(shown, shown_line++);
+	}
+
+	for (std::size_t i = 0; i < found.size(); ++i) {
+		const MatchRecord& match = found[i];
+		const char* const line_begin = contents.data() + (match.byte_offset - base_offset);
+
+		// Go back over the lines before the match down to the last line shown, and on into the tail of the
+		// previous part if nothing of these contents is shown yet
+		std::uint64_t before_count;
+		const char* before = lastLines(shown, line_begin, context.before, before_count);
+		if (carry != nullptr && before_count < context.before && shown == contents.data()) {
+			const char* const tail_end = carry->tail.data() + carry->tail.size();
+			std::uint64_t tail_count;
+			const char* tail_line = lastLines(carry->tail.data(), tail_end, context.before - before_count, tail_count);
+			std::uint64_t number = first_line - tail_count;
+			while (tail_line < tail_end) {
+				tail_line = add_line(tail_line, tail_end, base_offset - (tail_end - tail_line), number++);
+			}
+		}
+		std::uint64_t number = match.line_number - before_count;
+		while (before < line_begin) {
+			before = add_contents_line(before, number++);
+		}
+		results.matches.push_back(match);
+
+		// Show the lines after the match up to the next one
+		const char* const line_end = line_begin + match.line_length;
+		shown = line_end == contents_end ? contents_end : line_end + 1;
+		const char* const next = i + 1 < found.size() ? contents.data() + (found[i + 1].byte_offset - base_offset) : contents_end;
+		number = match.line_number + 1;
+		for (after_left = context.after; after_left > 0 && shown < next; --after_left) {
+			shown = add_contents_line(shown, number++);
+		}
+	}
+
+	// Hand the lines still owed, or else the last lines not shown, over to the next part
+	if (carry != nullptr) {
+		carry->after_left = after_left;
+		std::string tail;
+		std::uint64_t tail_lines = 0;
+		if (after_left == 0) {
+			const char* const tail_begin = lastLines(shown, contents_end, context.before, tail_lines);
+			if (tail_lines < context.before && shown == contents.data()) {
+				// Contents shorter than the lines wanted keep the end of the tail before them
+				const char* const carried_end = carry->tail.data() + carry->tail.size();
+				std::uint64_t kept;
+				tail.assign(lastLines(carry->tail.data(), carried_end, context.before - tail_lines, kept), carried_end);
+			}
+			tail.append(tail_begin, contents_end);
+		}
+		carry->tail = std::move(tail);
+	}
+}
+
+
+/**
+ * Searches a compressed file a decompressed part at a time, as if its decompressed contents were searched
+ * as a whole: the matches get the line numbers and byte offsets they have in the decompressed file.
+ *
+ * @param searcher The searcher for the strings to search for.
+ * @param decompressor The decompressor of the searching thread.
+ * @param compressed The contents of the file.
+ * @param results The results of the searching thread to add the matches to.
+ * @param binary_files What is done with the file if it decompresses to a binary file.
+ * @param binary Set to whether it does, which is only checked if binary files are not searched as text.
+ * @param decompressed_size Receives the number of bytes decompressed.
+ * @param limits The limits on the matches, or nullptr for none.
+ * @param context The lines to show around every matching line.
+ * @return True on success, false if the file is corrupt or truncated, in which case the matches before that point are kept.
+ */
+template <typename Output, typename Searcher>
+bool searchCompressedContents(const Searcher& searcher, Decompressor& decompressor, std::string_view compressed, ThreadResults& results,
+	BinaryFiles binary_files, bool& binary, std::uint64_t& decompressed_size, MatchLimits* limits, const LineContext& context) {
+	const std::size_t files_before = results.files.size();
+	std::uint64_t part_line = 1;
+	decompressed_size = 0;
+	binary = false;
+
+	// Every part ends at the end of a line, so the parts are searched like consecutive pieces of one file
+	ContextCarry carry;
+	decompressor.start(compressed);
+	std::string_view part;
+	while (decompressor.next(part)) {
+		// The first part holds the start of the decompressed file, which tells whether it is binary
+		if (decompressed_size == 0 && binary_files != BinaryFiles::Text) {
+			binary = isBinary(part);
+			if (binary && binary_files == BinaryFiles::Skip) {
+				decompressed_size = part.size();
+				return true;
+			}
+		}
+		const std::size_t part_matches = results.matches.size();
+		const bool file_recorded = results.files.size() > files_before;
+		const bool search_on = binary ? searchContentsForString<typename Output::Binary>(searcher, part, results, 0, part_line, file_recorded, limits)
+			: searchContentsForString<Output>(searcher, part, results, 0, part_line, file_recorded, limits);
+		for (std::size_t i = part_matches; i < results.matches.size(); ++i) {
+			results.matches[i].byte_offset += decompressed_size;
+		}
+
+		// The part is gone with the next one, so its last lines are carried over for the context of the next
+		if constexpr (Output::LINE_NUMBERS) {
+			if (context.any() && !binary) {
+				addContextLines(results, part_matches, part, decompressed_size, part_line, context, &carry);
+			}
+		}
+		decompressed_size += part.size();
+		if (!search_on) {
+			return true;
+		}
+		if constexpr (Output::LINE_NUMBERS) {
+			part_line += std::count(part.begin(), part.end(), '\n');
+		}
+	}
+	return !decompressor.failed();
+}
+
+
+/**
+ * Searches for the search strings in the files handed out by the scheduler and returns everything the thread found:
+ * the files with matches, a compact record per matching line, and the text of those lines. It is instantiated
+ * for every searcher and output policy, so the loop over the files has no dispatch on either of them.
+ *
+ * @param searcher The searcher for the strings to search for: a ByteSearcher, a LiteralSearcher, an AhoCorasickSearcher, or a RegexSearcher.
+ * @param scheduler The scheduler to take batches of files from.
+ * @param worker_index The index of the calling thread within the scheduler.
+ * @param search_strings The strings searched for, used to format streamed results.
+ * @param format The format of streamed results.
+ * @param stream The stream to write the matches to while searching, or nullptr to keep them in the results.
+ * @param cache The results of the previous search for the same strings, or nullptr to scan every file in full.
+ * @param io_depth The number of files to read ahead, 0 to read every file only when it is searched.
+ * @param device_limits The files all threads may read ahead on every device.
+ * @param chunk_size The size of the chunks a file of at least twice that size is split into, to be searched by several threads, 0 to search every file on one thread.
+ * @param binary_files What is done with binary files.
+ * @param limits The limits on the matches, shared by all threads, or nullptr for none. The thread that takes the last
+ * result cancels the search.
+ * @param context The lines to show around every matching line, taken from the contents the file was searched in.
+ * @return The results of the thread, tagged with its ID.
+ */
+template <typename Output, typename Searcher>
+ThreadResults searchFilesForString(const Searcher& searcher, FileScheduler& scheduler, int worker_index, const std::vector<std::string>& search_strings,
+	ResultFormat format, ResultStream* stream, const ResultCache* cache, unsigned io_depth, DeviceReadLimits* device_limits, std::uint64_t chunk_size, BinaryFiles binary_files, MatchLimits* limits,
+	LineContext context) {
+	// Initialize the results, tagged with the ID of the current thread
+	ThreadResults results;
+	results.thread_id = std::this_thread::get_id();
+
+	// The reader keeps its buffers across files, so small files do not allocate, and reads the files of a batch ahead
+	BatchReader reader(io_depth, device_limits);
+
+	// The decompressor keeps its buffer and library state across the compressed files
+	Decompressor decompressor(&scheduler);
+
+	// The stamps of the files of a batch, their cached results, and whether they are unchanged since, with a result cache
+	std::vector<FileStamp> stamps;
+	std::vector<const CachedFile*> cached_files;
+	std::vector<bool> unchanged;
+
+	// Formatted matches waiting to be handed to the stream, and the number of files formatted so far
+	std::string stream_buffer;
+	std::size_t streamed_files = 0;
+
+	// Keep taking batches until there is no work left, then loop through each file path in the batch and search for the string
+	const auto thread_start = std::chrono::steady_clock::now();
+	auto wait_start = thread_start;
+	FileBatch batch;
+	while (scheduler.nextBatch(worker_index, batch)) {
+		results.stats.queue_wait_time += std::chrono::steady_clock::now() - wait_start;
+
+		// Instead of files, a thread out of work may get the chunks of a file another thread split
+		if (batch.split != nullptr) {
+			const auto match_start = std::chrono::steady_clock::now();
+			results.stats.chunks_searched += batch.split->searchChunks(&searcher);
+			wait_start = std::chrono::steady_clock::now();
+			results.stats.match_time += wait_start - match_start;
+			continue;
+		}
+		++results.stats.batches;
+
+		// With a result cache, the files that did not change are known up front, so only the others are read ahead
+		const auto batch_start = std::chrono::steady_clock::now();
+		if (cache != nullptr) {
+			stamps.assign(batch.files.size(), FileStamp());
+			cached_files.assign(batch.files.size(), nullptr);
+			unchanged.assign(batch.files.size(), false);
+			for (std::size_t i = 0; i < batch.files.size(); ++i) {
+				if (readFileStamp(batch.files[i], stamps[i])) {
+					cached_files[i] = cache->find(batch.files[i]);
+					unchanged[i] = cached_files[i] != nullptr && cached_files[i]->stamp == stamps[i];
+				}
+			}
+		}
+		reader.start(batch.files, unchanged);
+		results.stats.read_time += std::chrono::steady_clock::now() - batch_start;
+
+		for (std::size_t i = 0; i < batch.files.size(); ++i) {
+			// Once the search has all its results, the files left are not needed, by this thread nor any other
+			if (limits != nullptr && limits->exhausted()) {
+				scheduler.cancel();
+				break;
+			}
+
+			// A file that did not change takes its matches from the cache unread
+			const fs::path& file_path = batch.files[i];
+			const auto read_start = std::chrono::steady_clock::now();
+			const FileStamp stamp = cache != nullptr ? stamps[i] : FileStamp();
+			const CachedFile* cached = cache != nullptr ? cached_files[i] : nullptr;
+			if (cache != nullptr && unchanged[i]) {
+				ScannedFile scanned{ file_path, stamp, cached->resume_offset, cached->resume_line, cached->tail_hash, -1 };
+				scanned.file_index = Output::addCached(results, *cached, limitMatches<Output>(limits, cached->matches.size(), 0));
+				if (scanned.file_index >= 0) {
+					results.files.back().path = std::move(batch.files[i]);
+				}
+				results.scanned.push_back(std::move(scanned));
+				++results.stats.files_cached;
+				results.stats.read_time += std::chrono::steady_clock::now() - read_start;
+				continue;
+			}
+
+			// Open the file, taking its contents from the read-ahead or mapping or reading them now
+			std::string_view contents;
+			bool read_ahead = false;
+			const bool opened = reader.open(i, contents, read_ahead);
+			const auto match_start = std::chrono::steady_clock::now();
+			results.stats.read_time += match_start - read_start;
+			if (!opened) {
+				// If the file could not be opened, output an error message
+				std::cerr << "Error: could not open file " << file_path.string() << " due to permission issues." << std::endl;
+				++results.stats.files_skipped;
+				continue;
+			}
+			++results.stats.files_opened;
+			results.stats.files_read_ahead += read_ahead;
+
+			// A compressed file is searched as the file it decompresses to, in parts, and always in full
+			const std::size_t files_before = results.files.size();
+			if (Decompressor::isCompressed(contents)) {
+				std::uint64_t decompressed_size = 0;
+				bool binary = false;
+				if (!searchCompressedContents<Output>(searcher, decompressor, contents, results, binary_files, binary, decompressed_size, limits, context)) {
+					std::cerr << "Error: the compressed file " << file_path.string() << " is corrupt or truncated, only its intact start was searched." << std::endl;
+				}
+				++results.stats.files_decompressed;
+				results.stats.files_binary += binary;
+				results.stats.bytes_read += decompressed_size;
+				if (cache != nullptr && !binary) {
+					ScannedFile scanned{ file_path, stamp, 0, 1, 0, -1 };
+					scanned.stamp.size = contents.size();
+					if (results.files.size() > files_before) {
+						scanned.file_index = results.files.size() - 1;
+					}
+					results.scanned.push_back(std::move(scanned));
+				}
+			}
+			else if (binary_files != BinaryFiles::Text && isBinary(contents)) {
+				// A binary file is left out after its first block, or searched without building any of its lines, and never cached
+				++results.stats.files_binary;
+				if (binary_files == BinaryFiles::Skip) {
+					results.stats.bytes_read += std::min(contents.size(), BINARY_CHECK_SIZE);
+				}
+				else {
+					results.stats.bytes_read += contents.size();
+					searchContentsForString<typename Output::Binary>(searcher, contents, results, 0, 1, false, limits);
+				}
+			}
+			else {
+				// A file that only grew keeps the cached matches before its last line and is scanned from that line on
+				std::size_t start_offset = 0;
+				std::uint64_t start_line = 1;
+				bool file_recorded = false;
+				if (cached != nullptr && stamp.inode == cached->stamp.inode && contents.size() > cached->stamp.size
+					&& ResultCache::hashEnds(contents.substr(0, cached->stamp.size)) == cached->tail_hash) {
+					const auto kept = std::partition_point(cached->matches.begin(), cached->matches.end(), [cached](const MatchRecord& match) {
+						return match.byte_offset < cached->resume_offset;
+						});
+					file_recorded = Output::addCached(results, *cached, limitMatches<Output>(limits, kept - cached->matches.begin(), 0)) >= 0;
+					start_offset = cached->resume_offset;
+					start_line = cached->resume_line;
+					++results.stats.files_tail_scanned;
+				}
+				results.stats.bytes_read += contents.size() - start_offset;
+
+				// Scan the raw bytes for the string, a huge file together with the threads that run out of work
+				std::uint64_t line_count = 0;
+				const bool split = chunk_size > 0 && contents.size() - start_offset >= 2 * chunk_size;
+				if (split) {
+					results.stats.chunks_searched += searchSplitContents<Output>(searcher, scheduler, contents, results,
+						start_offset, start_line, file_recorded, chunk_size, cache != nullptr, line_count, limits);
+					++results.stats.files_split;
+				}
+				else {
+					searchContentsForString<Output>(searcher, contents, results, start_offset, start_line, file_recorded, limits);
+				}
+
+				// Show the lines around the matches while the contents are still at hand
+				if constexpr (Output::LINE_NUMBERS) {
+					if (context.any() && results.files.size() > files_before) {
+						addContextLines(results, results.files.back().first_match, contents, 0, 1, context, nullptr);
+					}
+				}
+
+				// Remember where the last line starts, so the next search can scan only what is appended to the file
+				if (cache != nullptr) {
+					std::size_t resume_offset = contents.size();
+					while (resume_offset > start_offset && contents[resume_offset - 1] != '\n') {
+						--resume_offset;
+					}
+					ScannedFile scanned{ file_path, stamp, resume_offset, 0, ResultCache::hashEnds(contents), -1 };
+					scanned.stamp.size = contents.size();
+					scanned.resume_line = start_line + (split ? line_count : std::count(contents.data() + start_offset, contents.data() + resume_offset, '\n'));
+					if (results.files.size() > files_before) {
+						scanned.file_index = results.files.size() - 1;
+					}
+					results.scanned.push_back(std::move(scanned));
+				}
+			}
+			const bool has_matches = results.files.size() > files_before;
+
+			// The batch does not need the path anymore, so a file with matches takes it over without a copy
+			if (has_matches) {
+				results.files.back().path = std::move(batch.files[i]);
+			}
+			const auto output_start = std::chrono::steady_clock::now();
+			results.stats.match_time += output_start - match_start;
+
+			// In streaming mode, format the file's matches right away and pass them on in large chunks
+			if (stream != nullptr) {
+				Output::moveToStreamBuffer(results, search_strings, format, streamed_files, stream_buffer);
+				if (!stream->ordered() && stream_buffer.size() >= STREAM_CHUNK_SIZE) {
+					stream->write(std::move(stream_buffer));
+					stream_buffer.clear();
+				}
+				results.stats.output_time += std::chrono::steady_clock::now() - output_start;
+			}
+		}
+
+		// In ordered streaming mode, every batch is handed over as a whole, even without matches
+		if (stream != nullptr && stream->ordered()) {
+			const auto output_start = std::chrono::steady_clock::now();
+			stream->writeBatch(batch.sequence, std::move(stream_buffer));
+			stream_buffer.clear();
+			results.stats.output_time += std::chrono::steady_clock::now() - output_start;
+		}
+
+		wait_start = std::chrono::steady_clock::now();
+	}
+
+	// Hand over the rest of the streamed matches
+	const auto thread_stop = std::chrono::steady_clock::now();
+	results.stats.queue_wait_time += thread_stop - wait_start;
+	if (stream != nullptr && !stream_buffer.empty()) {
+		stream->write(std::move(stream_buffer));
+		results.stats.output_time += std::chrono::steady_clock::now() - thread_stop;
+	}
+	results.stats.busy_time = std::chrono::steady_clock::now() - thread_start - results.stats.queue_wait_time;
+
+	// Return the search results, a thread without matches still reports its ID for the log
+	return results;
+}
+
+
+/**
+ * Starts a search task on every thread of the pool for one searcher and output policy, each taking
+ * batches of files from the scheduler.
+ *
+ * @param searcher The searcher for the strings to search for.
+ * @param pool The threads to search with.
+ * @param scheduler The scheduler to take batches of files from.
+ * @param search_strings The strings searched for, used to format streamed results.
+ * @param format The format of streamed results.
+ * @param stream The stream to write the matches to while searching, or nullptr to keep them in the results.
+ * @param cache The results of the previous search for the same strings, or nullptr to scan every file in full.
+ * @param io_depth The number of files each thread reads ahead.
+ * @param device_limits The files all threads may read ahead on every device.
+ * @param chunk_size The size of the chunks huge files are split into, 0 to search every file on one thread.
+ * @param binary_files What is done with binary files.
+ * @param limits The limits on the matches, or nullptr for none.
+ * @param context The lines to show around every matching line.
+ * @param futures Receives the future results of the threads.
+ */
+template <typename Output, typename Searcher>
+void startSearchThreads(const Searcher& searcher, ThreadPool& pool, FileScheduler& scheduler, const std::vector<std::string>& search_strings,
+	ResultFormat format, ResultStream* stream, const ResultCache* cache, unsigned io_depth, DeviceReadLimits* device_limits, std::uint64_t chunk_size, BinaryFiles binary_files, MatchLimits* limits,
+	LineContext context, std::vector<std::future<ThreadResults>>& futures) {
+	// A single thread has nobody to share a file with
+	if (pool.size() < 2) {
+		chunk_size = 0;
+	}
+	for (int i = 0; i < pool.size(); ++i) {
+		if constexpr (std::is_same_v<Searcher, RegexSearcher>) {
+			// The DFA grows while searching, so every thread builds its states in a copy of its own
+			futures.push_back(pool.submit([searcher, &scheduler, i, &search_strings, format, stream, cache, io_depth, device_limits, chunk_size, binary_files, limits, context] {
+				return searchFilesForString<Output, Searcher>(searcher, scheduler, i, search_strings, format, stream, cache, io_depth, device_limits, chunk_size, binary_files, limits, context);
+			}));
+		}
+		else {
+			futures.push_back(pool.submit([&searcher, &scheduler, i, &search_strings, format, stream, cache, io_depth, device_limits, chunk_size, binary_files, limits, context] {
+				return searchFilesForString<Output, Searcher>(searcher, scheduler, i, search_strings, format, stream, cache, io_depth, device_limits, chunk_size, binary_files, limits, context);
+			}));
+		}
+	}
+}
+
+
+/**
+ * Opens the trigram index of the searched directory, building it first if there is none yet,
+ * and selects the files that may contain the search strings.
+ *
+ * @param options The search settings, with the index directory.
+ * @param required_strings Strings of which every matching line contains at least one.
+ * @param files The files of the directory if they are listed already, or nullptr to list them when needed.
+ * @param pool The threads to build the index with.
+ * @return The index, or nullptr if it could not be built, in which case every file is searched.
+ */
+std::unique_ptr<TrigramIndex> openIndex(const SearchOptions& options, const std::vector<std::string>& required_strings, const std::vector<fs::path>* files, ThreadPool& pool) {
+	auto index = std::make_unique<TrigramIndex>();
+	if (!index->open(options.index_directory, options.directory_path)) {
+		// The index is missing, or was made for another tree or version, so read the whole tree once.
+		std::cerr << "Building index in " << options.index_directory << std::endl;
+		std::vector<fs::path> listed_files;
+		if (files == nullptr) {
+			std::vector<std::uintmax_t> file_sizes;
+			listDirectoryTree(options.directory_path, options.thread_count, options.walk, listed_files, file_sizes);
+			files = &listed_files;
+		}
+		if (!TrigramIndex::build(options.index_directory, options.directory_path, *files, pool)
+			|| !index->open(options.index_directory, options.directory_path)) {
+			std::cerr << "Error: could not build index in " << options.index_directory << ", searching all files" << std::endl;
+			return nullptr;
+		}
+	}
+
+	index->selectCandidates(required_strings, options.ignore_case);
+	return index;
+}
+
+
+/**
+ * @param options The search settings.
+ * @return The search strings as regular expressions, escaped if they are literals.
+ */
+std::vector<std::string> expressionsOf(const SearchOptions& options) {
+	if (options.regex) {
+		return options.search_strings;
+	}
+	std::vector<std::string> expressions;
+	for (const auto& search_string : options.search_strings) {
+		expressions.push_back(escapeRegex(search_string));
+	}
+	return expressions;
+}
+
+
+/**
+ * Search a directory and its subdirectories for files containing any of the search strings.
+ *
+ * @param options The search settings: search strings, directory, thread count, and mode.
+ * @param stream The stream to write the matches to while searching, or nullptr to return them in the results.
+ * @param pool The threads to search with, one search task runs on each of them. With -t auto, the tuner lets only some of them search.
+ * @param tree The files of the tree kept by the server, or nullptr to walk the directory.
+ * @return The results of every search thread and the total number of files searched.
+ */
+SearchResults searchDirectoryForString(const SearchOptions& options, ResultStream* stream, ThreadPool& pool, const FileTree* tree) {
+	const int thread_count = pool.size();
+	const int walker_count = options.ordered ? 1 : options.thread_count;
+
+	// Results written in a fixed order are held back behind the oldest batch still searched, so the batches run at most a window ahead of it.
+	const std::size_t ordered_window = stream != nullptr && stream->ordered() ? thread_count * ORDERED_BATCHES_PER_THREAD : 0;
+	std::unique_ptr<FileScheduler> scheduler;
+	std::size_t files_count = 0;
+	SearchResults results;
+	std::unique_ptr<TrigramIndex> index;
+
+	// With an index, every file of the tree is kept to bring the index up to date after the search.
+	std::vector<fs::path> tree_files;
+	std::mutex tree_files_mutex;
+
+	// Prepare the search once, all threads share it. A single byte is found with memchr, a longer string with
+	// the vectorized literal kernel, and several strings together in one pass by an Aho-Corasick automaton.
+	// A line never contains a newline, the automaton leaves out strings with one, so such a single string
+	// goes there as well. Regular expressions run through a lazy DFA, and only the strings they require can
+	// be looked up in the index. The expressions were checked with the options.
+	// Ignoring case, the literal searchers fold ASCII letters themselves, a single letter included. Strings
+	// with other letters that have cases go through the DFA as escaped expressions, which has their variants.
+	std::variant<std::monostate, ByteSearcher, LiteralSearcher, AhoCorasickSearcher, RegexSearcher> searcher;
+	const std::vector<std::string>* required_strings = &options.search_strings;
+	const bool unicode_case = options.ignore_case && !options.regex
+		&& std::any_of(options.search_strings.begin(), options.search_strings.end(), [](const std::string& s) { return hasUnicodeCases(s); });
+	if (options.regex || unicode_case) {
+		std::string error;
+		RegexSearcher& regex_searcher = searcher.emplace<RegexSearcher>();
+		regex_searcher.compile(expressionsOf(options), error, options.ignore_case);
+		required_strings = &regex_searcher.requiredStrings();
+	}
+	else if (options.search_strings.size() == 1 && options.search_strings[0].size() == 1 && options.search_strings[0][0] != '\n'
+		&& !(options.ignore_case && std::isalpha(static_cast<unsigned char>(options.search_strings[0][0])))) {
+		searcher.emplace<ByteSearcher>(options.search_strings[0][0]);
+	}
+	else if (options.search_strings.size() == 1 && options.search_strings[0].find('\n') == std::string::npos) {
+		searcher.emplace<LiteralSearcher>(options.search_strings[0], options.ignore_case);
+	}
+	else {
+		searcher.emplace<AhoCorasickSearcher>(options.search_strings, options.ignore_case);
+	}
+
+	const auto walk_start = std::chrono::steady_clock::now();
+	if (!options.pipelined) {
+		// Create a vector of paths to all regular files in the directory and its subdirectories, along with their sizes.
+		std::vector<fs::path> files_to_search;
+		std::vector<std::uintmax_t> file_sizes;
+		if (tree) {
+			tree->list(options.directory_path, files_to_search, file_sizes);
+		}
+		else {
+			listDirectoryTree(options.directory_path, walker_count, options.walk, files_to_search, file_sizes);
+		}
+
+		// Keep only the files the index can not rule out.
+		if (!options.index_directory.empty()) {
+			index = openIndex(options, *required_strings, &files_to_search, pool);
+		}
+		if (index) {
+			tree_files = std::move(files_to_search);
+			std::vector<std::uintmax_t> tree_sizes = std::move(file_sizes);
+			files_to_search.clear();
+			file_sizes.clear();
+
+			// Ask the index about a slice of the tree on every thread, which stats each file, and keep the candidates in tree order.
+			const std::size_t slice_count = pool.size();
+			std::vector<std::vector<std::size_t>> candidates(slice_count);
+			std::vector<std::future<void>> filters;
+			for (std::size_t slice = 0; slice < slice_count; ++slice) {
+				filters.push_back(pool.submit([&index, &tree_files, &candidates, slice, slice_count] {
+					const std::size_t first = tree_files.size() * slice / slice_count;
+					const std::size_t last = tree_files.size() * (slice + 1) / slice_count;
+					for (std::size_t i = first; i < last; ++i) {
+						if (index->mayContain(tree_files[i])) {
+							candidates[slice].push_back(i);
+						}
+					}
+				}));
+			}
+			for (std::size_t slice = 0; slice < slice_count; ++slice) {
+				filters[slice].get();
+				for (const std::size_t i : candidates[slice]) {
+					files_to_search.push_back(tree_files[i]);
+					file_sizes.push_back(tree_sizes[i]);
+				}
+			}
+		}
+		files_count = files_to_search.size();
+		results.walk_time = std::chrono::steady_clock::now() - walk_start;
+
+		// Split the files into batches that the threads take dynamically, so large files do not pile up on one thread.
+		scheduler = std::make_unique<FileScheduler>(std::move(files_to_search), file_sizes, thread_count, ordered_window);
+	}
+	else {
+		// The walkers fill the scheduler while the threads are already searching.
+		if (!options.index_directory.empty()) {
+			index = openIndex(options, *required_strings, nullptr, pool);
+		}
+		scheduler = std::make_unique<FileScheduler>(thread_count, thread_count * PIPELINE_BATCHES_PER_THREAD, ordered_window);
+	}
+
+	// The result cache lives next to the index. Streamed results are not kept, so they can not be cached,
+	// and the cache holds no lines around the matches.
+	// The same strings match other lines as expressions than as literals, so each matcher has its own cache.
+	// Binary files are only cached when they are searched as text, so the caches without them are kept apart.
+	const std::string matcher = std::string(options.regex ? "regex" : "literal") + (options.ignore_case ? "-i" : "")
+		+ (options.binary_files != BinaryFiles::Text ? "-no-binary" : "");
+	std::unique_ptr<ResultCache> cache;
+	if (index && !stream && !options.context.any()) {
+		cache = std::make_unique<ResultCache>();
+		cache->load(options.index_directory, matcher, options.search_strings);
+	}
+
+	// The limits on the matches are shared by all threads, the one that reaches the limit of the search cancels it.
+	std::unique_ptr<MatchLimits> limits;
+	if (options.max_count != 0 || options.max_results != 0) {
+		limits = std::make_unique<MatchLimits>(options.max_count, options.max_results);
+	}
+
+	// The files the threads read ahead on every device are shared, so together they do not thrash a disk.
+	DeviceReadLimits device_limits(options.device_depth);
+
+	// With -t auto, the tuner lets a thread per CPU search at first, and then as many as the search turns out to do best with.
+	std::unique_ptr<ThreadTuner> tuner;
+	if (options.auto_threads) {
+		tuner = std::make_unique<ThreadTuner>(*scheduler, options.thread_count, thread_count);
+	}
+
+	// Start the threads on the file loop compiled for the prepared searcher and the output, one future with the results per thread.
+	const auto search_start = std::chrono::steady_clock::now();
+	std::vector<std::future<ThreadResults>> futures;
+	std::visit([&](const auto& prepared) {
+		if constexpr (!std::is_same_v<std::decay_t<decltype(prepared)>, std::monostate>) {
+			if (options.list_files) {
+				startSearchThreads<MatchingFiles>(prepared, pool, *scheduler, options.search_strings, options.format, stream, cache.get(), options.io_depth, &device_limits, options.chunk_size, options.binary_files,
+					limits.get(), options.context, futures);
+			}
+			else if (options.count) {
+				startSearchThreads<MatchCounts>(prepared, pool, *scheduler, options.search_strings, options.format, stream, cache.get(), options.io_depth, &device_limits, options.chunk_size, options.binary_files,
+					limits.get(), options.context, futures);
+			}
+			else {
+				startSearchThreads<MatchingLines>(prepared, pool, *scheduler, options.search_strings, options.format, stream, cache.get(), options.io_depth, &device_limits, options.chunk_size, options.binary_files,
+					limits.get(), options.context, futures);
+			}
+		}
+		}, searcher);
+
+	// Walk the directory on this thread while the search threads take the batches it produces.
+	// Ordered output needs the batches in the same order on every run, which only a single walker gives.
+	if (options.pipelined) {
+		std::function<bool(const fs::path&)> filter;
+		if (index) {
+			filter = [&index, &tree_files, &tree_files_mutex](const fs::path& file_path) {
+				{
+					std::lock_guard<std::mutex> lock(tree_files_mutex);
+					tree_files.push_back(file_path);
+				}
+				return index->mayContain(file_path);
+			};
+		}
+		files_count = walkDirectoryIntoScheduler(options.directory_path, walker_count, options.walk, *scheduler, filter);
+		results.walk_time = std::chrono::steady_clock::now() - walk_start;
+	}
+
+	// Collect the results from each thread, moving them instead of copying.
+	for (auto& future : futures) {
+		results.threads.push_back(future.get());
+	}
+	results.searched_files = files_count;
+	if (tuner) {
+		tuner->stop();
+	}
+	results.active_threads = scheduler->activeThreads();
+
+	// A cancelled search only searched the files the threads took before it stopped.
+	if (scheduler->cancelled()) {
+		results.searched_files = 0;
+		for (const auto& thread : results.threads) {
+			results.searched_files += thread.stats.files_opened + thread.stats.files_skipped + thread.stats.files_cached;
+		}
+	}
+	results.search_time = std::chrono::steady_clock::now() - search_start;
+
+	// Bring the index and the result cache up to date for the next search, which only reads the files that changed.
+	const auto update_start = std::chrono::steady_clock::now();
+	if (index && index->isStale()) {
+		index->update(tree_files, pool);
+	}
+	// The count and list-files modes keep no lines, and a limited search stops early, so they only read the cache of a full search.
+	if (cache && !options.count && !options.list_files && !limits) {
+		std::size_t scanned_files = 0;
+		std::uint64_t cached_files = 0;
+		for (const auto& thread : results.threads) {
+			scanned_files += thread.scanned.size();
+			cached_files += thread.stats.files_cached;
+		}
+		if (cached_files != scanned_files || scanned_files != cache->fileCount()) {
+			ResultCache::save(options.index_directory, matcher, options.search_strings, results);
+		}
+	}
+	results.index_time = std::chrono::steady_clock::now() - update_start;
+
+	// Return the search results and the total number of files searched.
+	return results;
+}
+
+
+/**
+ * Writes the results in the specified format.
+ * Every match is written with the file name, the line number, and the content of the line.
+ * When searching for several strings, the string found is written after the line number.
+ * The lines shown around the matches are written with dashes instead of colons, and a line of two
+ * dashes separates the groups of lines of a file that do not follow each other.
+ * The formats for tools write the same records, with the full path of the file, see result_format.h.
+ * Each file is searched by a single thread, which records its matches already aggregated and in
+ * line order, so only the files have to be ranked, with a parallel sort. The output is split into
+ * groups that are formatted in parallel and written in order with one large write each.
+ *
+ * @param output_file The file or connection to write to.
+ * @param results The results of all search threads.
+ * @param search_strings The strings searched for.
+ * @param format The format of the results.
+ * @param pool The threads to sort and format with.
+ * @return True if all writes succeeded.
+ */
+bool writeResults(OutputFile& output_file, const SearchResults& results, const std::vector<std::string>& search_strings, ResultFormat format, ThreadPool& pool) {
+	// A file with matches together with the thread that found them, which holds their records and text,
+	// and the number of its records, its matches and the context lines around them.
+	struct FileReference {
+		const ThreadResults* thread;
+		const FileMatches* file;
+		std::size_t record_count;
+	};
+
+	// Collect the files with matches of all threads, the records of a file run up to the first one of the next.
+	std::vector<FileReference> sorted_files;
+	for (const auto& thread : results.threads) {
+		for (std::size_t i = 0; i < thread.files.size(); ++i) {
+			const std::size_t records_end = i + 1 < thread.files.size() ? thread.files[i + 1].first_match : thread.matches.size();
+			sorted_files.push_back({ &thread, &thread.files[i], records_end - thread.files[i].first_match });
+		}
+	}
+
+	// Sort the files by number of patterns, files with equally many by path so the order is fixed.
+	parallelSort(sorted_files.begin(), sorted_files.end(), [](const auto& lhs, const auto& rhs) {
+		if (lhs.file->match_count != rhs.file->match_count) {
+			return lhs.file->match_count > rhs.file->match_count;
+		}
+		return lhs.file->path < rhs.file->path;
+		}, pool);
+
+	// Split the output into groups of about one output chunk, estimated from the line lengths.
+	// A group starts at a given match of a given file, so even a single file with many matches is split up.
+	std::vector<std::pair<std::size_t, std::size_t>> group_starts;
+	std::size_t group_bytes = OUTPUT_CHUNK_SIZE;
+	for (std::size_t i = 0; i < sorted_files.size(); ++i) {
+		const auto& [thread, file, record_count] = sorted_files[i];
+		for (std::size_t j = 0; j < record_count; ++j) {
+			if (group_bytes >= OUTPUT_CHUNK_SIZE) {
+				group_starts.push_back({ i, j });
+				group_bytes = 0;
+			}
+			group_bytes += thread->matches[file->first_match + j].line_length + 32;
+		}
+	}
+	group_starts.push_back({ sorted_files.size(), 0 });
+	const std::size_t group_count = group_starts.size() - 1;
+
+	// Format the groups in parallel, each thread taking the next unformatted group. The formatters stay
+	// at most a few groups ahead of the writer, so the formatted output is never held in memory as a whole.
+	std::vector<std::promise<std::string>> formatted_groups(group_count);
+	std::atomic<std::size_t> next_group = 0;
+	const std::size_t format_window = 2 * pool.size();
+	std::size_t groups_written = 0;
+	std::mutex window_mutex;
+	std::condition_variable window_moved;
+	auto formatGroups = [&]() {
+		for (std::size_t group = next_group++; group < group_count; group = next_group++) {
+			{
+				std::unique_lock<std::mutex> lock(window_mutex);
+				window_moved.wait(lock, [&] { return group < groups_written + format_window; });
+			}
+			std::string buffer;
+			std::string name_storage;
+			const auto [first_file, first_match] = group_starts[group];
+			const auto [last_file, last_match] = group_starts[group + 1];
+			for (std::size_t i = first_file; i <= last_file && i < sorted_files.size(); ++i) {
+				const auto& [thread, file, record_count] = sorted_files[i];
+				const std::string_view file_name = resultName(file->path, format, name_storage);
+				const std::size_t begin = i == first_file ? first_match : 0;
+				const std::size_t end = i == last_file ? last_match : record_count;
+				for (std::size_t j = begin; j < end; ++j) {
+					// Format the file name, line number, search string if there are several, and content in the specified format.
+					const MatchRecord* const records = &thread->matches[file->first_match];
+					formatRecord(buffer, format, *thread, *file, file_name, j > 0 ? &records[j - 1] : nullptr, records[j], search_strings);
+				}
+			}
+			formatted_groups[group].set_value(std::move(buffer));
+		}
+	};
+	std::vector<std::future<void>> formatters;
+	for (int i = 0; i < std::min<int>(pool.size(), group_count); ++i) {
+		formatters.push_back(pool.submit(formatGroups));
+	}
+
+	// Write the groups in order as soon as each one is formatted.
+	bool written = true;
+	for (auto& formatted_group : formatted_groups) {
+		written = output_file.write(formatted_group.get_future().get()) && written;
+		std::lock_guard<std::mutex> lock(window_mutex);
+		++groups_written;
+		window_moved.notify_all();
+	}
+	for (auto& formatter : formatters) {
+		formatter.get();
+	}
+	return written;
+}
+
+
+/**
+ * Writes the results of the count and list-files modes: the path of every file with matches,
+ * followed by its number of matching lines in the count mode. The files are written in the order the
+ * threads found them, there are no lines to rank them by or to format.
+ *
+ * @param output_file The file or connection to write to.
+ * @param results The results of all search threads.
+ * @param count Whether to write the number of matching lines of every file.
+ * @param format The format of the results.
+ * @return True if all writes succeeded.
+ */
+bool writeFiles(OutputFile& output_file, const SearchResults& results, bool count, ResultFormat format) {
+	// Format the files and write them in large chunks.
+	bool written = true;
+	std::string buffer;
+	for (const auto& thread : results.threads) {
+		for (const auto& file : thread.files) {
+			formatResultFile(buffer, file, count, format);
+			if (buffer.size() >= OUTPUT_CHUNK_SIZE) {
+				written = output_file.write(buffer) && written;
+				buffer.clear();
+			}
+		}
+	}
+	written = output_file.write(buffer) && written;
+	return written;
+}
+
+
+/**
+ * Writes log information to a file.
+ *
+ * @param filename The name of the file to write to.
+ * @param results The results of all search threads.
+ * @param sync Whether to flush the file to disk after writing.
+ */
+void writeLogToFile(const std::string& filename, const SearchResults& results, bool sync) {
+	// Open the output file for writing.
+	OutputFile output_file;
+	if (!output_file.open(filename + ".log")) {
+		std::cerr << "Unable to open file for writing: " << filename << std::endl;
+		return;
+	}
+
+	// The file names a thread logs, each one repeated once per match, and the total number of entries.
+	struct ThreadLog {
+		std::vector<std::pair<std::string, std::uint64_t>> file_names;
+		std::uint64_t entries = 0;
+	};
+
+	// Create a map to store the files associated with each thread.
+	std::map<std::thread::id, ThreadLog> threads_to_files;
+
+	// Populate the map with the file name of every match for each thread, or an empty name for a thread without matches.
+	for (const auto& thread : results.threads) {
+		ThreadLog& thread_log = threads_to_files[thread.thread_id];
+		if (thread.files.empty()) {
+			thread_log.file_names.push_back({ "", 1 });
+			thread_log.entries += 1;
+			continue;
+		}
+
+		for (const auto& file : thread.files) {
+			thread_log.file_names.push_back({ file.path.filename().stem().string(), file.match_count });
+			thread_log.entries += file.match_count;
+		}
+	}
+
+	// Convert the map to a vector of pairs.
+	std::vector<std::pair<std::thread::id, ThreadLog>> thread_file_pairs(threads_to_files.begin(), threads_to_files.end());
+
+	// Sort the vector of thread-file pairs by the number of files associated with each thread.
+	std::sort(thread_file_pairs.begin(), thread_file_pairs.end(), [](const auto& lhs, const auto& rhs) {
+		if (lhs.second.file_names[0].first == "" && rhs.second.file_names[0].first != "") {
+			return false;
+		}
+		else if (lhs.second.file_names[0].first != "" && rhs.second.file_names[0].first == "") {
+			return true;
+		}
+		else {
+			return lhs.second.entries > rhs.second.entries;
+		}
+		});
+
+	// Format the sorted thread-file pairs and write them in large chunks.
+	bool written = true;
+	std::string buffer;
+	for (const auto& [thread_id, thread_log] : thread_file_pairs) {
+		std::ostringstream thread_name;
+		thread_name << thread_id;
+		buffer += thread_name.str();
+		buffer += ':';
+		for (const auto& [file_name, count] : thread_log.file_names) {
+			for (std::uint64_t i = 0; i < count; ++i) {
+				buffer += ' ';
+				buffer += file_name;
+				buffer += ',';
+			}
+			if (buffer.size() >= OUTPUT_CHUNK_SIZE) {
+				// Keep the last comma in the buffer, it is replaced by the newline below.
+				written = output_file.write(std::string_view(buffer).substr(0, buffer.size() - 1)) && written;
+				buffer.erase(0, buffer.size() - 1);
+			}
+		}
+		// Replace the trailing comma by a newline character.
+		buffer.back() = '\n';
+	}
+	written = output_file.write(buffer) && written;
+
+	if (!written || (sync && !output_file.sync()) || !output_file.close()) {
+		std::cerr << "Unable to write file: " << filename << std::endl;
+	}
+}
+
+
+/**
+ * Writes a JSON report of where the time of a run went: the wall time of every phase, and for every
+ * search thread the files and bytes it read and how long it worked and waited for batches.
+ *
+ * @param filename The name of the file to write to, without extension, or "-" for stderr.
+ * @param options The search settings.
+ * @param results The results of all search threads, including the walk and search times.
+ * @param results_time The wall time of writing the result file.
+ * @param log_time The wall time of writing the log file.
+ * @param total_time The wall time of the whole run.
+ */
+void writeStatsToFile(const std::string& filename, const SearchOptions& options, const SearchResults& results,
+	std::chrono::nanoseconds results_time, std::chrono::nanoseconds log_time, std::chrono::nanoseconds total_time) {
+	auto milliseconds = [](std::chrono::nanoseconds time) {
+		return std::chrono::duration<double, std::milli>(time).count();
+	};
+
+	// Sum up the counters of all threads.
+	WorkerStats total;
+	std::uint64_t total_matches = 0;
+	for (const auto& thread : results.threads) {
+		total.batches += thread.stats.batches;
+		total.files_opened += thread.stats.files_opened;
+		total.files_skipped += thread.stats.files_skipped;
+		total.bytes_read += thread.stats.bytes_read;
+		total.files_cached += thread.stats.files_cached;
+		total.files_tail_scanned += thread.stats.files_tail_scanned;
+		total.files_read_ahead += thread.stats.files_read_ahead;
+		total.files_decompressed += thread.stats.files_decompressed;
+		total.files_binary += thread.stats.files_binary;
+		total.files_split += thread.stats.files_split;
+		total.chunks_searched += thread.stats.chunks_searched;
+		for (const auto& file : thread.files) {
+			total_matches += file.match_count;
+		}
+	}
+
+	std::ostringstream report;
+	report << std::fixed << std::setprecision(3);
+	report << "{\n";
+	report << "  \"threads\": " << results.active_threads << ",\n";
+	report << "  \"auto_threads\": " << (options.auto_threads ? "true" : "false") << ",\n";
+	report << "  \"pinned\": " << (options.pin ? "true" : "false") << ",\n";
+	report << "  \"pipelined\": " << (options.pipelined ? "true" : "false") << ",\n";
+	report << "  \"io_depth\": " << options.io_depth << ",\n";
+	report << "  \"device_depth\": " << options.device_depth << ",\n";
+	report << "  \"chunk_size\": " << options.chunk_size << ",\n";
+	report << "  \"binary_files\": \"" << (options.binary_files == BinaryFiles::Skip ? "skip" : options.binary_files == BinaryFiles::Text ? "text" : "match") << "\",\n";
+	report << "  \"format\": \"" << (options.format == ResultFormat::Json ? "json" : options.format == ResultFormat::Binary ? "binary" : "text") << "\",\n";
+	report << "  \"streamed\": " << (options.stream ? "true" : "false") << ",\n";
+	report << "  \"regex\": " << (options.regex ? "true" : "false") << ",\n";
+	report << "  \"ignore_case\": " << (options.ignore_case ? "true" : "false") << ",\n";
+	report << "  \"max_count\": " << options.max_count << ",\n";
+	report << "  \"max_results\": " << options.max_results << ",\n";
+	report << "  \"before_context\": " << options.context.before << ",\n";
+	report << "  \"after_context\": " << options.context.after << ",\n";
+	report << "  \"output\": \"" << (options.list_files ? "files" : options.count ? "count" : "lines") << "\",\n";
+	report << "  \"phases_ms\": {\n";
+	report << "    \"walk\": " << milliseconds(results.walk_time) << ",\n";
+	report << "    \"search\": " << milliseconds(results.search_time) << ",\n";
+	report << "    \"update_index\": " << milliseconds(results.index_time) << ",\n";
+	report << "    \"write_results\": " << milliseconds(results_time) << ",\n";
+	report << "    \"write_log\": " << milliseconds(log_time) << ",\n";
+	report << "    \"total\": " << milliseconds(total_time) << "\n";
+	report << "  },\n";
+	report << "  \"searched_files\": " << results.searched_files << ",\n";
+	report << "  \"files_opened\": " << total.files_opened << ",\n";
+	report << "  \"files_skipped\": " << total.files_skipped << ",\n";
+	report << "  \"files_cached\": " << total.files_cached << ",\n";
+	report << "  \"files_tail_scanned\": " << total.files_tail_scanned << ",\n";
+	report << "  \"files_read_ahead\": " << total.files_read_ahead << ",\n";
+	report << "  \"files_decompressed\": " << total.files_decompressed << ",\n";
+	report << "  \"files_binary\": " << total.files_binary << ",\n";
+	report << "  \"files_split\": " << total.files_split << ",\n";
+	report << "  \"chunks_searched\": " << total.chunks_searched << ",\n";
+	report << "  \"bytes_read\": " << total.bytes_read << ",\n";
+	report << "  \"batches\": " << total.batches << ",\n";
+	report << "  \"matches\": " << total_matches << ",\n";
+
+	// One entry per search thread, in start order, so load imbalance shows directly.
+	report << "  \"workers\": [";
+	for (std::size_t i = 0; i < results.threads.size(); ++i) {
+		const ThreadResults& thread = results.threads[i];
+		std::uint64_t matches = 0;
+		for (const auto& file : thread.files) {
+			matches += file.match_count;
+		}
+
+		report << (i == 0 ? "\n" : ",\n");
+		report << "    { \"index\": " << i
+			<< ", \"thread_id\": \"" << thread.thread_id << "\""
+			<< ", \"batches\": " << thread.stats.batches
+			<< ", \"files_opened\": " << thread.stats.files_opened
+			<< ", \"files_skipped\": " << thread.stats.files_skipped
+			<< ", \"files_cached\": " << thread.stats.files_cached
+			<< ", \"files_tail_scanned\": " << thread.stats.files_tail_scanned
+			<< ", \"files_read_ahead\": " << thread.stats.files_read_ahead
+			<< ", \"files_decompressed\": " << thread.stats.files_decompressed
+			<< ", \"files_binary\": " << thread.stats.files_binary
+			<< ", \"files_split\": " << thread.stats.files_split
+			<< ", \"chunks_searched\": " << thread.stats.chunks_searched
+			<< ", \"bytes_read\": " << thread.stats.bytes_read
+			<< ", \"matches\": " << matches
+			<< ", \"busy_ms\": " << milliseconds(thread.stats.busy_time)
+			<< ", \"queue_wait_ms\": " << milliseconds(thread.stats.queue_wait_time)
+			<< ", \"read_ms\": " << milliseconds(thread.stats.read_time)
+			<< ", \"match_ms\": " << milliseconds(thread.stats.match_time)
+			<< ", \"output_ms\": " << milliseconds(thread.stats.output_time) << " }";
+	}
+	report << "\n  ]\n";
+	report << "}\n";
+
+	// The report is small, so it is written in one go.
+	if (filename == "-") {
+		std::cerr << report.str();
+		return;
+	}
+	std::ofstream stats_file(filename + ".json");
+	stats_file << report.str();
+	if (!stats_file) {
+		std::cerr << "Unable to write file: " << filename << std::endl;
+	}
+}
+
+
+/**
+ * Counts the searched files, the files containing the search pattern, and the pattern occurrences.
+ *
+ * @param results The search results and the number of searched files.
+ * @return The counts for the summary.
+ */
+SearchSummary summarizeResults(const SearchResults& results) {
+	SearchSummary counts;
+	counts.searched_files = results.searched_files;
+
+	// Count files with pattern and pattern occurrences from the per-file counts the search threads kept.
+	for (const auto& thread : results.threads) {
+		counts.files_with_pattern += thread.files.size();
+		for (const auto& file : thread.files) {
+			counts.pattern_occurrences += file.match_count;
+		}
+	}
+	return counts;
+}
+
+
+/**
+* Print the search results to the console, including the number of searched files,
+* the number of files containing the search pattern, the number of unique pattern occurrences,
+* the name of the result file, the name of the log file, the number of threads used in the search,
+* and the elapsed time.
+*
+* @param counts The counts of the search.
+* @param thread_count The number of threads used in the search.
+* @param log_filename The name of the log file to be generated, empty if none is written.
+* @param result_filename The name of the result file to be generated.
+* @param result_extension The extension of the result file, which depends on its format.
+* @param timer_start The time at which the search began.
+*/
+void printSearchResults(const SearchSummary& counts, int thread_count, std::string log_filename, std::string result_filename, const char* result_extension,
+	std::chrono::steady_clock::time_point timer_start) {
+	// Keep stdout free for the results if they are written there.
+	std::ostream& summary = result_filename != "-" ? std::cout : std::cerr;
+
+	// Print number of searched files, number of files with pattern and number of pattern occurrences.
+	summary << "Searched files: " << counts.searched_files << std::endl;
+	summary << "Files with pattern: " << counts.files_with_pattern << std::endl;
+	summary << "Patterns number: " << counts.pattern_occurrences << std::endl;
+
+	// Get current directory.
+	std::string cur_directory = fs::current_path().string();
+
+	// Print name of result file and log file, number of threads used, and elapsed time.
+	if (result_filename != "-") {
+		summary << "Result file: " << cur_directory << "\\" << result_filename << result_extension << std::endl;
+	}
+	else {
+		summary << "Result file: stdout" << std::endl;
+	}
+	if (!log_filename.empty()) {
+		summary << "Log file: " << cur_directory << "\\" << log_filename << ".log" << std::endl;
+	}
+	summary << "Used threads: " << thread_count << std::endl;
+
+	// Stop the timer and calculate the elapsed wall time of the program, clock() would sum up the CPU time of all threads
+	auto timer_stop = std::chrono::steady_clock::now();
+	double elapsed_time_ms = std::chrono::duration<double, std::milli>(timer_stop - timer_start).count();
+	summary << "Elapsed time: " << elapsed_time_ms << "[ms]" << std::endl;
+}
+
+
+/**
+ * @param options The search settings, with the name and the format of the result file.
+ * @return The path of the result file, with the extension of its format, or "-" for stdout.
+ */
+std::string resultPath(const SearchOptions& options) {
+	return options.result_filename != "-" ? options.result_filename + resultExtension(options.format) : options.result_filename;
+}
+
+
+/**
+ * Determines if a given filename is valid, meaning it contains only alphanumeric
+ * characters, hyphens, dots, and spaces.
+ *
+ * @param filename the filename to validate
+ * @return true if the filename is valid, false otherwise
+ */
+bool isValidFilename(const std::string& filename) {
+	// Define a regular expression pattern to match characters that are not alphanumeric,
+	// hyphens, dots, or spaces.
+	static const std::regex pattern("[^\\w\\-. ]");
+
+	// Use regex_search to check if the filename contains any invalid characters.
+	// If the search returns true, it means the filename is invalid, so return false.
+	// If the search returns false, it means the filename is valid, so return true.
+	return !std::regex_search(filename, pattern);
+}
+
+
+/**
+ * Sets the starting directory for the program.
+ *
+ * @param dir_opt A reference to a boolean that tracks whether the directory option has already been set.
+ * @param directory_path A reference to a string that stores the path of the starting directory.
+ * @param argv The command line arguments.
+ * @param i The index of the current option, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setStartingDirectory(bool& dir_opt, std::string& directory_path, char* argv[], int i)
+{
+	// Check if the directory option has already been set
+	if (dir_opt == true) {
+		std::cerr << "Error: multiple usage of the starting directory option" << std::endl;
+		return false;
+	}
+
+	// Append the directory to the current directory path
+	directory_path = directory_path + "\\" + argv[i + 1];
+
+	// Check if the directory exists
+	if (!fs::exists(directory_path)) {
+		if (!fs::exists(argv[i + 1])) {
+			std::cerr << "Error: directory does not exist" << std::endl;
+			return false;
+		}
+		directory_path = argv[i + 1];
+	}
+
+	// Set the directory option to true indicating that this option has been set
+	dir_opt = true;
+
+	return true;
+}
+
+
+/**
+ * Sets the log filename and checks if it is a valid filename.
+ *
+ * @param log_filename_opt A boolean reference indicating if the log filename option has already been set.
+ * @param log_filename A string reference to store the log filename.
+ * @param argv A character array containing the command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setLogFilename(bool& log_filename_opt, std::string& log_filename, char* argv[], int i)
+{
+	// Check if option already used
+	if (log_filename_opt == true) {
+		std::cerr << "Error: multiple usage of the log filename option" << std::endl;
+		return false;
+	}
+
+	// Set log filename and check if valid
+	log_filename = argv[i + 1];
+	if (!isValidFilename(log_filename)) {
+		std::cerr << "Error: invalid log filename" << std::endl;
+		return false;
+	}
+
+	// Set log filename option to true indicating that this option has been set
+	log_filename_opt = true;
+
+	return true;
+}
+
+
+/**
+ * Sets the result filename option and checks if the option has already been set
+ * and if the filename is valid.
+ *
+ * @param result_filename_opt A boolean flag to indicate if the result filename option has been set.
+ * @param result_filename A reference to the string that will hold the result filename.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setResultFilename(bool& result_filename_opt, std::string& result_filename, char* argv[], int i)
+{
+	// Check if option already used
+	if (result_filename_opt == true) {
+		std::cerr << "Error: multiple usage of the result filename option" << std::endl;
+		return false;
+	}
+
+	// Set result filename and check if valid
+	result_filename = argv[i + 1];
+	if (!isValidFilename(result_filename)) {
+		std::cerr << "Error: invalid result filename" << std::endl;
+		return false;
+	}
+
+	// Set result filename option to true indicating that this option has been set
+	result_filename_opt = true;
+
+	return true;
+}
+
+
+/**
+ * Sets the directory of the trigram index.
+ *
+ * @param index_directory A string reference to store the index directory, empty while the option is not set.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setIndexDirectory(std::string& index_directory, char* argv[], int i)
+{
+	// Check if option already used
+	if (!index_directory.empty()) {
+		std::cerr << "Error: multiple usage of the index directory option" << std::endl;
+		return false;
+	}
+
+	// Set index directory, it is created when the index is built
+	index_directory = argv[i + 1];
+	if (index_directory.empty() || (fs::exists(index_directory) && !fs::is_directory(index_directory))) {
+		std::cerr << "Error: invalid index directory" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Adds the name of a directory to leave out of the walk.
+ *
+ * @param excluded_directories The names excluded so far, to add the name to.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool addExcludedDirectory(std::vector<std::string>& excluded_directories, char* argv[], int i)
+{
+	// The name is matched against every directory of the tree, so it can not hold a separator
+	const std::string name = argv[i + 1];
+	if (name.empty() || name == "." || name == ".." || name.find('/') != std::string::npos || name.find('\\') != std::string::npos) {
+		std::cerr << "Error: invalid directory name to exclude" << std::endl;
+		return false;
+	}
+	excluded_directories.push_back(name);
+
+	return true;
+}
+
+
+/**
+ * Adds a glob pattern of the names of the files to search, or of the files to leave out.
+ *
+ * @param patterns The patterns given so far, to add the pattern to.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool addFilePattern(std::vector<std::string>& patterns, char* argv[], int i)
+{
+	// The pattern is matched against the name of every file, without its directory
+	const std::string pattern = argv[i + 1];
+	if (pattern.empty() || pattern.find('/') != std::string::npos) {
+		std::cerr << "Error: invalid file name pattern" << std::endl;
+		return false;
+	}
+	patterns.push_back(pattern);
+
+	return true;
+}
+
+
+/**
+ * Sets the size above which files are left out of the search.
+ *
+ * @param max_file_size The size to set, in bytes.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setMaxFileSize(std::uintmax_t& max_file_size, char* argv[], int i)
+{
+	// Parse the size in MiB, 0 searches files of any size
+	const char* const value = argv[i + 1];
+	const char* const value_end = value + strlen(value);
+	std::uint64_t mebibytes = 0;
+	const auto [parsed_end, error] = std::from_chars(value, value_end, mebibytes);
+	if (error != std::errc() || parsed_end != value_end || mebibytes > MAX_MEBIBYTES) {
+		std::cerr << "Error: invalid file size limit" << std::endl;
+		return false;
+	}
+	max_file_size = mebibytes * 1024 * 1024;
+
+	return true;
+}
+
+
+/**
+ * Sets a limit on the matches of a search.
+ *
+ * @param limit The limit to set, 0 for none.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setMatchLimit(std::uint64_t& limit, char* argv[], int i)
+{
+	const char* const value = argv[i + 1];
+	const char* const value_end = value + strlen(value);
+	const auto [parsed_end, error] = std::from_chars(value, value_end, limit);
+	if (error != std::errc() || parsed_end != value_end) {
+		std::cerr << "Error: invalid match limit" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Sets the number of lines shown before or after every matching line.
+ *
+ * @param lines The number of lines to set.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setContextLines(std::uint64_t& lines, char* argv[], int i)
+{
+	const char* const value = argv[i + 1];
+	const char* const value_end = value + strlen(value);
+	const auto [parsed_end, error] = std::from_chars(value, value_end, lines);
+	if (error != std::errc() || parsed_end != value_end) {
+		std::cerr << "Error: invalid number of context lines" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Sets the format of the results.
+ *
+ * @param format The setting to set.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setResultFormat(ResultFormat& format, char* argv[], int i)
+{
+	if (strcmp(argv[i + 1], "text") == 0) {
+		format = ResultFormat::Text;
+	}
+	else if (strcmp(argv[i + 1], "json") == 0) {
+		format = ResultFormat::Json;
+	}
+	else if (strcmp(argv[i + 1], "binary") == 0) {
+		format = ResultFormat::Binary;
+	}
+	else {
+		std::cerr << "Error: invalid result format, expected text, json or binary" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Sets what is done with binary files.
+ *
+ * @param binary_files The setting to set.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setBinaryFiles(BinaryFiles& binary_files, char* argv[], int i)
+{
+	if (strcmp(argv[i + 1], "match") == 0) {
+		binary_files = BinaryFiles::Match;
+	}
+	else if (strcmp(argv[i + 1], "skip") == 0) {
+		binary_files = BinaryFiles::Skip;
+	}
+	else if (strcmp(argv[i + 1], "text") == 0) {
+		binary_files = BinaryFiles::Text;
+	}
+	else {
+		std::cerr << "Error: invalid binary files mode, expected match, skip or text" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Sets the statistics report filename and checks if it is a valid filename.
+ *
+ * @param stats_filename A string reference to store the statistics filename, empty while the option is not set.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setStatsFilename(std::string& stats_filename, char* argv[], int i)
+{
+	// Check if option already used
+	if (!stats_filename.empty()) {
+		std::cerr << "Error: multiple usage of the statistics filename option" << std::endl;
+		return false;
+	}
+
+	// Set statistics filename and check if valid
+	stats_filename = argv[i + 1];
+	if (stats_filename.empty() || !isValidFilename(stats_filename)) {
+		std::cerr << "Error: invalid statistics filename" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Sets the socket of the search server, to answer searches on or to send the search to.
+ *
+ * @param socket_path A string reference to store the socket path, empty while the option is not set.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setSocketPath(std::string& socket_path, char* argv[], int i)
+{
+	// Check if option already used
+	if (!socket_path.empty()) {
+		std::cerr << "Error: multiple usage of the socket option" << std::endl;
+		return false;
+	}
+
+	// Set socket path, the socket file is created by the server
+	socket_path = argv[i + 1];
+	if (socket_path.empty()) {
+		std::cerr << "Error: invalid socket path" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Adds a server to run a distributed search on, or a directory to split the search into.
+ *
+ * @param values The sockets or directories given so far, to add the value to.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool addDistributedValue(std::vector<std::string>& values, char* argv[], int i)
+{
+	// Every value is used as given, and the same one twice would search the same files twice
+	const std::string value = argv[i + 1];
+	if (value.empty() || std::find(values.begin(), values.end(), value) != values.end()) {
+		std::cerr << "Error: invalid or repeated " << argv[i] + 2 << std::endl;
+		return false;
+	}
+	values.push_back(value);
+
+	return true;
+}
+
+
+/**
+ * Sets the number of files every search thread reads ahead.
+ *
+ * @param io_depth An unsigned reference to store the number of files.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setIoDepth(unsigned& io_depth, char* argv[], int i)
+{
+	// Parse the queue depth, the ring holds three entries per file
+	const char* const value = argv[i + 1];
+	const char* const value_end = value + strlen(value);
+	const auto [parsed_end, error] = std::from_chars(value, value_end, io_depth);
+	if (error != std::errc() || parsed_end != value_end || io_depth > MAX_IO_DEPTH) {
+		std::cerr << "Error: invalid io depth" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Sets the size of the chunks huge files are split into.
+ *
+ * @param chunk_size A reference to store the size in bytes.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value in MiB follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setChunkSize(std::uint64_t& chunk_size, char* argv[], int i)
+{
+	// Parse the size in MiB, 0 turns the splitting off
+	const char* const value = argv[i + 1];
+	const char* const value_end = value + strlen(value);
+	std::uint64_t mebibytes = 0;
+	const auto [parsed_end, error] = std::from_chars(value, value_end, mebibytes);
+	if (error != std::errc() || parsed_end != value_end || mebibytes > MAX_MEBIBYTES) {
+		std::cerr << "Error: invalid chunk size" << std::endl;
+		return false;
+	}
+	chunk_size = mebibytes * 1024 * 1024;
+
+	return true;
+}
+
+
+/**
+ * Sets the number of threads to be used in the program.
+ *
+ * @param thread_cnt_opt A boolean flag indicating whether the thread count option has already been set.
+ * @param thread_cnt An integer indicating the number of threads to be used in the program.
+ * @param auto_threads Set to whether the value is auto, which starts with a thread per CPU and adapts their number.
+ * @param argv The command-line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setThreadCount(bool& thread_cnt_opt, int& thread_cnt, bool& auto_threads, char* argv[], int i)
+{
+	// Check if option already used
+	if (thread_cnt_opt == true) {
+		std::cerr << "Error: multiple usage of the thread count option" << std::endl;
+		return false;
+	}
+
+	// Start with a thread per CPU, or the default if their number is not known
+	if (strcmp(argv[i + 1], "auto") == 0) {
+		const unsigned cpu_count = std::thread::hardware_concurrency();
+		thread_cnt = cpu_count > 0 ? static_cast<int>(std::min<unsigned>(cpu_count, MAX_AUTO_THREADS)) : thread_cnt;
+		auto_threads = true;
+		thread_cnt_opt = true;
+		return true;
+	}
+
+	// Set thread count and catch invalid argument
+	try {
+		thread_cnt = std::stoi(argv[i + 1]);
+	}
+	catch (const std::invalid_argument& e) {
+		std::cerr << "Error: invalid thread count" << std::endl;
+		return false;
+	}
+
+	// Check if thread count is valid
+	if (thread_cnt < 1) {
+		std::cerr << "Error: invalid thread count" << std::endl;
+		return false;
+	}
+
+	thread_cnt_opt = true;
+
+	return true;
+}
+
+
+/**
+ * @param options The search settings.
+ * @return The number of threads to start, with -t auto enough of them for the tuner to let in more than one per CPU.
+ */
+int searchThreadCount(const SearchOptions& options)
+{
+	if (!options.auto_threads) {
+		return options.thread_count;
+	}
+	return std::max(options.thread_count, std::min(options.thread_count * AUTO_THREADS_PER_CPU, MAX_AUTO_THREADS));
+}
+
+
+/**
+ * Sets the number of files all search threads together may read ahead on one device.
+ *
+ * @param device_depth An unsigned reference to store the number of files.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool setDeviceDepth(unsigned& device_depth, char* argv[], int i)
+{
+	// Parse the number of files, 0 leaves the limits to the kind of every device
+	const char* const value = argv[i + 1];
+	const char* const value_end = value + strlen(value);
+	const auto [parsed_end, error] = std::from_chars(value, value_end, device_depth);
+	if (error != std::errc() || parsed_end != value_end || device_depth > MAX_IO_DEPTH) {
+		std::cerr << "Error: invalid device depth" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Adds the search strings listed in a file, one per line, to the search strings.
+ *
+ * @param search_strings A reference to the vector of search strings to add to.
+ * @param argv The command line arguments.
+ * @param i The index of the current argument being processed, its value follows at i + 1.
+ *
+ * @return True on success, false on error.
+ */
+bool addPatternsFromFile(std::vector<std::string>& search_strings, char* argv[], int i)
+{
+	// Open the patterns file
+	std::ifstream patterns_file(argv[i + 1]);
+	if (!patterns_file.good()) {
+		std::cerr << "Error: could not open patterns file " << argv[i + 1] << std::endl;
+		return false;
+	}
+
+	// Add every line as a search string
+	std::string pattern;
+	while (std::getline(patterns_file, pattern)) {
+		search_strings.push_back(pattern);
+	}
+
+	return true;
+}
+
+
+/**
+ * Sets additional options for the program based on the provided command line arguments.
+ *
+ * @param argc The number of command line arguments.
+ * @param filename The name of the program.
+ * @param argv An array of the command line arguments.
+ * @param options The search settings to fill, holding the default values on entry.
+ *
+ * @return True on success, false on error.
+ */
+bool setAdditionalOptions(int argc, std::string& filename, char* argv[], SearchOptions& options)
+{
+	// If no arguments are given or the number of arguments is invalid, print an error message and exit
+	if (argc == 1) {
+		std::cerr << "Error: wrong usage of the program\n"
+			<< "Usage: " << filename << " <search string> [<search string>...] [options]\n"
+			<< "       " << filename << " -f <patterns file> [options]\n"
+			<< "       " << filename << " --serve <socket> [-d <directory>] [-t <thread count|auto>] [--pin] [--index <index directory>] [--io_depth <file count>] [--device_depth <file count>] [--chunk_size <MiB>] [--exclude_dir <name>] [--include <glob>] [--exclude <glob>] [--max_size <MiB>]\n"
+			<< "Options:\n"
+			<< "  -d <directory> - directory to search in (default: current directory)\n"
+			<< "  -l <log filename> - log filename (default: <program name>.log)\n"
+			<< "  -r <result filename> - result filename (default: <program name>.txt)\n"
+			<< "  --format <text|json|binary> - write the results as text, as NDJSON to <result filename>.ndjson, or as binary records to <result filename>.bin (default: text)\n"
+			<< "  -t <thread count|auto> - number of threads to use, auto to start with one per CPU and adapt to the I/O (default: 4)\n"
+			<< "  -p - search while the directory is still being walked\n"
+			<< "  --exclude_dir <name> - do not descend into directories of that name, may be given several times\n"
+			<< "  --follow - descend into symbolic links to directories, each directory is searched once\n"
+			<< "  --include <glob> - only search the files whose names match, may be given several times\n"
+			<< "  --exclude <glob> - do not search the files whose names match, may be given several times\n"
+			<< "  --max_size <MiB> - do not search files larger than that, 0 for no limit (default: 0)\n"
+			<< "  --binary_files <match|skip|text> - report binary files that match without their lines, leave them out, or search them as text (default: match)\n"
+			<< "  -f <patterns file> - also search for every line of the file\n"
+			<< "  -e - treat the search strings as regular expressions\n"
+			<< "  -i - match letters in either case, also outside of ASCII\n"
+			<< "  -s - write the results while searching, in the order files finish\n"
+			<< "  -o - write the results while searching, in a fixed order\n"
+			<< "  -c - only write the number of matching lines of every file\n"
+			<< "  -L - only write the files with a match, each is read up to its first one\n"
+			<< "  -m <count> - stop searching a file after that many matching lines, 0 for no limit (default: 0)\n"
+			<< "  --max_results <count> - stop the search after that many results, lines or with -c and -L files, 0 for no limit (default: 0)\n"
+			<< "  -A <count> - also write that many lines after every matching line (default: 0)\n"
+			<< "  -B <count> - also write that many lines before every matching line (default: 0)\n"
+			<< "  -C <count> - also write that many lines before and after every matching line (default: 0)\n"
+			<< "  --fsync - flush the result and log files to disk before exiting\n"
+			<< "  --pin - pin every thread to a CPU of its own, spread over the NUMA nodes (Linux only)\n"
+			<< "  --index <index directory> - skip files ruled out by a trigram index, built on first use, and reuse the matches of files that did not change\n"
+			<< "    or only grew, which misses an edit in place of a grown file between its first and last 4 KiB before the previous end\n"
+			<< "  --stats <stats filename> - write timings and counters as JSON (- for stderr)\n"
+			<< "  --io_depth <file count> - number of files every thread reads ahead with io_uring, 0 for none (default: 32)\n"
+			<< "  --device_depth <file count> - number of files all threads together read ahead on one device, 0 to only limit rotational disks (default: 0)\n"
+			<< "  --chunk_size <MiB> - search files of twice the size in chunks of it on several threads, 0 for never (default: 16)\n"
+			<< "  --connect <socket> - run the search on a server started with --serve\n"
+			<< "  --serve <socket> - keep the files of the directory in memory and answer searches on the socket, or on TCP for <host>:<port>\n"
+			<< "  --worker <socket> - run the search on this server and the others given, each searching the directory in its own tree\n"
+			<< "  --shard <directory> - split the search of the servers given with --worker into directories, each searched by one of them\n"
+			<< "  (a result filename of - writes the results to stdout)\n";
+		return false;
+	}
+
+	bool dir_opt = false, log_filename_opt = false, result_filename_opt = false, thread_cnt_opt = false;
+
+	// The first argument is the search string, unless the search strings come from a patterns file,
+	// the regex option comes first, which the expressions then follow, or a server is started
+	int first_option = 1;
+	if (strcmp(argv[1], "-f") != 0 && strcmp(argv[1], "--patterns_file") != 0 && strcmp(argv[1], "-e") != 0 && strcmp(argv[1], "--regex") != 0
+		&& strcmp(argv[1], "--serve") != 0) {
+		options.search_strings.push_back(argv[1]);
+		first_option = 2;
+	}
 
 	// Loop through the additional options
-	for (int i = 1; i <= additional_options_cnt; i++) {
+	for (int i = first_option; i < argc; i++) {
+		// An argument that is not an option is another search string
+		if (argv[i][0] != '-') {
+			options.search_strings.push_back(argv[i]);
+			continue;
+		}
+
+		// If the option is the -p or --pipeline option, search while the directory is still being walked
+		if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--pipeline") == 0) {
+			options.pipelined = true;
+			continue;
+		}
+
+		// If the option is the -s or --stream option, write the results while searching
+		if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--stream") == 0) {
+			options.stream = true;
+			continue;
+		}
+
+		// If the option is the -o or --stream_ordered option, write the results while searching, in a fixed order
+		if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--stream_ordered") == 0) {
+			options.stream = true;
+			options.ordered = true;
+			continue;
+		}
+
+		// If the option is the -c or --count option, only count the matching lines of every file
+		if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--count") == 0) {
+			options.count = true;
+			continue;
+		}
+
+		// If the option is the -L or --list_files option, only list the files with a match
+		if (strcmp(argv[i], "-L") == 0 || strcmp(argv[i], "--list_files") == 0) {
+			options.list_files = true;
+			continue;
+		}
+
+		// If the option is the --fsync option, flush the output files to disk before exiting
+		if (strcmp(argv[i], "--fsync") == 0) {
+			options.sync = true;
+			continue;
+		}
+
+		// If the option is the --pin option, pin every thread to a CPU, spread over the NUMA nodes
+		if (strcmp(argv[i], "--pin") == 0) {
+			options.pin = true;
+			continue;
+		}
+
+		// If the option is the --follow option, descend into symbolic links to directories
+		if (strcmp(argv[i], "--follow") == 0) {
+			options.walk.follow_symlinks = true;
+			continue;
+		}
+
+		// If the option is the -e or --regex option, treat the search strings as regular expressions
+		if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "--regex") == 0) {
+			options.regex = true;
+			continue;
+		}
+
+		// If the option is the -i or --ignore_case option, match letters in either case
+		if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--ignore_case") == 0) {
+			options.ignore_case = true;
+			continue;
+		}
+
+		// All other options take a value
+		if (i + 1 >= argc) {
+			std::cerr << "Error: missing value for option " << argv[i] << std::endl;
+			return false;
+		}
+
 		// If the option is the -d or --dir option, set the directory path
-		if (strcmp(argv[i * 2], "-d") == 0 || strcmp(argv[i * 2], "--dir") == 0) {
-			int directory_func_success = setStartingDirectory(dir_opt, directory_path, argv, i);
+		if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--dir") == 0) {
+			int directory_func_success = setStartingDirectory(dir_opt, options.directory_path, argv, i);
 
 			// If the directory path is invalid, return false
 			if (!directory_func_success) return directory_func_success;
 		}
 		// If the option is the -l or --log_file option, set the log filename
-		else if (strcmp(argv[i * 2], "-l") == 0 || strcmp(argv[i * 2], "--log_file") == 0) {
-			int log_func_success = setLogFilename(log_filename_opt, log_filename, argv, i);
+		else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--log_file") == 0) {
+			int log_func_success = setLogFilename(log_filename_opt, options.log_filename, argv, i);
 
 			// If the log filename is invalid, return false
 			if (!log_func_success) return log_func_success;
 		}
 		// If the option is the -r or --result_file option, set the result filename
-		else if (strcmp(argv[i * 2], "-r") == 0 || strcmp(argv[i * 2], "--result_file") == 0) {
-			int result_func_success = setResultFilename(result_filename_opt, result_filename, argv, i);
+		else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--result_file") == 0) {
+			int result_func_success = setResultFilename(result_filename_opt, options.result_filename, argv, i);
 
 			// If the result filename is invalid, return false
 			if (!result_func_success) return result_func_success;
 		}
 		// If the option is the -t or --threads option, set the threads count
-		else if (strcmp(argv[i * 2], "-t") == 0 || strcmp(argv[i * 2], "--threads") == 0) {
-			int thread_func_success = setThreadCount(thread_cnt_opt, thread_cnt, argv, i);
+		else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) {
+			int thread_func_success = setThreadCount(thread_cnt_opt, options.thread_count, options.auto_threads, argv, i);
 
 			// If the thread count is invalid, return false
 			if (!thread_func_success) return thread_func_success;
 		}
+		// If the option is the -f or --patterns_file option, add the search strings listed in the file
+		else if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--patterns_file") == 0) {
+			int patterns_func_success = addPatternsFromFile(options.search_strings, argv, i);
+
+			// If the patterns file could not be read, return false
+			if (!patterns_func_success) return patterns_func_success;
+		}
+		// If the option is the --index option, set the directory of the trigram index
+		else if (strcmp(argv[i], "--index") == 0) {
+			int index_func_success = setIndexDirectory(options.index_directory, argv, i);
+
+			// If the index directory is invalid, return false
+			if (!index_func_success) return index_func_success;
+		}
+		// If the option is the --io_depth option, set the number of files every thread reads ahead
+		else if (strcmp(argv[i], "--io_depth") == 0) {
+			int io_depth_func_success = setIoDepth(options.io_depth, argv, i);
+
+			// If the queue depth is invalid, return false
+			if (!io_depth_func_success) return io_depth_func_success;
+		}
+		// If the option is the --device_depth option, set the number of files all threads read ahead on one device
+		else if (strcmp(argv[i], "--device_depth") == 0) {
+			int device_depth_func_success = setDeviceDepth(options.device_depth, argv, i);
+
+			// If the depth is invalid, return false
+			if (!device_depth_func_success) return device_depth_func_success;
+		}
+		// If the option is the --exclude_dir option, leave the directories of that name out of the walk
+		else if (strcmp(argv[i], "--exclude_dir") == 0) {
+			int exclude_func_success = addExcludedDirectory(options.walk.excluded_directories, argv, i);
+
+			// If the directory name is invalid, return false
+			if (!exclude_func_success) return exclude_func_success;
+		}
+		// If the option is the --include or --exclude option, only search the files whose names match, or leave them out
+		else if (strcmp(argv[i], "--include") == 0) {
+			int include_func_success = addFilePattern(options.walk.included_files, argv, i);
+
+			// If the pattern is invalid, return false
+			if (!include_func_success) return include_func_success;
+		}
+		else if (strcmp(argv[i], "--exclude") == 0) {
+			int exclude_func_success = addFilePattern(options.walk.excluded_files, argv, i);
+
+			// If the pattern is invalid, return false
+			if (!exclude_func_success) return exclude_func_success;
+		}
+		// If the option is the --max_size option, leave out the files above that size
+		else if (strcmp(argv[i], "--max_size") == 0) {
+			int max_size_func_success = setMaxFileSize(options.walk.max_file_size, argv, i);
+
+			// If the size is invalid, return false
+			if (!max_size_func_success) return max_size_func_success;
+		}
+		// If the option is the -m or --max_count option, set the most matching lines of every file
+		else if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--max_count") == 0) {
+			int max_count_func_success = setMatchLimit(options.max_count, argv, i);
+
+			// If the limit is invalid, return false
+			if (!max_count_func_success) return max_count_func_success;
+		}
+		// If the option is the --max_results option, set the most results of the whole search
+		else if (strcmp(argv[i], "--max_results") == 0) {
+			int max_results_func_success = setMatchLimit(options.max_results, argv, i);
+
+			// If the limit is invalid, return false
+			if (!max_results_func_success) return max_results_func_success;
+		}
+		// If the option is the -A, -B or -C option, set the number of lines shown after, before, or around every matching line
+		else if (strcmp(argv[i], "-A") == 0 || strcmp(argv[i], "--after_context") == 0) {
+			int after_func_success = setContextLines(options.context.after, argv, i);
+
+			// If the number of lines is invalid, return false
+			if (!after_func_success) return after_func_success;
+		}
+		else if (strcmp(argv[i], "-B") == 0 || strcmp(argv[i], "--before_context") == 0) {
+			int before_func_success = setContextLines(options.context.before, argv, i);
+
+			// If the number of lines is invalid, return false
+			if (!before_func_success) return before_func_success;
+		}
+		else if (strcmp(argv[i], "-C") == 0 || strcmp(argv[i], "--context") == 0) {
+			int context_func_success = setContextLines(options.context.before, argv, i);
+
+			// If the number of lines is invalid, return false
+			if (!context_func_success) return context_func_success;
+			options.context.after = options.context.before;
+		}
+		// If the option is the --format option, set the format of the results
+		else if (strcmp(argv[i], "--format") == 0) {
+			int format_func_success = setResultFormat(options.format, argv, i);
+
+			// If the format is invalid, return false
+			if (!format_func_success) return format_func_success;
+		}
+		// If the option is the --binary_files option, set what is done with binary files
+		else if (strcmp(argv[i], "--binary_files") == 0) {
+			int binary_func_success = setBinaryFiles(options.binary_files, argv, i);
+
+			// If the mode is invalid, return false
+			if (!binary_func_success) return binary_func_success;
+		}
+		// If the option is the --chunk_size option, set the size of the chunks huge files are split into
+		else if (strcmp(argv[i], "--chunk_size") == 0) {
+			int chunk_size_func_success = setChunkSize(options.chunk_size, argv, i);
+
+			// If the chunk size is invalid, return false
+			if (!chunk_size_func_success) return chunk_size_func_success;
+		}
+		// If the option is the --serve or --connect option, set the socket of the search server
+		else if (strcmp(argv[i], "--serve") == 0) {
+			int serve_func_success = setSocketPath(options.serve_socket, argv, i);
+
+			// If the socket path is invalid, return false
+			if (!serve_func_success) return serve_func_success;
+		}
+		else if (strcmp(argv[i], "--connect") == 0) {
+			int connect_func_success = setSocketPath(options.connect_socket, argv, i);
+
+			// If the socket path is invalid, return false
+			if (!connect_func_success) return connect_func_success;
+		}
+		// If the option is the --worker or --shard option, add a server or a directory of a distributed search
+		else if (strcmp(argv[i], "--worker") == 0) {
+			int worker_func_success = addDistributedValue(options.worker_sockets, argv, i);
+
+			// If the socket is invalid, return false
+			if (!worker_func_success) return worker_func_success;
+		}
+		else if (strcmp(argv[i], "--shard") == 0) {
+			int shard_func_success = addDistributedValue(options.shard_directories, argv, i);
+
+			// If the directory is invalid, return false
+			if (!shard_func_success) return shard_func_success;
+		}
+		// If the option is the --stats option, set the statistics report filename
+		else if (strcmp(argv[i], "--stats") == 0) {
+			int stats_func_success = setStatsFilename(options.stats_filename, argv, i);
+
+			// If the statistics filename is invalid, return false
+			if (!stats_func_success) return stats_func_success;
+		}
 		// If option not recognized, print error message
 		else {
 			std::cerr << "Wrong usage of the additional parameters." << std::endl;
 			return false;
 		}
+
+		// Skip the value of the option
+		i++;
+	}
+
+	// A server takes the patterns from its queries, a client leaves the report of the search to the server
+	if (!options.serve_socket.empty()) {
+		if (!options.search_strings.empty() || !options.connect_socket.empty()) {
+			std::cerr << "Error: a server takes no search strings, they come with every query" << std::endl;
+			return false;
+		}
+		if (options.walk.follow_symlinks) {
+			std::cerr << "Error: a server does not follow symbolic links" << std::endl;
+			return false;
+		}
+		return true;
+	}
+	if ((!options.connect_socket.empty() || !options.worker_sockets.empty()) && !options.stats_filename.empty()) {
+		std::cerr << "Error: the statistics option can not be used with a server" << std::endl;
+		return false;
+	}
+
+	// A distributed search merges the results of all shards before writing them, and every shard keeps its own results
+	if (!options.shard_directories.empty() && options.worker_sockets.empty()) {
+		std::cerr << "Error: shards are only searched by the servers given with --worker" << std::endl;
+		return false;
+	}
+	if (!options.worker_sockets.empty()) {
+		if (!options.connect_socket.empty() || !options.serve_socket.empty()) {
+			std::cerr << "Error: a distributed search can not be combined with --connect or --serve" << std::endl;
+			return false;
+		}
+		if (options.stream || options.max_results != 0) {
+			std::cerr << "Error: the results of a distributed search are merged at the end, -s, -o and --max_results can not be used" << std::endl;
+			return false;
+		}
+	}
+
+	// The count and list-files modes leave out different parts of the results, only one of them can be used
+	if (options.count && options.list_files) {
+		std::cerr << "Error: the count and list files options can not be combined" << std::endl;
+		return false;
+	}
+
+	// Check the regular expressions up front, the search compiles them again
+	if (options.regex) {
+		RegexSearcher searcher;
+		std::string error;
+		if (!searcher.compile(options.search_strings, error, options.ignore_case)) {
+			std::cerr << "Error: invalid regular expression " << error << std::endl;
+			return false;
+		}
 	}
 
 	return true;
 }
 
 
-int main(int argc, char* argv[]) {
-	// Initialize the timer
-	int timer_start;
+/**
+ * Makes the path of a directory absolute and normal, without a trailing separator, so that two
+ * paths of the same directory compare equal.
+ *
+ * @param directory_path The path of the directory.
+ * @return The absolute path.
+ */
+fs::path absoluteDirectory(const std::string& directory_path) {
+	fs::path directory = fs::absolute(directory_path).lexically_normal();
+	if (!directory.has_filename()) {
+		directory = directory.parent_path();
+	}
+	return directory;
+}
+
+
+/**
+ * Answers the query of a client: searches the files of the tree below the directory of the query and
+ * sends back the results, formatted like those of a search on its own, followed by the summary.
+ *
+ * @param connection The connection to the client.
+ * @param settings The settings of the server: the tree, the thread count, the index, and the read-ahead depth.
+ * @param tree The files of the tree, brought up to date before the search.
+ * @param pool The threads to search with.
+ */
+void answerQuery(int connection, const SearchOptions& settings, FileTree& tree, ThreadPool& pool) {
+	SearchOptions options = settings;
+	if (!receiveQuery(connection, options)) {
+		sendMessage(connection, ERROR_MESSAGE, "malformed query");
+		return;
+	}
+
+	// A query may search a part of the tree, but nothing outside of it. The index only covers the whole tree.
+	const fs::path directory = absoluteDirectory(options.directory_path);
+	const fs::path relative = directory.lexically_relative(tree.root());
+	if (relative.empty() || *relative.begin() == "..") {
+		sendMessage(connection, ERROR_MESSAGE, "the server searches " + tree.root().string() + ", not " + directory.string());
+		return;
+	}
+	options.directory_path = directory.string();
+	if (directory != tree.root()) {
+		options.index_directory.clear();
+	}
+
+	// Check the query like the options of a search on its own
+	if (options.count && options.list_files) {
+		sendMessage(connection, ERROR_MESSAGE, "the count and list files options can not be combined");
+		return;
+	}
+	if (options.regex) {
+		RegexSearcher searcher;
+		std::string error;
+		if (!searcher.compile(options.search_strings, error, options.ignore_case)) {
+			sendMessage(connection, ERROR_MESSAGE, "invalid regular expression " + error);
+			return;
+		}
+	}
+
+	// Search the current files of the tree and write the results to the client
+	tree.refresh();
+	OutputFile output;
+	output.openMessages(connection);
+	SearchResults results;
+	bool written = output.write(formatResultHeader(options.format, options.search_strings));
+	if (!written) {
+		return;
+	}
+	if (options.stream) {
+		ResultStream stream(output, options.ordered);
+		results = searchDirectoryForString(options, &stream, pool, &tree);
+		written = stream.finish();
+	}
+	else {
+		results = searchDirectoryForString(options, nullptr, pool, &tree);
+		written = options.count || options.list_files ? writeFiles(output, results, options.count, options.format)
+			: writeResults(output, results, options.search_strings, options.format, pool);
+	}
+
+	// A client that went away gets no summary
+	if (written) {
+		const SearchSummary counts = summarizeResults(results);
+		std::ostringstream summary;
+		summary << counts.searched_files << ' ' << counts.files_with_pattern << ' ' << counts.pattern_occurrences << ' ' << results.active_threads;
+		sendMessage(connection, SUMMARY_MESSAGE, summary.str());
+	}
+}
+
+
+/**
+ * Records a request to stop the server.
+ *
+ * @param signal_number The signal received.
+ */
+void stopServing(int signal_number) {
+	stop_serving = 1;
+}
+
+
+/**
+ * Serves searches of the directory on a Unix socket until the process receives SIGINT or SIGTERM.
+ * The threads, the list of the files of the tree, and the index stay in place between the queries,
+ * so a query only costs the search itself. The queries are answered one after another, each one
+ * with all threads.
+ *
+ * @param options The settings of the server: the socket, the tree, the thread count, the index, and the read-ahead depth.
+ * @return The exit code of the program.
+ */
+int serveQueries(const SearchOptions& options) {
+	const int listener = listenOnSocket(options.serve_socket);
+	if (listener < 0) {
+		return 1;
+	}
+
+#if defined(__unix__) || defined(__APPLE__)
+	// A signal has to interrupt the wait for the next client, so the worker threads started from here on
+	// block it and leave it to this thread. A client that goes away must not end the server.
+	struct sigaction action = {};
+	action.sa_handler = stopServing;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+	sigset_t stop_signals;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+#endif
+	ThreadPool pool(searchThreadCount(options), options.pin);
+#if defined(__unix__) || defined(__APPLE__)
+	pthread_sigmask(SIG_UNBLOCK, &stop_signals, nullptr);
+#endif
+
+	// Walk the tree once, the server keeps up with its changes from then on
+	FileTree tree(options.walk);
+	tree.watch(absoluteDirectory(options.directory_path));
+	SearchOptions settings = options;
+	settings.directory_path = tree.root().string();
+	settings.pipelined = false;
+	std::cerr << "Serving " << settings.directory_path << " on " << options.serve_socket << std::endl;
+
+	while (!stop_serving) {
+		const int connection = acceptClient(listener);
+		if (connection < 0) {
+			continue;
+		}
+		answerQuery(connection, settings, tree, pool);
+		closeSocket(connection);
+	}
+
+	closeSocket(listener);
+	if (!isTcpAddress(options.serve_socket)) {
+		std::error_code remove_error;
+		fs::remove(options.serve_socket, remove_error);
+	}
+	return 0;
+}
+
+
+/**
+ * Hands the search to a server and writes the results it sends back to the result file, followed by
+ * the summary. No log file is written, the search runs with the threads, index, and read-ahead depth
+ * of the server.
+ *
+ * @param options The search settings, with the socket of the server.
+ * @param timer_start The time at which the program started.
+ * @return The exit code of the program.
+ */
+int queryServer(const SearchOptions& options, std::chrono::steady_clock::time_point timer_start) {
+#if defined(__unix__) || defined(__APPLE__)
+	// A server that goes away shows as a failed write, not as a signal
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	OutputFile output_file;
+	if (!output_file.open(resultPath(options))) {
+		std::cerr << "Could not open output file" << std::endl;
+		return 1;
+	}
+	const int connection = connectToSocket(options.connect_socket);
+	if (connection < 0) {
+		return 1;
+	}
+
+	// The server resolves the directory against its own, so it gets the absolute path
+	SearchOptions query = options;
+	query.directory_path = absoluteDirectory(options.directory_path).string();
+	if (!sendQuery(connection, query)) {
+		std::cerr << "Error: could not send the search to the server" << std::endl;
+		closeSocket(connection);
+		return 1;
+	}
+
+	// Write the results as they arrive, until the summary or an error ends them. Once the output is
+	// closed, the rest of the results is of no use, and the server stops writing when the connection closes.
+	bool finished = false;
+	SearchSummary counts;
+	int thread_count = 0;
+	char type;
+	std::string payload;
+	while (!finished && receiveMessage(connection, type, payload)) {
+		if (type == RESULT_MESSAGE) {
+			if (!output_file.write(payload)) {
+				std::cerr << "Could not write output file" << std::endl;
+				closeSocket(connection);
+				return 1;
+			}
+		}
+		else if (type == SUMMARY_MESSAGE) {
+			std::istringstream summary(payload);
+			summary >> counts.searched_files >> counts.files_with_pattern >> counts.pattern_occurrences >> thread_count;
+			finished = true;
+		}
+		else if (type == ERROR_MESSAGE) {
+			std::cerr << "Error: " << payload << std::endl;
+			closeSocket(connection);
+			return 1;
+		}
+	}
+	closeSocket(connection);
+	if (!finished) {
+		std::cerr << "Error: the server ended the search before sending all results" << std::endl;
+		return 1;
+	}
+	if ((options.sync && !output_file.sync()) || !output_file.close()) {
+		std::cerr << "Could not write output file" << std::endl;
+	}
+
+	printSearchResults(counts, thread_count, "", options.result_filename, resultExtension(options.format), timer_start);
+	return 0;
+}
+
+
+/**
+ * A part of a distributed search: a directory one worker searches, and how far it got.
+ */
+struct Shard {
+	std::string directory;
+
+	// The worker whose own tree the shard is, or -1 if any worker whose tree holds the directory may search it.
+	int pinned_worker = -1;
+
+	// The workers that answered that they can not search the shard.
+	std::vector<bool> refused;
+
+	// The number of workers searching it, more than one once it was handed to another worker as a straggler.
+	int running = 0;
+	bool done = false;
+};
+
+
+/**
+ * A server taking part in a distributed search.
+ */
+struct Worker {
+	std::string socket;
+
+	// Whether it searches a shard, and whether its connection failed, which leaves it out of the rest of the search.
+	bool busy = false;
+	bool failed = false;
+
+	// The number of threads it reported for its last shard.
+	int thread_count = 0;
+};
+
+
+/**
+ * A shard handed to a worker, with the results it sent so far.
+ */
+struct ShardAttempt {
+	std::size_t shard;
+	std::size_t worker;
+	int connection;
+	std::chrono::steady_clock::time_point start;
+
+	// The results, as if a thread of this process had found them, the bytes of a record that is not complete
+	// yet, and the path of the file of the last record.
+	ThreadResults results;
+	std::string pending;
+	bool header_read = false;
+	std::string last_path;
+
+	// Whether the attempt is over, with its connection closed.
+	bool ended = false;
+};
+
+
+/**
+ * Adds the next bytes of the binary results a worker sent to the results of its shard. The records of a file
+ * follow each other, so a record of another file than the one before starts the next file.
+ *
+ * @param attempt The shard and its results so far.
+ * @param data The bytes that follow the ones received so far, which may end within a record.
+ * @param pattern_count The number of search strings, which the records refer to by index.
+ * @param path_prefix The text put before every path, to tell apart the files of several workers.
+ * @return False if the results are malformed.
+ */
+bool addWorkerResults(ShardAttempt& attempt, std::string_view data, std::size_t pattern_count, const std::string& path_prefix) {
+	attempt.pending += data;
+	std::string_view rest = attempt.pending;
+	if (!attempt.header_read) {
+		if (rest.size() < sizeof(BinaryResultHeader)) {
+			return true;
+		}
+		if (!isBinaryResultHeader(rest)) {
+			return false;
+		}
+		rest.remove_prefix(sizeof(BinaryResultHeader));
+		attempt.header_read = true;
+	}
+
+	ThreadResults& results = attempt.results;
+	ResultEntry entry;
+	for (std::size_t size; (size = readBinaryEntry(rest, entry)) != 0; rest.remove_prefix(size)) {
+		if (entry.type == ResultType::Pattern) {
+			continue;
+		}
+		if ((entry.type == ResultType::Match || entry.type == ResultType::BinaryFile) && entry.pattern_index >= pattern_count) {
+			return false;
+		}
+		if (results.files.empty() || entry.path != attempt.last_path) {
+			results.files.push_back({ fs::path(path_prefix + std::string(entry.path)), 0, results.matches.size(), entry.type == ResultType::BinaryFile });
+			attempt.last_path = entry.path;
+		}
+
+		// The count and list-files modes only have the files, every other record is a line of the file
+		FileMatches& file = results.files.back();
+		if (entry.type == ResultType::Count || entry.type == ResultType::File) {
+			file.match_count = entry.type == ResultType::Count ? entry.line_number : 1;
+			continue;
+		}
+		if (entry.type != ResultType::Context) {
+			++file.match_count;
+		}
+		MatchRecord record;
+		record.file_index = static_cast<std::uint32_t>(results.files.size() - 1);
+		record.pattern_index = entry.type == ResultType::Context ? CONTEXT_LINE : entry.pattern_index;
+		record.line_number = entry.line_number;
+		record.byte_offset = entry.byte_offset;
+		record.line_length = entry.text.size();
+		record.text_offset = results.text.append(entry.text);
+		results.matches.push_back(record);
+	}
+	attempt.pending.erase(0, attempt.pending.size() - rest.size());
+	return true;
+}
+
+
+/**
+ * Picks the shard an idle worker searches next: the first one nobody searches yet, or, once all of them are
+ * handed out, one that takes much longer than the shards done so far, which the first of both workers to
+ * finish then answers.
+ *
+ * @param shards The shards of the search.
+ * @param attempts The shards being searched.
+ * @param worker The index of the idle worker.
+ * @param shard_times The times the shards done so far took.
+ * @return The index of the shard, or shards.size() if there is none for the worker.
+ */
+std::size_t nextShard(const std::vector<Shard>& shards, const std::list<ShardAttempt>& attempts, std::size_t worker,
+	const std::vector<std::chrono::nanoseconds>& shard_times) {
+	auto takes = [&](const Shard& shard) {
+		return !shard.done && !shard.refused[worker] && (shard.pinned_worker < 0 || shard.pinned_worker == static_cast<int>(worker));
+	};
+	for (std::size_t i = 0; i < shards.size(); ++i) {
+		if (shards[i].running == 0 && takes(shards[i])) {
+			return i;
+		}
+	}
+
+	// A straggler is searched by a single worker for more than a few times as long as the median shard
+	if (shard_times.empty()) {
+		return shards.size();
+	}
+	std::vector<std::chrono::nanoseconds> times = shard_times;
+	std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+	const auto threshold = std::max<std::chrono::nanoseconds>(STRAGGLER_MIN_TIME, times[times.size() / 2] * STRAGGLER_FACTOR);
+	const auto now = std::chrono::steady_clock::now();
+	for (const auto& attempt : attempts) {
+		const Shard& shard = shards[attempt.shard];
+		if (shard.pinned_worker < 0 && shard.running == 1 && takes(shard) && now - attempt.start > threshold) {
+			return attempt.shard;
+		}
+	}
+	return shards.size();
+}
+
+
+/**
+ * Runs a search on several servers started with --serve, on this host or others, and writes the results
+ * of all of them to the result file as one search, in the order of a search on its own.
+ *
+ * Every worker searches the directory of the search in its own tree, or, with shards, the shards are handed
+ * out one at a time to the workers whose tree holds them, so a fast worker takes more of them. A worker only
+ * gets its next shard once it answered the last one, and its results are read as they come, so a worker waits
+ * on the socket buffer while the coordinator is behind rather than results piling up anywhere. A shard that
+ * takes much longer than the others is handed to an idle worker as well, and the first answer is kept. A worker
+ * whose connection fails is left out, its shard goes to another one. The workers answer in the binary format,
+ * which is read back record by record into the results the result file is written from.
+ *
+ * @param options The search settings, with the sockets of the workers and the shards.
+ * @param timer_start The time at which the program started.
+ * @return The exit code of the program.
+ */
+int coordinateWorkers(const SearchOptions& options, std::chrono::steady_clock::time_point timer_start) {
+#if defined(__unix__) || defined(__APPLE__)
+	// A worker that goes away shows as a failed write, not as a signal
+	signal(SIGPIPE, SIG_IGN);
+
+	// Without shards, every worker searches a shard of its own, and its paths are told apart by its socket
+	std::vector<Worker> workers(options.worker_sockets.size());
+	std::vector<Shard> shards;
+	for (std::size_t i = 0; i < workers.size(); ++i) {
+		workers[i].socket = options.worker_sockets[i];
+		if (options.shard_directories.empty()) {
+			shards.push_back({ absoluteDirectory(options.directory_path).string(), static_cast<int>(i) });
+		}
+	}
+	for (const auto& directory : options.shard_directories) {
+		shards.push_back({ absoluteDirectory(directory).string() });
+	}
+	for (auto& shard : shards) {
+		shard.refused.assign(workers.size(), false);
+	}
+	SearchOptions query = options;
+	query.format = ResultFormat::Binary;
+
+	std::list<ShardAttempt> attempts;
+	std::vector<std::chrono::nanoseconds> shard_times;
+	std::size_t shards_done = 0;
+	SearchResults results;
+	SearchSummary counts;
+	std::string last_error;
+
+	// Ends an attempt, leaving its worker free for the next shard unless its connection failed
+	auto finish = [&](ShardAttempt& attempt, bool failed) {
+		closeSocket(attempt.connection);
+		attempt.ended = true;
+		workers[attempt.worker].busy = false;
+		workers[attempt.worker].failed = workers[attempt.worker].failed || failed;
+		--shards[attempt.shard].running;
+	};
+
+	while (shards_done < shards.size()) {
+		// Hand every idle worker its next shard
+		for (std::size_t i = 0; i < workers.size(); ++i) {
+			if (workers[i].busy || workers[i].failed) {
+				continue;
+			}
+			const std::size_t shard = nextShard(shards, attempts, i, shard_times);
+			if (shard == shards.size()) {
+				continue;
+			}
+			const int connection = connectToSocket(workers[i].socket);
+			query.directory_path = shards[shard].directory;
+			if (connection < 0 || !sendQuery(connection, query)) {
+				if (connection >= 0) {
+					closeSocket(connection);
+				}
+				last_error = "could not reach " + workers[i].socket;
+				workers[i].failed = true;
+				continue;
+			}
+			attempts.push_back({ shard, i, connection, std::chrono::steady_clock::now() });
+			workers[i].busy = true;
+			++shards[shard].running;
+		}
+
+		// With nobody searching, no worker is left for the shards that are not done
+		if (attempts.empty()) {
+			const auto left = std::find_if(shards.begin(), shards.end(), [](const Shard& shard) { return !shard.done; });
+			std::cerr << "Error: no worker could search " << left->directory << (last_error.empty() ? "" : ": " + last_error) << std::endl;
+			return 1;
+		}
+
+		// Wait for the next messages, waking up now and then to look for stragglers
+		std::vector<pollfd> connections;
+		for (const auto& attempt : attempts) {
+			connections.push_back({ attempt.connection, POLLIN, 0 });
+		}
+		if (poll(connections.data(), connections.size(), STRAGGLER_CHECK_MS) < 0 && errno != EINTR) {
+			std::cerr << "Error: could not wait for the workers: " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+
+		// Take a message from every worker that sent one
+		auto polled = connections.begin();
+		for (auto& attempt : attempts) {
+			if ((polled++)->revents == 0 || attempt.ended) {
+				continue;
+			}
+			Shard& shard = shards[attempt.shard];
+			const std::string& socket = workers[attempt.worker].socket;
+			char type;
+			std::string payload;
+			if (!receiveMessage(attempt.connection, type, payload)) {
+				last_error = "the worker on " + socket + " went away";
+				finish(attempt, true);
+			}
+			else if (type == RESULT_MESSAGE) {
+				if (!addWorkerResults(attempt, payload, options.search_strings.size(), shard.pinned_worker < 0 ? std::string() : socket + ":")) {
+					last_error = "the worker on " + socket + " sent malformed results";
+					finish(attempt, true);
+				}
+			}
+			else if (type == SUMMARY_MESSAGE && attempt.header_read && attempt.pending.empty()) {
+				// The first answer of a shard is kept, any other worker still searching it is let go
+				SearchSummary shard_counts;
+				std::istringstream summary(payload);
+				summary >> shard_counts.searched_files >> shard_counts.files_with_pattern >> shard_counts.pattern_occurrences >> workers[attempt.worker].thread_count;
+				counts.searched_files += shard_counts.searched_files;
+				counts.files_with_pattern += shard_counts.files_with_pattern;
+				counts.pattern_occurrences += shard_counts.pattern_occurrences;
+				shard.done = true;
+				++shards_done;
+				shard_times.push_back(std::chrono::steady_clock::now() - attempt.start);
+				results.threads.push_back(std::move(attempt.results));
+				for (auto& other : attempts) {
+					if (other.shard == attempt.shard && !other.ended) {
+						finish(other, false);
+					}
+				}
+			}
+			else if (type == ERROR_MESSAGE) {
+				last_error = socket + ": " + payload;
+				shard.refused[attempt.worker] = true;
+				finish(attempt, false);
+			}
+			else {
+				last_error = "the worker on " + socket + " sent malformed results";
+				finish(attempt, true);
+			}
+		}
+		attempts.remove_if([](const ShardAttempt& attempt) { return attempt.ended; });
+	}
+
+	// Write the results of all shards like those of a search on its own
+	OutputFile output_file;
+	if (!output_file.open(resultPath(options))) {
+		std::cerr << "Could not open output file" << std::endl;
+		return 1;
+	}
+	ThreadPool pool(options.thread_count, options.pin);
+	const bool written = output_file.write(formatResultHeader(options.format, options.search_strings))
+		&& (options.count || options.list_files ? writeFiles(output_file, results, options.count, options.format)
+		: writeResults(output_file, results, options.search_strings, options.format, pool));
+	if (!written || (options.sync && !output_file.sync()) || !output_file.close()) {
+		std::cerr << "Could not write output file" << std::endl;
+	}
+
+	int thread_count = 0;
+	for (const auto& worker : workers) {
+		thread_count += worker.thread_count;
+	}
+	printSearchResults(counts, thread_count, "", options.result_filename, resultExtension(options.format), timer_start);
+	return 0;
+#else
+	std::cerr << "Error: distributed searches are only supported on Unix" << std::endl;
+	return 1;
+#endif
+}
+
 
+int main(int argc, char* argv[]) {
 	// Start the timer
-	timer_start = clock();
+	auto timer_start = std::chrono::steady_clock::now();
 
 	// Extract the filename from the first argument
 	std::string filename = fs::path(argv[0]).filename().string();
-	// Extract the string to search for from the second argument
-	std::string search_string = argv[1];
-	// Initialize the directory path to the current directory
-	std::string directory_path = fs::current_path().string();
 
-	// Set default values for log filename, result filename, and thread count
-	int thread_cnt = 4;
+	// Initialize the directory path to the current directory, the thread count keeps its default
+	SearchOptions options;
+	options.directory_path = fs::current_path().string();
 
-	// Extract the program name from the filename
+	// Extract the program name from the filename and use it for the default log and result filenames
 	std::size_t last_dot = filename.find_last_of(".");
 	std::string program_name = filename.substr(0, last_dot);
-	std::string log_filename = program_name;
-	std::string result_filename = program_name;
+	options.log_filename = program_name;
+	options.result_filename = program_name;
 
-	// Parse the additional options using the setAdditionalOptions function
-	int options_func_success = setAdditionalOptions(argc, filename, argv, directory_path, log_filename, result_filename, thread_cnt);
+	// Parse the search strings and additional options using the setAdditionalOptions function
+	int options_func_success = setAdditionalOptions(argc, filename, argv, options);
 
 	// If any of the additional options is invalid, return false
 	if (!options_func_success) return 1;
 
-	// Search directory for string with specified thread count
-	std::pair<std::vector<std::tuple<std::thread::id, std::string, int, std::string>>, int> results = searchDirectoryForString(search_string, directory_path, thread_cnt);
+	// Serve searches of the directory until stopped, or hand this search to a server
+	if (!options.serve_socket.empty()) {
+		return serveQueries(options);
+	}
+	if (!options.connect_socket.empty()) {
+		return queryServer(options, timer_start);
+	}
+	if (!options.worker_sockets.empty()) {
+		return coordinateWorkers(options, timer_start);
+	}
+
+	// In streaming mode, open the result file up front, the search threads write to it while searching
+	OutputFile stream_file;
+	std::unique_ptr<ResultStream> stream;
+	if (options.stream) {
+		if (!stream_file.open(resultPath(options)) || !stream_file.write(formatResultHeader(options.format, options.search_strings))) {
+			std::cerr << "Could not open output file" << std::endl;
+			return 1;
+		}
+		stream = std::make_unique<ResultStream>(stream_file, options.ordered);
+	}
+
+	// Start the threads once, they search, then sort and format the results, and build the index
+	ThreadPool pool(searchThreadCount(options), options.pin);
 
-	// Write results to the file specified by result_filename variable
-	writeResultsToFile(result_filename, std::get<0>(results));
+	// Search directory for the strings with specified thread count
+	SearchResults results = searchDirectoryForString(options, stream.get(), pool, nullptr);
+
+	// Write results to the file specified by result_filename variable, unless they were streamed there already
+	const auto results_start = std::chrono::steady_clock::now();
+	if (stream) {
+		if (!stream->finish() || (options.sync && !stream_file.sync()) || !stream_file.close()) {
+			std::cerr << "Could not write output file" << std::endl;
+		}
+	}
+	else {
+		OutputFile output_file;
+		if (!output_file.open(resultPath(options))) {
+			std::cerr << "Could not open output file" << std::endl;
+		}
+		else {
+			const bool written = output_file.write(formatResultHeader(options.format, options.search_strings))
+				&& (options.count || options.list_files ? writeFiles(output_file, results, options.count, options.format)
+				: writeResults(output_file, results, options.search_strings, options.format, pool));
+			if (!written || (options.sync && !output_file.sync()) || !output_file.close()) {
+				std::cerr << "Could not write output file" << std::endl;
+			}
+		}
+	}
 
 	// Write the log file to the file specified by log_filename variable
-	writeLogToFile(log_filename, std::get<0>(results));
+	const auto log_start = std::chrono::steady_clock::now();
+	writeLogToFile(options.log_filename, results, options.sync);
+	const auto log_stop = std::chrono::steady_clock::now();
+
+	// Write the statistics report if requested
+	if (!options.stats_filename.empty()) {
+		writeStatsToFile(options.stats_filename, options, results, log_start - results_start, log_stop - log_start, log_stop - timer_start);
+	}
 
 	// Print the results of the program
-	printSearchResults(results, thread_cnt, log_filename, result_filename, timer_start);
+	printSearchResults(summarizeResults(results), results.active_threads, options.log_filename, options.result_filename, resultExtension(options.format), timer_start);
 
 	// Return success
 	return 0;
@@ -0,0 +1,41 @@
+#include "text_arena.h"
+
+#include <cstring>
+
+
+std::uint64_t TextArena::append(std::string_view text) {
+	if (text.empty()) {
+		return size_;
+	}
+
+	// Start a new block when the text does not fit behind the previous one
+	if (size_ % BLOCK_SIZE + text.size() > BLOCK_SIZE || size_ == chunks_.size() * BLOCK_SIZE) {
+		size_ = chunks_.size() * BLOCK_SIZE;
+		if (text.size() <= BLOCK_SIZE) {
+			if (used_blocks_ == blocks_.size()) {
+				blocks_.emplace_back(BLOCK_SIZE);
+			}
+			chunks_.push_back(blocks_[used_blocks_++].data());
+		}
+		else {
+			const std::size_t chunk_count = (text.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			large_blocks_.emplace_back(chunk_count * BLOCK_SIZE);
+			for (std::size_t i = 0; i < chunk_count; ++i) {
+				chunks_.push_back(large_blocks_.back().data() + i * BLOCK_SIZE);
+			}
+		}
+	}
+
+	const std::uint64_t offset = size_;
+	memcpy(chunks_[offset / BLOCK_SIZE] + offset % BLOCK_SIZE, text.data(), text.size());
+	size_ += text.size();
+	return offset;
+}
+
+
+void TextArena::clear() {
+	used_blocks_ = 0;
+	large_blocks_.clear();
+	chunks_.clear();
+	size_ = 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "aligned_buffer.h"
+
+/**
+ * Keeps the texts of the matching lines a search thread found, back to back in large blocks.
+ *
+ * Appending a text only copies it behind the previous one, so a thread allocates once per block
+ * instead of once per line, and a full block is never moved like the buffer of a growing std::string
+ * would be. Every text is addressed by an offset, which stays valid until the arena is cleared.
+ * Clearing keeps the blocks for reuse, so a thread that hands its matches on after every file,
+ * like in streaming mode, allocates nothing once its first block exists.
+ */
+class TextArena {
+public:
+	/**
+	 * Appends a text.
+	 *
+	 * @param text The text to append.
+	 * @return The offset of the text in the arena.
+	 */
+	std::uint64_t append(std::string_view text);
+
+	/**
+	 * @param offset The offset of a text, as returned by append().
+	 * @param length The length of the text.
+	 * @return The text.
+	 */
+	std::string_view view(std::uint64_t offset, std::size_t length) const {
+		if (length == 0) {
+			return std::string_view();
+		}
+		return std::string_view(chunks_[offset / BLOCK_SIZE] + offset % BLOCK_SIZE, length);
+	}
+
+	/**
+	 * Drops all texts, keeping the blocks of regular size for the next ones.
+	 */
+	void clear();
+
+private:
+	// Size of a block, a text that does not fit into one gets a block of its own made up of several.
+	static constexpr std::size_t BLOCK_SIZE = 1024 * 1024;
+
+	// The blocks of regular size, of which the first used_blocks_ hold texts, and the blocks of long texts.
+	std::vector<AlignedBuffer> blocks_;
+	std::size_t used_blocks_ = 0;
+	std::vector<AlignedBuffer> large_blocks_;
+
+	// The start of every BLOCK_SIZE of the offsets, a large block covers several in a row.
+	std::vector<char*> chunks_;
+
+	// The offset the next text is appended at.
+	std::uint64_t size_ = 0;
+};
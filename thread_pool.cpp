@@ -0,0 +1,163 @@
+#include "thread_pool.h"
+
+#include <string>
+#include <fstream>
+#include <iostream>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+#if defined(__linux__)
+/**
+ * Parses a list of CPUs in the format of the kernel, like "0-3,8,10-11".
+ *
+ * @param list The list to parse.
+ * @return The numbers of the CPUs.
+ */
+static std::vector<int> parseCpuList(const std::string& list) {
+	std::vector<int> cpus;
+	std::size_t position = 0;
+	while (position < list.size()) {
+		std::size_t end = list.find(',', position);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		const std::string range = list.substr(position, end - position);
+		const std::size_t dash = range.find('-');
+		try {
+			const int first = std::stoi(range.substr(0, dash));
+			const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+			for (int cpu = first; cpu <= last; ++cpu) {
+				cpus.push_back(cpu);
+			}
+		}
+		catch (const std::exception&) {
+			// A malformed range is left out, the remaining CPUs are still used
+		}
+		position = end + 1;
+	}
+	return cpus;
+}
+
+
+/**
+ * Picks a CPU for every worker. The workers go to the NUMA nodes in turn, and within a node to its
+ * CPUs in turn, using only the CPUs the process may run on.
+ *
+ * @param thread_count The number of workers.
+ * @return The CPU of every worker, empty if the CPUs of the process can not be determined.
+ */
+static std::vector<int> placeWorkers(int thread_count) {
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return {};
+	}
+
+	// Group the allowed CPUs by node, a system without NUMA information counts as a single node
+	std::vector<std::vector<int>> nodes;
+	for (int node = 0;; ++node) {
+		std::ifstream cpu_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		if (!cpu_list.good()) {
+			break;
+		}
+		std::string list;
+		std::getline(cpu_list, list);
+		std::vector<int> node_cpus;
+		for (const int cpu : parseCpuList(list)) {
+			if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+				node_cpus.push_back(cpu);
+			}
+		}
+		if (!node_cpus.empty()) {
+			nodes.push_back(std::move(node_cpus));
+		}
+	}
+	if (nodes.empty()) {
+		std::vector<int> all_cpus;
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &allowed)) {
+				all_cpus.push_back(cpu);
+			}
+		}
+		if (all_cpus.empty()) {
+			return {};
+		}
+		nodes.push_back(std::move(all_cpus));
+	}
+
+	std::vector<int> placement;
+	for (int i = 0; i < thread_count; ++i) {
+		const std::vector<int>& node_cpus = nodes[i % nodes.size()];
+		placement.push_back(node_cpus[(i / nodes.size()) % node_cpus.size()]);
+	}
+	return placement;
+}
+#endif
+
+
+ThreadPool::ThreadPool(int thread_count, bool pin) {
+	for (int i = 0; i < thread_count; ++i) {
+		workers_.emplace_back(&ThreadPool::run, this);
+	}
+
+	if (pin) {
+#if defined(__linux__)
+		const std::vector<int> placement = placeWorkers(thread_count);
+		for (std::size_t i = 0; i < placement.size(); ++i) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(placement[i], &cpus);
+			if (pthread_setaffinity_np(workers_[i].native_handle(), sizeof(cpus), &cpus) != 0) {
+				std::cerr << "Error: could not pin a thread to CPU " << placement[i] << std::endl;
+			}
+		}
+#else
+		std::cerr << "Error: pinning threads is only supported on Linux" << std::endl;
+#endif
+	}
+}
+
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	task_available_.notify_all();
+	for (auto& worker : workers_) {
+		worker.join();
+	}
+}
+
+
+void ThreadPool::push(std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.push_back(std::move(task));
+	}
+	task_available_.notify_one();
+}
+
+
+/**
+ * Runs the tasks of the pool on a worker thread until the pool is destroyed and no task is left.
+ */
+void ThreadPool::run() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			task_available_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+			if (tasks_.empty()) {
+				return;
+			}
+			task = std::move(tasks_.front());
+			tasks_.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+/**
+ * A fixed set of worker threads that run the tasks handed to them, in the order they were submitted.
+ *
+ * The threads are started once and live as long as the pool, so a search, the sorting and formatting
+ * of its results, and the building of the index all run on the same threads, and a process that
+ * serves many searches does not start new threads for each one. The workers can be pinned to CPUs:
+ * they are then spread over the NUMA nodes in turn, and the buffers each of them allocates end up
+ * in the memory of its own node.
+ */
+class ThreadPool {
+public:
+	/**
+	 * Starts the worker threads.
+	 *
+	 * @param thread_count The number of worker threads, at least 1.
+	 * @param pin Whether to pin every worker to a CPU of its own, spread over the NUMA nodes.
+	 */
+	ThreadPool(int thread_count, bool pin);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/**
+	 * Runs the tasks still queued and stops the worker threads.
+	 */
+	~ThreadPool();
+
+	/**
+	 * Queues a task for the next free worker.
+	 *
+	 * A task must not wait for another task of the same pool that is queued after it, which would keep
+	 * a worker waiting for work that only a free worker can start.
+	 *
+	 * @param task The function to run.
+	 * @return A future that receives the result of the function.
+	 */
+	template <typename Task>
+	std::future<std::invoke_result_t<Task>> submit(Task task) {
+		using Result = std::invoke_result_t<Task>;
+		auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+		std::future<Result> result = packaged->get_future();
+		push([packaged] { (*packaged)(); });
+		return result;
+	}
+
+	/**
+	 * @return The number of worker threads.
+	 */
+	int size() const { return static_cast<int>(workers_.size()); }
+
+private:
+	void push(std::function<void()> task);
+	void run();
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable task_available_;
+	std::deque<std::function<void()>> tasks_;
+	bool stopping_ = false;
+};
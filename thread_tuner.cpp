@@ -0,0 +1,159 @@
+#include "thread_tuner.h"
+
+#include <fstream>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+// The time every number of threads is measured for.
+static const std::chrono::milliseconds TUNING_INTERVAL{ 500 };
+
+// The most intervals measured, after which the best number of threads is kept for the rest of the search.
+static const int MAX_TUNING_STEPS = 8;
+
+// The share of the CPU time spent waiting for I/O from which a search counts as bound by I/O.
+static const double IO_BOUND_SHARE = 0.1;
+
+// How much faster twice the threads have to search to be kept, and how much slower half of them may search.
+static const double MIN_GAIN = 0.1;
+static const double MAX_LOSS = 0.1;
+
+
+/**
+ * What the tuner measures at the end of an interval.
+ */
+struct TuningSample {
+	std::chrono::steady_clock::time_point time;
+	std::uint64_t bytes = 0;
+
+	// The time of all CPUs and the part of it spent waiting for I/O, in clock ticks, if /proc/stat could be read.
+	bool cpu_known = false;
+	std::uint64_t cpu_time = 0;
+	std::uint64_t io_wait_time = 0;
+};
+
+
+/**
+ * @param scheduler The scheduler of the search.
+ * @return The bytes searched and the time of the CPUs so far.
+ */
+static TuningSample takeSample(const FileScheduler& scheduler) {
+	TuningSample sample;
+	sample.time = std::chrono::steady_clock::now();
+	sample.bytes = scheduler.bytesSearched();
+
+	// The first line adds up all CPUs: user, nice, system, idle, iowait, irq, softirq and steal time
+	std::ifstream stat_file("/proc/stat");
+	std::string cpu;
+	std::uint64_t times[8] = {};
+	if (stat_file >> cpu && cpu == "cpu") {
+		sample.cpu_known = true;
+		for (auto& time : times) {
+			if (!(stat_file >> time)) {
+				sample.cpu_known = false;
+				break;
+			}
+			sample.cpu_time += time;
+		}
+		sample.io_wait_time = times[4];
+	}
+	return sample;
+}
+
+
+ThreadTuner::ThreadTuner(FileScheduler& scheduler, int start_threads, int max_threads)
+	: scheduler_(scheduler), start_threads_(std::min(start_threads, max_threads)), max_threads_(max_threads) {
+	scheduler_.setActiveThreads(start_threads_);
+	tuner_ = std::thread(&ThreadTuner::run, this);
+}
+
+
+ThreadTuner::~ThreadTuner() {
+	stop();
+}
+
+
+void ThreadTuner::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+		stopped_.notify_all();
+	}
+	if (tuner_.joinable()) {
+		tuner_.join();
+	}
+}
+
+
+/**
+ * Waits for the end of an interval.
+ *
+ * @return True once the interval is over, false if tuning was stopped before.
+ */
+bool ThreadTuner::waitInterval() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	return !stopped_.wait_for(lock, TUNING_INTERVAL, [this] { return stopping_; });
+}
+
+
+/**
+ * Measures the threads to start with, then tries twice or half as many threads in turn, each from the best
+ * number so far, and keeps the best one.
+ */
+void ThreadTuner::run() {
+	TuningSample previous = takeSample(scheduler_);
+	int threads = start_threads_;
+	int best_threads = threads;
+	double best_rate = 0;
+	bool growing = true;
+	for (int step = 0; step < MAX_TUNING_STEPS; ++step) {
+		if (!waitInterval()) {
+			return;
+		}
+		const TuningSample sample = takeSample(scheduler_);
+		const double rate = (sample.bytes - previous.bytes) / std::chrono::duration<double>(sample.time - previous.time).count();
+
+		// A search that does not wait for I/O keeps a thread for every CPU, and one that did not get through
+		// a batch yet gives nothing to compare with
+		if (step == 0) {
+			const bool io_bound = !sample.cpu_known || !previous.cpu_known || sample.cpu_time == previous.cpu_time
+				|| sample.io_wait_time - previous.io_wait_time >= IO_BOUND_SHARE * (sample.cpu_time - previous.cpu_time);
+			if (!io_bound || rate <= 0) {
+				return;
+			}
+			best_rate = rate;
+		}
+		else if (growing && rate > best_rate * (1 + MIN_GAIN)) {
+			best_rate = rate;
+			best_threads = threads;
+		}
+		else if (growing) {
+			// Fewer threads are only tried if more of them did not help at all
+			if (best_threads != start_threads_) {
+				break;
+			}
+			growing = false;
+		}
+		else if (rate >= best_rate * (1 - MAX_LOSS)) {
+			best_threads = threads;
+		}
+		else {
+			break;
+		}
+		previous = sample;
+
+		// Try the next number of threads, fewer ones once there can be no more
+		int next = growing ? std::min(best_threads * 2, max_threads_) : std::max(best_threads / 2, 1);
+		if (next == best_threads && growing && best_threads == start_threads_) {
+			growing = false;
+			next = std::max(best_threads / 2, 1);
+		}
+		if (next == best_threads) {
+			break;
+		}
+		threads = next;
+		scheduler_.setActiveThreads(threads);
+	}
+	scheduler_.setActiveThreads(best_threads);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "file_scheduler.h"
+
+/**
+ * Adapts the number of threads that search to what the search turns out to be bound by, for -t auto.
+ *
+ * During the first seconds of a search, the tuner measures how many bytes the threads search and how much
+ * of the time the CPUs wait for I/O, over intervals of TUNING_INTERVAL. A search that hardly waits for I/O
+ * keeps one thread per CPU. A search that waits for I/O, like one on a network filesystem, is let twice as
+ * many threads while every step makes it faster by a margin, since more files in flight hide the latency of
+ * every one of them. If the first step does not help, it is let half as many threads instead while that does
+ * not make it slower by more than a margin, since the threads of a disk that seeks between their files only
+ * get in each other's way. On systems without /proc/stat, every search is tuned by its speed alone.
+ *
+ * The tuner runs on a thread of its own and only changes the threads the scheduler lets in, so the threads
+ * themselves always exist and the search gives the same results with any of their numbers.
+ */
+class ThreadTuner {
+public:
+	/**
+	 * Lets the threads to start with into the scheduler and starts tuning.
+	 *
+	 * @param scheduler The scheduler of the search, created for all threads that may be let in.
+	 * @param start_threads The number of threads to start with.
+	 * @param max_threads The most threads to let in.
+	 */
+	ThreadTuner(FileScheduler& scheduler, int start_threads, int max_threads);
+	ThreadTuner(const ThreadTuner&) = delete;
+	ThreadTuner& operator=(const ThreadTuner&) = delete;
+
+	/**
+	 * Stops tuning.
+	 */
+	~ThreadTuner();
+
+	/**
+	 * Stops tuning at the end of the search, which keeps the threads let in as they are.
+	 */
+	void stop();
+
+private:
+	void run();
+	bool waitInterval();
+
+	FileScheduler& scheduler_;
+	const int start_threads_;
+	const int max_threads_;
+
+	std::mutex mutex_;
+	std::condition_variable stopped_;
+	bool stopping_ = false;
+	std::thread tuner_;
+};
@@ -0,0 +1,868 @@
+#include "trigram_index.h"
+
+#include "file_reader.h"
+#include "output_file.h"
+#include "decompressor.h"
+#include "case_fold.h"
+
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <future>
+#include <unordered_map>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <fstream>
+#endif
+
+static const char INDEX_MAGIC[8] = { 'S', 'G', 'T', 'R', 'I', 'G', 'R', 'M' };
+static const std::uint32_t INDEX_VERSION = 2;
+static const char* const BASE_FILENAME = "trigrams.idx";
+static const char* const DELTA_FILENAME = "trigrams.delta.idx";
+
+// Every possible trigram, three bytes wide.
+static const std::size_t TRIGRAM_SPACE = std::size_t{ 1 } << 24;
+
+// Sections of a segment start on this alignment, so their tables can be read in place.
+static const std::uint64_t SECTION_ALIGNMENT = 8;
+
+// Up to this many trigram occurrences the posting lists are built by sorting them, instead of
+// counting over every possible trigram, which keeps writing a small delta cheap.
+static const std::size_t SPARSE_BUILD_LIMIT = 4 * 1024 * 1024;
+
+// The delta is merged into the base once it holds more than one file for this many files of the base.
+static const std::size_t MERGE_RATIO = 8;
+
+// Marks a file in the delta that was deleted from the tree.
+static const std::uint64_t DELETED_FLAG = 1;
+
+
+/**
+ * The start of a segment file, with the position of every section.
+ */
+struct IndexHeader {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t file_count;
+	std::uint64_t trigram_count;
+	std::uint64_t root_offset;
+	std::uint64_t root_length;
+	std::uint64_t files_offset;
+	std::uint64_t paths_offset;
+	std::uint64_t trigrams_offset;
+	std::uint64_t postings_offset;
+	std::uint64_t total_size;
+};
+
+
+/**
+ * An indexed file, with the stamp it had when it was read.
+ */
+struct IndexFileEntry {
+	std::uint64_t size;
+	std::int64_t mtime_ns;
+	std::uint64_t inode;
+	std::uint64_t flags;
+	std::uint64_t path_offset;
+	std::uint64_t path_length;
+};
+
+
+/**
+ * A trigram and where its posting list starts.
+ */
+struct IndexTrigramEntry {
+	std::uint32_t trigram;
+	std::uint32_t file_count;
+	std::uint64_t postings_offset;
+};
+
+
+/**
+ * Appends a number as a varint, seven bits per byte, lowest first.
+ */
+static void appendVarint(std::string& buffer, std::uint64_t value) {
+	while (value >= 0x80) {
+		buffer += static_cast<char>((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	buffer += static_cast<char>(value);
+}
+
+
+/**
+ * Writes a number as a varint at the given position.
+ *
+ * @return The position after the number.
+ */
+static char* writeVarint(char* position, std::uint64_t value) {
+	while (value >= 0x80) {
+		*position++ = static_cast<char>((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	*position++ = static_cast<char>(value);
+	return position;
+}
+
+
+/**
+ * Reads a varint and advances the position past it.
+ */
+static std::uint64_t readVarint(const char*& position) {
+	std::uint64_t value = 0;
+	int shift = 0;
+	while (true) {
+		const unsigned char byte = static_cast<unsigned char>(*position++);
+		value |= std::uint64_t{ byte & 0x7Fu } << shift;
+		if ((byte & 0x80) == 0) {
+			return value;
+		}
+		shift += 7;
+	}
+}
+
+
+static std::size_t varintSize(std::uint64_t value) {
+	std::size_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		++size;
+	}
+	return size;
+}
+
+
+static std::uint64_t alignSection(std::uint64_t offset) {
+	return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+
+static FileStamp entryStamp(const IndexFileEntry& entry) {
+	return FileStamp{ entry.size, entry.mtime_ns, entry.inode };
+}
+
+
+/**
+ * @return The root with a trailing separator, which every path the walk yields below it starts with.
+ */
+static std::string rootPrefix(const fs::path& root) {
+	std::string prefix = root.generic_string();
+	if (prefix.empty() || prefix.back() != '/') {
+		prefix += '/';
+	}
+	return prefix;
+}
+
+
+/**
+ * @return The path of a file relative to the root in generic format, which is how the index stores it.
+ */
+static std::string relativePath(const fs::path& file_path, const fs::path& root, const std::string& root_prefix) {
+	// The walk yields paths below the root as given, so stripping that prefix is enough in the common case.
+	std::string relative_path = file_path.generic_string();
+	if (relative_path.size() > root_prefix.size() && relative_path.compare(0, root_prefix.size(), root_prefix) == 0) {
+		relative_path.erase(0, root_prefix.size());
+		return relative_path;
+	}
+	return file_path.lexically_relative(root).generic_string();
+}
+
+
+/**
+ * Adds the trigrams of some bytes that were not seen before.
+ *
+ * @param contents The bytes to add the trigrams of.
+ * @param seen A bit per possible trigram, set for the trigrams collected so far.
+ * @param trigrams The trigrams collected so far, in the order they were first seen.
+ */
+static void addTrigrams(std::string_view contents, std::vector<std::uint64_t>& seen, std::vector<std::uint32_t>& trigrams) {
+	if (contents.size() < 3) {
+		return;
+	}
+
+	// Roll the trigram over the bytes and keep the ones not seen before.
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(contents.data());
+	std::uint32_t trigram = (std::uint32_t{ bytes[0] } << 8) | bytes[1];
+	for (std::size_t i = 2; i < contents.size(); ++i) {
+		trigram = ((trigram << 8) | bytes[i]) & 0xFFFFFF;
+		std::uint64_t& word = seen[trigram >> 6];
+		const std::uint64_t bit = std::uint64_t{ 1 } << (trigram & 63);
+		if ((word & bit) == 0) {
+			word |= bit;
+			trigrams.push_back(trigram);
+		}
+	}
+}
+
+
+/**
+ * Sorts the collected trigrams and clears their bits for the next file.
+ *
+ * @param seen A bit per possible trigram, set for the collected ones on entry and all clear on return.
+ * @param trigrams The collected trigrams, in ascending order on return.
+ */
+static void finishTrigrams(std::vector<std::uint64_t>& seen, std::vector<std::uint32_t>& trigrams) {
+	// Clear only the bits that were set, which is far cheaper than clearing the whole set for small files.
+	for (const std::uint32_t seen_trigram : trigrams) {
+		seen[seen_trigram >> 6] = 0;
+	}
+	std::sort(trigrams.begin(), trigrams.end());
+}
+
+
+/**
+ * Collects the distinct trigrams of some bytes in ascending order.
+ *
+ * @param contents The bytes to collect the trigrams of.
+ * @param seen A bit per possible trigram, all clear on entry and on return.
+ * @param trigrams Receives the trigrams.
+ */
+static void collectTrigrams(std::string_view contents, std::vector<std::uint64_t>& seen, std::vector<std::uint32_t>& trigrams) {
+	trigrams.clear();
+	addTrigrams(contents, seen, trigrams);
+	finishTrigrams(seen, trigrams);
+}
+
+
+/**
+ * One segment file of the index, mapped as it is.
+ */
+struct TrigramIndex::Segment {
+	~Segment();
+
+	/**
+	 * Maps a segment file and checks that it is valid for the root.
+	 *
+	 * @return True on success, false if the file is missing or not a valid segment for the root.
+	 */
+	bool open(const fs::path& segment_path, const std::string& canonical_root);
+
+	const IndexFileEntry& file(std::uint32_t number) const {
+		return reinterpret_cast<const IndexFileEntry*>(data + header.files_offset)[number];
+	}
+
+	std::string_view path(std::uint32_t number) const {
+		return std::string_view(data + header.paths_offset + file(number).path_offset, file(number).path_length);
+	}
+
+	/**
+	 * Looks a file up by its path relative to the root.
+	 *
+	 * @return True if the segment holds the file, with its number.
+	 */
+	bool find(std::string_view relative_path, std::uint32_t& number) const;
+
+	/**
+	 * Decodes the posting list of a trigram.
+	 *
+	 * @return True if any file of the segment contains the trigram, with their numbers in ascending order.
+	 */
+	bool findPostings(std::uint32_t trigram, std::vector<std::uint32_t>& files) const;
+
+	/**
+	 * Decodes the posting lists of a trigram in all cases of its ASCII letters and merges them.
+	 *
+	 * @return True if any file of the segment contains the trigram in some case, with their numbers in ascending order.
+	 */
+	bool findFoldedPostings(std::uint32_t trigram, std::vector<std::uint32_t>& files) const;
+
+	/**
+	 * Recovers the trigrams of every file from the posting lists, encoded as gaps like a fresh read.
+	 */
+	void decodeFileTrigrams(std::vector<std::string>& file_trigrams) const;
+
+	/**
+	 * Marks the files that contain all trigrams of at least one of the strings, in any case of their letters if case is ignored.
+	 */
+	void selectCandidates(const std::vector<std::string>& search_strings, bool ignore_case);
+
+	IndexHeader header;
+	const char* data = nullptr;
+	std::size_t size = 0;
+	bool mapped = false;
+	std::vector<char> buffer;
+	std::unordered_map<std::string_view, std::uint32_t> file_numbers;
+	std::vector<bool> candidates;
+};
+
+
+TrigramIndex::Segment::~Segment() {
+#if defined(__unix__) || defined(__APPLE__)
+	if (mapped) {
+		munmap(const_cast<char*>(data), size);
+	}
+#endif
+}
+
+
+bool TrigramIndex::Segment::open(const fs::path& segment_path, const std::string& canonical_root) {
+#if defined(__unix__) || defined(__APPLE__)
+	const int fd = ::open(segment_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(IndexHeader))) {
+		close(fd);
+		return false;
+	}
+	void* mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	data = static_cast<const char*>(mapping);
+	size = file_stat.st_size;
+	mapped = true;
+#else
+	std::ifstream file(segment_path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	if (buffer.size() < sizeof(IndexHeader)) {
+		return false;
+	}
+	data = buffer.data();
+	size = buffer.size();
+#endif
+
+	// Check that the segment is complete, of this version, and made for the same tree.
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header.version != INDEX_VERSION || header.total_size != size
+		|| header.root_offset + header.root_length > header.files_offset
+		|| header.files_offset + header.file_count * sizeof(IndexFileEntry) > header.paths_offset
+		|| header.paths_offset > header.trigrams_offset
+		|| header.trigrams_offset + header.trigram_count * sizeof(IndexTrigramEntry) > header.postings_offset
+		|| header.postings_offset > size) {
+		return false;
+	}
+	if (std::string_view(data + header.root_offset, header.root_length) != canonical_root) {
+		return false;
+	}
+
+	// Look the files up by their path relative to the root.
+	file_numbers.reserve(header.file_count);
+	for (std::uint32_t i = 0; i < header.file_count; ++i) {
+		file_numbers.emplace(path(i), i);
+	}
+	return true;
+}
+
+
+bool TrigramIndex::Segment::find(std::string_view relative_path, std::uint32_t& number) const {
+	const auto found = file_numbers.find(relative_path);
+	if (found == file_numbers.end()) {
+		return false;
+	}
+	number = found->second;
+	return true;
+}
+
+
+bool TrigramIndex::Segment::findPostings(std::uint32_t trigram, std::vector<std::uint32_t>& files) const {
+	// The trigrams are sorted, so a binary search finds the posting list.
+	const IndexTrigramEntry* first = reinterpret_cast<const IndexTrigramEntry*>(data + header.trigrams_offset);
+	const IndexTrigramEntry* last = first + header.trigram_count;
+	const IndexTrigramEntry* entry = std::lower_bound(first, last, trigram, [](const IndexTrigramEntry& lhs, std::uint32_t value) {
+		return lhs.trigram < value;
+		});
+	files.clear();
+	if (entry == last || entry->trigram != trigram) {
+		return false;
+	}
+
+	// Decode the gaps back to file numbers.
+	const char* position = data + header.postings_offset + entry->postings_offset;
+	std::uint32_t number = 0;
+	for (std::uint32_t i = 0; i < entry->file_count; ++i) {
+		number += static_cast<std::uint32_t>(readVarint(position));
+		files.push_back(number - 1);
+	}
+	return true;
+}
+
+
+void TrigramIndex::Segment::decodeFileTrigrams(std::vector<std::string>& file_trigrams) const {
+	// Walk the trigrams in ascending order and append each one to the files of its posting list,
+	// which gives every file its trigrams in ascending order.
+	file_trigrams.assign(header.file_count, std::string());
+	std::vector<std::uint32_t> previous(header.file_count, 0);
+	const IndexTrigramEntry* table = reinterpret_cast<const IndexTrigramEntry*>(data + header.trigrams_offset);
+	for (std::uint64_t i = 0; i < header.trigram_count; ++i) {
+		const char* position = data + header.postings_offset + table[i].postings_offset;
+		std::uint32_t number = 0;
+		for (std::uint32_t j = 0; j < table[i].file_count; ++j) {
+			number += static_cast<std::uint32_t>(readVarint(position));
+			appendVarint(file_trigrams[number - 1], table[i].trigram - previous[number - 1]);
+			previous[number - 1] = table[i].trigram;
+		}
+	}
+}
+
+
+bool TrigramIndex::Segment::findFoldedPostings(std::uint32_t trigram, std::vector<std::uint32_t>& files) const {
+	// Every letter of the trigram doubles the variants to look up, the bytes of the upper case ones differ by 0x20
+	std::uint32_t letter_bits = 0;
+	for (int shift = 0; shift < 24; shift += 8) {
+		const char byte = static_cast<char>((trigram >> shift) & 0xFF);
+		if (byte >= 'a' && byte <= 'z') {
+			letter_bits |= std::uint32_t{ 0x20 } << shift;
+		}
+	}
+
+	// Go through every subset of the letter bits, and merge the lists of the variants found
+	files.clear();
+	std::vector<std::uint32_t> variant_files;
+	std::uint32_t subset = 0;
+	do {
+		if (findPostings(trigram & ~subset, variant_files)) {
+			const std::size_t middle = files.size();
+			files.insert(files.end(), variant_files.begin(), variant_files.end());
+			std::inplace_merge(files.begin(), files.begin() + middle, files.end());
+		}
+		subset = (subset - letter_bits) & letter_bits;
+	} while (subset != 0);
+	files.erase(std::unique(files.begin(), files.end()), files.end());
+	return !files.empty();
+}
+
+
+void TrigramIndex::Segment::selectCandidates(const std::vector<std::string>& search_strings, bool ignore_case) {
+	candidates.assign(header.file_count, false);
+
+	std::vector<std::uint64_t> seen(TRIGRAM_SPACE / 64, 0);
+	std::vector<std::uint32_t> trigrams;
+	std::vector<std::uint32_t> matching;
+	std::vector<std::uint32_t> postings;
+	std::vector<std::uint32_t> intersection;
+	for (const auto& search_string : search_strings) {
+		// Intersect the posting lists of all trigrams of the string, a missing trigram rules out every file.
+		// Ignoring case, the trigrams are taken in lower case and looked up in all cases.
+		collectTrigrams(ignore_case ? foldAscii(search_string) : search_string, seen, trigrams);
+		matching.clear();
+		bool first = true;
+		for (const std::uint32_t trigram : trigrams) {
+			if (!(ignore_case ? findFoldedPostings(trigram, postings) : findPostings(trigram, postings))) {
+				matching.clear();
+				break;
+			}
+			if (first) {
+				matching.swap(postings);
+				first = false;
+			}
+			else {
+				intersection.clear();
+				std::set_intersection(matching.begin(), matching.end(), postings.begin(), postings.end(), std::back_inserter(intersection));
+				matching.swap(intersection);
+			}
+			if (matching.empty()) {
+				break;
+			}
+		}
+
+		for (const std::uint32_t number : matching) {
+			candidates[number] = true;
+		}
+	}
+}
+
+
+bool TrigramIndex::writeSegment(const fs::path& segment_path, const std::string& root, const std::vector<fs::path>& files,
+	const std::vector<std::string>& deleted_files, ThreadPool& pool, const std::vector<const Segment*>& previous) {
+	const fs::path root_path(root);
+	const std::string root_prefix = rootPrefix(root_path);
+
+	// The trigrams of every file, as varint-encoded gaps, and the stamp the file had before it was read.
+	std::vector<std::string> file_trigrams(files.size());
+	std::vector<std::string> relative_paths(files.size());
+	std::vector<FileStamp> stamps(files.size());
+	std::vector<char> readable(files.size(), 0);
+
+	// The trigrams of the files in the previous segments, recovered from their posting lists.
+	std::vector<std::vector<std::string>> previous_trigrams(previous.size());
+	for (std::size_t k = 0; k < previous.size(); ++k) {
+		previous[k]->decodeFileTrigrams(previous_trigrams[k]);
+	}
+
+	// Read the files in parallel, each thread takes the next unread file.
+	std::atomic<std::size_t> next_file = 0;
+	auto indexFiles = [&]() {
+		FileReader reader;
+		Decompressor decompressor;
+		std::vector<std::uint64_t> seen(TRIGRAM_SPACE / 64, 0);
+		std::vector<std::uint32_t> trigrams;
+		std::size_t i;
+		while ((i = next_file++) < files.size()) {
+			relative_paths[i] = relativePath(files[i], root_path, root_prefix);
+			if (!readFileStamp(files[i], stamps[i])) {
+				continue;
+			}
+
+			// A file that did not change since a previous segment keeps its trigrams without being read.
+			// The newest segment holding the file decides, and the newer segments come first.
+			bool reused = false;
+			for (std::size_t k = 0; k < previous.size(); ++k) {
+				std::uint32_t number;
+				if (previous[k]->find(relative_paths[i], number)) {
+					const IndexFileEntry& entry = previous[k]->file(number);
+					if ((entry.flags & DELETED_FLAG) == 0 && entryStamp(entry) == stamps[i]) {
+						file_trigrams[i] = std::move(previous_trigrams[k][number]);
+						reused = true;
+					}
+					break;
+				}
+			}
+			if (reused) {
+				readable[i] = 1;
+				continue;
+			}
+
+			std::string_view contents;
+			if (!reader.open(files[i], contents)) {
+				continue;
+			}
+
+			// A compressed file is indexed by what it decompresses to, which is what the search looks at.
+			// Its parts end at line ends, and no search string spans lines, so no trigram across parts is missed.
+			if (Decompressor::isCompressed(contents)) {
+				trigrams.clear();
+				decompressor.start(contents);
+				std::string_view part;
+				while (decompressor.next(part)) {
+					addTrigrams(part, seen, trigrams);
+				}
+				finishTrigrams(seen, trigrams);
+			}
+			else {
+				collectTrigrams(contents, seen, trigrams);
+			}
+			std::uint32_t previous_trigram = 0;
+			for (const std::uint32_t trigram : trigrams) {
+				appendVarint(file_trigrams[i], trigram - previous_trigram);
+				previous_trigram = trigram;
+			}
+			readable[i] = 1;
+		}
+	};
+	std::vector<std::future<void>> workers;
+	for (int i = 0; i < pool.size(); ++i) {
+		workers.push_back(pool.submit(indexFiles));
+	}
+	for (auto& worker : workers) {
+		worker.get();
+	}
+	std::vector<std::vector<std::string>>().swap(previous_trigrams);
+
+	// Number the readable files, unreadable ones stay out of the index and are always searched.
+	std::vector<std::uint32_t> indexed;
+	for (std::size_t i = 0; i < files.size(); ++i) {
+		if (readable[i]) {
+			indexed.push_back(static_cast<std::uint32_t>(i));
+		}
+	}
+
+	// Calls the function for every trigram of every indexed file, in file order.
+	std::size_t occurrences = 0;
+	auto forEachTrigram = [&](auto&& function) {
+		for (std::uint32_t number = 0; number < indexed.size(); ++number) {
+			const std::string& encoded = file_trigrams[indexed[number]];
+			const char* position = encoded.data();
+			const char* const end = position + encoded.size();
+			std::uint32_t trigram = 0;
+			while (position < end) {
+				trigram += static_cast<std::uint32_t>(readVarint(position));
+				function(trigram, number);
+			}
+		}
+	};
+	forEachTrigram([&](std::uint32_t, std::uint32_t) {
+		++occurrences;
+		});
+
+	// The posting lists store the gaps between consecutive file numbers plus one, so the first gap is never zero either.
+	std::vector<IndexTrigramEntry> trigram_table;
+	std::string postings;
+	if (occurrences <= SPARSE_BUILD_LIMIT) {
+		// Sort the occurrences by trigram and file, then encode the run of every trigram.
+		std::vector<std::uint64_t> pairs;
+		pairs.reserve(occurrences);
+		forEachTrigram([&](std::uint32_t trigram, std::uint32_t number) {
+			pairs.push_back((std::uint64_t{ trigram } << 32) | number);
+			});
+		std::sort(pairs.begin(), pairs.end());
+
+		std::uint32_t last_file = 0;
+		for (const std::uint64_t pair : pairs) {
+			const std::uint32_t trigram = static_cast<std::uint32_t>(pair >> 32);
+			const std::uint32_t number = static_cast<std::uint32_t>(pair);
+			if (trigram_table.empty() || trigram_table.back().trigram != trigram) {
+				trigram_table.push_back({ trigram, 0, postings.size() });
+				last_file = 0;
+			}
+			++trigram_table.back().file_count;
+			appendVarint(postings, number + 1 - last_file);
+			last_file = number + 1;
+		}
+	}
+	else {
+		// First pass: count the files of every trigram and the bytes of its posting list.
+		std::vector<std::uint32_t> file_counts(TRIGRAM_SPACE, 0);
+		std::vector<std::uint32_t> last_file(TRIGRAM_SPACE, 0);
+		std::vector<std::uint64_t> posting_cursors(TRIGRAM_SPACE, 0);
+		forEachTrigram([&](std::uint32_t trigram, std::uint32_t number) {
+			++file_counts[trigram];
+			posting_cursors[trigram] += varintSize(number + 1 - last_file[trigram]);
+			last_file[trigram] = number + 1;
+			});
+
+		// Lay out the trigram table and turn the sizes into the start of every posting list.
+		std::uint64_t postings_size = 0;
+		for (std::uint32_t trigram = 0; trigram < TRIGRAM_SPACE; ++trigram) {
+			if (file_counts[trigram] == 0) {
+				continue;
+			}
+			trigram_table.push_back({ trigram, file_counts[trigram], postings_size });
+			const std::uint64_t list_size = posting_cursors[trigram];
+			posting_cursors[trigram] = postings_size;
+			postings_size += list_size;
+		}
+		std::vector<std::uint32_t>().swap(file_counts);
+
+		// Second pass: fill in the posting lists.
+		postings.assign(postings_size, '\0');
+		std::fill(last_file.begin(), last_file.end(), 0);
+		forEachTrigram([&](std::uint32_t trigram, std::uint32_t number) {
+			char* const position = postings.data() + posting_cursors[trigram];
+			posting_cursors[trigram] = writeVarint(position, number + 1 - last_file[trigram]) - postings.data();
+			last_file[trigram] = number + 1;
+			});
+	}
+	std::vector<std::string>().swap(file_trigrams);
+
+	// Build the file table and the paths, the deleted files follow the indexed ones and have no postings.
+	std::vector<IndexFileEntry> file_table;
+	std::string paths;
+	for (const std::uint32_t i : indexed) {
+		file_table.push_back({ stamps[i].size, stamps[i].mtime_ns, stamps[i].inode, 0, paths.size(), relative_paths[i].size() });
+		paths += relative_paths[i];
+	}
+	for (const auto& deleted_file : deleted_files) {
+		file_table.push_back({ 0, 0, 0, DELETED_FLAG, paths.size(), deleted_file.size() });
+		paths += deleted_file;
+	}
+	const std::string canonical_root = fs::weakly_canonical(root_path).generic_string();
+
+	// Place the sections one after another.
+	IndexHeader header;
+	std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	header.version = INDEX_VERSION;
+	header.file_count = static_cast<std::uint32_t>(file_table.size());
+	header.trigram_count = trigram_table.size();
+	header.root_offset = sizeof(IndexHeader);
+	header.root_length = canonical_root.size();
+	header.files_offset = alignSection(header.root_offset + header.root_length);
+	header.paths_offset = header.files_offset + file_table.size() * sizeof(IndexFileEntry);
+	header.trigrams_offset = alignSection(header.paths_offset + paths.size());
+	header.postings_offset = header.trigrams_offset + trigram_table.size() * sizeof(IndexTrigramEntry);
+	header.total_size = header.postings_offset + postings.size();
+
+	// Write a temporary file and move it into place, so a concurrent search never sees half a segment.
+	std::error_code error;
+	const fs::path temporary_path = segment_path.string() + ".tmp";
+	OutputFile output;
+	if (!output.open(temporary_path.string())) {
+		std::cerr << "Error: could not create index file " << temporary_path.string() << std::endl;
+		return false;
+	}
+
+	const std::string padding(SECTION_ALIGNMENT, '\0');
+	std::uint64_t written_size = 0;
+	bool written = true;
+	auto writeSection = [&](std::uint64_t offset, const void* data, std::size_t size) {
+		written = written && output.write(std::string_view(padding.data(), offset - written_size));
+		written = written && output.write(std::string_view(static_cast<const char*>(data), size));
+		written_size = offset + size;
+	};
+	writeSection(0, &header, sizeof(header));
+	writeSection(header.root_offset, canonical_root.data(), canonical_root.size());
+	writeSection(header.files_offset, file_table.data(), file_table.size() * sizeof(IndexFileEntry));
+	writeSection(header.paths_offset, paths.data(), paths.size());
+	writeSection(header.trigrams_offset, trigram_table.data(), trigram_table.size() * sizeof(IndexTrigramEntry));
+	writeSection(header.postings_offset, postings.data(), postings.size());
+
+	if (!written || !output.close()) {
+		std::cerr << "Error: could not write index file " << temporary_path.string() << std::endl;
+		fs::remove(temporary_path, error);
+		return false;
+	}
+	fs::rename(temporary_path, segment_path, error);
+	if (error) {
+		std::cerr << "Error: could not replace index file " << segment_path.string() << ": " << error.message() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+TrigramIndex::TrigramIndex() = default;
+
+
+TrigramIndex::~TrigramIndex() = default;
+
+
+bool TrigramIndex::build(const std::string& index_directory, const std::string& root, const std::vector<fs::path>& files, ThreadPool& pool) {
+	std::error_code error;
+	fs::create_directories(index_directory, error);
+	if (!writeSegment(fs::path(index_directory) / BASE_FILENAME, root, files, {}, pool, {})) {
+		return false;
+	}
+
+	// A delta of the previous base would shadow the new one.
+	fs::remove(fs::path(index_directory) / DELTA_FILENAME, error);
+	return true;
+}
+
+
+bool TrigramIndex::open(const std::string& index_directory, const std::string& root) {
+	index_directory_ = index_directory;
+	root_ = fs::path(root);
+	root_prefix_ = rootPrefix(root_);
+	const std::string canonical_root = fs::weakly_canonical(root_).generic_string();
+
+	// The base is required, the delta only exists after an update.
+	base_ = std::make_unique<Segment>();
+	if (!base_->open(fs::path(index_directory) / BASE_FILENAME, canonical_root)) {
+		base_.reset();
+		return false;
+	}
+	delta_ = std::make_unique<Segment>();
+	if (!delta_->open(fs::path(index_directory) / DELTA_FILENAME, canonical_root)) {
+		delta_.reset();
+	}
+
+	// The files of the delta replace their entries in the base, and the deleted ones remove them.
+	file_count_ = base_->header.file_count;
+	if (delta_) {
+		for (std::uint32_t i = 0; i < delta_->header.file_count; ++i) {
+			std::uint32_t number;
+			if (base_->find(delta_->path(i), number)) {
+				--file_count_;
+			}
+			if ((delta_->file(i).flags & DELETED_FLAG) == 0) {
+				++file_count_;
+			}
+		}
+	}
+
+	select_all_ = true;
+	changed_ = false;
+	current_files_ = 0;
+	base_current_.assign(base_->header.file_count, 0);
+	return true;
+}
+
+
+std::size_t TrigramIndex::fileCount() const {
+	return file_count_;
+}
+
+
+void TrigramIndex::selectCandidates(const std::vector<std::string>& search_strings, bool ignore_case) {
+	// A string without a full trigram can be anywhere.
+	select_all_ = false;
+	for (const auto& search_string : search_strings) {
+		if (search_string.size() < 3) {
+			select_all_ = true;
+			return;
+		}
+	}
+
+	base_->selectCandidates(search_strings, ignore_case);
+	if (delta_) {
+		delta_->selectCandidates(search_strings, ignore_case);
+	}
+}
+
+
+bool TrigramIndex::mayContain(const fs::path& file_path) const {
+	// The delta is newer than the base, so its entry of a file wins.
+	const std::string relative_path = relativePath(file_path, root_, root_prefix_);
+	const Segment* segment = nullptr;
+	std::uint32_t number = 0;
+	if (delta_ && delta_->find(relative_path, number)) {
+		segment = delta_.get();
+	}
+	else if (base_->find(relative_path, number)) {
+		segment = base_.get();
+	}
+
+	// Files that are not in the index were never read, and a file that changed since it was indexed
+	// may contain anything now, so both have to be searched.
+	FileStamp stamp;
+	if (segment == nullptr || (segment->file(number).flags & DELETED_FLAG) != 0 || !readFileStamp(file_path, stamp)
+		|| stamp != entryStamp(segment->file(number))) {
+		changed_ = true;
+		return true;
+	}
+
+	// Every file is asked about once, so no two threads write the same flag.
+	++current_files_;
+	if (segment == base_.get()) {
+		base_current_[number] = 1;
+	}
+	return select_all_ || segment->candidates[number];
+}
+
+
+bool TrigramIndex::isStale() const {
+	return changed_ || current_files_ != file_count_;
+}
+
+
+bool TrigramIndex::update(const std::vector<fs::path>& files, ThreadPool& pool) {
+	// Files that are current in the base stay there, all others go to the delta.
+	std::vector<fs::path> delta_files;
+	std::vector<char> base_present(base_->header.file_count, 0);
+	for (const auto& file_path : files) {
+		std::uint32_t number;
+		if (base_->find(relativePath(file_path, root_, root_prefix_), number)) {
+			base_present[number] = 1;
+			if (base_current_[number]) {
+				continue;
+			}
+		}
+		delta_files.push_back(file_path);
+	}
+
+	// Files of the base that are gone from the tree are marked deleted in the delta.
+	std::vector<std::string> deleted_files;
+	for (std::uint32_t i = 0; i < base_->header.file_count; ++i) {
+		if (!base_present[i]) {
+			deleted_files.emplace_back(base_->path(i));
+		}
+	}
+
+	// A delta that grew too big is merged with the base into a new base, otherwise only the delta is replaced.
+	std::vector<const Segment*> previous;
+	if (delta_) {
+		previous.push_back(delta_.get());
+	}
+	std::error_code error;
+	const fs::path delta_path = fs::path(index_directory_) / DELTA_FILENAME;
+	if ((delta_files.size() + deleted_files.size()) * MERGE_RATIO > base_->header.file_count) {
+		previous.push_back(base_.get());
+		if (!writeSegment(fs::path(index_directory_) / BASE_FILENAME, root_.string(), files, {}, pool, previous)) {
+			return false;
+		}
+		fs::remove(delta_path, error);
+		return true;
+	}
+	return writeSegment(delta_path, root_.string(), delta_files, deleted_files, pool, previous);
+}
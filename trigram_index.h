@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include <filesystem>
+
+#include "file_stamp.h"
+#include "thread_pool.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * A persistent index from trigrams, every run of three bytes, to the files of a tree that contain them.
+ *
+ * A string of three or more bytes can only occur in a file that contains all of its trigrams, so
+ * intersecting their posting lists leaves a few candidate files to search instead of the whole tree.
+ * Files that changed since the index was built, or are not in it at all, are always candidates.
+ *
+ * The index consists of a base segment and a delta segment. Each one is a single file that is used
+ * memory-mapped as it is: a header, the searched root, a table of the indexed files with their stamps,
+ * their paths relative to the root, a table of the trigrams sorted by value, and the posting lists,
+ * each one a run of varint-encoded gaps between file numbers. The delta holds the files that changed
+ * since the base was built, and marks the deleted ones, so an update only costs as much as the change.
+ * Once the delta grows too big compared to the base, both are merged into a new base.
+ */
+class TrigramIndex {
+public:
+	TrigramIndex();
+	TrigramIndex(const TrigramIndex&) = delete;
+	TrigramIndex& operator=(const TrigramIndex&) = delete;
+	~TrigramIndex();
+
+	/**
+	 * Reads the files and writes a new index for them, replacing a previous one.
+	 *
+	 * @param index_directory The directory to write the index to, created if missing.
+	 * @param root The directory the files were found in.
+	 * @param files The files to index. Files that can not be read are left out.
+	 * @param pool The threads to read the files with.
+	 * @return True on success, false if the index could not be written.
+	 */
+	static bool build(const std::string& index_directory, const std::string& root, const std::vector<fs::path>& files, ThreadPool& pool);
+
+	/**
+	 * Maps an existing index.
+	 *
+	 * @param index_directory The directory holding the index.
+	 * @param root The directory that is going to be searched.
+	 * @return True on success, false if there is no valid index for the root.
+	 */
+	bool open(const std::string& index_directory, const std::string& root);
+
+	/**
+	 * Selects the indexed files that may contain at least one of the strings. Strings shorter than a
+	 * trigram select every file.
+	 *
+	 * @param search_strings The strings to search for.
+	 * @param ignore_case Whether the strings may occur with their ASCII letters in any case.
+	 */
+	void selectCandidates(const std::vector<std::string>& search_strings, bool ignore_case = false);
+
+	/**
+	 * Tells whether a file has to be searched, which is the case for selected, changed and unknown files.
+	 * Safe to call from several threads at once, and meant to be called once for every file of the tree.
+	 *
+	 * @param file_path The path of the file below the root.
+	 * @return False if the file is known not to contain any of the strings, true otherwise.
+	 */
+	bool mayContain(const fs::path& file_path) const;
+
+	/**
+	 * @return True if mayContain() came across a new or changed file, or was not asked about every
+	 *         indexed file because some were deleted, so the index should be updated.
+	 */
+	bool isStale() const;
+
+	/**
+	 * Brings the index up to date with the tree after mayContain() was asked about all of its files.
+	 * Only the files that changed since the base was built are written to the delta, and only those
+	 * that changed since the previous delta are read.
+	 *
+	 * @param files All files of the tree.
+	 * @param pool The threads to read the files with.
+	 * @return True on success, false if the index could not be written.
+	 */
+	bool update(const std::vector<fs::path>& files, ThreadPool& pool);
+
+	/**
+	 * @return The number of files in the index.
+	 */
+	std::size_t fileCount() const;
+
+private:
+	struct Segment;
+
+	static bool writeSegment(const fs::path& segment_path, const std::string& root, const std::vector<fs::path>& files,
+		const std::vector<std::string>& deleted_files, ThreadPool& pool, const std::vector<const Segment*>& previous);
+
+	std::string index_directory_;
+	fs::path root_;
+	std::string root_prefix_;
+	std::unique_ptr<Segment> base_;
+	std::unique_ptr<Segment> delta_;
+	std::size_t file_count_ = 0;
+	bool select_all_ = true;
+
+	// What mayContain() saw, to tell whether the index is still current and what an update has to write.
+	mutable std::atomic<bool> changed_ = false;
+	mutable std::atomic<std::size_t> current_files_ = 0;
+	mutable std::vector<char> base_current_;
+};